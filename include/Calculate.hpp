@@ -37,6 +37,8 @@ class Calculate {
 	
 	void addChannel(ReadingIdentifier::Ptr rid, double factor = 1.0);
 	size_t channels() const { return _channels.size(); }
+	// append the identifiers of the input channels
+	void inputs(std::vector<ReadingIdentifier::Ptr> &ids) const;
 	
 	// add and read in one step
 	size_t calculateData(std::vector<Reading> &rds, size_t rds_pos, size_t rds_count);
@@ -30,6 +30,7 @@
 #include <pthread.h>
 
 #include "Buffer.hpp"
+#include "Metrics.hpp"
 #include "Reading.hpp"
 #include <Options.hpp>
 #include <VZException.hpp>
@@ -107,17 +108,21 @@ class Channel {
 	}
 
 	int duplicates() const { return _duplicates; }
+	int id() const { return _id; } // 0..n-1 in order of creation
+	vz::metrics::ChannelStats &stats() { return _stats; }
+
 	bool mqtt() const { return _mqtt; }
 	const std::string mqttName() const { return _mqttName; }
 	const std::string mqttDescription() const { return _mqttDescription; }
 	const std::string mqttGroupKey() const { return _mqttGroupKey; }
 	const std::string mqttGroupName() const { return _mqttGroupName; }
+	const std::string mqttFormat() const { return _mqttFormat; }
 
   private:
 	static int instances;
 	bool _thread_running; // flag if thread is started
 
-	int id;            // only for internal usage & debugging
+	int _id;           // only for internal usage, debugging and lookup tables
 	std::string _name; // name of the channel
 	std::list<Option> _options;
 
@@ -125,6 +130,7 @@ class Channel {
 
 	ReadingIdentifier::Ptr _identifier; // channel identifier (OBIS, string)
 	Reading *_last;                     // most recent reading
+	vz::metrics::ChannelStats _stats;   // counters for the /metrics endpoint
 
 	pthread_cond_t condition; // pthread syncronization to notify logging thread and local webserver
 	pthread_t _thread;        // pthread for asynchronus logging
@@ -137,6 +143,7 @@ class Channel {
 	std::string _mqttDescription;
 	std::string _mqttGroupKey; // whether output to via mqtt client should published to a "Group" message
 	std::string _mqttGroupName; // name of the Channel-Data inside the "Group". Default: _mqttName or UUID or _name
+	std::string _mqttFormat;    // payload format, empty for the format of the mqtt client
 };
 
 #endif /* _CHANNEL_H_ */
@@ -71,6 +71,9 @@ class Config_Options {
 	const int &verbosity() const { return _verbosity; }
 	const int &comet_timeout() const { return _comet_timeout; }
 	const int &buffer_length() const { return _buffer_length; }
+	int httpd_threads() const { return _httpd_threads; }
+	int httpd_connections() const { return _httpd_connections; }
+	int httpd_conn_timeout() const { return _httpd_conn_timeout; }
 	int retry_pause() const { return _retry_pause; }
 
 	bool channel_index() const { return _channel_index; }
@@ -111,6 +114,9 @@ class Config_Options {
 	int _verbosity;     // verbosity level
 	int _comet_timeout; // in seconds;
 	int _buffer_length; // in seconds; how long to buffer readings for local interfalce
+	int _httpd_threads;      // size of the thread pool of the local interface
+	int _httpd_connections;  // max. number of concurrent connections to the local interface
+	int _httpd_conn_timeout; // in seconds; close idle connections to the local interface
 	int _retry_pause;   // in seconds; how long to pause after an unsuccessful HTTP request
 
 	// boolean bitfields, padding at the end of struct
@@ -4,7 +4,9 @@
 #include <json-c/json.h>
 #include <shared_ptr.hpp>
 #include <stdarg.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 class Json {
   public:
@@ -27,4 +29,76 @@ struct json_object * json_path_singleV(struct json_object *jso, const std::strin
 
 void inspect_json_object(struct json_object *jobject, int nested_level = 0);
 
+/**
+ * JSONPath subset ("$", ".key", "[index]", negative index counts from the end)
+ * compiled once into steps. Throws vz::VZException on syntax errors.
+ */
+class JsonPath {
+  public:
+	struct Step {
+		std::string _key; // empty for an index step
+		int _index;
+		bool isIndex() const { return _key.empty(); }
+		bool operator==(const Step &other) const {
+			return _key == other._key && (!isIndex() || _index == other._index);
+		}
+	};
+
+	JsonPath(const std::string &path);
+
+	const std::string &path() const { return _path; }
+	const std::string &name() const { return _name; } // last key of the path
+	const std::vector<Step> &steps() const { return _steps; }
+
+	struct json_object *find(struct json_object *jso) const;
+
+  private:
+	std::string _path;
+	std::string _name;
+	std::vector<Step> _steps;
+};
+
+/**
+ * Extracts the numbers of several compiled paths with one walk of a document,
+ * either of a json-c tree or directly of the json text (without building a tree).
+ */
+class JsonExtractor {
+  public:
+	struct Value {
+		bool _found;
+		bool _int;
+		int64_t _i;
+		double _d;
+		double toDouble() const { return _int ? (double)_i : _d; }
+		int64_t toInt64() const { return _int ? _i : (int64_t)_d; }
+	};
+
+	JsonExtractor() : _streamable(true), _count(0) { _nodes.push_back(Node()); }
+
+	size_t add(const JsonPath &path); // returns the index of the path's value
+	size_t size() const { return _count; }
+	bool streamable() const { return _streamable; } // false if a path has a negative index
+
+	void extract(struct json_object *jso, std::vector<Value> &values) const;
+	// returns false if text is no valid json (values found so far are kept)
+	bool extract(const char *text, size_t len, std::vector<Value> &values) const;
+
+  private:
+	struct Node {
+		JsonPath::Step _step;
+		std::vector<size_t> _children; // into _nodes
+		std::vector<size_t> _values;   // paths ending here
+	};
+
+	void visit(size_t node, struct json_object *jso, std::vector<Value> &values) const;
+	const char *scan(const char *p, const char *end, size_t node, int depth,
+					 std::vector<Value> &values) const;
+	size_t child(size_t node, const char *key, size_t len) const;
+	size_t child(size_t node, int index) const;
+
+	std::vector<Node> _nodes; // _nodes[0] is the root ("$")
+	bool _streamable;
+	size_t _count;
+};
+
 #endif /* _Json_hpp_ */
@@ -35,6 +35,7 @@
 #include <protocols/Protocol.hpp>
 #include <shared_ptr.hpp>
 #include "Calculate.hpp"
+#include "Metrics.hpp"
 
 //class MeterMap;
 
@@ -51,6 +52,8 @@ class Meter {
 	virtual int close();
 	virtual size_t read(std::vector<Reading> &rds, size_t n);
 	virtual size_t adapt_max_readings(size_t max_readings, size_t channels);
+	// tell the protocol which readings the channels use (plus the calculation inputs)
+	void channelIdentifiers(const std::vector<ReadingIdentifier::Ptr> &ids);
 
 	// setter
 	void interval(const int i) { _interval = i; }
@@ -69,6 +72,8 @@ class Meter {
 
 	int aggtime() const { return _aggtime; }
 	bool aggFixedInterval() const { return _aggFixedInterval; }
+
+	vz::metrics::MeterStats &stats() { return _stats; }
     
   private:
 	static int instances; // meter instance id (increasing counter)
@@ -91,6 +96,8 @@ class Meter {
 
 	std::vector<Calculate::Ptr> _calculations;	
 
+	vz::metrics::MeterStats _stats; // counters for the /metrics endpoint
+
     // Unused
 	//std::vector<Channel> channels; // channel for logging
 	size_t _channels = 0;
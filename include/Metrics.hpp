@@ -0,0 +1,147 @@
+/**
+ * Internal counters exposed in the Prometheus text format
+ * (header only, shared by libvz, the api and the protocols)
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _METRICS_HPP_
+#define _METRICS_HPP_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+namespace vz {
+namespace metrics {
+
+typedef std::atomic<uint64_t> Counter;
+
+/**
+ * Fixed bucket latency histogram (seconds).
+ * Only atomic increments on observe(), so it can be read while being updated.
+ */
+class Histogram {
+  public:
+	static const size_t nbounds = 10;
+
+	// upper bounds of the buckets, +Inf is implicit
+	static double bound(size_t i) {
+		static const double bounds[nbounds] = {0.005, 0.01, 0.025, 0.05, 0.1,
+											   0.25,  0.5,  1,     2.5,  5};
+		return bounds[i];
+	}
+
+	Histogram() : _count(0), _sum_us(0) {
+		for (size_t i = 0; i <= nbounds; i++)
+			_buckets[i] = 0;
+	}
+
+	void observe(double seconds) {
+		size_t i = 0;
+		while (i < nbounds && seconds > bound(i))
+			i++;
+		_buckets[i].fetch_add(1, std::memory_order_relaxed);
+		_sum_us.fetch_add((uint64_t)(seconds * 1e6), std::memory_order_relaxed);
+		_count.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	uint64_t bucket(size_t i) const { return _buckets[i].load(std::memory_order_relaxed); }
+	uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+	double sum() const { return _sum_us.load(std::memory_order_relaxed) / 1e6; }
+
+  private:
+	Counter _buckets[nbounds + 1]; // not cumulative, the last one is +Inf
+	Counter _count;
+	Counter _sum_us;
+};
+
+/**
+ * Statistics of a meter, updated by its reading thread
+ */
+struct MeterStats {
+	MeterStats() : readings(0), dispatch_misses(0) {}
+
+	Counter readings;        // readings returned by the meter
+	Counter dispatch_misses; // readings not matching any channel
+};
+
+/**
+ * Framing statistics of a protocol reading a byte stream (e.g. SML transport)
+ */
+struct FrameStats {
+	FrameStats() : frames(0), corrupt(0), resyncs(0), crc_errors(0) {}
+
+	Counter frames;     // complete frames
+	Counter corrupt;    // frames dropped: cut off, invalid escape sequence or too long
+	Counter resyncs;    // start of a frame found again after an error
+	Counter crc_errors; // frames dropped because of a wrong checksum
+};
+
+/**
+ * Statistics of a channel, updated by its reading and logging thread
+ */
+struct ChannelStats {
+	ChannelStats()
+		: last_value(0), last_time_ms(0), buffer_depth(0), http_errors(0), curl_errors(0),
+		  curl_retries(0) {}
+
+	std::atomic<double> last_value;
+	std::atomic<int64_t> last_time_ms; // 0 until the first reading arrived
+	std::atomic<size_t> buffer_depth;
+	Histogram upload_latency;
+	Counter http_errors;  // middleware answered with a non-success status
+	Counter curl_errors;  // request failed on the transport level
+	Counter curl_retries; // requests repeated after a failure
+};
+
+// messages the MQTT client failed to hand over to libmosquitto
+inline Counter &mqtt_publish_failures() {
+	static Counter failures(0);
+	return failures;
+}
+
+// messages of the MQTT offline queue
+inline Counter &mqtt_queue_dropped() {
+	static Counter dropped(0);
+	return dropped;
+}
+inline Counter &mqtt_queue_spilled() {
+	static Counter spilled(0);
+	return spilled;
+}
+inline Counter &mqtt_queue_replayed() {
+	static Counter replayed(0);
+	return replayed;
+}
+
+// monotonic clock in seconds, for latency measurements
+inline double monotonic() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+} // namespace metrics
+} // namespace vz
+
+#endif /* _METRICS_HPP_ */
@@ -0,0 +1,58 @@
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MqttPayload_hpp_
+#define __MqttPayload_hpp_
+
+#include <stdint.h>
+#include <string>
+
+/**
+ * Payload encoders for published values.
+ *
+ * text:   value as "%f" (like std::to_string)
+ * json:   {"timestamp": <ms>, "value": <double>} as formatted by json-c
+ * binary: 16 bytes, int64 timestamp in ms and IEEE 754 double, little endian
+ * cbor:   map {"timestamp": <ms>, "value": <float64>} (RFC 8949)
+ * influx: InfluxDB line protocol "<prefix> value=<%f> <ns>"
+ */
+class MqttPayload {
+  public:
+	enum Format { TEXT, JSON, BINARY, CBOR, INFLUX };
+
+	static bool parseFormat(const std::string &name, Format &format);
+	static const char *formatName(Format format);
+
+	/**
+	 * encode into a buffer owned by the calling thread. The result is valid until
+	 * the next call from the same thread.
+	 * @param prefix measurement and tags for the influx format
+	 */
+	static const std::string &encode(Format format, int64_t time_ms, double value,
+									 const std::string &prefix);
+	// same, into out (replacing its contents)
+	static void encode(std::string &out, Format format, int64_t time_ms, double value,
+					   const std::string &prefix);
+
+	static void appendText(std::string &out, double value); // "%f"
+	static void appendJson(std::string &out, double value); // json_object_new_double()
+	static void appendInt(std::string &out, int64_t value);
+	// escape commas, spaces and '=' of a measurement or tag in the line protocol
+	static void appendInfluxKey(std::string &out, const std::string &key);
+};
+
+#endif
@@ -0,0 +1,194 @@
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MqttTopicTrie_hpp_
+#define __MqttTopicTrie_hpp_
+
+#include <algorithm>
+#include <memory>
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Topic filters (with '+' and '#' wildcards) compiled into a trie of topic levels.
+ * A topic is matched level by level without copying it, so the cost depends on
+ * the depth of the topic and not on the number of filters.
+ */
+template <typename T> class MqttTopicTrie {
+  public:
+	/**
+	 * check a subscription filter: '#' only as last level, wildcards only as whole level
+	 */
+	static bool valid(const std::string &filter) {
+		if (filter.empty())
+			return false;
+		size_t start = 0;
+		while (true) {
+			size_t end = filter.find('/', start);
+			std::string level =
+				filter.substr(start, end == std::string::npos ? std::string::npos : end - start);
+			if (level.find_first_of("+#") != std::string::npos && level.size() != 1)
+				return false;
+			if (level == "#" && end != std::string::npos)
+				return false;
+			if (end == std::string::npos)
+				return true;
+			start = end + 1;
+		}
+	}
+
+	void insert(const std::string &filter, const T &value) {
+		Node *node = &_root;
+		size_t start = 0;
+		while (true) {
+			size_t end = filter.find('/', start);
+			size_t len = (end == std::string::npos ? filter.size() : end) - start;
+			const char *level = filter.data() + start;
+
+			if (len == 1 && *level == '#') {
+				node->_hashValues.push_back(value);
+				return;
+			}
+			if (len == 1 && *level == '+') {
+				if (!node->_plus)
+					node->_plus.reset(new Node());
+				node = node->_plus.get();
+			} else {
+				typename Node::Children::iterator it = node->find(level, len);
+				if (it == node->_children.end() || !Node::equal(*it, level, len))
+					it = node->_children.insert(
+						it, std::make_pair(std::string(level, len), std::unique_ptr<Node>(new Node())));
+				node = it->second.get();
+			}
+			if (end == std::string::npos)
+				break;
+			start = end + 1;
+		}
+		node->_values.push_back(value);
+	}
+
+	/**
+	 * remove value for filter. Empty nodes are kept, filters rarely change.
+	 * @return true if the value has been found
+	 */
+	bool erase(const std::string &filter, const T &value) {
+		Node *node = &_root;
+		size_t start = 0;
+		while (true) {
+			size_t end = filter.find('/', start);
+			size_t len = (end == std::string::npos ? filter.size() : end) - start;
+			const char *level = filter.data() + start;
+
+			if (len == 1 && *level == '#')
+				return remove(node->_hashValues, value);
+			if (len == 1 && *level == '+') {
+				node = node->_plus.get();
+			} else {
+				typename Node::Children::iterator it = node->find(level, len);
+				node = (it == node->_children.end() || !Node::equal(*it, level, len))
+						   ? NULL
+						   : it->second.get();
+			}
+			if (node == NULL)
+				return false;
+			if (end == std::string::npos)
+				break;
+			start = end + 1;
+		}
+		return remove(node->_values, value);
+	}
+
+	/**
+	 * call f(value) for every filter matching topic
+	 */
+	template <typename F> void match(const char *topic, F &f) const {
+		// wildcards at the first level don't match topics starting with '$' (MQTT 4.7.2)
+		match(_root, topic, *topic != '$', f);
+	}
+
+  private:
+	struct Node {
+		typedef std::vector<std::pair<std::string, std::unique_ptr<Node>>> Children;
+
+		Children _children; // sorted by level
+		std::unique_ptr<Node> _plus;
+		std::vector<T> _values;     // filters ending here
+		std::vector<T> _hashValues; // filters ending with '#' here
+
+		static int compare(const std::string &a, const char *level, size_t len) {
+			int res = memcmp(a.data(), level, std::min(a.size(), len));
+			return res != 0 ? res : (a.size() < len ? -1 : (a.size() > len ? 1 : 0));
+		}
+		static bool equal(const typename Children::value_type &child, const char *level,
+						  size_t len) {
+			return compare(child.first, level, len) == 0;
+		}
+		typename Children::iterator find(const char *level, size_t len) {
+			size_t lo = 0, hi = _children.size();
+			while (lo < hi) {
+				size_t mid = (lo + hi) / 2;
+				if (compare(_children[mid].first, level, len) < 0)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			return _children.begin() + lo;
+		}
+		const Node *child(const char *level, size_t len) const {
+			typename Children::iterator it = const_cast<Node *>(this)->find(level, len);
+			return (it == _children.end() || !equal(*it, level, len)) ? NULL : it->second.get();
+		}
+	};
+
+	static bool remove(std::vector<T> &values, const T &value) {
+		typename std::vector<T>::iterator it = std::find(values.begin(), values.end(), value);
+		if (it == values.end())
+			return false;
+		values.erase(it);
+		return true;
+	}
+
+	template <typename F>
+	static void match(const Node &node, const char *level, bool wildcards, F &f) {
+		const char *end = strchr(level, '/');
+		size_t len = end ? (size_t)(end - level) : strlen(level);
+
+		if (wildcards) {
+			for (size_t i = 0; i < node._hashValues.size(); i++)
+				f(node._hashValues[i]); // "a/#" matches "a/b", "a/b/c", ...
+		}
+		const Node *next[2] = {node.child(level, len), wildcards ? node._plus.get() : NULL};
+		for (size_t n = 0; n < 2; n++) {
+			if (next[n] == NULL)
+				continue;
+			if (end) {
+				match(*next[n], end + 1, true, f);
+			} else {
+				for (size_t i = 0; i < next[n]->_values.size(); i++)
+					f(next[n]->_values[i]);
+				for (size_t i = 0; i < next[n]->_hashValues.size(); i++)
+					f(next[n]->_hashValues[i]); // "a/#" matches "a" as well
+			}
+		}
+	}
+
+	Node _root;
+};
+
+#endif
@@ -26,7 +26,13 @@
 #ifndef _OBIS_H_
 #define _OBIS_H_
 
+#include <stddef.h>
+#include <stdint.h>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <shared_ptr.hpp>
 
 #define OBIS_STR_LEN (6 * 3 + 5 + 1)
 
@@ -40,6 +46,12 @@ class Obis {
 
 	// static Obis lookup(const char *alias);
 
+	/**
+	 * parse str (not zero terminated) without aliases and exceptions
+	 * @return false if str is no valid OBIS code, obis is undefined then
+	 */
+	static bool tryParse(const char *str, size_t len, Obis &obis);
+
 	/* regex: A-BB:CC.DD.EE([*&]FF)? */
 	size_t unparse(char *buffer, size_t n);
 	const std::string toString();
@@ -50,8 +62,16 @@ class Obis {
 	bool isAllNotGiven() const; // check whether all are not given (=DC/255)
 	bool isValid() const;
 
+	// the six value groups packed into an integer (A in bits 40..47)
+	uint64_t key() const {
+		uint64_t k = 0;
+		for (int i = 0; i < 6; i++)
+			k = (k << 8) | _obisId._raw[i];
+		return k;
+	}
+
   private:
-	int parse(const char *str);
+	int parse(const char *str, size_t len);
 	int lookup_alias(const char *alias);
 
   private:
@@ -72,4 +92,59 @@ typedef struct {
 
 obis_alias_t *obis_get_aliases();
 
+/**
+ * Fixed set of OBIS codes, e.g. the ones of the configured channels.
+ * Uses a perfect hash, a lookup is one multiplication and one compare.
+ */
+class ObisSet {
+  public:
+	ObisSet() : _size(0), _seed(0), _shift(63) {}
+
+	void assign(const std::vector<Obis> &codes);
+	void clear() {
+		_slots.clear();
+		_size = 0;
+	}
+
+	bool empty() const { return _slots.empty(); }
+	size_t size() const { return _size; }
+
+	bool contains(const Obis &obis) const { return contains(obis.key()); }
+	bool contains(uint64_t key) const {
+		return !_slots.empty() && _slots[(key * _seed) >> _shift] == key;
+	}
+
+  private:
+	static const uint64_t unused = ~0ULL; // keys have 48 bits only
+
+	std::vector<uint64_t> _slots;
+	size_t _size;
+	uint64_t _seed;
+	unsigned _shift;
+};
+
+class ReadingIdentifier;
+
+/**
+ * Identifiers of the OBIS codes read by a meter (D0, SML). They are created once and
+ * shared by the readings. Up to 256 codes are kept, more are garbage on the line.
+ */
+class ObisIdentifiers {
+  public:
+	typedef vz::shared_ptr<ReadingIdentifier> Ptr;
+
+	// codes of the channels, none (= all are needed) if a channel has no OBIS identifier
+	static std::vector<Obis> channelCodes(const std::vector<Ptr> &ids);
+
+	// @return NULL if key isn't a valid OBIS code
+	Ptr get(uint64_t key);
+	// for codes checked by the parser
+	Ptr get(const Obis &obis);
+
+  private:
+	Ptr _add(uint64_t key, ReadingIdentifier *rid);
+
+	std::unordered_map<uint64_t, Ptr> _ids; // by Obis::key()
+};
+
 #endif /* _OBIS_H_ */
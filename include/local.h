@@ -38,9 +38,31 @@ using MHD_RESULT = MHD_Result;
 using MHD_RESULT = int;
 #endif
 
+#if MHD_VERSION < 0x00095900
+#define MHD_ALLOW_SUSPEND_RESUME MHD_USE_SUSPEND_RESUME
+#endif
+#if MHD_VERSION < 0x00095300
+#define MHD_USE_INTERNAL_POLLING_THREAD MHD_USE_SELECT_INTERNALLY
+#define MHD_USE_EPOLL MHD_USE_EPOLL_LINUX_ONLY
+#endif
+
+class MapContainer;
+
+/**
+ * Start the local HTTPd with an internal polling thread (pool)
+ *
+ * @param mappings the mapping between meters and channels to serve
+ * @return the daemon handle, NULL on error
+ */
+struct MHD_Daemon *local_start_daemon(MapContainer *mappings);
+
 MHD_RESULT handle_request(void *cls, struct MHD_Connection *connection, const char *url,
 						  const char *method, const char *version, const char *upload_data,
 						  size_t *upload_data_size, void **con_cls);
+void local_request_completed(void *cls, struct MHD_Connection *connection, void **con_cls,
+							 enum MHD_RequestTerminationCode toe);
+void local_expire_waiters(); // answer comet requests after timeout, keep streams alive
+void local_resume_all();     // resume all suspended connections before stopping the daemon
 
 class Channel;
 void shrink_localbuffer(); // remove old data in the local buffer
@@ -7,8 +7,12 @@
 #define __mqtt_hpp_
 
 #include "Channel.hpp"
+#include "MqttPayload.hpp"
 #include "Reading.hpp"
+#include <atomic>
+#include <deque>
 #include <mutex>
+#include <stdio.h>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -17,6 +21,17 @@ struct mosquitto; // forward decl. to avoid pulling the header here
 struct mqtt5__property;
 typedef struct mqtt5__property mosquitto_property;
 
+/**
+ * Receiver of the messages of a subscription. message() is called by the mqtt client
+ * thread, topic and payload point into the mosquitto message and are only valid
+ * during the call.
+ */
+class MqttSubscriber {
+  public:
+	virtual ~MqttSubscriber() {}
+	virtual void message(const char *topic, const char *payload, size_t len) = 0;
+};
+
 class MqttClient {
   public:
 	MqttClient(struct json_object *option);
@@ -26,18 +41,29 @@ class MqttClient {
 	bool isConfigured() const;
 	bool isConnected() const { return _isConnected; }
 	
+	typedef std::vector<Channel::Ptr>::iterator channel_iterator;
+
 	virtual void publish(Channel::Ptr ch, Reading &rds,
 				 bool aggregate = false); // thread safe, non blocking
+	// publish the aggregated values of all channels of a meter after an aggregation cycle
+	virtual void publish(channel_iterator first, channel_iterator last);
 				 
-	virtual bool subscribe(const std::string& sub) { return false; }
-	virtual void unsubscribe(const std::string& sub) {}
-	virtual size_t receive(const std::string& sub, std::vector<std::string>& data) { return 0; }
+	// subscriptions may use '+' and '#' wildcards
+	virtual bool subscribe(const std::string& sub, MqttSubscriber *subscriber) { return false; }
+	// no more messages are delivered to subscriber once this returns
+	virtual void unsubscribe(const std::string& sub, MqttSubscriber *subscriber) {}
+
+	// messages waiting for the broker (in memory or in the spill file)
+	bool queued() const { return _queued; }
 	
   protected:
 	friend void *mqtt_client_thread(void *);
 	virtual void connect_callback(struct mosquitto *mosq, int result);
 	virtual void disconnect_callback(struct mosquitto *mosq, int result);
 	virtual void message_callback(struct mosquitto *mosq, const struct mosquitto_message *msg);
+	virtual void idle(); // called by the mqtt client thread after each loop
+	// max. time the client thread waits in mosquitto_loop before idle() is called again
+	virtual int loopTimeout() const { return _queued ? 100 : 1000; }
     
 	bool _enabled;
 	std::string _host;
@@ -59,11 +85,16 @@ class MqttClient {
 	std::string _id;
 	int _qos = 0;
 	bool _timestamp = false;
+	MqttPayload::Format _format = MqttPayload::TEXT; // JSON if _timestamp is set
 	bool _generateTopicWithUuid = false;
 	int _sessionExpiry_s = 0;
 	int _messageExpiry_s = 0;
+	int _queueSize = 1000;       // messages kept in memory while disconnected, 0 = no queue
+	std::string _queueFile;      // optional file taking the messages exceeding _queueSize
+	long _queueFileSize = 16 * 1024 * 1024; // max. size of _queueFile in bytes
+	int _replayRate = 100;       // messages per second replayed after reconnect, 0 = unlimited
 
-	bool _isConnected = false;
+	std::atomic<bool> _isConnected{false};
 
 	struct mosquitto *_mcs = nullptr; // mosquitto client session data
 	
@@ -71,17 +102,64 @@ class MqttClient {
 	mosquitto_property *_propsPublish = nullptr;
 
 	struct ChannelEntry {
-		bool _announced = false;
+		std::atomic<bool> _announced; // nothing (more) to announce, read without lock
+		ChannelEntry() : _announced(false) {}
+		ChannelEntry(const ChannelEntry &) = delete;
 		bool _sendRaw = true;
 		bool _sendAgg = true;
 		std::string _fullTopicRaw;
 		std::string _fullTopicAgg;
 		std::string _announceName;
+		MqttPayload::Format _format;
+		std::string _influxPrefix; // measurement and tags for MqttPayload::INFLUX
 		std::vector<std::pair<std::string, std::string>> _announceValues;
 		void generateNames(const std::string &prefix, Channel &ch, bool generateTopicWithUuid);
 	};
 	std::mutex _chMapMutex;
 	std::unordered_map<std::string, ChannelEntry> _chMap;
+
+	// Channel::id() -> entry in _chMap. Chunks and entries are added under _chMapMutex
+	// and read without lock, so publishing a known channel needs neither lock nor string key.
+	static const int indexChunkSize = 64;
+	static const int indexChunks = 64;
+	typedef std::atomic<ChannelEntry *> IndexChunk[indexChunkSize];
+	std::atomic<IndexChunk *> _index[indexChunks];
+
+	ChannelEntry &channelEntry(Channel &ch); // cached topics, announces the channel once
+	void index(int id, ChannelEntry *entry); // _chMapMutex locked
+	void publishValue(const ChannelEntry &entry, const std::string &topic, const Reading &rds);
+	// publish or queue (if queue is set and the broker is not reachable)
+	bool send(const std::string &topic, const std::string &payload, bool retain, int64_t time_ms,
+			  bool queue = true);
+	// mosquitto_publish, returns MOSQ_ERR_*
+	virtual int publishMessage(const std::string &topic, const std::string &payload, bool retain);
+
+	// offline queue. Messages are replayed in timestamp order, the spill file is only
+	// used while the memory queue is full and takes all newer messages until it is drained.
+	// After the reconnect live values are published directly, only the replay is limited
+	// to _replayRate so the queue drains however fast the live values come in.
+	struct QueuedMessage {
+		int64_t _time;
+		bool _retain;
+		std::string _topic;
+		std::string _payload;
+	};
+	std::mutex _queueMutex;
+	std::deque<QueuedMessage> _queue;
+	bool _queueSorted = true;
+	std::atomic<bool> _queued;
+	FILE *_spill = nullptr;
+	long _spillRead = 0;  // offset of the first unread message
+	long _spillWrite = 0; // end of the spill file
+	std::atomic<bool> _replayBehindLive{false}; // live values published since the reconnect
+	double _replayTokens = 0;
+	double _replayLast = 0;
+
+	void enqueue(QueuedMessage &&msg);  // _queueMutex locked
+	bool spill(const QueuedMessage &msg); // _queueMutex locked
+	bool unspill();                       // _queueMutex locked
+	void closeSpill(); // saves _queue and the unread messages of the file
+	void replay();
 };
 
 extern MqttClient *mqttClient;
@@ -1,7 +1,9 @@
 #ifndef __mqttex_hpp_
 #define __mqttex_hpp_
 
+#include "MqttTopicTrie.hpp"
 #include "mqtt.hpp"
+#include <atomic>
 
 class MqttClientEx : public MqttClient {
   public:
@@ -10,39 +12,67 @@ class MqttClientEx : public MqttClient {
 	MqttClientEx(const MqttClient &) = delete; // no copy constr.
 	~MqttClientEx() override;
 
-	void publish(Channel::Ptr ch, Reading &rds, bool aggregate = false) override; // thread safe, non blocking
-	bool subscribe(const std::string& sub) override;
-	void unsubscribe(const std::string& sub) override;
-	size_t receive(const std::string& sub, std::vector<std::string>& data) override;
+	using MqttClient::publish;
+	void publish(channel_iterator first, channel_iterator last) override; // one message per group
+	bool subscribe(const std::string& sub, MqttSubscriber *subscriber) override;
+	void unsubscribe(const std::string& sub, MqttSubscriber *subscriber) override;
 
   protected:
 	void connect_callback(struct mosquitto *mosq, int result) override;
 	void disconnect_callback(struct mosquitto *mosq, int result) override;
 	void message_callback(struct mosquitto *mosq, const struct mosquitto_message *msg) override;
+	void idle() override;
+	int loopTimeout() const override;
 	
 	struct SubscriptionEntry {
 		// 0=off, 1=on, 2...n=max_retry, 100=success
 		int _state = 0;
-		std::mutex _dataMutex;
-		std::vector<std::string> _data;
+		std::vector<MqttSubscriber *> _subscribers;
 	};
 	
 	std::mutex _subscriptionMapMutex;
 	std::unordered_map<std::string, SubscriptionEntry> _subscriptionMap;	
 	int _qosSubscribe = 0;
+	std::atomic<bool> _updatePending; // (re-)subscribe from the mqtt client thread
+
+	// compiled subscriptions, locked while a message is delivered
+	std::mutex _trieMutex;
+	MqttTopicTrie<MqttSubscriber *> _trie;
 	
 	void update();
 	void update(const std::string& sub, SubscriptionEntry& entry);
 	void reset();
 	
+	/*
+	 * One message per group and aggregation cycle: it is published as soon as every
+	 * member has a new value, or _groupLinger_ms after the first new value of the cycle.
+	 */
 	struct GroupEntry {
 		std::string _topic;
-		int64_t _time = 0;
-		std::unordered_map<std::string, double> _data;
+		int64_t _time = 0;      // timestamp of the last message
+		int64_t _cycleTime = 0; // newest reading of the current cycle
+		size_t _updated = 0;    // members with a new value in the current cycle
+		double _since = 0;      // monotonic time of the first new value of the cycle
+		// cached json key prefix (",\"name\":") and last value of each member
+		std::vector<std::pair<std::string, double>> _data;
+		std::vector<bool> _fresh; // member has a new value in the current cycle
+	};
+
+	struct GroupMember {
+		GroupEntry *_group;
+		size_t _index; // into GroupEntry::_data
 	};
 		
 	std::mutex _groupPublishMapMutex;
-	std::unordered_map<std::string, GroupEntry> _groupPublishMap;		
+	std::unordered_map<std::string, GroupEntry> _groupPublishMap;
+	std::unordered_map<const Channel *, GroupMember> _groupMemberMap;
+
+	int _groupLinger_ms = 2000; // 0: publish the groups after each meter's cycle
+	std::atomic<size_t> _groupsPending; // groups waiting for members
+
+	GroupMember &groupMember(Channel &ch);
+	void groupPublish(GroupEntry &group); // _groupPublishMapMutex locked
+	static void groupPayload(std::string &payload, const GroupEntry &group);
 };
 
 #endif
@@ -0,0 +1,115 @@
+/**
+ * Serial line or socket shared by D0 meters, e.g. several meters on one RS-485 bus
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _D0Bus_hpp_
+#define _D0Bus_hpp_
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <termios.h>
+
+#include <common.h>
+
+/**
+ * All D0 meters configured with the same device (or host) share one D0Bus.
+ * It opens the port once and hands the line to one meter at a time, in the
+ * order the meters asked for it (a meter addresses its device with its pullseq).
+ * Between two meters the line is kept idle for the reaction time of the meter
+ * that answered last. The next meter sets its baudrate and parity meanwhile and sends its
+ * pull sequence as soon as that time is over.
+ */
+class D0Bus {
+  public:
+	typedef std::shared_ptr<D0Bus> Ptr;
+
+	// the bus of device (or host), created for the first meter
+	static Ptr attach(const std::string &port);
+	void detach();
+
+	const std::string &port() const { return _port; }
+	int members() const { return _members; } // meters attached
+
+	/**
+	 * open the port for the first meter, the others get the same fd
+	 * (and set their baudrate and framing in their transactions)
+	 * @param name of the meter, for the log
+	 * @return file descriptor, <0 on error
+	 */
+	int open(const std::string &name, const std::string &device, const std::string &host,
+			 speed_t baudrate, parity_type_t parity);
+	int close();
+
+	// data bits, parity and stop bits, set by each meter as the others may differ
+	static void framing(struct termios &tio, parity_type_t parity);
+
+	/**
+	 * exclusive use of the line during the lifetime of the object
+	 * (released during stack unwinding if the reading thread is cancelled)
+	 */
+	class Transaction {
+	  public:
+		/**
+		 * wait for the line
+		 * @param guard_ms time the line stays idle after this transaction
+		 */
+		Transaction(D0Bus &bus, int guard_ms);
+		~Transaction();
+
+		// change the guard time, e.g. to the reaction time announced in the answer
+		void guard(int guard_ms) { _guard_ms = guard_ms; }
+
+		// wait until the line is idle (before sending a request)
+		void ready();
+		double waited() const { return _waited; } // seconds waited for the line
+
+	  private:
+		D0Bus &_bus;
+		int _guard_ms;
+		std::list<Transaction *>::iterator _entry;
+		double _waited;
+	};
+
+  private:
+	D0Bus(const std::string &port) : _port(port), _members(0), _fd(-1), _users(0), _idleUntil(0) {}
+
+	int _openSocket(const char *name, const char *node, const char *service);
+	int _openDevice(const char *name, const char *device, speed_t baudrate, parity_type_t parity);
+
+	std::string _port;
+	std::atomic<int> _members;
+	int _fd;
+	int _users;             // meters which opened the port
+	struct termios _oldtio; // of the device before it was opened
+
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	std::list<Transaction *> _queue; // the first one owns the line
+	double _idleUntil;               // monotonic time the line can be used again
+};
+
+#endif /* _D0Bus_hpp_ */
@@ -0,0 +1,197 @@
+/**
+ * Incremental parser for the plaintext protocol according to DIN EN 62056-21 ("D0")
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _D0Parser_hpp_
+#define _D0Parser_hpp_
+
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <Obis.hpp>
+
+/**
+ * Parses a telegram from byte slices as they arrive and stops at each event.
+ * The data lines are not copied: obisText(), value() and unit() point into the
+ * input unless a line was split between two slices. Lines with OBIS codes not in
+ * the filter are skipped once the code is parsed, their value isn't looked at.
+ *
+ * The parser does no I/O and has no timeouts, so it can be fed from a dump_file.
+ */
+class D0Parser {
+  public:
+	enum Event {
+		NEED_DATA, // input consumed
+		HEADER,    // identification line received: vendor(), baudrate(), identification()
+		RECORD,    // data line: obis(), value(), unit()
+		INVALID,   // data line with an OBIS code that can't be parsed: obisText()
+		END,       // end of telegram ('!')
+		ERROR      // invalid vendor id
+	};
+
+	struct Slice {
+		const char *data;
+		size_t len;
+
+		std::string str() const { return std::string(data, len); }
+	};
+
+	D0Parser();
+
+	/**
+	 * only report data lines with these codes, all if empty
+	 */
+	void filter(const std::vector<Obis> &codes) { _filter.assign(codes); }
+	const ObisSet &filter() const { return _filter; }
+
+	// wait for the start of a telegram ('/')
+	void reset();
+	// a telegram is being received
+	bool started() const { return _context != START; }
+
+	/**
+	 * parse [pos, end) up to the next event
+	 * The slices of RECORD and INVALID are valid until the next call or until the input
+	 * is modified. NEED_DATA is returned with pos == end, the input can be reused then.
+	 */
+	Event parse(const char *&pos, const char *end);
+
+	const char *vendor() const { return _vendor; }
+	char baudrate() const { return _baudrate; }
+	const char *identification() const { return _identification; }
+
+	const Obis &obis() const { return _obis; }
+	Slice obisText() const { return _obisText.slice(); }
+	Slice value() const { return _value.slice(); }
+	Slice unit() const { return _unit.slice(); }
+	double number() const; // value() as double
+
+	// counters since reset()
+	size_t skipped() const { return _skipped; } // lines filtered, or with codes L/P
+	size_t dropped() const { return _dropped; } // bytes of too long or binary fields
+
+  private:
+	/**
+	 * a field points into the input as long as its bytes are contiguous there,
+	 * else (and before the input is released) it is copied into its own buffer
+	 */
+	class Field {
+	  public:
+		Field(size_t max) : _data(_buf), _len(0), _max(max), _own(true) { _buf[0] = '\0'; }
+
+		void clear() {
+			_data = _buf;
+			_len = 0;
+			_own = true;
+			_buf[0] = '\0';
+		}
+		size_t len() const { return _len; }
+		Slice slice() const {
+			Slice s = {_data, _len};
+			return s;
+		}
+
+		// @return false if the field is full
+		bool append(const char *p) {
+			if (_len >= _max)
+				return false;
+			if (_len == 0) {
+				_data = p;
+				_own = false;
+			} else if (!_own && p != _data + _len) {
+				keep();
+			}
+			if (_own) {
+				_buf[_len] = *p;
+				_buf[_len + 1] = '\0';
+			}
+			_len++;
+			return true;
+		}
+
+		// copy to the own buffer
+		void keep() {
+			if (!_own) {
+				memcpy(_buf, _data, _len);
+				_buf[_len] = '\0';
+				_data = _buf;
+				_own = true;
+			}
+		}
+
+	  private:
+		const char *_data;
+		size_t _len;
+		size_t _max;
+		bool _own;
+		char _buf[33];
+	};
+
+	enum Context {
+		START,
+		VENDOR,
+		BAUDRATE,
+		IDENTIFICATION,
+		ACK,
+		OBIS_CODE,
+		VALUE,
+		UNIT,
+		SKIP,   // value and unit of a filtered line
+		END_SEQ // "!" or "?!"
+	};
+
+	// decide at '(' whether the line is reported
+	Context _startValue();
+	// @return true if the line is reported
+	bool _endLine();
+	void _clearLine();
+
+	ObisSet _filter;
+
+	Context _context;
+	size_t _iterator; // bytes in the current field
+	bool _clear;      // fields hold the last record
+	bool _obisValid;
+
+	static const size_t VENDOR_LEN = 3;
+	static const size_t IDENTIFICATION_LEN = 16;
+	char _vendor[VENDOR_LEN + 1];
+	char _baudrate;
+	char _identification[IDENTIFICATION_LEN + 1];
+
+	/* A-B:C.D.E*F
+	   fields A, B, E, F are optional
+	   fields C & D are mandatory
+	   see DIN-EN-62056-61 */
+	Field _obisText;
+	Obis _obis;
+	Field _value;
+	Field _unit;
+
+	size_t _skipped;
+	size_t _dropped;
+};
+
+#endif /* _D0Parser_hpp_ */
@@ -33,6 +33,8 @@
 
 #include <termios.h>
 
+#include <protocols/D0Bus.hpp>
+#include <protocols/D0Parser.hpp>
 #include <protocols/Protocol.hpp>
 
 class MeterD0 : public vz::protocol::Protocol {
@@ -46,6 +48,8 @@ class MeterD0 : public vz::protocol::Protocol {
 	virtual bool allowInterval() const {
 		return _pull.size() ? true : false;
 	} // only allow conf setting interval if pull is set (otherwise meter sends autom.)
+	// lines with other OBIS codes are skipped
+	virtual void channelIdentifiers(const std::vector<ReadingIdentifier::Ptr> &ids);
 
 	const char *host() const { return _host.c_str(); }
 	const char *device() const { return _device.c_str(); }
@@ -66,26 +70,35 @@ class MeterD0 : public vz::protocol::Protocol {
 	int _baudrate_change_delay_ms;
 	int _reaction_time_ms; // reaction time t_r according to 62056-21
 
-	int _fd; /* file descriptor of port */
+	D0Bus::Ptr _bus; // device or host, maybe shared with other meters
+	int _fd;         /* file descriptor of port */
+
+	// receive buffer, bytes following a telegram are kept for the next read()
+	char _buf[D0_BUFFER_LENGTH];
+	size_t _bufPos;
+	size_t _bufLen;
+	double _lastFill;    // monotonic time of the last chunk received
+	size_t _readCalls;   // statistics of the current telegram
+	size_t _bytesRead;
+	double _waitTime;    // time spent waiting for data or the meter
+
 	FILE *_dump_fd;
-	struct termios _oldtio; /* required to reset port */
 
 	/**
-	 * Open socket
-	 *
-	 * @param node the hostname or ASCII encoded IP address
-	 * @param the ASCII encoded portnum or service as in /etc/services
-	 * @return file descriptor, <0 on error
+	 * refill the empty receive buffer with one read()
+	 * @param timeout_ms max. time to wait for the device
+	 * @return 1 on success, 0 on timeout, <0 on error
 	 */
-	int _openSocket(const char *node, const char *service);
-	int _openDevice(struct termios *old_tio, speed_t baudrate);
+	int _fill(int timeout_ms);
+
+	D0Parser _parser;
+	ObisIdentifiers _identifiers;
 
 	enum DUMP_MODE { NONE, CTRL, DUMP_IN, DUMP_OUT };
 	DUMP_MODE _old_mode;
 	int _dump_pos;
 	void dump_file(DUMP_MODE mode, const char *str);
 	void dump_file(DUMP_MODE mode, const char *buf, size_t len);
-	void dump_file(const char &c) { dump_file(DUMP_IN, &c, 1); };
 };
 
 #endif /* _D0_H_ */
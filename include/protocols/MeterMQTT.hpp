@@ -18,9 +18,15 @@
 #ifndef _MMQTT_H_
 #define _MMQTT_H_
 
+#include <deque>
+#include <pthread.h>
+#include <unordered_map>
+
+#include "Json.hpp"
+#include "mqtt.hpp"
 #include <protocols/Protocol.hpp>
 
-class MeterMQTT : public vz::protocol::Protocol {
+class MeterMQTT : public vz::protocol::Protocol, public MqttSubscriber {
 
   public:
 	MeterMQTT(const std::list<Option> &options);
@@ -33,19 +39,40 @@ class MeterMQTT : public vz::protocol::Protocol {
 
 	int open();
 	int close();
+
+	// called by the mqtt client thread for each message of the subscription
+	void message(const char *topic, const char *payload, size_t len) override;
 	
   protected:
 	std::string _subscription;
 	std::string _data_format;
 	std::string _data_query_time;
 	std::vector<std::string> _data_query_values;
-	std::vector<std::string> _read_pending;
 	// 0 = ms, 1 = s
 	int _time_unit;
 	bool _use_local_time;
+	bool _topic_identifier; // prefix the reading identifiers with the topic
+	bool _stream_parser;    // extract the values from the json text without building a tree
 	bool _open;
+
+	// readings parsed by message(), waiting for read()
+	pthread_mutex_t _mutex;
+	pthread_cond_t _cond;
+	std::deque<Reading> _pending;
+
+	// data_query_values and data_query_time compiled into one extractor
+	JsonExtractor _extractor;
+	std::vector<std::string> _value_names; // identifier of each data_query_value
+	size_t _time_value;                    // index of data_query_time in the extracted values
+
+	// only used by the mqtt client thread:
+	struct json_tokener *_tok;
+	std::vector<JsonExtractor::Value> _values;
+	std::vector<Reading> _parsed;
+	// per topic (up to 256 topics) and data_query_value
+	std::unordered_map<std::string, std::vector<ReadingIdentifier::Ptr>> _identifiers;
 		
-	ssize_t parse(const std::string& msg, std::vector<Reading> &rds, size_t rds_pos, size_t rds_max);
+	size_t parse(const char *topic, const char *msg, size_t len, std::vector<Reading> &rds);
 	
 private:
     void test();	
@@ -67,8 +67,45 @@ class MeterOCR : public vz::protocol::Protocol {
 
   private:
 	friend class MeterOCR_Test;
+
+	/**
+	 * The region of interest of a captured image: the capture coords of all recognizers plus the
+	 * autofix margin. It is rotated and cropped once per image and shared by the recognizers.
+	 */
+	class Frame {
+	  public:
+		Frame(PIX *roi, int x, int y) : x(x), y(y), _color(roi), _gray(0) {}
+		~Frame();
+		PIX *color() const { return _color; }
+		PIX *gray(); // luminance, converted once for all recognizers
+		/**
+		 * copy a rectangle of color() or gray(), parts outside of the region are black
+		 * @param x, y image coordinates
+		 */
+		PIX *crop(bool gray, int x, int y, int w, int h);
+		int right() const; // image coordinates of the end of the region
+		int bottom() const;
+
+		const int x, y; // position of the region in the (rotated) image
+
+	  private:
+		Frame(const Frame &);
+		Frame &operator=(const Frame &);
+		PIX *_color;
+		PIX *_gray;
+	};
+
 	bool isNotifiedFileChanged();
-	bool autofixDetection(PIX *image, int &dX, int &dY, PIXA *debugPixa);
+	// region of interest in the (rotated) image of size w x h
+	void roiRect(int w, int h, int &x1, int &y1, int &x2, int &y2) const;
+	// part of the image used for the region, before the rotation. Can exceed the image.
+	void roiSource(int w, int h, int &x1, int &y1, int &x2, int &y2) const;
+	/**
+	 * crop the region of interest from the image, rotated by the rotate parameter
+	 * @param x, y set to the position of the region in the rotated image
+	 */
+	PIX *cropRoi(PIX *image, int &x, int &y);
+	bool autofixDetection(Frame &frame, int &dX, int &dY, PIXA *debugPixa);
 	int calcImpulses(const double &value, const double &oldValue) const;
 
 	// class for the parameters:
@@ -95,10 +132,11 @@ class MeterOCR : public vz::protocol::Protocol {
 	class Recognizer {
 	  public:
 		Recognizer(const std::string &type, struct json_object *);
-		virtual bool recognize(PIX *image, int dX, int dY, ReadsMap &reads,
+		virtual bool recognize(Frame &frame, int dX, int dY, ReadsMap &reads,
 							   const ReadsMap *old_reads, PIXA *debugPixa) = 0;
 		virtual ~Recognizer(){};
 		virtual void getCaptureCoords(int &minX, int &minY, int &maxX, int &maxY) = 0;
+		virtual bool needsColor() const { return true; } // or the luminance only
 
 	  protected:
 		void saveDebugImage(PIXA *debugPixa, PIX *img, const char *title);
@@ -110,7 +148,7 @@ class MeterOCR : public vz::protocol::Protocol {
 	class RecognizerTesseract : public Recognizer {
 	  public:
 		RecognizerTesseract(struct json_object *);
-		bool recognize(PIX *image, int dX, int dY, ReadsMap &reads, const ReadsMap *old_reads,
+		bool recognize(Frame &frame, int dX, int dY, ReadsMap &reads, const ReadsMap *old_reads,
 					   PIXA *debugPixa);
 		virtual ~RecognizerTesseract();
 		virtual void getCaptureCoords(int &minX, int &minY, int &maxX, int &maxY) {
@@ -119,12 +157,13 @@ class MeterOCR : public vz::protocol::Protocol {
 			maxX = _max_x2;
 			maxY = _max_y2;
 		};
+		virtual bool needsColor() const { return false; }
 
 	  protected:
 		bool initTesseract();
 		bool deinitTesseract();
 
-		tesseract::TessBaseAPI *api;
+		tesseract::TessBaseAPI *api; // loaded with the first image, kept for all
 		double _gamma;
 		int _gamma_min;
 		int _gamma_max;
@@ -136,7 +175,7 @@ class MeterOCR : public vz::protocol::Protocol {
 	class RecognizerNeedle : public Recognizer {
 	  public:
 		RecognizerNeedle(struct json_object *);
-		bool recognize(PIX *image, int dX, int dY, ReadsMap &reads, const ReadsMap *old_reads,
+		bool recognize(Frame &frame, int dX, int dY, ReadsMap &reads, const ReadsMap *old_reads,
 					   PIXA *debugPixa);
 		virtual ~RecognizerNeedle();
 		virtual void getCaptureCoords(int &minX, int &minY, int &maxX, int &maxY) {
@@ -158,7 +197,7 @@ class MeterOCR : public vz::protocol::Protocol {
 	class RecognizerBinary : public Recognizer {
 	  public:
 		RecognizerBinary(struct json_object *);
-		bool recognize(PIX *image, int dX, int dY, ReadsMap &reads, const ReadsMap *old_reads,
+		bool recognize(Frame &frame, int dX, int dY, ReadsMap &reads, const ReadsMap *old_reads,
 					   PIXA *debugPixa);
 		virtual ~RecognizerBinary();
 		virtual void getCaptureCoords(int &minX, int &minY, int &maxX, int &maxY) {
@@ -11,7 +11,11 @@
 #define _meteroms_hpp_
 
 #include <mbus/mbus.h>
+#include <memory>
+#include <openssl/evp.h>
 #include <protocols/Protocol.hpp>
+#include <stdint.h>
+#include <unordered_map>
 
 class MeterOMS : public vz::protocol::Protocol {
   public:
@@ -55,17 +59,42 @@ class MeterOMS : public vz::protocol::Protocol {
 	virtual int open();
 	virtual int close();
 	virtual ssize_t read(std::vector<Reading> &rds, size_t n);
-	bool aes_decrypt(unsigned char *data, int data_len, unsigned char *key, unsigned char *iv);
+	typedef std::shared_ptr<EVP_CIPHER_CTX> AesContext;
+	/**
+	 * AES-128-CBC decryption context with the key expanded once, reused for all frames
+	 * @return NULL on error
+	 */
+	static AesContext aes_context(const unsigned char *key);
+	// decrypt data in place, only the iv is set per frame
+	bool aes_decrypt(unsigned char *data, int data_len, const AesContext &ctx,
+					 const unsigned char *iv);
 
   protected:
+	// a device we have the key for
+	struct Device {
+		std::string id; // 8 digits as printed on the device, prefixes the identifiers in receiver mode
+		AesContext aes;
+		double last_timestamp;
+	};
+
 	double get_record_value(mbus_data_record *) const;
+	/**
+	 * find the device of a frame by the ID and manufacturer in its header (data[0..5])
+	 * @return NULL if the device is unknown
+	 */
+	Device *lookup_device(const unsigned char *header);
+	ReadingIdentifier *identifier(const Device &dev, const char *obis) const;
 
 	OMSHWif *_hwif;
-	unsigned char *_aes_key;
 	std::string _device;
 	bool _mbus_debug;
 	bool _use_local_time;
-	double _last_timestamp;
+
+	// receiver mode: listen to the frames of many devices (from the "devices" option) without
+	// acknowledging them and prefix the identifiers with the device id, e.g. "12345678/1.8.0".
+	// Otherwise the only device is the one with the "key" option, whatever its address.
+	bool _receiver;
+	std::unordered_map<uint64_t, Device> _devices; // by manufacturer << 32 | id, manufacturer 0 = any
 };
 
 #endif
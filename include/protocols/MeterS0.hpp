@@ -29,6 +29,7 @@
 #include <atomic>
 #include <termios.h>
 #include <thread>
+#include <vector>
 
 #include <protocols/Protocol.hpp>
 
@@ -48,6 +49,17 @@ class MeterS0 : public vz::protocol::Protocol {
 		virtual bool waitForImpulse(bool &timeout) = 0; // blocking interface
 		virtual int status() = 0; // non blocking IO status (<0 = ERR, 0 = low, 1 = high)
 		virtual bool is_blocking() const = 0;
+
+		// true if the impulses are timestamped by the kernel (see waitForImpulses)
+		virtual bool has_timestamps() const { return false; }
+		/**
+		 * wait for timestamped impulses (blocking interface, returns after 1s without impulse)
+		 * @param ts filled with the CLOCK_REALTIME time of the impulses, oldest first
+		 * @param lines filled with the index of the line of each impulse (0 for single lines)
+		 * @param n size of ts and lines
+		 * @return number of impulses, 0 on timeout, <0 on error
+		 */
+		virtual int waitForImpulses(struct timespec *, unsigned int *, int) { return -1; }
 	};
 
 	class HWIF_UART : public HWIF {
@@ -85,6 +97,40 @@ class MeterS0 : public vz::protocol::Protocol {
 		std::string _device;
 	};
 
+	/**
+	 * GPIO lines requested from the character device (/dev/gpiochipN) with the v2 API.
+	 * The kernel debounces the lines and timestamps the rising edges, which are read in
+	 * batches, so the counter thread neither sleeps for debouncing nor needs realtime priority.
+	 * All lines are requested at once and share one event queue.
+	 */
+	class HWIF_GPIOCDEV : public HWIF {
+	  public:
+		/**
+		 * @param edges request rising edge events, otherwise the line is only read by status()
+		 * @param debounce_us debounce period, 0 to disable
+		 */
+		HWIF_GPIOCDEV(const std::string &chip, const std::vector<int> &lines, bool edges,
+					  int debounce_us);
+		virtual ~HWIF_GPIOCDEV();
+
+		virtual bool _open();
+		virtual bool _close();
+		virtual bool waitForImpulse(bool &timeout);
+		virtual int status(); // of the first line
+		virtual bool is_blocking() const { return true; }
+		virtual bool has_timestamps() const { return _edges; }
+		virtual int waitForImpulses(struct timespec *ts, unsigned int *lines, int n);
+
+	  protected:
+		std::string _chip;
+		std::vector<int> _lines; // offsets on the chip
+		bool _edges;
+		int _debounce_us;
+		int _fd;                          // line request
+		bool _monotonic;                  // kernel < 5.11 without realtime event timestamps
+		std::vector<unsigned int> _seqno; // of the last event per line, to detect lost events
+	};
+
 	class HWIF_MMAP : public HWIF {
 	  public:
 		HWIF_MMAP(int gpiopin, const std::string &hw);
@@ -105,6 +151,35 @@ class MeterS0 : public vz::protocol::Protocol {
 		void *_gpio_base;
 	};
 
+	// impulses timestamped by the counter thread, read without locking by read()
+	class ImpulseLog {
+	  public:
+		static const unsigned int MIN_SIZE = 256;
+		static const unsigned int MAX_SIZE = 65536;
+
+		ImpulseLog() : _mask(0), _head(0), _tail(0), _dropped(0) {}
+		// room for two read periods at 1 impulse/ms, before the counter thread starts
+		void resize(int read_period_ms);
+		unsigned int size() const { return _entries.size(); }
+		// counter thread only. @return false if full, the impulse is counted as dropped
+		bool push(const struct timespec &ts, unsigned int counter);
+		// reading thread only. @return false if empty
+		bool pop(struct timespec &ts, unsigned int &counter);
+		// impulses not logged since the last call
+		unsigned int dropped() { return _dropped.exchange(0); }
+
+	  private:
+		struct Entry {
+			struct timespec ts;
+			unsigned int counter;
+		};
+		std::vector<Entry> _entries; // power of two
+		unsigned int _mask;
+		std::atomic<unsigned int> _head; // next entry to write
+		std::atomic<unsigned int> _tail; // next entry to read
+		std::atomic<unsigned int> _dropped;
+	};
+
   public:
 	MeterS0(const std::list<Option> &options, HWIF *hwif = 0, HWIF *hwif_dir = 0);
 	virtual ~MeterS0();
@@ -117,27 +192,51 @@ class MeterS0 : public vz::protocol::Protocol {
 	} // don't allow interval setting in conf file with S0
 
   protected:
+	// how the power is estimated from the impulses
+	enum PowerEstimator {
+		POWER_INTERVALS, // mean over the impulse intervals completed since the last read
+		POWER_WINDOW,    // impulses within the read period
+		POWER_LAST,      // inverse of the last interval
+		POWER_EMA        // exponential moving average over the intervals
+	};
+
 	void counter_thread();
+	void count_impulse(const struct timespec &ts, unsigned int counter);
 	void check_ref_for_overflow();
 
+	// impulses of one line (or of one direction of a single line)
+	struct Counter {
+		std::string impulse; // identifiers
+		std::string power;
+		std::atomic<unsigned int> impulses; // increased by the counter thread
+		struct timespec time_last_logged;   // time of the last impulse read from _log
+		bool have_last_logged;
+		double interval; // last interval in s, 0 if none yet
+		double ema;      // of the power over the intervals
+	};
+
 	HWIF *_hwif;
 	HWIF *_hwif_dir; // for dir gpio pin
 	std::thread _counter_thread;
-	std::atomic<unsigned int> _impulses;
-	std::atomic<unsigned int> _impulses_neg;
+	std::vector<Counter> _counters; // Impulse, Impulse_neg or Impulse_<gpio> for each gpio
 
 	volatile bool _counter_thread_stop;
 
 	bool _send_zero;
+	int _read_period_ms;
+	PowerEstimator _power;
+	double _ema_alpha;
 	int _resolution;
 	int _debounce_delay_ms;
 	int _nonblocking_delay_ns;
 
-	struct timespec _time_last_read; // timestamp of last read. 1s interval based on this timestamp
+	struct timespec _time_last_read; // timestamp of last read. read period based on this timestamp
 	struct timespec _time_last_ref;  // reference timestamp for the millisecond delta
 	std::atomic<unsigned long> _ms_last_impulse; // ms of last impulse relative to _time_last_ref
 	struct timespec _time_last_impulse_returned; // timestamp of last impulse returned
 	bool _first_impulse;
+
+	ImpulseLog _log; // all impulses with their time
 };
 
 #endif /* _S0_H_ */
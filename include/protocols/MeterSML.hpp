@@ -33,10 +33,13 @@
 #include <sml/sml_file.h>
 #include <sml/sml_value.h>
 
+#include <sys/time.h>
 #include <termios.h>
 
 #include "Obis.hpp"
 #include <protocols/Protocol.hpp>
+#include <protocols/SmlFramer.hpp>
+#include <protocols/SmlTcpPool.hpp>
 
 class MeterSML : public vz::protocol::Protocol {
 
@@ -54,6 +57,11 @@ class MeterSML : public vz::protocol::Protocol {
 	virtual bool allowInterval() const {
 		return false;
 	} // don't allow conf setting interval with sml
+	virtual const vz::metrics::FrameStats *frameStats() const {
+		return _source ? &_source->stats() : &_framer.stats();
+	}
+	// list entries with other OBIS codes are skipped
+	virtual void channelIdentifiers(const std::vector<ReadingIdentifier::Ptr> &ids);
 
 	const char *host() const { return _host.c_str(); }
 	const char *device() const { return _device.c_str(); }
@@ -65,26 +73,50 @@ class MeterSML : public vz::protocol::Protocol {
 	parity_type_t _parity;
 	std::string _pull;
 	bool _use_local_time;
+	bool _tcpPool; // host is read by the SmlTcpPool
+
+	SmlTcpPool::Source::Ptr _source;
+	std::vector<unsigned char> _poolFrame;
 
 	int _fd;                 /* file descriptor of port */
 	struct termios _old_tio; /* required to reset port */
 
 	const int BUFFER_LEN;
 
+	SmlFramer _framer;
+	uint64_t _frameErrors; // corrupt frames and CRC errors already logged
+	void _logFrameErrors();
+
+	/**
+	 * Parses an SML file (without transport escape sequences) into readings
+	 * @return number of readings
+	 */
+	ssize_t _parseFile(const unsigned char *buf, size_t len, std::vector<Reading> &rds, size_t n);
+
+	/**
+	 * read the next chunk of the stream into the framer
+	 * @return 1 on success, 0 if interrupted, <0 on error or end of file
+	 */
+	int _fill();
+
 	/**
 	 * @brief reopen the underlying device. We do this to workaround issue #362
 	 * @return true if reopen was successful. False otherwise.
 	 * */
 	bool reopen();
 
+	ObisSet _filter; // codes used by the channels, all if empty
+	ObisIdentifiers _identifiers;
+
 	/**
 	 * Parses SML list entry and stores it in reading pointed by rd
 	 *
 	 * @param list the list entry
 	 * @param rd the reading to store to
-	 * @return true if it is a valid entry
+	 * @param now local time of the SML file, used if the entry has no time
+	 * @return true if it is a valid entry used by a channel
 	 */
-	bool _parse(sml_list *list, Reading *rd);
+	bool _parse(sml_list *list, Reading *rd, const struct timeval &now);
 
 	/**
 	 * Open serial port by device
@@ -31,6 +31,7 @@
 #include <list>
 #include <vector>
 
+#include <Metrics.hpp>
 #include <Options.hpp>
 #include <Reading.hpp>
 #include <common.h>
@@ -53,6 +54,15 @@ class Protocol {
 		return true;
 	} // default we allow interval (but S0 e.g disallows)
 
+	/**
+	 * identifiers of the readings used by the channels and calculations of the meter.
+	 * Called before open(). Protocols can skip data nobody uses, by default all is read.
+	 */
+	virtual void channelIdentifiers(const std::vector<ReadingIdentifier::Ptr> &ids) {}
+
+	// framing statistics of stream protocols for the /metrics endpoint, NULL if none
+	virtual const vz::metrics::FrameStats *frameStats() const { return NULL; }
+
 	const std::string &name() const { return _name; }
 
   private:
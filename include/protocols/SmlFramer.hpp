@@ -0,0 +1,112 @@
+/**
+ * Framer for the SML transport protocol version 1
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SmlFramer_hpp_
+#define _SmlFramer_hpp_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <Metrics.hpp>
+
+/**
+ * Cuts a byte stream into SML files:
+ *   1b1b1b1b 01010101 <body> 1b1b1b1b 1a <padding> <crc16>
+ * The input is read into a ring buffer and scanned once. The body is unescaped
+ * (1b1b1b1b 1b1b1b1b -> 1b1b1b1b) into the frame buffer, which can be handed to
+ * sml_file_parse() directly.
+ *
+ * On errors (unknown escape sequence, wrong CRC, frame too long, frame cut off by
+ * the start of the next one) the frame is dropped and the framer waits for the next
+ * start sequence, so the stream doesn't need to be reopened.
+ * Like libsml, escape sequences are only recognized at 4 byte boundaries of the frame.
+ * A start sequence is recognized anywhere, so the framer resyncs after lost bytes.
+ */
+class SmlFramer {
+  public:
+	SmlFramer(size_t max_len = 8096);
+
+	// drop all input and wait for a start sequence (e.g. after the port was reopened)
+	void reset();
+	// check the CRC of the end sequence (default), some meters send wrong ones
+	void verifyCrc(bool verify) { _verifyCrc = verify; }
+
+	/**
+	 * free space of the input buffer for the next read()
+	 * @param len contiguous bytes available
+	 */
+	unsigned char *space(size_t &len);
+	// len bytes have been read into space()
+	void commit(size_t len);
+
+	/**
+	 * scan the input up to the end of the next frame
+	 * The bytes following the frame are kept for the next call.
+	 * @return true if frame() holds a complete frame, false if more input is needed
+	 */
+	bool next();
+
+	// body of the last frame, without escape sequences and padding, valid until next()
+	const unsigned char *frame() const { return &_frame[0]; }
+	size_t frameLen() const { return _len; }
+
+	const vz::metrics::FrameStats &stats() const { return _stats; }
+
+  private:
+	enum State {
+		HUNT, // wait for the start sequence
+		BODY
+	};
+
+	// @return true if a start sequence is complete
+	bool _hunt(uint8_t byte);
+	void _begin();
+	// an error in the current frame
+	void _lost(bool crc = false);
+	// @return true if the frame is complete
+	bool _word();
+	void _crc(const uint8_t *p, size_t len);
+
+	static const size_t INPUT_LEN = 1024;
+	uint8_t _in[INPUT_LEN]; // ring buffer
+	size_t _rd;
+	size_t _fill;
+
+	State _state;
+	size_t _match;    // bytes of the start sequence matched
+	uint8_t _w[4];    // current word of the body
+	size_t _wLen;     // bytes in _w
+	bool _escape;     // the last word was an escape sequence
+	bool _resync;     // an error occured, count the next start sequence
+	uint16_t _crcReg; // CRC-16/X-25 of the frame so far
+
+	std::vector<unsigned char> _frame;
+	size_t _len;
+	bool _verifyCrc;
+
+	vz::metrics::FrameStats _stats;
+};
+
+#endif /* _SmlFramer_hpp_ */
@@ -0,0 +1,125 @@
+/**
+ * Event loop receiving SML over TCP from many remote sources
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SmlTcpPool_hpp_
+#define _SmlTcpPool_hpp_
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include <protocols/SmlFramer.hpp>
+
+/**
+ * One thread connects to all sources (e.g. ser2net or IR head gateways) with
+ * non-blocking sockets in an epoll loop, frames their streams and queues the
+ * frames for the meters. Each address of a host is tried in turn. Lost or idle
+ * connections are reopened with an exponential backoff.
+ * The meters parse the frames in their reading threads, which only wait for their
+ * queue and need no socket of their own.
+ */
+class SmlTcpPool {
+  public:
+	class Source {
+	  public:
+		typedef std::shared_ptr<Source> Ptr;
+		~Source();
+
+		/**
+		 * wait for the next frame (a cancellation point)
+		 * @param frame body of the SML file
+		 */
+		void next(std::vector<unsigned char> &frame);
+
+		const vz::metrics::FrameStats &stats() const { return _framer.stats(); }
+		bool connected();
+
+	  private:
+		friend class SmlTcpPool;
+		enum State { CLOSED, CONNECTING, CONNECTED };
+
+		Source(const std::string &name, struct addrinfo *ais, int timeout);
+
+		std::string _name;
+		struct addrinfo *_ais; // all addresses of the host
+		int _timeout;          // seconds without data until the connection is closed
+
+		// the following is guarded by the mutex of the pool
+		struct addrinfo *_ai; // the address in use
+		int _fd;
+		State _state;
+		double _reconnect; // monotonic time of the next connect
+		double _deadline;  // monotonic time the connection is closed without data
+		int _backoff;      // seconds
+		SmlFramer _framer;
+		std::deque<std::vector<unsigned char>> _frames;
+		int _event; // eventfd, signaled when a frame is queued
+	};
+
+	static SmlTcpPool &instance();
+
+	/**
+	 * connect to node:service in the background
+	 * @param name of the meter, for logging
+	 * @param timeout seconds to connect or without data until the connection is reopened
+	 * @return NULL if the address can't be resolved
+	 */
+	Source::Ptr add(const char *node, const char *service, const std::string &name,
+					int timeout = IDLE_TIMEOUT);
+	void remove(const Source::Ptr &source);
+
+	size_t size();
+
+	static const size_t MAX_QUEUED = 16; // frames per source, the oldest ones are dropped
+	static const int MAX_BACKOFF = 64;   // seconds
+	static const int IDLE_TIMEOUT = 60;  // seconds, the meters send every few seconds
+
+  private:
+	SmlTcpPool();
+	static void *_run(void *arg);
+	void _loop();
+	void _connect(uint64_t id, Source &source, double now);
+	void _connectFailed(uint64_t id, Source &source, double now, int err);
+	void _disconnect(Source &source, double now);
+	void _receive(Source &source, double now);
+
+	std::mutex _mutex;
+	std::map<uint64_t, Source::Ptr> _sources; // by epoll data
+	uint64_t _nextId;
+	double _nextTimer; // earliest reconnect or deadline
+
+	int _epoll;
+	int _wake; // eventfd to interrupt epoll_wait()
+	pthread_t _thread;
+	bool _running;
+};
+
+#endif /* _SmlTcpPool_hpp_ */
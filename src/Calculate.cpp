@@ -66,6 +66,11 @@ void Calculate::addChannel(ReadingIdentifier::Ptr rid, double factor) {
 	_channels.push_back( cd );
 }
 	
+void Calculate::inputs(std::vector<ReadingIdentifier::Ptr> &ids) const {
+	for (size_t i = 0; i < _channels.size(); i++)
+		ids.push_back(_channels[i].identifier);
+}
+
 void Calculate::validateData(reading_data& rd)
 {
 	if (rd.value < 0) {
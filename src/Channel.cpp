@@ -40,11 +40,11 @@ Channel::Channel(const std::list<Option> &pOptions, const std::string apiProtoco
 				 const std::string uuid, ReadingIdentifier::Ptr pIdentifier)
 	: _thread_running(false), _options(pOptions), _buffer(new Buffer()), _identifier(pIdentifier),
 	  _last(0), _uuid(uuid), _apiProtocol(apiProtocol), _duplicates(0), _mqtt(true) {
-	id = instances++;
+	_id = instances++;
 
 	// set channel name
 	std::stringstream oss;
-	oss << "chn" << id;
+	oss << "chn" << _id;
 	_name = oss.str();
 
 	OptionList optlist;
@@ -122,6 +122,11 @@ Channel::Channel(const std::list<Option> &pOptions, const std::string apiProtoco
 	} catch (vz::OptionNotFoundException &e) {
 		// using default value if not specified (from above)
 	} 
+	try {
+		_mqttFormat = optlist.lookup_string(pOptions, "mqtt_format");
+	} catch (vz::OptionNotFoundException &e) {
+		// using default value if not specified (from above)
+	}
 	
 	pthread_cond_init(&condition, NULL); // initialize thread syncronization helpers
 }
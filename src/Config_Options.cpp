@@ -26,6 +26,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <regex>
+#include <set>
 #include <stdio.h>
 
 #include "Channel.hpp"
@@ -41,15 +42,16 @@ static const char *option_type_str[] = {"null",   "boolean", "double", "int",
 
 Config_Options::Config_Options()
 	: _config("/etc/vzlogger.conf"), _log(""), _pds(0), _port(8080), _verbosity(0),
-	  _comet_timeout(30), _buffer_length(-1), _retry_pause(15), _local(false), _foreground(false),
+	  _comet_timeout(30), _buffer_length(-1), _httpd_threads(1), _httpd_connections(64),
+	  _httpd_conn_timeout(90), _retry_pause(15), _local(false), _foreground(false),
 	  _time_machine(false) {
 	_logfd = NULL;
 }
 
 Config_Options::Config_Options(const std::string filename)
 	: _config(filename), _log(""), _pds(0), _port(8080), _verbosity(0), _comet_timeout(30),
-	  _buffer_length(-1), _retry_pause(15), _local(false), _foreground(false),
-	  _time_machine(false) {
+	  _buffer_length(-1), _httpd_threads(1), _httpd_connections(64), _httpd_conn_timeout(90),
+	  _retry_pause(15), _local(false), _foreground(false), _time_machine(false) {
 	_logfd = NULL;
 }
 
@@ -146,6 +148,20 @@ void Config_Options::config_parse(MapContainer &mappings) {
 								-1; // 0 makes no sense, use size based mode with 1 element
 					} else if (strcmp(key, "index") == 0 && local_type == json_type_boolean) {
 						_channel_index = json_object_get_boolean(local_value);
+					} else if (strcmp(key, "threads") == 0 && local_type == json_type_int) {
+						_httpd_threads = json_object_get_int(local_value);
+						if (_httpd_threads < 1)
+							throw vz::VZException("local threads < 1 not allowed");
+					} else if (strcmp(key, "max_connections") == 0 &&
+							   local_type == json_type_int) {
+						_httpd_connections = json_object_get_int(local_value);
+						if (_httpd_connections < 1)
+							throw vz::VZException("local max_connections < 1 not allowed");
+					} else if (strcmp(key, "connection_timeout") == 0 &&
+							   local_type == json_type_int) {
+						_httpd_conn_timeout = json_object_get_int(local_value);
+						if (_httpd_conn_timeout < 0)
+							_httpd_conn_timeout = 0; // 0 disables the timeout
 					} else {
 						print(log_alert, "Ignoring invalid field or type: %s=%s (%s)", NULL, key,
 							  json_object_get_string(local_value), option_type_str[local_type]);
@@ -187,6 +203,21 @@ void Config_Options::config_parse(MapContainer &mappings) {
 					  json_object_get_string(value), option_type_str[type]);
 			}
 		}
+
+		// the names are the keys of the group message, one value each
+		std::set<std::pair<std::string, std::string>> group_names;
+		for (MapContainer::iterator it = mappings.begin(); it != mappings.end(); ++it) {
+			for (MeterMap::iterator ch = it->begin(); ch != it->end(); ++ch) {
+				const std::string &group = (*ch)->mqttGroupKey(), &name = (*ch)->mqttGroupName();
+				if (group.empty())
+					continue;
+				if (!group_names.insert(std::make_pair(group, name)).second) {
+					print(log_alert, "mqtt_group %s: name %s used by several channels", NULL,
+						  group.c_str(), name.c_str());
+					throw vz::VZException("duplicate name in mqtt_group");
+				}
+			}
+		}
 	} catch (std::exception &e) {
 		json_object_put(json_cfg); /* free allocated memory */
 		std::stringstream oss;
@@ -1,5 +1,13 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "Json.hpp"
 #include "common.h"
+#include <VZException.hpp>
+
+#define JSON_NONE ((size_t)-1) // no node of interest
+#define JSON_MAX_DEPTH 64
 
 struct json_object * json_path_single(struct json_object *jso, const char *path, int allowed_json_types_count, ...) {
 	if (jso == NULL)
@@ -150,3 +158,339 @@ void inspect_json_object(struct json_object *jobject, int nested_level) {
     }
 	print(log_finest, "inspect: exit level %d", "json", nested_level); 
 }
+
+JsonPath::JsonPath(const std::string &path) : _path(path) {
+	size_t pos = 0;
+	if (pos < path.size() && path[pos] == '$')
+		pos++;
+
+	while (pos < path.size()) {
+		Step step;
+		step._index = 0;
+
+		if (path[pos] == '.') {
+			size_t next = path.find_first_of(".[", pos + 1);
+			if (next == std::string::npos)
+				next = path.size();
+			step._key = path.substr(pos + 1, next - pos - 1);
+			if (step._key.empty())
+				throw vz::VZException("invalid path '" + path + "', empty key after '.'");
+			_name = step._key;
+			pos = next;
+		} else if (path[pos] == '[') {
+			size_t close = path.find(']', pos);
+			if (close == std::string::npos)
+				throw vz::VZException("invalid path '" + path + "', missing closing ']' after '['");
+			std::string sidx = path.substr(pos + 1, close - pos - 1);
+			char *endp;
+			long idx = strtol(sidx.c_str(), &endp, 10);
+			if (sidx.empty() || *endp != '\0')
+				throw vz::VZException("invalid path '" + path + "', no index between '[]'");
+			step._index = (int)idx;
+			pos = close + 1;
+			if (pos < path.size() && path[pos] != '.' && path[pos] != '[')
+				throw vz::VZException("invalid path '" + path + "', '.' or '[' expected after ']'");
+		} else {
+			throw vz::VZException("invalid path '" + path + "', one of '$.[' expected");
+		}
+		_steps.push_back(step);
+	}
+}
+
+struct json_object *JsonPath::find(struct json_object *jso) const {
+	for (std::vector<Step>::const_iterator it = _steps.begin(); it != _steps.end() && jso; ++it) {
+		struct json_object *next = NULL;
+		if (!it->isIndex()) {
+			if (!json_object_object_get_ex(jso, it->_key.c_str(), &next))
+				return NULL;
+		} else {
+			if (json_object_get_type(jso) != json_type_array)
+				return NULL;
+			int len = json_object_array_length(jso);
+			int idx = it->_index < 0 ? len + it->_index : it->_index;
+			if (idx < 0 || idx >= len)
+				return NULL;
+			next = json_object_array_get_idx(jso, idx);
+		}
+		jso = next;
+	}
+	return jso;
+}
+
+size_t JsonExtractor::add(const JsonPath &path) {
+	size_t node = 0;
+	const std::vector<JsonPath::Step> &steps = path.steps();
+
+	for (std::vector<JsonPath::Step>::const_iterator step = steps.begin(); step != steps.end();
+		 ++step) {
+		size_t next = JSON_NONE;
+		for (size_t i = 0; i < _nodes[node]._children.size(); i++) {
+			if (_nodes[_nodes[node]._children[i]]._step == *step) {
+				next = _nodes[node]._children[i];
+				break;
+			}
+		}
+		if (next == JSON_NONE) { // paths with a common prefix share their nodes
+			Node n;
+			n._step = *step;
+			_nodes.push_back(n);
+			next = _nodes.size() - 1;
+			_nodes[node]._children.push_back(next);
+		}
+		if (step->isIndex() && step->_index < 0)
+			_streamable = false; // the length of the array is not known while scanning
+		node = next;
+	}
+	_nodes[node]._values.push_back(_count);
+	return _count++;
+}
+
+size_t JsonExtractor::child(size_t node, const char *key, size_t len) const {
+	const std::vector<size_t> &children = _nodes[node]._children;
+	for (size_t i = 0; i < children.size(); i++) {
+		const JsonPath::Step &step = _nodes[children[i]]._step;
+		if (!step.isIndex() && step._key.size() == len && memcmp(step._key.data(), key, len) == 0)
+			return children[i];
+	}
+	return JSON_NONE;
+}
+
+size_t JsonExtractor::child(size_t node, int index) const {
+	const std::vector<size_t> &children = _nodes[node]._children;
+	for (size_t i = 0; i < children.size(); i++) {
+		const JsonPath::Step &step = _nodes[children[i]]._step;
+		if (step.isIndex() && step._index == index)
+			return children[i];
+	}
+	return JSON_NONE;
+}
+
+void JsonExtractor::visit(size_t node, struct json_object *jso,
+						  std::vector<Value> &values) const {
+	const Node &n = _nodes[node];
+
+	if (!n._values.empty()) {
+		json_type type = json_object_get_type(jso);
+		if (type == json_type_int || type == json_type_double) {
+			for (size_t i = 0; i < n._values.size(); i++) {
+				Value &v = values[n._values[i]];
+				v._found = true;
+				v._int = type == json_type_int;
+				v._i = json_object_get_int64(jso);
+				v._d = json_object_get_double(jso);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < n._children.size(); i++) {
+		const JsonPath::Step &step = _nodes[n._children[i]]._step;
+		struct json_object *next = NULL;
+
+		if (!step.isIndex()) {
+			json_object_object_get_ex(jso, step._key.c_str(), &next);
+		} else if (json_object_get_type(jso) == json_type_array) {
+			int len = json_object_array_length(jso);
+			int idx = step._index < 0 ? len + step._index : step._index;
+			if (idx >= 0 && idx < len)
+				next = json_object_array_get_idx(jso, idx);
+		}
+		if (next)
+			visit(n._children[i], next, values);
+	}
+}
+
+void JsonExtractor::extract(struct json_object *jso, std::vector<Value> &values) const {
+	Value none = {false, false, 0, 0};
+	values.assign(_count, none);
+	if (jso)
+		visit(0, jso, values);
+}
+
+static const char *json_skip_ws(const char *p, const char *end) {
+	while (p < end && isspace((unsigned char)*p))
+		p++;
+	return p;
+}
+
+// p points to the opening quote (json-c accepts single quotes as well)
+static const char *json_skip_string(const char *p, const char *end, bool *escaped) {
+	char quote = *p++;
+	while (p < end && *p != quote) {
+		if (*p == '\\') {
+			*escaped = true;
+			p++;
+		}
+		p++;
+	}
+	return p < end ? p + 1 : NULL;
+}
+
+static unsigned long json_hex4(const char *p) {
+	char hex[5] = {p[0], p[1], p[2], p[3], 0};
+	return strtoul(hex, NULL, 16);
+}
+
+static void json_unescape(const char *p, size_t len, std::string &out) {
+	const char *end = p + len;
+	out.clear();
+	while (p < end) {
+		if (*p != '\\' || p + 1 >= end) {
+			out += *p++;
+			continue;
+		}
+		p++;
+		switch (*p) {
+		case 'b':
+			out += '\b';
+			break;
+		case 'f':
+			out += '\f';
+			break;
+		case 'n':
+			out += '\n';
+			break;
+		case 'r':
+			out += '\r';
+			break;
+		case 't':
+			out += '\t';
+			break;
+		case 'u':
+			if (p + 4 < end) {
+				unsigned long c = json_hex4(p + 1);
+				p += 4;
+				if (c >= 0xd800 && c < 0xdc00 && p + 6 < end && p[1] == '\\' && p[2] == 'u') {
+					unsigned long low = json_hex4(p + 3); // surrogate pair
+					if (low >= 0xdc00 && low < 0xe000) {
+						c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+						p += 6;
+					}
+				}
+				if (c >= 0xd800 && c < 0xe000)
+					c = 0xfffd; // unpaired surrogate, no valid code point
+				if (c < 0x80) {
+					out += (char)c;
+				} else if (c < 0x800) {
+					out += (char)(0xc0 | (c >> 6));
+					out += (char)(0x80 | (c & 0x3f));
+				} else if (c < 0x10000) {
+					out += (char)(0xe0 | (c >> 12));
+					out += (char)(0x80 | ((c >> 6) & 0x3f));
+					out += (char)(0x80 | (c & 0x3f));
+				} else {
+					out += (char)(0xf0 | (c >> 18));
+					out += (char)(0x80 | ((c >> 12) & 0x3f));
+					out += (char)(0x80 | ((c >> 6) & 0x3f));
+					out += (char)(0x80 | (c & 0x3f));
+				}
+			}
+			break;
+		default: // '"', '\\', '/', ...
+			out += *p;
+		}
+		p++;
+	}
+}
+
+const char *JsonExtractor::scan(const char *p, const char *end, size_t node, int depth,
+								std::vector<Value> &values) const {
+	p = json_skip_ws(p, end);
+	if (p >= end || depth > JSON_MAX_DEPTH)
+		return NULL;
+
+	if (*p == '{') {
+		p = json_skip_ws(p + 1, end);
+		if (p < end && *p == '}')
+			return p + 1;
+		std::string key;
+		while (true) {
+			if (p >= end || (*p != '"' && *p != '\''))
+				return NULL;
+			bool escaped = false;
+			const char *start = p + 1;
+			p = json_skip_string(p, end, &escaped);
+			if (p == NULL)
+				return NULL;
+
+			size_t next = JSON_NONE;
+			if (node != JSON_NONE) {
+				if (escaped) {
+					json_unescape(start, p - 1 - start, key);
+					next = child(node, key.data(), key.size());
+				} else {
+					next = child(node, start, p - 1 - start);
+				}
+			}
+
+			p = json_skip_ws(p, end);
+			if (p >= end || *p != ':')
+				return NULL;
+			p = scan(p + 1, end, next, depth + 1, values);
+			if (p == NULL)
+				return NULL;
+			p = json_skip_ws(p, end);
+			if (p < end && *p == '}')
+				return p + 1;
+			if (p >= end || *p != ',')
+				return NULL;
+			p = json_skip_ws(p + 1, end);
+		}
+	}
+
+	if (*p == '[') {
+		p = json_skip_ws(p + 1, end);
+		if (p < end && *p == ']')
+			return p + 1;
+		for (int idx = 0;; idx++) {
+			p = scan(p, end, node != JSON_NONE ? child(node, idx) : JSON_NONE, depth + 1, values);
+			if (p == NULL)
+				return NULL;
+			p = json_skip_ws(p, end);
+			if (p < end && *p == ']')
+				return p + 1;
+			if (p >= end || *p != ',')
+				return NULL;
+			p++;
+		}
+	}
+
+	if (*p == '"' || *p == '\'') {
+		bool escaped = false;
+		return json_skip_string(p, end, &escaped);
+	}
+
+	// number or literal
+	const char *start = p;
+	while (p < end && *p && !strchr(",}] \t\r\n", *p))
+		p++;
+	size_t len = p - start;
+	if (len == 0)
+		return NULL;
+
+	if (node != JSON_NONE && !_nodes[node]._values.empty() && len < 64) {
+		char buf[64];
+		memcpy(buf, start, len);
+		buf[len] = '\0';
+
+		char *endp;
+		Value v = {true, strpbrk(buf, ".eEnN") == NULL, 0, 0}; // NaN, Infinity are doubles
+		if (v._int) {
+			v._i = strtoll(buf, &endp, 10);
+			v._d = (double)v._i;
+		} else {
+			v._d = strtod(buf, &endp);
+			v._i = (int64_t)v._d;
+		}
+		if (endp == buf + len) { // true, false, null are no numbers
+			for (size_t i = 0; i < _nodes[node]._values.size(); i++)
+				values[_nodes[node]._values[i]] = v;
+		}
+	}
+	return p;
+}
+
+bool JsonExtractor::extract(const char *text, size_t len, std::vector<Value> &values) const {
+	Value none = {false, false, 0, 0};
+	values.assign(_count, none);
+	return scan(text, text + len, 0, 0, values) != NULL;
+}
@@ -63,7 +63,7 @@ static const meter_details_t protocols[] = {
 	METER_DETAIL(exec, Exec, "Parse program output", 32),
 	METER_DETAIL(random, Random, "Generate random values with a random walk", 1),
 	METER_DETAIL(fluksov2, Fluksov2, "Read from Flukso's onboard SPI fifo", 16),
-	METER_DETAIL(s0, S0, "S0-meter directly connected to RS232", 4),
+	METER_DETAIL(s0, S0, "S0-meter directly connected to RS232", 128),
 	METER_DETAIL(d0, D0, "DLMS/IEC 62056-21 plaintext protocol", 400),
 #ifdef SML_SUPPORT
 	METER_DETAIL(sml, Sml, "Smart Message Language as used by EDL-21, eHz and SyM²", 32),
@@ -73,7 +73,7 @@ static const meter_details_t protocols[] = {
 #endif
 	METER_DETAIL(w1therm, W1therm, "W1-therm / 1wire temperature devices", 400),
 #ifdef OMS_SUPPORT
-	METER_DETAIL(oms, OMS, "OMS (M-BUS) protocol based devices", 100),
+	METER_DETAIL(oms, OMS, "OMS (M-BUS) protocol based devices", 256),
 #endif
 #ifdef ENABLE_MQTT
 	METER_DETAIL(mqtt, MQTT, "MQTT subscriptions", 100),
@@ -296,6 +296,13 @@ size_t Meter::adapt_max_readings(size_t max_readings, size_t channels) {
 	return max_readings;
 }
 
+void Meter::channelIdentifiers(const std::vector<ReadingIdentifier::Ptr> &ids) {
+	std::vector<ReadingIdentifier::Ptr> all(ids);
+	for (size_t i = 0; i < _calculations.size(); i++)
+		_calculations[i]->inputs(all);
+	_protocol->channelIdentifiers(all);
+}
+
 int meter_lookup_protocol(const char *name, meter_protocol_t *protocol) {
 	if (!name)
 		return ERR_NOT_FOUND;
@@ -50,6 +50,11 @@ extern Config_Options options; /* global application options */
 */
 void MeterMap::start() {
 	if (_meter->isEnabled()) {
+		std::vector<ReadingIdentifier::Ptr> ids;
+		for (iterator it = _channels.begin(); it != _channels.end(); it++)
+			ids.push_back((*it)->identifier());
+		_meter->channelIdentifiers(ids);
+
 		try {
 			_meter->open();
 		} catch (vz::ConnectionException &e) {
@@ -0,0 +1,172 @@
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <stdio.h>
+#include <string.h>
+
+#include "MqttPayload.hpp"
+
+static const char *formatNames[] = {"text", "json", "binary", "cbor", "influx"};
+
+bool MqttPayload::parseFormat(const std::string &name, Format &format) {
+	for (size_t i = 0; i < sizeof(formatNames) / sizeof(formatNames[0]); i++) {
+		if (name == formatNames[i]) {
+			format = (Format)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *MqttPayload::formatName(Format format) { return formatNames[format]; }
+
+void MqttPayload::appendInt(std::string &out, int64_t value) {
+	char buf[24];
+	char *p = buf + sizeof(buf);
+	uint64_t u = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	if (value < 0)
+		*--p = '-';
+	out.append(p, buf + sizeof(buf) - p);
+}
+
+void MqttPayload::appendText(std::string &out, double value) {
+	// counters and impulses are mostly integral, skip printf for them
+	if (std::fabs(value) < 1e15 && value == std::trunc(value) &&
+		!(value == 0 && std::signbit(value))) {
+		appendInt(out, (int64_t)value);
+		out.append(".000000", 7);
+		return;
+	}
+	char buf[320]; // "%f" of DBL_MAX has 309 integer digits
+	int len = snprintf(buf, sizeof(buf), "%f", value);
+	out.append(buf, len);
+}
+
+void MqttPayload::appendJson(std::string &out, double value) {
+	// same number format as json_object_new_double()
+	if (std::isnan(value)) {
+		out += "NaN";
+	} else if (std::isinf(value)) {
+		out += value > 0 ? "Infinity" : "-Infinity";
+	} else {
+		char buf[32];
+		int len = snprintf(buf, sizeof(buf), "%.17g", value);
+		out.append(buf, len);
+		if (strpbrk(buf, ".eE") == NULL)
+			out += ".0";
+	}
+}
+
+void MqttPayload::appendInfluxKey(std::string &out, const std::string &key) {
+	for (std::string::const_iterator it = key.begin(); it != key.end(); ++it) {
+		if (*it == ',' || *it == ' ' || *it == '=')
+			out += '\\';
+		out += *it;
+	}
+}
+
+static void appendLE(std::string &out, uint64_t v) {
+	char b[8];
+	for (int i = 0; i < 8; i++)
+		b[i] = (char)(v >> (8 * i));
+	out.append(b, 8);
+}
+
+static void appendBE(std::string &out, uint64_t v, int bytes) {
+	char b[8];
+	for (int i = 0; i < bytes; i++)
+		b[i] = (char)(v >> (8 * (bytes - 1 - i)));
+	out.append(b, bytes);
+}
+
+// CBOR initial byte with the argument in the shortest form
+static void appendCborHead(std::string &out, unsigned major, uint64_t arg) {
+	major <<= 5;
+	if (arg < 24) {
+		out += (char)(major | arg);
+	} else if (arg <= 0xff) {
+		out += (char)(major | 24);
+		appendBE(out, arg, 1);
+	} else if (arg <= 0xffff) {
+		out += (char)(major | 25);
+		appendBE(out, arg, 2);
+	} else if (arg <= 0xffffffff) {
+		out += (char)(major | 26);
+		appendBE(out, arg, 4);
+	} else {
+		out += (char)(major | 27);
+		appendBE(out, arg, 8);
+	}
+}
+
+void MqttPayload::encode(std::string &out, Format format, int64_t time_ms, double value,
+						 const std::string &prefix) {
+	out.clear();
+	switch (format) {
+	case TEXT:
+		appendText(out, value);
+		break;
+	case JSON:
+		out.append("{ \"timestamp\": ", 15);
+		appendInt(out, time_ms);
+		out.append(", \"value\": ", 11);
+		appendJson(out, value);
+		out.append(" }", 2);
+		break;
+	case BINARY: {
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		appendLE(out, (uint64_t)time_ms);
+		appendLE(out, bits);
+	} break;
+	case CBOR: {
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		out += (char)0xa2; // map with 2 pairs
+		appendCborHead(out, 3, 9);
+		out.append("timestamp", 9);
+		if (time_ms >= 0)
+			appendCborHead(out, 0, (uint64_t)time_ms);
+		else
+			appendCborHead(out, 1, (uint64_t)(-1 - time_ms));
+		appendCborHead(out, 3, 5);
+		out.append("value", 5);
+		out += (char)0xfb; // float64
+		appendBE(out, bits, 8);
+	} break;
+	case INFLUX:
+		out += prefix;
+		out.append(" value=", 7);
+		appendText(out, value);
+		out += ' ';
+		appendInt(out, time_ms * 1000000); // default precision is ns
+		break;
+	}
+}
+
+const std::string &MqttPayload::encode(Format format, int64_t time_ms, double value,
+									   const std::string &prefix) {
+	// keeps its capacity, no allocation once it has grown to the payload size
+	static thread_local std::string buffer;
+	encode(buffer, format, time_ms, value, prefix);
+	return buffer;
+}
@@ -23,6 +23,7 @@
  * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 
@@ -32,6 +33,7 @@
 #include <string.h>
 
 #include "Obis.hpp"
+#include "Reading.hpp"
 #include "common.h"
 #include <VZException.hpp>
 
@@ -116,7 +118,7 @@ Obis::Obis(unsigned char a, unsigned char b, unsigned char c, unsigned char d, u
 }
 
 Obis::Obis(const char *strClear) {
-	if (parse(strClear) != SUCCESS) {
+	if (parse(strClear, strlen(strClear)) != SUCCESS) {
 		// check alias
 		if (lookup_alias(strClear) == SUCCESS) {
 		} else {
@@ -135,13 +137,16 @@ Obis::Obis() {
 	_obisId._raw[5] = DC;
 }
 
-int Obis::parse(const char *str) {
+bool Obis::tryParse(const char *str, size_t len, Obis &obis) {
+	return obis.parse(str, len) == SUCCESS;
+}
+
+int Obis::parse(const char *str, size_t len) {
 	enum { A = 0, B, C, D, E, F };
 
 	char byte; // currently processed byte
 	int num;
 	int field;
-	int len = strlen(str);
 	int digit = 0;
 	bool has_sc = false;
 
@@ -152,7 +157,7 @@ int Obis::parse(const char *str) {
 	// format: "A-B:C.D.E[*&]F"
 	// fields A, B, E, F are optional
 	// fields C & D are mandatory
-	for (int i = 0; i < len; i++) {
+	for (size_t i = 0; i < len; i++) {
 		byte = str[i];
 		digit++; // count number of digits for this field
 
@@ -160,6 +165,8 @@ int Obis::parse(const char *str) {
 			if (has_sc)
 				return ERR;                  // no F1,... allowed.
 			num = (num * 10) + (byte - '0'); // parse digits
+			if (num > 255)
+				return ERR; // sanity check (the last field isn't checked below)
 		} else if (byte == 'C') {
 			num = SC_C;
 			has_sc = true;
@@ -261,6 +268,82 @@ bool Obis::isManufacturerSpecific() const {
 			(_obisId.groups.storage >= 128 && _obisId.groups.storage <= 254));
 }
 
+const uint64_t ObisSet::unused;
+
+void ObisSet::assign(const std::vector<Obis> &codes) {
+	std::vector<uint64_t> keys;
+	for (size_t i = 0; i < codes.size(); i++)
+		keys.push_back(codes[i].key());
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	_size = keys.size();
+	_slots.clear();
+	if (keys.empty())
+		return;
+
+	// search a multiplier without collisions, with a table of at least twice the size
+	// there is one after a few tries
+	unsigned bits = 1;
+	while ((1u << bits) < 2 * keys.size())
+		bits++;
+	uint64_t seed = 0x9e3779b97f4a7c15ULL;
+	for (;; bits++) {
+		for (int tries = 0; tries < 100; tries++) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL; // LCG
+			uint64_t odd = seed | 1;
+			std::vector<uint64_t> slots(1u << bits, unused);
+			size_t i;
+			for (i = 0; i < keys.size(); i++) {
+				uint64_t &slot = slots[(keys[i] * odd) >> (64 - bits)];
+				if (slot != unused)
+					break;
+				slot = keys[i];
+			}
+			if (i == keys.size()) {
+				_slots.swap(slots);
+				_seed = odd;
+				_shift = 64 - bits;
+				return;
+			}
+		}
+	}
+}
+
+std::vector<Obis> ObisIdentifiers::channelCodes(const std::vector<Ptr> &ids) {
+	std::vector<Obis> codes;
+	for (size_t i = 0; i < ids.size(); i++) {
+		ObisIdentifier *oid = dynamic_cast<ObisIdentifier *>(ids[i].get());
+		if (!oid) // can't tell which codes are needed
+			return std::vector<Obis>();
+		codes.push_back(oid->obis());
+	}
+	return codes;
+}
+
+ObisIdentifiers::Ptr ObisIdentifiers::get(uint64_t key) {
+	std::unordered_map<uint64_t, Ptr>::iterator it = _ids.find(key);
+	if (it != _ids.end())
+		return it->second;
+	Obis obis(key >> 40, key >> 32, key >> 24, key >> 16, key >> 8, key);
+	return _add(key, obis.isValid() ? new ObisIdentifier(obis) : NULL);
+}
+
+ObisIdentifiers::Ptr ObisIdentifiers::get(const Obis &obis) {
+	uint64_t key = obis.key();
+	std::unordered_map<uint64_t, Ptr>::iterator it = _ids.find(key);
+	if (it != _ids.end())
+		return it->second;
+	return _add(key, new ObisIdentifier(obis));
+}
+
+ObisIdentifiers::Ptr ObisIdentifiers::_add(uint64_t key, ReadingIdentifier *rid) {
+	if (_ids.size() >= 256)
+		_ids.clear(); // garbage on the line
+	Ptr ptr(rid);
+	_ids[key] = ptr; // NULL for invalid codes
+	return ptr;
+}
+
 bool Obis::isValid() const {
 	// check validity according to V2.2 from 1.4.2013:
 	// This is just a basic sanity check as the OBIS are not strictly defined.
@@ -80,9 +80,16 @@ ReadingIdentifier::Ptr reading_id_parse(meter_protocol_t protocol, const char *s
 	ReadingIdentifier::Ptr rid;
 
 	switch (protocol) {
+	case meter_protocol_oms:
+		if (strchr(string, '/')) { // <device id>/<obis> of an OMS receiver
+			rid = ReadingIdentifier::Ptr(new StringIdentifier(string));
+			break;
+		}
+		rid = ReadingIdentifier::Ptr(new ObisIdentifier(Obis(string)));
+		break;
+
 	case meter_protocol_d0:
 	case meter_protocol_sml:
-	case meter_protocol_oms:
 		rid = ReadingIdentifier::Ptr(new ObisIdentifier(Obis(string)));
 		break;
 
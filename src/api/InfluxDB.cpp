@@ -339,18 +339,24 @@ void vz::api::InfluxDB::send() {
 		curl_easy_setopt(_api.curl, CURLOPT_WRITEDATA, response());
 
 		// actually send the request to InfluxDB
+		double started = vz::metrics::monotonic();
 		curl_code = curl_easy_perform(_api.curl);
 		print(log_finest, "Influxdb curl terminated", channel()->name());
 		curl_easy_getinfo(_api.curl, CURLINFO_RESPONSE_CODE, &http_code);
+		channel()->stats().upload_latency.observe(vz::metrics::monotonic() - started);
 
 		if (curl_code == CURLE_OK && http_code >= 200 && http_code < 300) { // everything is ok
 			print(log_debug, "InfluxDB CURL success", channel()->name());
 			buf->clean(); // delete the stuff we just sent to InfluxDB from the buffer
 		} else {
 			buf->undelete(); // failure to insert, so dont delete the buffer
+			channel()->stats().curl_retries++; // kept for the next send()
 			if (curl_code != CURLE_OK) {
+				channel()->stats().curl_errors++;
 				print(log_error, "CURL Error: %s", channel()->name(),
 					  curl_easy_strerror(curl_code));
+			} else {
+				channel()->stats().http_errors++;
 			}
 			print(log_error, "InfluxDB error! - HTTP Status %i", channel()->name(), http_code);
 			if (!_response->get_response().empty()) {
@@ -184,8 +184,10 @@ void vz::api::MySmartGrid::send() {
 
 	_curlIF.commitHeader();
 
+	double started = vz::metrics::monotonic();
 	curl_code = _curlIF.perform();
 	curl_easy_getinfo(_curlIF.handle(), CURLINFO_RESPONSE_CODE, &http_code);
+	channel()->stats().upload_latency.observe(vz::metrics::monotonic() - started);
 
 	/* check response */
 	if (curl_code == CURLE_OK && http_code == 200) { /* everything is ok */
@@ -194,8 +196,10 @@ void vz::api::MySmartGrid::send() {
 	} else { /* error */
 		channel()->buffer()->undelete();
 		if (curl_code != CURLE_OK) {
+			channel()->stats().curl_errors++;
 			print(log_alert, "CURL: %s", channel()->name(), curl_easy_strerror(curl_code));
 		} else if (http_code != 200) {
+			channel()->stats().http_errors++;
 			// 502 - Bad gateway
 			char err[255];
 			api_parse_exception(err, 255);
@@ -209,6 +213,7 @@ void vz::api::MySmartGrid::send() {
 	if ((curl_code != CURLE_OK || http_code != 200)) {
 		print(log_info, "Waiting %i secs for next request due to previous failure",
 			  channel()->name(), options.retry_pause());
+		channel()->stats().curl_retries++;
 		sleep(options.retry_pause());
 	}
 	// sleep(20);
@@ -277,8 +282,10 @@ void vz::api::MySmartGrid::_send(const std::string &url, json_object *json_obj)
 
 	_curlIF.commitHeader();
 
+	double started = vz::metrics::monotonic();
 	curl_code = _curlIF.perform();
 	curl_easy_getinfo(_curlIF.handle(), CURLINFO_RESPONSE_CODE, &http_code);
+	channel()->stats().upload_latency.observe(vz::metrics::monotonic() - started);
 
 	/* check response */
 	if (curl_code == CURLE_OK && http_code == 200) { /* everything is ok */
@@ -287,8 +294,10 @@ void vz::api::MySmartGrid::_send(const std::string &url, json_object *json_obj)
 	} else { /* error */
 		channel()->buffer()->undelete();
 		if (curl_code != CURLE_OK) {
+			channel()->stats().curl_errors++;
 			print(log_alert, "CURL: %s", channel()->name(), curl_easy_strerror(curl_code));
 		} else if (http_code != 200) {
+			channel()->stats().http_errors++;
 			// 502 - Bad gateway
 			char err[255];
 			api_parse_exception(err, 255);
@@ -302,6 +311,7 @@ void vz::api::MySmartGrid::_send(const std::string &url, json_object *json_obj)
 	if ((curl_code != CURLE_OK || http_code != 200)) {
 		print(log_info, "Waiting %i secs for next request due to previous failure",
 			  channel()->name(), options.retry_pause());
+		channel()->stats().curl_retries++;
 		sleep(options.retry_pause());
 	}
 }
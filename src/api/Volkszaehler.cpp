@@ -137,8 +137,10 @@ void vz::api::Volkszaehler::send() {
 	curl_easy_setopt(_api.curl, CURLOPT_WRITEFUNCTION, curl_custom_write_callback);
 	curl_easy_setopt(_api.curl, CURLOPT_WRITEDATA, (void *)&response);
 
+	double started = vz::metrics::monotonic();
 	curl_code = curl_easy_perform(_api.curl);
 	curl_easy_getinfo(_api.curl, CURLINFO_RESPONSE_CODE, &http_code);
+	channel()->stats().upload_latency.observe(vz::metrics::monotonic() - started);
 
 	if (curlSessionProvider)
 		curlSessionProvider->return_session(_middleware, _api.curl);
@@ -159,8 +161,10 @@ void vz::api::Volkszaehler::send() {
 		// channel()->buffer.sent = last->next;
 	} else { // error
 		if (curl_code != CURLE_OK) {
+			channel()->stats().curl_errors++;
 			print(log_alert, "CURL: %s", channel()->name(), curl_easy_strerror(curl_code));
 		} else if (http_code != 200) {
+			channel()->stats().http_errors++;
 			char err[255];
 			api_parse_exception(response, err, 255);
 			print(log_alert, "CURL Error from middleware: %s", channel()->name(), err);
@@ -174,6 +178,7 @@ void vz::api::Volkszaehler::send() {
 	if ((curl_code != CURLE_OK || http_code != 200)) {
 		print(log_info, "Waiting %i secs for next request due to previous failure",
 			  channel()->name(), options.retry_pause());
+		channel()->stats().curl_retries++;
 		sleep(options.retry_pause());
 	}
 }
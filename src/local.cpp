@@ -23,6 +23,7 @@
  * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <list>
 #include <map>
 
@@ -35,6 +36,7 @@
 #include "local.h"
 #include "vzlogger.h"
 #include <MeterMap.hpp>
+#include <Metrics.hpp>
 #include <VZException.hpp>
 #include <pthread.h>
 
@@ -42,15 +44,238 @@ extern Config_Options options;
 
 class ChannelData {
   public:
-	ChannelData(const int64_t &t, const double &v) : _t(t), _v(v){};
+	ChannelData(const int64_t &t, const double &v) : _t(t), _v(v), _len(0){};
 	int64_t _t;
 	double _v;
+	size_t _len; // length of the serialized tuple in LocalChannelBuffer::_json
 };
 
 typedef std::list<ChannelData> LIST_ChannelData;
-typedef std::map<std::string, LIST_ChannelData> MAP_UUID_ChannelData;
+
+/**
+ * Buffered tuples of a channel together with their serialized JSON fragment.
+ * The fragment is maintained incrementally as tuples are added and removed,
+ * so requests never have to serialize the tuples.
+ */
+class LocalChannelBuffer {
+  public:
+	void push_back(const ChannelData &d);
+	void pop_front();
+
+	LIST_ChannelData _tuples;
+	std::string _json; // "[ t, v ], " for every tuple
+};
+
+typedef std::map<std::string, LocalChannelBuffer> MAP_UUID_ChannelData;
 pthread_mutex_t localbuffer_mutex = PTHREAD_MUTEX_INITIALIZER;
 MAP_UUID_ChannelData localbuffer;
+uint64_t localbuffer_version = 0; // incremented on every change of the localbuffer
+
+void LocalChannelBuffer::push_back(const ChannelData &d) {
+	char tuple[64];
+	int len = snprintf(tuple, sizeof(tuple), "[ %lld, %.17g ], ", (long long)d._t, d._v);
+
+	_tuples.push_back(d);
+	_tuples.back()._len = len;
+	_json.append(tuple, len);
+}
+
+void LocalChannelBuffer::pop_front() {
+	_json.erase(0, _tuples.front()._len);
+	_tuples.pop_front();
+}
+
+/**
+ * Cached response per URL, shared by all requests until the data changes.
+ * libmicrohttpd reference counts responses, so a cached response can be
+ * queued on any number of connections without copying the body.
+ */
+class LocalResponse {
+  public:
+	LocalResponse() : _response(NULL){};
+
+	std::string _etag;
+	struct MHD_Response *_response;
+};
+
+typedef std::map<std::string, LocalResponse> MAP_URL_Response;
+pthread_mutex_t localresponses_mutex = PTHREAD_MUTEX_INITIALIZER;
+MAP_URL_Response localresponses;
+
+/**
+ * A request waiting for new data in the local buffer.
+ * Comet requests are suspended until new data for their channel arrives or the comet timeout
+ * elapsed. Stream requests stay open and get every new tuple as server-sent event.
+ */
+class LocalWaiter {
+  public:
+	enum mode { COMET, STREAM };
+
+	LocalWaiter(struct MHD_Connection *connection, mode m, const char *uuid)
+		: _connection(connection), _mode(m), _uuid(uuid ? uuid : ""), _suspended(false),
+		  _done(false), _deadline(0){};
+
+	bool matches(const std::string &uuid) const { return _uuid.empty() || _uuid == uuid; }
+
+	struct MHD_Connection *_connection;
+	mode _mode;
+	std::string _uuid; // empty for all channels
+	bool _suspended;
+	bool _done;           // comet: answer now, stream: end of stream
+	time_t _deadline;     // comet: timeout, stream: next keep-alive (0 = none)
+	std::string _pending; // stream: events not yet sent to the client
+};
+
+#define LOCAL_STREAM_MAX_PENDING 65536 // drop slow stream clients above this backlog
+
+typedef std::list<LocalWaiter *> LIST_LocalWaiter;
+pthread_mutex_t localwaiters_mutex = PTHREAD_MUTEX_INITIALIZER;
+LIST_LocalWaiter localwaiters;
+bool localwaiters_closing = false; // daemon is about to stop
+
+// localwaiters_mutex has to be locked by the caller
+static void resume_waiter(LocalWaiter *w) {
+	if (w->_suspended) {
+		w->_suspended = false;
+		MHD_resume_connection(w->_connection);
+	}
+}
+
+static void notify_waiters(const std::string &uuid, const LIST_ChannelData &tuples) {
+	std::string event;
+
+	pthread_mutex_lock(&localwaiters_mutex);
+	for (LIST_LocalWaiter::iterator it = localwaiters.begin(); it != localwaiters.end(); ++it) {
+		LocalWaiter *w = *it;
+		if (!w->matches(uuid))
+			continue;
+
+		if (w->_mode == LocalWaiter::STREAM) {
+			if (event.empty()) { // format only once and only if somebody listens
+				struct json_object *json_ev = json_object_new_object();
+				struct json_object *json_tuples = json_object_new_array();
+				for (LIST_ChannelData::const_iterator cit = tuples.cbegin(); cit != tuples.cend();
+					 ++cit) {
+					struct json_object *json_tuple = json_object_new_array();
+					json_object_array_add(json_tuple, json_object_new_int64(cit->_t));
+					json_object_array_add(json_tuple, json_object_new_double(cit->_v));
+					json_object_array_add(json_tuples, json_tuple);
+				}
+				json_object_object_add(json_ev, "uuid", json_object_new_string(uuid.c_str()));
+				json_object_object_add(json_ev, "tuples", json_tuples);
+				event = std::string("data: ") + json_object_to_json_string(json_ev) + "\n\n";
+				json_object_put(json_ev);
+			}
+			if (w->_pending.size() + event.size() > LOCAL_STREAM_MAX_PENDING) {
+				print(log_warning, "Stream client too slow, closing stream", "http");
+				w->_done = true;
+			} else {
+				w->_pending += event;
+			}
+		} else {
+			w->_done = true;
+		}
+		resume_waiter(w);
+	}
+	pthread_mutex_unlock(&localwaiters_mutex);
+}
+
+static bool suspend_request(struct MHD_Connection *connection, void **con_cls, LocalWaiter *w) {
+	pthread_mutex_lock(&localwaiters_mutex);
+	if (localwaiters_closing) {
+		pthread_mutex_unlock(&localwaiters_mutex);
+		delete w;
+		return false;
+	}
+	localwaiters.push_back(w);
+	*con_cls = w;
+	if (w->_mode == LocalWaiter::COMET) {
+		w->_deadline = time(NULL) + options.comet_timeout();
+		w->_suspended = true;
+		MHD_suspend_connection(connection);
+	} else if (options.comet_timeout() > 0) {
+		w->_deadline = time(NULL) + options.comet_timeout();
+	}
+	pthread_mutex_unlock(&localwaiters_mutex);
+	return true;
+}
+
+void local_request_completed(void *cls, struct MHD_Connection *connection, void **con_cls,
+							 enum MHD_RequestTerminationCode toe) {
+	LocalWaiter *w = static_cast<LocalWaiter *>(*con_cls);
+	if (w == NULL)
+		return;
+
+	pthread_mutex_lock(&localwaiters_mutex);
+	localwaiters.remove(w);
+	pthread_mutex_unlock(&localwaiters_mutex);
+
+	delete w;
+	*con_cls = NULL;
+}
+
+void local_expire_waiters() {
+	time_t now = time(NULL);
+
+	pthread_mutex_lock(&localwaiters_mutex);
+	for (LIST_LocalWaiter::iterator it = localwaiters.begin(); it != localwaiters.end(); ++it) {
+		LocalWaiter *w = *it;
+		if (w->_deadline == 0 || w->_deadline > now)
+			continue;
+
+		if (w->_mode == LocalWaiter::STREAM) {
+			w->_pending += ": keep-alive\n\n"; // SSE comment, ignored by clients
+			w->_deadline = now + options.comet_timeout();
+		} else {
+			w->_done = true;
+			w->_deadline = 0;
+		}
+		resume_waiter(w);
+	}
+	pthread_mutex_unlock(&localwaiters_mutex);
+}
+
+void local_resume_all() {
+	pthread_mutex_lock(&localwaiters_mutex);
+	localwaiters_closing = true;
+	for (LIST_LocalWaiter::iterator it = localwaiters.begin(); it != localwaiters.end(); ++it) {
+		(*it)->_done = true;
+		resume_waiter(*it);
+	}
+	pthread_mutex_unlock(&localwaiters_mutex);
+}
+
+static ssize_t stream_reader(void *cls, uint64_t pos, char *buf, size_t max) {
+	LocalWaiter *w = static_cast<LocalWaiter *>(cls);
+	ssize_t n = 0;
+
+	pthread_mutex_lock(&localwaiters_mutex);
+	if (!w->_pending.empty()) {
+		n = std::min(max, w->_pending.size());
+		memcpy(buf, w->_pending.data(), n);
+		w->_pending.erase(0, n);
+	} else if (w->_done) {
+		n = MHD_CONTENT_READER_END_OF_STREAM;
+	} else {
+		// nothing to send: park the connection until notify_waiters() resumes it
+		w->_suspended = true;
+		MHD_suspend_connection(w->_connection);
+	}
+	pthread_mutex_unlock(&localwaiters_mutex);
+
+	return n;
+}
+
+static bool channel_exists(MapContainer *mappings, const char *uuid) {
+	for (MapContainer::iterator mapping = mappings->begin(); mapping != mappings->end();
+		 mapping++) {
+		for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
+			if (strcmp((*ch)->uuid(), uuid) == 0)
+				return true;
+		}
+	}
+	return false;
+}
 
 void shrink_localbuffer() // remove old data in the local buffer
 {
@@ -64,11 +289,12 @@ void shrink_localbuffer() // remove old data in the local buffer
 
 		MAP_UUID_ChannelData::iterator it = localbuffer.begin();
 		for (; it != localbuffer.end(); ++it) {
-			LIST_ChannelData &l = it->second;
-			LIST_ChannelData::iterator lit = l.begin();
+			LocalChannelBuffer &lb = it->second;
 
-			while (lit != l.end() && ((lit->_t) < minT))
-				lit = l.erase(lit);
+			while (lb._tuples.size() > 0 && lb._tuples.front()._t < minT) {
+				lb.pop_front();
+				localbuffer_version++;
+			}
 		}
 
 		pthread_mutex_unlock(&localbuffer_mutex);
@@ -76,8 +302,10 @@ void shrink_localbuffer() // remove old data in the local buffer
 }
 
 void add_ch_to_localbuffer(Channel &ch) {
+	LIST_ChannelData added;
+
 	pthread_mutex_lock(&localbuffer_mutex);
-	LIST_ChannelData &l = localbuffer[ch.uuid()];
+	LocalChannelBuffer &lb = localbuffer[ch.uuid()];
 
 	// now add all not-deleted items to the localbuffer:
 	Buffer::Ptr buf = ch.buffer();
@@ -85,43 +313,420 @@ void add_ch_to_localbuffer(Channel &ch) {
 	for (it = buf->begin(); it != buf->end(); ++it) {
 		Reading &r = *it;
 		if (!r.deleted()) {
-			l.push_back(ChannelData(r.time_ms(), r.value()));
+			lb.push_back(ChannelData(r.time_ms(), r.value()));
+			added.push_back(lb._tuples.back());
 		}
 	}
 	if (options.buffer_length() < 0) { // max size based localbuffer. keep max -buffer_length items
-		while (l.size() > static_cast<unsigned int>(-(options.buffer_length())))
-			l.pop_front();
+		while (lb._tuples.size() > static_cast<unsigned int>(-(options.buffer_length())))
+			lb.pop_front();
 	}
+	if (added.size() > 0)
+		localbuffer_version++;
 
 	pthread_mutex_unlock(&localbuffer_mutex);
+
+	// wake up waiting comet requests and streams
+	if (added.size() > 0)
+		notify_waiters(ch.uuid(), added);
 }
 
-json_object *api_json_tuples(const char *uuid) {
+/**
+ * Calculate the entity tag of a response from the localbuffer version and
+ * the channel headers (which contain the time of the last reading)
+ */
+static std::string local_etag(const std::vector<std::string> &headers) {
+	pthread_mutex_lock(&localbuffer_mutex);
+	uint64_t hash = 14695981039346656037ULL ^ localbuffer_version; // FNV-1a
+	pthread_mutex_unlock(&localbuffer_mutex);
+
+	for (std::vector<std::string>::const_iterator it = headers.begin(); it != headers.end();
+		 ++it) {
+		for (std::string::const_iterator c = it->begin(); c != it->end(); ++c) {
+			hash ^= (unsigned char)*c;
+			hash *= 1099511628211ULL;
+		}
+	}
+
+	char etag[20];
+	snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)hash);
+	return etag;
+}
+
+/**
+ * Assemble the channel list from the channel headers and the cached tuple fragments
+ * into one buffer
+ *
+ * @param headers the JSON object for each channel without tuples and closing brace
+ * @param uuids the uuid of each channel
+ * @param size the size of the assembled response
+ * @return malloc'd buffer, to be freed by libmicrohttpd
+ */
+static char *assemble_json(const std::vector<std::string> &headers,
+						   const std::vector<std::string> &uuids, size_t *size) {
+	static const char prefix[] =
+		"{ \"version\": \"" VERSION "\", \"generator\": \"" PACKAGE "\", \"data\": [ ";
+	static const char suffix[] = " ] }";
+	static const char tuples[] = ", \"tuples\": [ ";
+	std::vector<const std::string *> fragments(uuids.size(), (const std::string *)NULL);
 
-	if (!uuid)
-		return NULL;
 	pthread_mutex_lock(&localbuffer_mutex);
-	LIST_ChannelData &l = localbuffer[uuid];
 
-	print(log_debug, "==> number of tuples: %d", uuid, l.size());
+	// first pass: calculate the size
+	size_t len = sizeof(prefix) - 1 + sizeof(suffix) - 1;
+	for (size_t i = 0; i < uuids.size(); i++) {
+		MAP_UUID_ChannelData::const_iterator it = localbuffer.find(uuids[i]);
+		if (it != localbuffer.end() && it->second._tuples.size() > 0) {
+			fragments[i] = &it->second._json;
+			print(log_debug, "==> number of tuples: %d", uuids[i].c_str(),
+				  it->second._tuples.size());
+			len += sizeof(tuples) - 1 + fragments[i]->size() - 2 + 2; // strip last ", " add " ]"
+		}
+		len += (i ? 2 : 0) + headers[i].size() + 2;
+	}
 
-	if (l.size() < 1) {
-		pthread_mutex_unlock(&localbuffer_mutex);
-		return NULL;
+	// second pass: concatenate
+	char *buf = static_cast<char *>(malloc(len));
+	char *pos = buf;
+	if (buf != NULL) {
+		memcpy(pos, prefix, sizeof(prefix) - 1);
+		pos += sizeof(prefix) - 1;
+		for (size_t i = 0; i < uuids.size(); i++) {
+			if (i) {
+				memcpy(pos, ", ", 2);
+				pos += 2;
+			}
+			memcpy(pos, headers[i].data(), headers[i].size());
+			pos += headers[i].size();
+			if (fragments[i]) {
+				memcpy(pos, tuples, sizeof(tuples) - 1);
+				pos += sizeof(tuples) - 1;
+				memcpy(pos, fragments[i]->data(), fragments[i]->size() - 2);
+				pos += fragments[i]->size() - 2;
+				memcpy(pos, " ]", 2);
+				pos += 2;
+			}
+			memcpy(pos, " }", 2);
+			pos += 2;
+		}
+		memcpy(pos, suffix, sizeof(suffix) - 1);
+		pos += sizeof(suffix) - 1;
 	}
 
-	json_object *json_tuples = json_object_new_array();
-	for (LIST_ChannelData::const_iterator cit = l.cbegin(); cit != l.cend(); ++cit) {
-		struct json_object *json_tuple = json_object_new_array();
+	pthread_mutex_unlock(&localbuffer_mutex);
 
-		json_object_array_add(json_tuple, json_object_new_int64(cit->_t));
-		json_object_array_add(json_tuple, json_object_new_double(cit->_v));
+	*size = pos - buf;
+	return buf;
+}
 
-		json_object_array_add(json_tuples, json_tuple);
+/**
+ * Queue the cached response for url, (re-)assemble it if the etag changed
+ */
+static MHD_RESULT queue_cached_response(struct MHD_Connection *connection, const char *url,
+										const std::string &etag,
+										const std::vector<std::string> &headers,
+										const std::vector<std::string> &uuids) {
+	pthread_mutex_lock(&localresponses_mutex);
+	LocalResponse &cached = localresponses[url];
+
+	if (cached._response == NULL || cached._etag != etag) {
+		size_t size;
+		char *buf = assemble_json(headers, uuids, &size);
+		if (buf == NULL) {
+			pthread_mutex_unlock(&localresponses_mutex);
+			throw vz::VZException("out of memory");
+		}
+
+		if (cached._response)
+			MHD_destroy_response(cached._response); // queued connections keep their reference
+		cached._response = MHD_create_response_from_buffer(size, buf, MHD_RESPMEM_MUST_FREE);
+		cached._etag = etag;
+
+		MHD_add_response_header(cached._response, "Content-type", "application/json");
+		MHD_add_response_header(cached._response, MHD_HTTP_HEADER_ETAG, etag.c_str());
+		MHD_add_response_header(cached._response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-cache");
+	}
+
+	// queue while locked, the cached response might be replaced right after unlocking
+	MHD_RESULT status = MHD_queue_response(connection, MHD_HTTP_OK, cached._response);
+	pthread_mutex_unlock(&localresponses_mutex);
+
+	return status;
+}
+
+/**
+ * Append a Prometheus label value, escaped as required by the text format
+ */
+static void metrics_label(std::string &out, const char *key, const char *value, bool first) {
+	if (!first)
+		out += ',';
+	out += key;
+	out += "=\"";
+	for (const char *p = value; *p; p++) {
+		switch (*p) {
+		case '\\':
+			out += "\\\\";
+			break;
+		case '"':
+			out += "\\\"";
+			break;
+		case '\n':
+			out += "\\n";
+			break;
+		default:
+			out += *p;
+		}
+	}
+	out += '"';
+}
+
+static void metrics_family(std::string &out, const char *name, const char *type,
+						   const char *help) {
+	out += "# HELP ";
+	out += name;
+	out += ' ';
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += ' ';
+	out += type;
+	out += '\n';
+}
+
+static void metrics_sample(std::string &out, const char *name, const char *suffix,
+						   const std::string &labels, const char *value) {
+	out += name;
+	out += suffix;
+	out += '{';
+	out += labels;
+	out += "} ";
+	out += value;
+	out += '\n';
+}
+
+/**
+ * Render all counters in the Prometheus text exposition format (version 0.0.4)
+ *
+ * Only the atomic counters of meters and channels are read, neither the
+ * local buffer nor the channel buffers are locked.
+ */
+static std::string render_metrics(MapContainer *mappings) {
+	std::vector<std::string> meter_labels;
+	std::vector<std::string> channel_labels;
+	std::vector<Meter *> meters;
+	std::vector<Channel *> channels;
+	std::string out;
+	char value[64];
+
+	for (MapContainer::iterator mapping = mappings->begin(); mapping != mappings->end();
+		 mapping++) {
+		Meter::Ptr mtr = mapping->meter();
+		std::string labels;
+		metrics_label(labels, "meter", mtr->name(), true);
+		metrics_label(labels, "protocol", meter_get_details(mtr->protocolId())->name, false);
+		meters.push_back(mtr.get());
+		meter_labels.push_back(labels);
+
+		for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
+			std::string ch_labels;
+			metrics_label(ch_labels, "uuid", (*ch)->uuid(), true);
+			metrics_label(ch_labels, "name", (*ch)->name(), false);
+			channels.push_back(ch->get());
+			channel_labels.push_back(ch_labels + "," + labels);
+		}
+	}
+
+	metrics_family(out, "vzlogger_meter_readings_total", "counter",
+				   "Readings returned by the meter.");
+	for (size_t i = 0; i < meters.size(); i++) {
+		snprintf(value, sizeof(value), "%llu",
+				 (unsigned long long)meters[i]->stats().readings.load());
+		metrics_sample(out, "vzlogger_meter_readings_total", "", meter_labels[i], value);
+	}
+
+	metrics_family(out, "vzlogger_meter_dispatch_misses_total", "counter",
+				   "Readings not matching any channel of the meter.");
+	for (size_t i = 0; i < meters.size(); i++) {
+		snprintf(value, sizeof(value), "%llu",
+				 (unsigned long long)meters[i]->stats().dispatch_misses.load());
+		metrics_sample(out, "vzlogger_meter_dispatch_misses_total", "", meter_labels[i], value);
+	}
+
+	// framing counters of stream protocols (e.g. SML)
+	const struct {
+		const char *name;
+		const char *help;
+		vz::metrics::Counter vz::metrics::FrameStats::*counter;
+	} frame_counters[] = {
+		{"vzlogger_meter_frames_total", "Complete frames received by the meter.",
+		 &vz::metrics::FrameStats::frames},
+		{"vzlogger_meter_frames_corrupt_total",
+		 "Frames dropped because they were cut off, too long or had an invalid escape sequence.",
+		 &vz::metrics::FrameStats::corrupt},
+		{"vzlogger_meter_frame_resyncs_total",
+		 "Start of a frame found again after an error in the stream.",
+		 &vz::metrics::FrameStats::resyncs},
+		{"vzlogger_meter_frame_crc_errors_total", "Frames dropped because of a wrong checksum.",
+		 &vz::metrics::FrameStats::crc_errors},
+	};
+	for (size_t c = 0; c < sizeof(frame_counters) / sizeof(frame_counters[0]); c++) {
+		bool family = false;
+		for (size_t i = 0; i < meters.size(); i++) {
+			const vz::metrics::FrameStats *fs = meters[i]->protocol()->frameStats();
+			if (!fs)
+				continue;
+			if (!family) {
+				metrics_family(out, frame_counters[c].name, "counter", frame_counters[c].help);
+				family = true;
+			}
+			snprintf(value, sizeof(value), "%llu",
+					 (unsigned long long)(fs->*frame_counters[c].counter).load());
+			metrics_sample(out, frame_counters[c].name, "", meter_labels[i], value);
+		}
+	}
+
+	metrics_family(out, "vzlogger_channel_last_value", "gauge", "Last value read for the channel.");
+	for (size_t i = 0; i < channels.size(); i++) {
+		if (channels[i]->stats().last_time_ms.load() == 0)
+			continue; // nothing read yet
+		snprintf(value, sizeof(value), "%.17g", channels[i]->stats().last_value.load());
+		metrics_sample(out, "vzlogger_channel_last_value", "", channel_labels[i], value);
+	}
+
+	metrics_family(out, "vzlogger_channel_last_timestamp_seconds", "gauge",
+				   "Time of the last value read for the channel.");
+	for (size_t i = 0; i < channels.size(); i++) {
+		int64_t t = channels[i]->stats().last_time_ms.load();
+		if (t == 0)
+			continue;
+		snprintf(value, sizeof(value), "%lld.%03lld", (long long)(t / 1000),
+				 (long long)(t % 1000));
+		metrics_sample(out, "vzlogger_channel_last_timestamp_seconds", "", channel_labels[i],
+					   value);
+	}
+
+	metrics_family(out, "vzlogger_channel_buffer_depth", "gauge",
+				   "Readings buffered for the channel, not sent yet.");
+	for (size_t i = 0; i < channels.size(); i++) {
+		snprintf(value, sizeof(value), "%zu", channels[i]->stats().buffer_depth.load());
+		metrics_sample(out, "vzlogger_channel_buffer_depth", "", channel_labels[i], value);
+	}
+
+	metrics_family(out, "vzlogger_channel_upload_latency_seconds", "histogram",
+				   "Duration of the requests to the middleware.");
+	for (size_t i = 0; i < channels.size(); i++) {
+		const vz::metrics::Histogram &h = channels[i]->stats().upload_latency;
+		uint64_t cumulative = 0;
+		for (size_t b = 0; b <= vz::metrics::Histogram::nbounds; b++) {
+			std::string labels = channel_labels[i];
+			if (b < vz::metrics::Histogram::nbounds) {
+				snprintf(value, sizeof(value), "%g", vz::metrics::Histogram::bound(b));
+				metrics_label(labels, "le", value, false);
+			} else {
+				metrics_label(labels, "le", "+Inf", false);
+			}
+			cumulative += h.bucket(b);
+			snprintf(value, sizeof(value), "%llu", (unsigned long long)cumulative);
+			metrics_sample(out, "vzlogger_channel_upload_latency_seconds", "_bucket", labels,
+						   value);
+		}
+		snprintf(value, sizeof(value), "%.6f", h.sum());
+		metrics_sample(out, "vzlogger_channel_upload_latency_seconds", "_sum", channel_labels[i],
+					   value);
+		// the buckets are read one after the other, so count their sum instead of h.count()
+		snprintf(value, sizeof(value), "%llu", (unsigned long long)cumulative);
+		metrics_sample(out, "vzlogger_channel_upload_latency_seconds", "_count",
+					   channel_labels[i], value);
+	}
+
+	metrics_family(out, "vzlogger_channel_http_errors_total", "counter",
+				   "Requests answered by the middleware with an error status.");
+	for (size_t i = 0; i < channels.size(); i++) {
+		snprintf(value, sizeof(value), "%llu",
+				 (unsigned long long)channels[i]->stats().http_errors.load());
+		metrics_sample(out, "vzlogger_channel_http_errors_total", "", channel_labels[i], value);
+	}
+
+	metrics_family(out, "vzlogger_channel_curl_errors_total", "counter",
+				   "Requests to the middleware failed on the transport level.");
+	for (size_t i = 0; i < channels.size(); i++) {
+		snprintf(value, sizeof(value), "%llu",
+				 (unsigned long long)channels[i]->stats().curl_errors.load());
+		metrics_sample(out, "vzlogger_channel_curl_errors_total", "", channel_labels[i], value);
+	}
+
+	metrics_family(out, "vzlogger_channel_curl_retries_total", "counter",
+				   "Requests to the middleware retried after a failure.");
+	for (size_t i = 0; i < channels.size(); i++) {
+		snprintf(value, sizeof(value), "%llu",
+				 (unsigned long long)channels[i]->stats().curl_retries.load());
+		metrics_sample(out, "vzlogger_channel_curl_retries_total", "", channel_labels[i], value);
 	}
-	pthread_mutex_unlock(&localbuffer_mutex);
 
-	return json_tuples;
+#ifdef ENABLE_MQTT
+	const struct {
+		const char *name;
+		const char *help;
+		vz::metrics::Counter &counter;
+	} mqtt_counters[] = {
+		{"vzlogger_mqtt_publish_failures_total",
+		 "MQTT messages the broker client failed to publish.",
+		 vz::metrics::mqtt_publish_failures()},
+		{"vzlogger_mqtt_queue_dropped_total",
+		 "MQTT messages dropped because the offline queue was full.",
+		 vz::metrics::mqtt_queue_dropped()},
+		{"vzlogger_mqtt_queue_spilled_total",
+		 "MQTT messages written to the offline queue file.", vz::metrics::mqtt_queue_spilled()},
+		{"vzlogger_mqtt_queue_replayed_total",
+		 "MQTT messages from the offline queue published after a reconnect.",
+		 vz::metrics::mqtt_queue_replayed()},
+	};
+	for (size_t i = 0; i < sizeof(mqtt_counters) / sizeof(mqtt_counters[0]); i++) {
+		metrics_family(out, mqtt_counters[i].name, "counter", mqtt_counters[i].help);
+		snprintf(value, sizeof(value), "%llu",
+				 (unsigned long long)mqtt_counters[i].counter.load());
+		out += mqtt_counters[i].name;
+		out += ' ';
+		out += value;
+		out += '\n';
+	}
+#endif
+
+	return out;
+}
+
+struct MHD_Daemon *local_start_daemon(MapContainer *mappings) {
+	unsigned int flags = MHD_USE_INTERNAL_POLLING_THREAD | MHD_ALLOW_SUSPEND_RESUME;
+	unsigned int threads = options.httpd_threads();
+	unsigned int connections = options.httpd_connections();
+	unsigned int timeout = options.httpd_conn_timeout();
+	unsigned int keep_alive = options.comet_timeout() > 0 ? options.comet_timeout() : 0;
+	if (timeout > 0 && timeout < 2 * keep_alive) {
+		// idle event streams only send a keep-alive every comet timeout
+		print(log_warning, "connection_timeout raised to %u, twice the keep-alive interval",
+			  "http", 2 * keep_alive);
+		timeout = 2 * keep_alive;
+	}
+
+	print(log_debug, "HTTPd threads=%u max_connections=%u connection_timeout=%u", "http",
+		  threads, connections, timeout);
+
+	struct MHD_Daemon *handle = MHD_start_daemon(
+		flags | MHD_USE_EPOLL, options.port(), NULL, NULL, &handle_request, (void *)mappings,
+		MHD_OPTION_THREAD_POOL_SIZE, threads, MHD_OPTION_CONNECTION_LIMIT, connections,
+		MHD_OPTION_CONNECTION_TIMEOUT, timeout, MHD_OPTION_NOTIFY_COMPLETED,
+		&local_request_completed, NULL, MHD_OPTION_END);
+
+	if (handle == NULL) { // libmicrohttpd might be built without epoll support
+		print(log_warning, "Starting HTTPd with epoll failed, falling back to poll", "http");
+		handle = MHD_start_daemon(flags | MHD_USE_POLL, options.port(), NULL, NULL,
+								  &handle_request, (void *)mappings, MHD_OPTION_THREAD_POOL_SIZE,
+								  threads, MHD_OPTION_CONNECTION_LIMIT, connections,
+								  MHD_OPTION_CONNECTION_TIMEOUT, timeout,
+								  MHD_OPTION_NOTIFY_COMPLETED, &local_request_completed, NULL,
+								  MHD_OPTION_END);
+	}
+	return handle;
 }
 
 MHD_RESULT handle_request(void *cls, struct MHD_Connection *connection, const char *url,
@@ -138,31 +743,71 @@ MHD_RESULT handle_request(void *cls, struct MHD_Connection *connection, const ch
 	const char *mode = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "mode");
 
 	try {
-		print(log_info, "Local request received: method=%s url=%s mode=%s", "http", method, url,
-			  mode);
+		if (*con_cls == NULL) // resumed requests have been logged already
+			print(log_info, "Local request received: method=%s url=%s mode=%s", "http", method,
+				  url, mode);
 
-		if (strcmp(method, "GET") == 0) {
+		if (strcmp(method, "GET") == 0 && strcmp(url, "/metrics") == 0) {
+			std::string metrics = render_metrics(mappings);
 
-			struct json_object *json_obj = json_object_new_object();
-			struct json_object *json_data = json_object_new_array();
-			struct json_object *json_exception = NULL;
+			response = MHD_create_response_from_buffer(
+				metrics.size(), static_cast<void *>(const_cast<char *>(metrics.data())),
+				MHD_RESPMEM_MUST_COPY);
+			response_code = MHD_HTTP_OK;
+
+			MHD_add_response_header(response, "Content-type", "text/plain; version=0.0.4");
+		} else if (strcmp(method, "GET") == 0 && strcmp(url, "/stream") == 0) {
+			// server-sent events: push new tuples as they are added to the local buffer
+			const char *uuid =
+				MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "uuid");
+
+			if (uuid ? channel_exists(mappings, uuid) : options.channel_index()) {
+				LocalWaiter *w = new LocalWaiter(connection, LocalWaiter::STREAM, uuid);
+				if (suspend_request(connection, con_cls, w)) {
+					response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 1024,
+																 &stream_reader, w, NULL);
+					response_code = MHD_HTTP_OK;
+
+					MHD_add_response_header(response, "Content-type", "text/event-stream");
+					MHD_add_response_header(response, "Cache-Control", "no-cache");
+				}
+			}
+			if (response == NULL) {
+				const char *response_str = "channel not found\n";
+
+				response = MHD_create_response_from_buffer(
+					strlen(response_str), static_cast<void *>(const_cast<char *>(response_str)),
+					MHD_RESPMEM_PERSISTENT);
+
+				MHD_add_response_header(response, "Content-type", "text/text");
+			}
+		} else if (strcmp(method, "GET") == 0) {
+
+			bool index_disabled = false;
 
 			const char *uuid = url + 1; // strip leading slash
-			const char *json_str;
 			bool show_all = false;
 
 			if (strcmp(url, "/") == 0) {
 				if (options.channel_index()) {
 					show_all = true;
 				} else {
-					json_exception = json_object_new_object();
-
-					json_object_object_add(json_exception, "message",
-										   json_object_new_string("channel index is disabled"));
-					json_object_object_add(json_exception, "code", json_object_new_int(0));
+					index_disabled = true;
 				}
 			}
 
+			// blocking until new data arrives (comet-like blocking of HTTP response)
+			if (mode && strcmp(mode, "comet") == 0 && *con_cls == NULL &&
+				options.comet_timeout() > 0 && (show_all || channel_exists(mappings, uuid))) {
+				LocalWaiter *w =
+					new LocalWaiter(connection, LocalWaiter::COMET, show_all ? NULL : uuid);
+				if (suspend_request(connection, con_cls, w))
+					return MHD_YES; // called again after resume
+			}
+
+			std::vector<std::string> headers;
+			std::vector<std::string> uuids;
+
 			shrink_localbuffer(); // in case the channel return very few/seldom data
 
 			for (MapContainer::iterator mapping = mappings->begin(); mapping != mappings->end();
@@ -171,55 +816,55 @@ MHD_RESULT handle_request(void *cls, struct MHD_Connection *connection, const ch
 					if (strcmp((*ch)->uuid(), uuid) == 0 || show_all) {
 						response_code = MHD_HTTP_OK;
 
-						// blocking until new data arrives (comet-like blocking of HTTP response)
-						if (mode && strcmp(mode, "comet") == 0) {
-							// TODO wait only options.comet_timeout()!
-							// gettimeofday(&tp, NULL);
-							// ts.tv_sec = tp.tv_sec + options.comet_timeout();
-							// ts.tv_nsec = tp.tv_usec * 1000;
-
-							// (*ch)->wait(); // TODO not usefull with
-							// 			   // show_all! Wait only if this channel empty?
-						}
-
 						struct json_object *json_ch = json_object_new_object();
-
 						json_object_object_add(json_ch, "uuid",
 											   json_object_new_string((*ch)->uuid()));
-						json_object_object_add(
-							json_ch, "last",
-							json_object_new_int64((*ch)->time_ms())); // return here in ms as well
+						json_object_object_add( // return here in ms as well
+							json_ch, "last", json_object_new_int64((*ch)->time_ms()));
 						json_object_object_add(json_ch, "interval",
 											   json_object_new_int(mapping->meter()->interval()));
 						json_object_object_add(
 							json_ch, "protocol",
 							json_object_new_string(
 								meter_get_details(mapping->meter()->protocolId())->name));
-
-						struct json_object *json_tuples = api_json_tuples((*ch)->uuid());
-						if (json_tuples)
-							json_object_object_add(json_ch, "tuples", json_tuples);
-
-						json_object_array_add(json_data, json_ch);
+						std::string header =
+							json_object_to_json_string_ext(json_ch, JSON_C_TO_STRING_SPACED);
+						json_object_put(json_ch);
+						header.erase(header.find_last_not_of(" }") + 1); // tuples follow
+						headers.push_back(header);
+						uuids.push_back((*ch)->uuid());
 					}
 				}
 			}
 
-			json_object_object_add(json_obj, "version", json_object_new_string(VERSION));
-			json_object_object_add(json_obj, "generator", json_object_new_string(PACKAGE));
-			json_object_object_add(json_obj, "data", json_data);
-
-			if (json_exception) {
-				json_object_object_add(json_obj, "exception", json_exception);
-			}
+			if (response_code == MHD_HTTP_OK) {
+				std::string etag = local_etag(headers);
+				const char *if_none_match = MHD_lookup_connection_value(
+					connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_NONE_MATCH);
 
-			json_str = json_object_to_json_string(json_obj);
-			response = MHD_create_response_from_buffer(
-				strlen(json_str), static_cast<void *>(const_cast<char *>(json_str)),
-				MHD_RESPMEM_MUST_COPY);
-			json_object_put(json_obj);
+				if (if_none_match && etag == if_none_match) { // client is up to date
+					response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+					response_code = MHD_HTTP_NOT_MODIFIED;
 
-			MHD_add_response_header(response, "Content-type", "application/json");
+					MHD_add_response_header(response, MHD_HTTP_HEADER_ETAG, etag.c_str());
+				} else {
+					return queue_cached_response(connection, url, etag, headers, uuids);
+				}
+			} else {
+				const char *json_str =
+					index_disabled
+						? "{ \"version\": \"" VERSION "\", \"generator\": \"" PACKAGE
+						  "\", \"data\": [ ], \"exception\": { \"message\": \"channel index "
+						  "is disabled\", \"code\": 0 } }"
+						: "{ \"version\": \"" VERSION "\", \"generator\": \"" PACKAGE
+						  "\", \"data\": [ ] }";
+
+				response = MHD_create_response_from_buffer(
+					strlen(json_str), static_cast<void *>(const_cast<char *>(json_str)),
+					MHD_RESPMEM_PERSISTENT);
+
+				MHD_add_response_header(response, "Content-type", "application/json");
+			}
 		} else {
 			char *response_str = strdup("not implemented\n");
 
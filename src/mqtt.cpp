@@ -6,6 +6,7 @@
 #include "mqtt.hpp"
 #include "common.h"
 #include "mosquitto.h"
+#include <algorithm>
 #include <cassert>
 #include <sstream>
 #include <unistd.h>
@@ -15,10 +16,13 @@ MqttClient *mqttClient = 0;
 volatile bool endMqttClientThread = false;
 
 // class impl.
-MqttClient::MqttClient(struct json_object *option) : _enabled(false) {
+MqttClient::MqttClient(struct json_object *option) : _enabled(false), _queued(false) {
 
 	print(log_finest, "constructor called", "mqtt");
-		
+	bool format = false;
+	for (int i = 0; i < indexChunks; i++)
+		_index[i] = nullptr;
+
 	if (option) {
 		assert(json_object_get_type(option) == json_type_object);
 		json_object_object_foreach(option, key, local_value) {
@@ -66,6 +70,11 @@ MqttClient::MqttClient(struct json_object *option) : _enabled(false) {
 				}
 			} else if (strcmp(key, "timestamp") == 0 && local_type == json_type_boolean) {
 				_timestamp = json_object_get_boolean(local_value);
+			} else if (strcmp(key, "format") == 0 && local_type == json_type_string) {
+				format = MqttPayload::parseFormat(json_object_get_string(local_value), _format);
+				if (!format)
+					print(log_alert, "Ignoring invalid format %s, assuming default", "mqtt",
+						  json_object_get_string(local_value));
 			} else if (strcmp(key, "id") == 0 && local_type == json_type_string) {
 				_id = json_object_get_string(local_value);
 			} else if (strcmp(key, "generateTopicWithUuid") == 0 && local_type == json_type_boolean) {
@@ -76,6 +85,14 @@ MqttClient::MqttClient(struct json_object *option) : _enabled(false) {
 				_sessionExpiry_s = json_object_get_int(local_value);
 			} else if (strcmp(key, "messageExpiry_s") == 0 && local_type == json_type_int) {
 				_messageExpiry_s = json_object_get_int(local_value);
+			} else if (strcmp(key, "queueSize") == 0 && local_type == json_type_int) {
+				_queueSize = std::max(0, json_object_get_int(local_value));
+			} else if (strcmp(key, "queueFile") == 0 && local_type == json_type_string) {
+				_queueFile = json_object_get_string(local_value);
+			} else if (strcmp(key, "queueFileSize") == 0 && local_type == json_type_int) {
+				_queueFileSize = json_object_get_int64(local_value);
+			} else if (strcmp(key, "replayRate") == 0 && local_type == json_type_int) {
+				_replayRate = std::max(0, json_object_get_int(local_value));
 			} else {
 				print(log_alert, "Ignoring invalid field or type: %s=%s", NULL, key,
 					  json_object_get_string(local_value));
@@ -85,12 +102,28 @@ MqttClient::MqttClient(struct json_object *option) : _enabled(false) {
 		throw vz::VZException("config: mqtt no options!");
 	}
 
+	if (!format)
+		_format = _timestamp ? MqttPayload::JSON : MqttPayload::TEXT;
+
 	// default topic to vzlogger
 	if (!_topic.length())
 		_topic = std::string("vzlogger/");
 	else
 		_topic += '/';
 
+	// messages not sent by the last run are replayed as well
+	if (_queueSize > 0 && _queueFile.length()) {
+		_spill = fopen(_queueFile.c_str(), "a+b");
+		if (!_spill) {
+			print(log_alert, "Can't open queue file %s: %s", "mqtt", _queueFile.c_str(),
+				  strerror(errno));
+		} else if (fseek(_spill, 0, SEEK_END) == 0 && (_spillWrite = ftell(_spill)) > 0) {
+			print(log_info, "Replaying %ld bytes from queue file %s", "mqtt", _spillWrite,
+				  _queueFile.c_str());
+			_queued = true;
+		}
+	}
+
 	// mosquitto lib init:
 	if (mosquitto_lib_init() != MOSQ_ERR_SUCCESS) {
 		print(log_alert, "libmosquitto init failed! Stopped.", "mqtt");
@@ -262,6 +295,13 @@ MqttClient::~MqttClient() {
 		mosquitto_property_free_all(&_propsConnect);
 	if(_propsPublish)
 		mosquitto_property_free_all(&_propsPublish);
+
+	for (int i = 0; i < indexChunks; i++)
+		delete[] _index[i].load();
+
+	if (_spill) {
+		closeSpill();
+	}
 		
 	mosquitto_lib_cleanup(); // this assumes nobody else is using libmosquitto!
 }
@@ -276,6 +316,12 @@ void MqttClient::ChannelEntry::generateNames(const std::string &prefix, Channel
 		_fullTopicRaw += uuid;
 	 else
 		_fullTopicRaw += ch.name(); // todo this converts from std::string to const char and back...
+	_influxPrefix = "vzlogger,channel=";
+	MqttPayload::appendInfluxKey(_influxPrefix, _fullTopicRaw.substr(prefix.length()));
+	if (uuid.length()) {
+		_influxPrefix += ",uuid=";
+		MqttPayload::appendInfluxKey(_influxPrefix, uuid);
+	}
 	_fullTopicRaw += '/';
 	if (ch.identifier() && !(*ch.identifier() == NilIdentifier::Instance)) {
 		char unparseBuf[200];
@@ -299,72 +345,323 @@ void MqttClient::ChannelEntry::generateNames(const std::string &prefix, Channel
 		_announceValues.emplace_back("description", ch.mqttDescription());
 }
 
-void MqttClient::publish(Channel::Ptr ch, Reading &rds, bool aggregate) {
-	// take care: this function must be thread safe and non-blocking!
-	// for now we do only call this from read_thread and our mqtt_client thread doesn't harm here
-	// mosquitto_publish doesn't seem to be blocking. needs further investigation!
-
-	if (!ch || !ch->mqtt())
-		return;
-	if (!_mcs)
-		return;
+MqttClient::ChannelEntry &MqttClient::channelEntry(Channel &ch) {
+	// fast path: known channel, announcement done
+	int id = ch.id();
+	if (id >= 0 && id < indexChunkSize * indexChunks) {
+		IndexChunk *chunk = _index[id / indexChunkSize].load(std::memory_order_acquire);
+		ChannelEntry *entry =
+			chunk ? (*chunk)[id % indexChunkSize].load(std::memory_order_acquire) : nullptr;
+		if (entry && entry->_announced.load(std::memory_order_acquire))
+			return *entry;
+	}
 
 	// search for cached values:
 	std::unique_lock<std::mutex> lock(_chMapMutex);
-	auto it = _chMap.find(ch->name());
+	auto it = _chMap.find(ch.name());
 	if (it == _chMap.end()) {
-		ChannelEntry entry;
-		entry.generateNames(_topic, (*ch), _generateTopicWithUuid);
+		it = _chMap.emplace(std::piecewise_construct, std::forward_as_tuple(ch.name()),
+							std::forward_as_tuple())
+				 .first;
+		ChannelEntry &entry = (*it).second;
+		entry.generateNames(_topic, ch, _generateTopicWithUuid);
 		if (entry._sendAgg && !_rawAndAgg)
 			entry._sendRaw = false;
-
-		it = _chMap.emplace(std::make_pair(ch->name(), entry)).first;
+		entry._format = _format;
+		if (ch.mqttFormat().length() &&
+			!MqttPayload::parseFormat(ch.mqttFormat(), entry._format))
+			print(log_alert, "Ignoring invalid mqtt_format %s, using %s", ch.name(),
+				  ch.mqttFormat().c_str(), MqttPayload::formatName(_format));
+		index(id, &entry);
 	}
 
 	assert(it != _chMap.end());
 	ChannelEntry &entry = (*it).second;
 	// do we need to announce the uuid?
-	if (!entry._announced && entry._announceValues.size()) {
+	if (!entry._announced) {
+		bool announced = entry._announceValues.empty();
 		for (auto &v : entry._announceValues) {
 			std::string name = entry._announceName + v.first;
-			int res = _propsPublish == NULL? mosquitto_publish(_mcs, 0, name.c_str(), v.second.length(), v.second.c_str(), _qos, _retain || _retainAnnounce) :
-				mosquitto_publish_v5(_mcs, 0, name.c_str(), v.second.length(), v.second.c_str(), _qos, _retain || _retainAnnounce, _propsPublish);
-									
-			if (res != MOSQ_ERR_SUCCESS) {
-				print(log_finest, "mosquitto_publish announce \"%s\" failed: %s", "mqtt",
-					  name.c_str(), mosquitto_strerror(res));
-			} else {
-				entry._announced = true; // if one can be announced we treat it successfull
+			// not queued, the announcement is repeated with the next value
+			if (send(name, v.second, _retain || _retainAnnounce, 0, false))
+				announced = true; // if one can be announced we treat it successfull
+		}
+		entry._announced.store(announced, std::memory_order_release);
+	}
+	// entries are never removed and references into an unordered_map survive rehashing
+	return entry;
+}
+
+void MqttClient::index(int id, ChannelEntry *entry) {
+	if (id < 0 || id >= indexChunkSize * indexChunks)
+		return; // found by name
+	IndexChunk *chunk = _index[id / indexChunkSize].load(std::memory_order_relaxed);
+	if (!chunk) {
+		chunk = new IndexChunk[1];
+		for (int i = 0; i < indexChunkSize; i++)
+			(*chunk)[i] = nullptr;
+		_index[id / indexChunkSize].store(chunk, std::memory_order_release);
+	}
+	(*chunk)[id % indexChunkSize].store(entry, std::memory_order_release);
+}
+
+void MqttClient::publishValue(const ChannelEntry &entry, const std::string &topic,
+							  const Reading &rds) {
+	const std::string &payload =
+		MqttPayload::encode(entry._format, rds.time_ms(), rds.value(), entry._influxPrefix);
+
+	print(log_finest, "publish %s=%f (%s)", "mqtt", topic.c_str(), rds.value(),
+		  MqttPayload::formatName(entry._format));
+
+	send(topic, payload, _retain, rds.time_ms());
+}
+
+bool MqttClient::send(const std::string &topic, const std::string &payload, bool retain,
+					  int64_t time_ms, bool queue) {
+	queue = queue && _queueSize > 0;
+	if (queue && !_isConnected) {
+		std::unique_lock<std::mutex> lock(_queueMutex);
+		enqueue(QueuedMessage{time_ms, retain, topic, payload});
+		return true;
+	}
+
+	// live values don't wait for the replay of the queue, only the replay is rate limited
+	int res = publishMessage(topic, payload, retain);
+	if (res == MOSQ_ERR_SUCCESS) {
+		if (_queued)
+			_replayBehindLive = true;
+		return true;
+	}
+	if (queue && (res == MOSQ_ERR_NO_CONN || res == MOSQ_ERR_CONN_LOST)) {
+		std::unique_lock<std::mutex> lock(_queueMutex);
+		enqueue(QueuedMessage{time_ms, retain, topic, payload});
+		return true;
+	}
+	vz::metrics::mqtt_publish_failures()++;
+	print(log_finest, "mosquitto_publish \"%s\" failed: %s", "mqtt", topic.c_str(),
+		  mosquitto_strerror(res));
+	return false;
+}
+
+int MqttClient::publishMessage(const std::string &topic, const std::string &payload,
+							   bool retain) {
+	return _propsPublish == NULL
+			   ? mosquitto_publish(_mcs, 0, topic.c_str(), payload.length(), payload.c_str(),
+								   _qos, retain)
+			   : mosquitto_publish_v5(_mcs, 0, topic.c_str(), payload.length(), payload.c_str(),
+									  _qos, retain, _propsPublish);
+}
+
+void MqttClient::enqueue(QueuedMessage &&msg) {
+	if (!_queued)
+		print(log_info, "Broker not reachable, queueing messages", "mqtt");
+	_queued = true;
+
+	if (_spillWrite > _spillRead || _queue.size() >= (size_t)_queueSize) {
+		if (_spill) {
+			if (!spill(msg)) {
+				vz::metrics::mqtt_queue_dropped()++;
+				print(log_finest, "Queue file full, dropping message for %s", "mqtt",
+					  msg._topic.c_str());
 			}
+			return;
 		}
+		// no spill file: the oldest message is dropped
+		_queue.pop_front();
+		vz::metrics::mqtt_queue_dropped()++;
 	}
+	if (!_queue.empty() && msg._time < _queue.back()._time)
+		_queueSorted = false;
+	_queue.push_back(std::move(msg));
+}
 
-	std::string &topic = aggregate ? entry._fullTopicAgg : entry._fullTopicRaw;
-	if ((entry._sendAgg and aggregate) or (entry._sendRaw && !aggregate)) {
-		lock.unlock(); // we can unlock here already
-		std::string payload;
-		struct json_object *payload_obj = NULL;
-
-		if (_timestamp) {
-			payload_obj = json_object_new_object();
-			json_object_object_add(payload_obj, "timestamp", json_object_new_int64(rds.time_ms()));
-			json_object_object_add(payload_obj, "value", json_object_new_double(rds.value()));
-			payload = json_object_to_json_string(payload_obj);
-		} else {
-			payload = std::to_string(rds.value());
+/*
+ * spill file record: int64 time, uint32 topic length, uint32 payload length, uint8 retain,
+ * topic, payload (host byte order, the file is only read by the same host)
+ */
+bool MqttClient::spill(const QueuedMessage &msg) {
+	uint32_t topicLen = msg._topic.length();
+	uint32_t payloadLen = msg._payload.length();
+	uint8_t retain = msg._retain;
+	long size = sizeof(msg._time) + sizeof(topicLen) + sizeof(payloadLen) + sizeof(retain) +
+				topicLen + payloadLen;
+	if (_spillWrite + size > _queueFileSize)
+		return false;
+
+	// "a" mode: writes always go to the end
+	if (fwrite(&msg._time, sizeof(msg._time), 1, _spill) != 1 ||
+		fwrite(&topicLen, sizeof(topicLen), 1, _spill) != 1 ||
+		fwrite(&payloadLen, sizeof(payloadLen), 1, _spill) != 1 ||
+		fwrite(&retain, sizeof(retain), 1, _spill) != 1 ||
+		fwrite(msg._topic.data(), 1, topicLen, _spill) != topicLen ||
+		fwrite(msg._payload.data(), 1, payloadLen, _spill) != payloadLen || fflush(_spill) != 0) {
+		print(log_error, "Writing queue file %s failed: %s", "mqtt", _queueFile.c_str(),
+			  strerror(errno));
+		return false;
+	}
+	_spillWrite += size;
+	vz::metrics::mqtt_queue_spilled()++;
+	return true;
+}
+
+void MqttClient::closeSpill() {
+	// keep the messages for the next start: the ones in memory (read from the file before
+	// or older than it) and the unread rest of the file, in this order
+	std::string unread;
+	if (_spillWrite > _spillRead && fseek(_spill, _spillRead, SEEK_SET) == 0) {
+		unread.resize(_spillWrite - _spillRead);
+		if (fread(&unread[0], 1, unread.size(), _spill) != unread.size()) {
+			print(log_error, "Reading queue file %s failed: %s", "mqtt", _queueFile.c_str(),
+				  strerror(errno));
+			unread.clear();
+		}
+	}
+	if (ftruncate(fileno(_spill), 0) != 0 || fseek(_spill, 0, SEEK_SET) != 0)
+		print(log_warning, "Truncating queue file %s failed: %s", "mqtt", _queueFile.c_str(),
+			  strerror(errno));
+	_spillRead = 0;
+	_spillWrite = unread.size(); // reserved for the unread messages, written last
+
+	size_t dropped = 0;
+	for (auto &msg : _queue)
+		if (!spill(msg))
+			dropped++;
+	if (dropped)
+		print(log_warning, "Queue file %s full, dropped %zu messages", "mqtt", _queueFile.c_str(),
+			  dropped);
+	if (unread.size() &&
+		(fwrite(unread.data(), 1, unread.size(), _spill) != unread.size() || fflush(_spill) != 0))
+		print(log_error, "Writing queue file %s failed: %s", "mqtt", _queueFile.c_str(),
+			  strerror(errno));
+	fclose(_spill);
+	_spill = nullptr;
+}
+
+bool MqttClient::unspill() {
+	if (_spillWrite <= _spillRead)
+		return false;
+
+	if (fseek(_spill, _spillRead, SEEK_SET) == 0) {
+		while (_spillRead < _spillWrite && _queue.size() < (size_t)_queueSize) {
+			QueuedMessage msg;
+			uint32_t topicLen, payloadLen;
+			uint8_t retain;
+			if (fread(&msg._time, sizeof(msg._time), 1, _spill) != 1 ||
+				fread(&topicLen, sizeof(topicLen), 1, _spill) != 1 ||
+				fread(&payloadLen, sizeof(payloadLen), 1, _spill) != 1 ||
+				fread(&retain, sizeof(retain), 1, _spill) != 1 ||
+				topicLen + payloadLen > (uint64_t)(_spillWrite - _spillRead))
+				break;
+			msg._retain = retain;
+			msg._topic.resize(topicLen);
+			msg._payload.resize(payloadLen);
+			if ((topicLen && fread(&msg._topic[0], 1, topicLen, _spill) != topicLen) ||
+				(payloadLen && fread(&msg._payload[0], 1, payloadLen, _spill) != payloadLen))
+				break;
+			_spillRead = ftell(_spill);
+			if (!_queue.empty() && msg._time < _queue.back()._time)
+				_queueSorted = false;
+			_queue.push_back(std::move(msg));
 		}
+	}
 
-		print(log_finest, "publish %s=%s", "mqtt", topic.c_str(), payload.c_str());
+	if (_queue.empty()) {
+		print(log_error, "Queue file %s is corrupt, discarding %ld bytes", "mqtt",
+			  _queueFile.c_str(), _spillWrite - _spillRead);
+		_spillRead = _spillWrite;
+	}
+	if (_spillRead >= _spillWrite) {
+		// drained, start over with an empty file
+		if (ftruncate(fileno(_spill), 0) != 0)
+			print(log_warning, "Truncating queue file %s failed: %s", "mqtt", _queueFile.c_str(),
+				  strerror(errno));
+		_spillRead = _spillWrite = 0;
+	}
+	return !_queue.empty();
+}
+
+void MqttClient::replay() {
+	if (!_queued || !_isConnected)
+		return;
+
+	// token bucket, allows bursts of up to one second. The client thread loops every
+	// 100 ms while messages are queued to spread them over the second.
+	double now = vz::metrics::monotonic();
+	if (_replayRate > 0)
+		_replayTokens = std::min<double>(_replayTokens + (now - _replayLast) * _replayRate,
+										 _replayRate);
+	_replayLast = now;
+
+	std::unique_lock<std::mutex> lock(_queueMutex);
+	while (_isConnected && (_replayRate == 0 || _replayTokens >= 1)) {
+		if (_queue.empty() && !unspill()) {
+			_queued = false;
+			_replayBehindLive = false;
+			print(log_info, "Queue replayed", "mqtt");
+			break;
+		}
+		if (!_queueSorted) {
+			std::stable_sort(_queue.begin(), _queue.end(),
+							 [](const QueuedMessage &a, const QueuedMessage &b) {
+								 return a._time < b._time;
+							 });
+			_queueSorted = true;
+		}
 
-		int res = _propsPublish == NULL? mosquitto_publish(_mcs, 0, topic.c_str(), payload.length(), payload.c_str(), _qos, _retain) :
-			mosquitto_publish_v5(_mcs, 0, topic.c_str(), payload.length(), payload.c_str(), _qos, _retain, _propsPublish);
-			
-		if (res != MOSQ_ERR_SUCCESS) {
-			print(log_finest, "mosquitto_publish failed: %s", "mqtt", mosquitto_strerror(res));
+		QueuedMessage &msg = _queue.front();
+		// an older value must not replace the retained live value
+		int res = publishMessage(msg._topic, msg._payload, msg._retain && !_replayBehindLive);
+		if (res == MOSQ_ERR_NO_CONN || res == MOSQ_ERR_CONN_LOST)
+			break; // keep it for the next connection
+		if (res == MOSQ_ERR_SUCCESS) {
+			vz::metrics::mqtt_queue_replayed()++;
+		} else {
+			vz::metrics::mqtt_publish_failures()++;
+			print(log_finest, "mosquitto_publish \"%s\" failed: %s", "mqtt",
+				  msg._topic.c_str(), mosquitto_strerror(res));
 		}
-		if (payload_obj != NULL) {
-			json_object_put(payload_obj);
+		_queue.pop_front();
+		_replayTokens -= 1;
+	}
+}
+
+void MqttClient::idle() { replay(); }
+
+void MqttClient::publish(Channel::Ptr ch, Reading &rds, bool aggregate) {
+	// take care: this function must be thread safe and non-blocking!
+	// for now we do only call this from read_thread and our mqtt_client thread doesn't harm here
+	// mosquitto_publish doesn't seem to be blocking. needs further investigation!
+
+	if (!ch || !ch->mqtt())
+		return;
+	if (!_mcs)
+		return;
+
+	ChannelEntry &entry = channelEntry(*ch);
+	if (aggregate ? entry._sendAgg : entry._sendRaw)
+		publishValue(entry, aggregate ? entry._fullTopicAgg : entry._fullTopicRaw, rds);
+}
+
+void MqttClient::publish(channel_iterator first, channel_iterator last) {
+	if (!_mcs)
+		return;
+
+	for (channel_iterator ch = first; ch != last; ++ch) {
+		if (!(*ch)->mqtt())
+			continue;
+
+		// one lookup per channel and cycle, not per reading
+		ChannelEntry &entry = channelEntry(*(*ch));
+		if (!entry._sendAgg)
+			continue;
+
+		Buffer::Ptr buf = (*ch)->buffer();
+		buf->lock();
+		for (Buffer::iterator it = buf->begin(); it != buf->end(); ++it) {
+			if (!it->deleted())
+				publishValue(entry, entry._fullTopicAgg, *it);
 		}
+		buf->unlock();
 	}
 }
 
@@ -394,7 +691,7 @@ void *mqtt_client_thread(void *arg) {
 
 	if (mqttClient) {
 		while (!endMqttClientThread) {
-			int res = mosquitto_loop(mqttClient->_mcs, 1000, 1);
+			int res = mosquitto_loop(mqttClient->_mcs, mqttClient->loopTimeout(), 1);
 			if (res != MOSQ_ERR_SUCCESS) {
 				print(log_warning, "mosquitto_loop failed (trying to reconnect): %s", "mqtt",
 					  mosquitto_strerror(res));
@@ -408,6 +705,7 @@ void *mqtt_client_thread(void *arg) {
 					print(log_finest, "mosquitto_reconnect succeeded", "mqtt");
 				}
 			}
+			mqttClient->idle();
 		}
 	}
 
@@ -1,6 +1,7 @@
 #include "mqttex.hpp"
 #include "common.h"
 #include "mosquitto.h"
+#include <algorithm>
 #include <cassert>
 #include <sstream>
 #include <unistd.h>
@@ -12,7 +13,8 @@
 #define SUB_SUCCESS 100
 
 // class impl.
-MqttClientEx::MqttClientEx(struct json_object *option) : MqttClient(option) {
+MqttClientEx::MqttClientEx(struct json_object *option)
+	: MqttClient(option), _updatePending(false), _groupsPending(0) {
 	print(log_finest, "constructor called", "mqttex");
 	
 	if (option) {
@@ -27,6 +29,8 @@ MqttClientEx::MqttClientEx(struct json_object *option) : MqttClient(option) {
 				} else {
 					print(log_alert, "Ignoring invalid QoS-Subscribe value %d, assuming default", NULL, qos);
 				}
+			} else if (strcmp(key, "groupLinger_ms") == 0 && local_type == json_type_int) {
+				_groupLinger_ms = std::max(0, json_object_get_int(local_value));
 			}	
 		}
 	}
@@ -37,65 +41,64 @@ MqttClientEx::~MqttClientEx() {
 	print(log_finest, "destructor called", "mqttex");
 }
 
-bool MqttClientEx::subscribe(const std::string& sub) {	
-	if (sub.empty() || sub.find('#') != std::string::npos || sub.find('+') != std::string::npos)
+bool MqttClientEx::subscribe(const std::string& sub, MqttSubscriber *subscriber) {	
+	if (!subscriber || !MqttTopicTrie<MqttSubscriber *>::valid(sub))
 		return false;
 	
 	std::unique_lock<std::mutex> lock(_subscriptionMapMutex);
-	auto it = _subscriptionMap.find(sub);	
-	if (it != _subscriptionMap.end()) {		
-		if ((*it).second._state != SUB_OFF)
-			return false;
-		(*it).second._state = SUB_ON;		
-	} else {		
-		auto& ref = _subscriptionMap[sub];
-		ref._state = SUB_ON;
-	}
+	auto& entry = _subscriptionMap[sub];
+	auto& subscribers = entry._subscribers;
+	if (std::find(subscribers.begin(), subscribers.end(), subscriber) != subscribers.end())
+		return false;
+	subscribers.push_back(subscriber);
 
-	return true;
-}
+	std::unique_lock<std::mutex> lockTrie(_trieMutex);
+	_trie.insert(sub, subscriber);
+	lockTrie.unlock();
 
-void MqttClientEx::unsubscribe(const std::string& sub) {	
-	std::unique_lock<std::mutex> lock(_subscriptionMapMutex);	
-	auto it = _subscriptionMap.find(sub);	
-	if (it != _subscriptionMap.end()) {	
-		int state = (*it).second._state;		
-		auto unsubscribe = state >= SUB_PENDING && _qosSubscribe == 0;
-		(*it).second._state = SUB_OFF;
-		std::unique_lock<std::mutex> lockData((*it).second._dataMutex);
-		(*it).second._data.clear();
-		lockData.unlock();
-		lock.unlock();	
-			
-		if (unsubscribe && _mcs) {
-			int res = mosquitto_unsubscribe(_mcs, NULL, sub.c_str());	
-					
-			if (res != MOSQ_ERR_SUCCESS) {
-				print(log_warning, "unsubscribe \"%s\" (state: %d->%d) failed: %s", "mqttex",
-					  sub.c_str(), state, SUB_OFF, mosquitto_strerror(res));
-			} else {
-				print(log_info, "unsubscribe \"%s\" (state: %d->%d) success", "mqttex",
-					  sub.c_str(), state, SUB_OFF);
-			}	
-		}	
-	}		
+	if (entry._state == SUB_OFF) {
+		entry._state = SUB_ON;
+		update(sub, entry);
+	}
+	return true;
 }
 
-size_t MqttClientEx::receive(const std::string& sub, std::vector<std::string>& data) {
-	data.clear();
+void MqttClientEx::unsubscribe(const std::string& sub, MqttSubscriber *subscriber) {	
 	std::unique_lock<std::mutex> lock(_subscriptionMapMutex);	
 	auto it = _subscriptionMap.find(sub);	
 	if (it == _subscriptionMap.end())
-		return 0;
-	
-	auto& entry = (*it).second;	
-	lock.unlock();
+		return;
 
-	update(sub, entry);
-	
-	std::unique_lock<std::mutex> lockData(entry._dataMutex);	
-	entry._data.swap(data);
-	return data.size();
+	auto& subscribers = (*it).second._subscribers;
+	auto pos = std::find(subscribers.begin(), subscribers.end(), subscriber);
+	if (pos == subscribers.end())
+		return;
+	subscribers.erase(pos);
+
+	// waits for a delivery in progress
+	std::unique_lock<std::mutex> lockTrie(_trieMutex);
+	_trie.erase(sub, subscriber);
+	lockTrie.unlock();
+
+	if (!subscribers.empty())
+		return;
+
+	int state = (*it).second._state;		
+	auto unsubscribe = state >= SUB_PENDING && _qosSubscribe == 0;
+	(*it).second._state = SUB_OFF;
+	lock.unlock();	
+		
+	if (unsubscribe && _mcs) {
+		int res = mosquitto_unsubscribe(_mcs, NULL, sub.c_str());	
+				
+		if (res != MOSQ_ERR_SUCCESS) {
+			print(log_warning, "unsubscribe \"%s\" (state: %d->%d) failed: %s", "mqttex",
+				  sub.c_str(), state, SUB_OFF, mosquitto_strerror(res));
+		} else {
+			print(log_info, "unsubscribe \"%s\" (state: %d->%d) success", "mqttex",
+				  sub.c_str(), state, SUB_OFF);
+		}	
+	}	
 }
 
 void MqttClientEx::update(const std::string& sub, SubscriptionEntry& entry) {
@@ -112,6 +115,7 @@ void MqttClientEx::update(const std::string& sub, SubscriptionEntry& entry) {
 		if (res != MOSQ_ERR_SUCCESS) {			
 			entry._state = state + 1;
 			if (entry._state < SUB_RETRY_MAX) {
+				_updatePending = true;
 				print(log_warning, "subscribe \"%s\" (state: %d->%d) failed: %s", "mqttex",
 					  sub.c_str(), state, entry._state, mosquitto_strerror(res));
 			} else {
@@ -155,6 +159,34 @@ void MqttClientEx::connect_callback(struct mosquitto *mosq, int result) {
 	if(isConnected && !_isConnected) {
 		reset();
 	}
+	if (_isConnected)
+		_updatePending = true; // subscribe after the callback returned
+}
+
+void MqttClientEx::idle() {
+	MqttClient::idle();
+	if (_updatePending.exchange(false))
+		update();
+
+	if (_groupsPending > 0) {
+		// members missing: publish what has arrived within the linger time
+		double now = vz::metrics::monotonic();
+		std::unique_lock<std::mutex> lock(_groupPublishMapMutex);
+		for (auto it = _groupPublishMap.begin(); it != _groupPublishMap.end(); ++it) {
+			GroupEntry &group = (*it).second;
+			if (group._updated && (now - group._since) * 1000 >= _groupLinger_ms) {
+				print(log_finest, "group %s: %zu of %zu members after %d ms", "mqtt",
+					  group._topic.c_str(), group._updated, group._data.size(), _groupLinger_ms);
+				groupPublish(group);
+			}
+		}
+	}
+}
+
+int MqttClientEx::loopTimeout() const {
+	// check the linger time of pending groups more often
+	return _groupsPending > 0 ? std::min(MqttClient::loopTimeout(), 100)
+							  : MqttClient::loopTimeout();
 }
 
 void MqttClientEx::disconnect_callback(struct mosquitto *mosq, int result) {	
@@ -173,64 +205,125 @@ void MqttClientEx::message_callback(struct mosquitto *mosq, const struct mosquit
 	print(log_finest, "message_callback \"%s\": mid=%d", "mqttex",
 			  msg->topic, msg->mid);		
 
-	std::unique_lock<std::mutex> lock(_subscriptionMapMutex);	
-	auto it = _subscriptionMap.find(msg->topic);		
-	if (it != _subscriptionMap.end() && (*it).second._state >= SUB_ON) {		
-		std::unique_lock<std::mutex> lockData((*it).second._dataMutex);	
-		std::string data((const char*)msg->payload, msg->payloadlen);
-		(*it).second._data.emplace_back(data);
-		print(log_finest, "message_callback \"%s\": %s", "mqttex",
-			  (*it).first.c_str(), data.c_str());		
-	}		
+	// the payload is handed over without copy, it is valid until the callback returns
+	const char *topic = msg->topic;
+	const char *payload = static_cast<const char *>(msg->payload);
+	size_t len = msg->payloadlen;
+	auto deliver = [topic, payload, len](MqttSubscriber *subscriber) {
+		subscriber->message(topic, payload, len);
+	};
+
+	std::unique_lock<std::mutex> lock(_trieMutex);
+	_trie.match(topic, deliver);
 }
 
-void MqttClientEx::publish(Channel::Ptr ch, Reading &rds, bool aggregate)
+MqttClientEx::GroupMember &MqttClientEx::groupMember(Channel &ch) {
+	// _groupPublishMapMutex has to be locked by the caller
+	auto it = _groupMemberMap.find(&ch);
+	if (it != _groupMemberMap.end())
+		return (*it).second;
+
+	auto& group = _groupPublishMap[ch.mqttGroupKey()];
+	if (group._topic.empty())
+		group._topic = _topic + ch.mqttGroupKey();
+
+	// let json-c escape the name once, the payload is assembled from the cached prefixes
+	struct json_object *name_obj = json_object_new_string(ch.mqttGroupName().c_str());
+	std::string prefix = ",";
+	prefix += json_object_to_json_string(name_obj);
+	prefix += ':';
+	json_object_put(name_obj);
+
+	// the names are unique within a group (checked by Config_Options)
+	GroupMember member = { &group, group._data.size() };
+	group._data.emplace_back(prefix, 0.0);
+	group._fresh.push_back(false);
+
+	return _groupMemberMap.emplace(&ch, member).first->second;
+}
+
+void MqttClientEx::groupPayload(std::string &payload, const GroupEntry &group) {
+	payload.assign("{\"timestamp\":", 13);
+	MqttPayload::appendInt(payload, group._time);
+	for (auto it = group._data.begin(); it != group._data.end(); ++it) {
+		payload += (*it).first;
+		MqttPayload::appendJson(payload, (*it).second);
+	}
+	payload += '}';
+}
+
+void MqttClientEx::groupPublish(GroupEntry &group) {
+	// initialize time, keep it increasing
+	if (group._time == 0 || group._cycleTime > group._time + 10)
+		group._time = group._cycleTime;
+	else
+		group._time += 10; // at least 10 ms later
+
+	// encoded into a buffer of the calling thread, send() doesn't keep it
+	static thread_local std::string payload;
+	groupPayload(payload, group);
+	print(log_finest, "publish group %s=%s", "mqtt", group._topic.c_str(), payload.c_str());
+	send(group._topic, payload, _retain, group._time);
+
+	group._updated = 0;
+	std::fill(group._fresh.begin(), group._fresh.end(), false);
+	_groupsPending--;
+}
+
+void MqttClientEx::publish(channel_iterator first, channel_iterator last)
 {
-	MqttClient::publish(ch, rds, aggregate);
-	
-	if (!aggregate)
-		return;		
-	if (!ch || ch->mqttGroupKey().empty())
-		return;
+	MqttClient::publish(first, last);
+
 	if (!_mcs)
-		return;			
-			
-	std::unique_lock<std::mutex> lock(_groupPublishMapMutex);	
-	auto& ref = _groupPublishMap[ch->mqttGroupKey()];
-		
-	ref._data[ch->mqttGroupName()] = rds.value();
-	std::string topic = ref._topic;
-	
-	// initialize topic and time
-	if (topic.empty() ) {
-		topic = _topic + ch->mqttGroupKey();
-		ref._topic = topic;
-		ref._time = rds.time_ms();
-	} else {
-		int64_t time = rds.time_ms();
-		if (time > ref._time + 10)
-			ref._time = time;
-		else
-			ref._time += 10; // at least 10 ms later 
-	}
-	
-	struct json_object *payload_obj = json_object_new_object();
-	json_object_object_add(payload_obj, "timestamp", json_object_new_int64(ref._time));
-	for (auto it = ref._data.begin(); it != ref._data.end(); ++it) {
-		json_object_object_add(payload_obj, (*it).first.c_str(), json_object_new_double((*it).second));
+		return;
+
+	std::unique_lock<std::mutex> lock(_groupPublishMapMutex);
+	for (channel_iterator ch = first; ch != last; ++ch) {
+		if ((*ch)->mqttGroupKey().empty())
+			continue;
+
+		// the last aggregated value of this cycle
+		bool found = false;
+		double value = 0;
+		int64_t time = 0;
+		Buffer::Ptr buf = (*ch)->buffer();
+		buf->lock();
+		for (Buffer::iterator it = buf->begin(); it != buf->end(); ++it) {
+			if (!it->deleted()) {
+				found = true;
+				value = it->value();
+				time = it->time_ms();
+			}
+		}
+		buf->unlock();
+		if (!found)
+			continue;
+
+		GroupMember &member = groupMember(*(*ch));
+		GroupEntry &group = *member._group;
+		if (group._fresh[member._index])
+			groupPublish(group); // next cycle of this member, don't overwrite its value
+
+		group._data[member._index].second = value;
+		group._fresh[member._index] = true;
+		if (group._updated++ == 0) {
+			group._since = vz::metrics::monotonic();
+			group._cycleTime = time;
+			_groupsPending++;
+		} else if (time > group._cycleTime) {
+			group._cycleTime = time;
+		}
+
+		// complete. The first message waits for the linger time, the members
+		// register with their first value.
+		if (_groupLinger_ms > 0 && group._time != 0 && group._updated == group._data.size())
+			groupPublish(group);
 	}
-	
-	lock.unlock();
-	
-	std::string payload = json_object_to_json_string(payload_obj);
-	json_object_put(payload_obj);	
-	
-	print(log_finest, "publish group %s=%s", "mqtt", topic.c_str(), payload.c_str());
 
-	int res = _propsPublish == NULL? mosquitto_publish(_mcs, 0, topic.c_str(), payload.length(), payload.c_str(), _qos, _retain) :
-		mosquitto_publish_v5(_mcs, 0, topic.c_str(), payload.length(), payload.c_str(), _qos, _retain, _propsPublish);
-		
-	if (res != MOSQ_ERR_SUCCESS) {
-		print(log_finest, "mosquitto_publish failed: %s", "mqtt", mosquitto_strerror(res));
-	}	
+	if (_groupLinger_ms == 0) {
+		for (auto it = _groupPublishMap.begin(); it != _groupPublishMap.end(); ++it) {
+			if ((*it).second._updated)
+				groupPublish((*it).second);
+		}
+	}
 }
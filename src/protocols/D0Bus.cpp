@@ -0,0 +1,266 @@
+/**
+ * Serial line or socket shared by D0 meters, e.g. several meters on one RS-485 bus
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// socket
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "Metrics.hpp"
+#include "protocols/D0Bus.hpp"
+
+static std::mutex busesMutex;
+static std::map<std::string, std::weak_ptr<D0Bus>> buses;
+
+D0Bus::Ptr D0Bus::attach(const std::string &port) {
+	std::lock_guard<std::mutex> lock(busesMutex);
+	Ptr bus = buses[port].lock();
+	if (!bus) {
+		bus.reset(new D0Bus(port));
+		buses[port] = bus;
+	}
+	bus->_members++;
+	return bus;
+}
+
+void D0Bus::detach() {
+	std::lock_guard<std::mutex> lock(busesMutex);
+	if (--_members == 0)
+		buses.erase(_port);
+}
+
+int D0Bus::open(const std::string &name, const std::string &device, const std::string &host,
+				speed_t baudrate, parity_type_t parity) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_users == 0) {
+		if (device.length() > 0) {
+			_fd = _openDevice(name.c_str(), device.c_str(), baudrate, parity);
+		} else if (host.length() > 0) {
+			char *addr = strdup(host.c_str());
+			char *tofree = addr;
+			const char *node = strsep(&addr, ":");
+			const char *service = strsep(&addr, ":");
+
+			_fd = _openSocket(name.c_str(), node, service);
+			free(tofree);
+		}
+		if (_fd < 0)
+			return _fd;
+		_idleUntil = 0;
+	}
+	_users++;
+	return _fd;
+}
+
+int D0Bus::close() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_users == 0 || --_users > 0)
+		return 0;
+	int res = ::close(_fd);
+	_fd = -1;
+	return res;
+}
+
+D0Bus::Transaction::Transaction(D0Bus &bus, int guard_ms)
+	: _bus(bus), _guard_ms(guard_ms), _waited(0) {
+	double start = vz::metrics::monotonic();
+	std::unique_lock<std::mutex> lock(_bus._mutex);
+	_entry = _bus._queue.insert(_bus._queue.end(), this);
+	try {
+		while (_bus._queue.front() != this) {
+			// condition_variable::wait() is noexcept, so it must not be cancelled.
+			// The thread can be cancelled in between.
+			int state;
+			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+			_bus._cond.wait_for(lock, std::chrono::milliseconds(100));
+			pthread_setcancelstate(state, NULL);
+			lock.unlock();
+			pthread_testcancel();
+			lock.lock();
+		}
+	} catch (...) { // thread cancelled, no destructor for us
+		if (!lock.owns_lock())
+			lock.lock();
+		_bus._queue.erase(_entry);
+		_bus._cond.notify_all();
+		throw;
+	}
+	_waited = vz::metrics::monotonic() - start;
+}
+
+D0Bus::Transaction::~Transaction() {
+	std::lock_guard<std::mutex> lock(_bus._mutex);
+	_bus._idleUntil = vz::metrics::monotonic() + _guard_ms / 1000.0;
+	_bus._queue.erase(_entry);
+	_bus._cond.notify_all();
+}
+
+void D0Bus::Transaction::ready() {
+	double idleUntil;
+	{
+		std::lock_guard<std::mutex> lock(_bus._mutex);
+		idleUntil = _bus._idleUntil;
+	}
+	double wait = idleUntil - vz::metrics::monotonic();
+	if (wait > 0) {
+		usleep((useconds_t)(wait * 1e6));
+		_waited += wait;
+	}
+}
+
+void D0Bus::framing(struct termios &tio, parity_type_t parity) {
+	switch (parity) {
+	case parity_8n1:
+		tio.c_cflag &= ~PARENB;
+		tio.c_cflag &= ~PARODD;
+		tio.c_cflag &= ~CSTOPB;
+		tio.c_cflag &= ~CSIZE;
+		tio.c_cflag |= CS8;
+		break;
+	case parity_7n1:
+		tio.c_cflag &= ~PARENB;
+		tio.c_cflag &= ~PARODD;
+		tio.c_cflag &= ~CSTOPB;
+		tio.c_cflag &= ~CSIZE;
+		tio.c_cflag |= CS7;
+		break;
+	case parity_7e1:
+		tio.c_cflag &= ~CRTSCTS;
+		tio.c_cflag |= PARENB;
+		tio.c_cflag &= ~PARODD;
+		tio.c_cflag &= ~CSTOPB;
+		tio.c_cflag &= ~CSIZE;
+		tio.c_cflag |= CS7;
+		break;
+	case parity_7o1:
+		tio.c_cflag &= ~PARENB;
+		tio.c_cflag |= PARODD;
+		tio.c_cflag &= ~CSTOPB;
+		tio.c_cflag &= ~CSIZE;
+		tio.c_cflag |= CS7;
+		break;
+	}
+}
+
+int D0Bus::_openSocket(const char *name, const char *node, const char *service) {
+	struct addrinfo hints, *ais;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int rc = getaddrinfo(node, service, &hints, &ais);
+	if (rc != 0) {
+		print(log_alert, "getaddrinfo(%s, %s): %s", name, node, service, gai_strerror(rc));
+		return ERR;
+	}
+
+	// try each address of the host, e.g. IPv6 and IPv4
+	int fd = -1, err = 0;
+	for (struct addrinfo *ai = ais; ai && fd < 0; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			err = errno;
+			continue;
+		}
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+			err = errno;
+			::close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(ais);
+
+	if (fd < 0) {
+		print(log_alert, "connect(%s, %s): %s", name, node, service, strerror(err));
+		return ERR;
+	}
+	return fd;
+}
+
+int D0Bus::_openDevice(const char *name, const char *device, speed_t baudrate,
+						parity_type_t parity) {
+	struct termios tio;
+	memset(&tio, 0, sizeof(struct termios));
+
+	int fd = ::open(device, O_RDWR);
+	if (fd < 0) {
+		print(log_alert, "open(%s): %s", name, device, strerror(errno));
+		return ERR;
+	}
+
+	// get old configuration
+	tcgetattr(fd, &tio);
+
+	// backup old configuration to restore it when closing the meter connection
+	memcpy(&_oldtio, &tio, sizeof(struct termios));
+	/*
+	initialize all control characters
+	default values can be found in /usr/include/termios.h, and are given
+	in the comments, but we don't need them here
+	*/
+	tio.c_cc[VINTR] = 0;    // Ctrl-c
+	tio.c_cc[VQUIT] = 0;    // Ctrl-<backslash>
+	tio.c_cc[VERASE] = 0;   // del
+	tio.c_cc[VKILL] = 0;    // @
+	tio.c_cc[VEOF] = 4;     // Ctrl-d
+	tio.c_cc[VTIME] = 0;    // inter-character timer unused
+	tio.c_cc[VMIN] = 1;     // blocking read until 1 character arrives
+	tio.c_cc[VSWTC] = 0;    // '\0'
+	tio.c_cc[VSTART] = 0;   // Ctrl-q
+	tio.c_cc[VSTOP] = 0;    // Ctrl-s
+	tio.c_cc[VSUSP] = 0;    // Ctrl-z
+	tio.c_cc[VEOL] = 0;     // '\0'
+	tio.c_cc[VREPRINT] = 0; // Ctrl-r
+	tio.c_cc[VDISCARD] = 0; // Ctrl-u
+	tio.c_cc[VWERASE] = 0;  // Ctrl-w
+	tio.c_cc[VLNEXT] = 0;   // Ctrl-v
+	tio.c_cc[VEOL2] = 0;    // '\0'
+
+	tio.c_iflag &= ~(BRKINT | INLCR | IMAXBEL | IXOFF | IXON);
+	tio.c_oflag &= ~(OPOST | ONLCR);
+	tio.c_lflag &= ~(ISIG | ICANON | IEXTEN | ECHO);
+
+	framing(tio, parity);
+
+	// Set return rules for read to prevent endless waiting
+	tio.c_cc[VTIME] = 50; // inter-character timer  50*0.1
+	tio.c_cc[VMIN] = 0;   // VTIME is timeout counter
+	// now clean the modem line and activate the settings for the port
+
+	tcflush(fd, TCIOFLUSH);
+	// set baudrate
+	cfsetispeed(&tio, baudrate);
+	cfsetospeed(&tio, baudrate);
+
+	// apply new configuration
+	tcsetattr(fd, TCSANOW, &tio);
+
+	return fd;
+}
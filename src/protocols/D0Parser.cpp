@@ -0,0 +1,251 @@
+/**
+ * Incremental parser for the plaintext protocol according to DIN EN 62056-21 ("D0")
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+
+#include "protocols/D0Parser.hpp"
+#include <VZException.hpp>
+
+#define STX 0x02
+
+D0Parser::D0Parser() : _obisText(16), _value(32), _unit(16) { reset(); }
+
+void D0Parser::reset() {
+	_context = START;
+	_iterator = 0;
+	_clear = false;
+	_obisValid = false;
+	_vendor[0] = '\0';
+	_baudrate = 0;
+	_identification[0] = '\0';
+	_clearLine();
+	_skipped = _dropped = 0;
+}
+
+void D0Parser::_clearLine() {
+	_obisText.clear();
+	_value.clear();
+	_unit.clear();
+	_clear = false;
+}
+
+double D0Parser::number() const {
+	char buf[33];
+	Slice v = value();
+	memcpy(buf, v.data, v.len);
+	buf[v.len] = '\0';
+	return strtod(buf, NULL);
+}
+
+D0Parser::Context D0Parser::_startValue() {
+	Slice text = _obisText.slice();
+	if (text.len == 0)
+		return SKIP; // e.g. the 2nd value of "0.1.0(12)(34)"
+
+	// let's check sanity of first char. we can't use isValid() as here we get incomplete
+	// obis codes as well (e.g. 1.8.0 -> 255-255:1.8.0)
+	char first = text.data[0];
+	if (!isdigit(first) && first != 'C' && first != 'F') { // L, P not supported yet
+		_skipped++;
+		return SKIP;
+	}
+
+	_obisValid = Obis::tryParse(text.data, text.len, _obis);
+	if (!_obisValid) {
+		try {
+			_obis = Obis(text.str().c_str()); // aliases
+			_obisValid = true;
+		} catch (vz::VZException &e) {
+			return VALUE; // reported as INVALID if there is a value
+		}
+	}
+	if (!_filter.empty() && !_filter.contains(_obis)) {
+		_skipped++;
+		return SKIP;
+	}
+	return VALUE;
+}
+
+bool D0Parser::_endLine() {
+	_iterator = 0;
+	_context = OBIS_CODE;
+	if (_value.len() == 0) { // nothing to report
+		_clearLine();
+		return false;
+	}
+	_clear = true;
+	return true;
+}
+
+D0Parser::Event D0Parser::parse(const char *&pos, const char *end) {
+	if (_clear) // previous line has been reported
+		_clearLine();
+
+	while (pos < end) {
+		const char *p = pos++;
+		char byte = *p;
+
+		if ((byte == '/') && (_iterator == 0)) {
+			_context = VENDOR; // Slash can also be in OBIS String of TD-3511 meter
+			_clearLine();
+		} else if ((byte == '?') || (byte == '!')) {
+			if (_context != END_SEQ) {
+				_context = END_SEQ; // "!" is the identifier for the END
+				_iterator = 0;
+			}
+		}
+
+		switch (_context) {
+		case START: // wait for the initial "/" (!? is checked above already)
+			break;
+
+		case VENDOR: // VENDOR has 3 Bytes
+			if ((byte == '\r') || (byte == '\n') || (byte == '/')) {
+				_iterator = 0;
+				break;
+			}
+			if (!isalpha(byte))
+				return ERROR; // Vendor ID needs to be alpha
+			_vendor[_iterator++] = byte;
+			if (_iterator >= VENDOR_LEN) {
+				_vendor[_iterator] = '\0';
+				_iterator = 0;
+				_context = BAUDRATE;
+			}
+			break;
+
+		case BAUDRATE: // BAUDRATE consists of 1 char only
+			_baudrate = byte;
+			_iterator = 0;
+			_context = IDENTIFICATION;
+			break;
+
+		case IDENTIFICATION: // IDENTIFICATION has up to 16 bytes
+			if ((byte == '\r') || (byte == '\n')) {
+				_identification[_iterator] = '\0';
+				_iterator = 0;
+				_context = ACK;
+			} else if (!isprint(byte) || _iterator >= IDENTIFICATION_LEN) {
+				_dropped++;
+			} else {
+				_identification[_iterator++] = byte;
+			}
+			break;
+
+		case ACK:
+			// reported only with the next char. The ID is ended by \r\n, so the ack is sent
+			// after the complete line
+			_context = OBIS_CODE;
+			_clearLine();
+			return HEADER;
+
+		case OBIS_CODE:
+			if ((byte != '\n') && (byte != '\r') && (byte != STX)) {
+				if (byte == '(') {
+					_iterator = 0;
+					_context = _startValue();
+				} else if (_obisText.append(p)) {
+					_iterator++;
+				} else {
+					_dropped++;
+				}
+			}
+			break;
+
+		case VALUE:
+			if ((byte == '*') || (byte == ')')) {
+				_iterator = 0;
+				if (byte == ')') {
+					if (_endLine())
+						return _obisValid ? RECORD : INVALID;
+					break;
+				}
+				_context = UNIT;
+			} else if (_value.append(p)) {
+				_iterator++;
+			} else {
+				_dropped++;
+			}
+			break;
+
+		case UNIT:
+			if (byte == ')') {
+				if (_endLine())
+					return _obisValid ? RECORD : INVALID;
+			} else if (_unit.append(p)) {
+				_iterator++;
+			} else {
+				_dropped++;
+			}
+			break;
+
+		case SKIP:
+			if (byte == ')') {
+				_iterator = 0;
+				_context = OBIS_CODE;
+				_clearLine();
+			} else if (byte == '*') {
+				_iterator = 0;
+			} else {
+				_iterator++;
+			}
+			break;
+
+		case END_SEQ:
+			// here we stay until we receive either:
+			// a) ! as end indicator
+			// b) ?! as pull seq indicator -> wait for VENDOR
+			// c) how to handle ? with something else? -> ignore (so ??! will be accepted as b)
+			// d) 0x0d 0x0a ? -> ignore, so stay in END state.
+			if (byte == '!') {
+				if (_iterator == 0) { // case a)
+					_context = START;
+					return END;
+				}
+				_context = VENDOR; // case b)
+				_iterator = 0;
+			} else if (byte == '?') {
+				_iterator = 1; // can be start of case b. we accept ??! as well
+			} else if (byte == STX) {
+				// some meter seem to send ? STX ... as start package. (e.g. AS1440)
+				_context = OBIS_CODE;
+				_iterator = 0;
+				_clearLine();
+			} else if (byte == '/') { // go to vendor
+				_context = VENDOR;
+				_iterator = 0;
+			} else {
+				_iterator = 0; // reset ? reminder but stay in this state
+			}
+			break;
+		}
+	}
+
+	// the input is released, keep the current line
+	_obisText.keep();
+	_value.keep();
+	_unit.keep();
+	return NEED_DATA;
+}
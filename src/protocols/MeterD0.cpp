@@ -32,6 +32,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,21 +40,17 @@
 #include <time.h>
 #include <unistd.h>
 
-// socket
-#include <netdb.h>
-#include <sys/socket.h>
-
+#include "Metrics.hpp"
 #include "protocols/MeterD0.hpp"
 #include <VZException.hpp>
 
 #include "Obis.hpp"
 
-#define STX 0x02
-
 MeterD0::MeterD0(const std::list<Option> &options)
 	: Protocol("d0"), _host(""), _device(""), _auto_ack(false), _wait_sync_end(false),
 	  _read_timeout_s(10), _baudrate_change_delay_ms(0), _reaction_time_ms(200) // default to 200ms
 	  ,
+	  _fd(-1), _bufPos(0), _bufLen(0), _lastFill(0), _readCalls(0), _bytesRead(0), _waitTime(0),
 	  _dump_fd(0), _old_mode(NONE), _dump_pos(0) {
 	OptionList optlist;
 
@@ -319,11 +316,15 @@ MeterD0::MeterD0(const std::list<Option> &options)
 		print(log_alert, "Failed to parse baudrate_change_delay", name().c_str());
 		throw;
 	}
+
+	_bus = D0Bus::attach(_device.length() ? _device : _host);
 }
 
 MeterD0::~MeterD0() {
 	if (_dump_fd)
 		(void)fclose(_dump_fd);
+	if (_bus)
+		_bus->detach();
 }
 
 int MeterD0::open() {
@@ -338,16 +339,15 @@ int MeterD0::open() {
 		dump_file(CTRL, "opened");
 	}
 
-	if (_device.length() > 0) {
-		_fd = _openDevice(&_oldtio, _baudrate);
-	} else if (_host.length() > 0) {
-		char *addr = strdup(host());
-		const char *node = strsep(&addr, ":");
-		const char *service = strsep(&addr, ":");
-
-		_fd = _openSocket(node, service);
+	if (_bus->members() > 1 && !_pull.size()) {
+		print(log_alert, "%s is shared with other meters, each one needs a pullseq", name().c_str(),
+			  _bus->port().c_str());
+		return ERR;
 	}
 
+	_fd = _bus->open(name(), _device, _host, _baudrate, _parity);
+	_bufPos = _bufLen = 0;
+
 	return (_fd < 0) ? ERR : SUCCESS;
 }
 
@@ -357,69 +357,30 @@ int MeterD0::close() {
 		(void)fclose(_dump_fd);
 		_dump_fd = 0;
 	}
-	return ::close(_fd);
+	_fd = -1;
+	return _bus->close();
 }
 
-ssize_t MeterD0::read(std::vector<Reading> &rds, size_t max_readings) {
-
-	enum {
-		START,
-		VENDOR,
-		BAUDRATE,
-		IDENTIFICATION,
-		ACK,
-		START_LINE,
-		OBIS_CODE,
-		VALUE,
-		UNIT,
-		END_LINE,
-		END
-	} context;
-
-	bool error_flag = false;
-	const int VENDOR_LEN = 3;
-	char vendor[VENDOR_LEN + 1]; // 3 upper case vendor + '\0' termination
-	const int IDENTIFICATION_LEN = 16;
-	char identification[IDENTIFICATION_LEN + 1]; // 16 meter specific + '\0' termination
-	const int OBIS_LEN = 16;
-	char obis_code[OBIS_LEN + 1]; /* A-B:C.D.E*F
-							 fields A, B, E, F are optional
-							 fields C & D are mandatory
-							 A: energy type; 1: energy
-							 B: channel number; 0: no channel specified
-							 C: data items; 0-89 in COSEM context: IEC 62056-62, Clause D.1; 96:
-							 General service entries 1:  Totel Active power+ 21: L1 Active power+
-							 31: L1 Current
-							 32: L1 Voltage
-							 41: L2 Active power+
-							 51: L2 Current
-							 52: L2 Voltage
-							 61: L3 Active power+
-							 71: L3 Current
-							 72: L3 Voltage
-							 96.1.255: Metering point ID 256 (electricity related)
-							 96.5.5: Meter started status flag
-							 D: types
-							 E: further processing or classification of quantities
-							 F: storage of data
-							 see DIN-EN-62056-61 */
-	const int VALUE_LEN = 32;
-	char value[VALUE_LEN + 1]; // value, i.e. the actual reading
-	const int UNIT_LEN = 16;
-	char unit[UNIT_LEN + 1]; // the unit of the value, e.g. kWh, V, ...
+void MeterD0::channelIdentifiers(const std::vector<ReadingIdentifier::Ptr> &ids) {
+	std::vector<Obis> codes = ObisIdentifiers::channelCodes(ids);
+	_parser.filter(codes);
+	if (codes.size())
+		print(log_debug, "Reading %zu OBIS codes, skipping other lines", name().c_str(),
+			  _parser.filter().size());
+}
 
-	char baudrate;       // 1 byte for
-	char byte, lastbyte; // we parse our input byte wise
-	int byte_iterator;
-	char endseq[2 + 1]; // Endsequence ! not ?!
+ssize_t MeterD0::read(std::vector<Reading> &rds, size_t max_readings) {
 	size_t number_of_tuples;
-	int bytes_read;
-	time_t start_time, end_time;
+	const int timeout_ms = _read_timeout_s * 1000;
+	double start_time, progress_time; // monotonic
 	struct termios tio;
 	int baudrate_connect, baudrate_read; // Baudrates for switching
 
 	dump_file(CTRL, "read");
 
+	// other meters on the bus wait until our answer is complete
+	D0Bus::Transaction transaction(*_bus, _pull.size() ? _reaction_time_ms : 0);
+
 	baudrate_connect = _baudrate;
 	baudrate_read = _baudrate_read;
 	tcgetattr(_fd, &tio);
@@ -427,42 +388,51 @@ ssize_t MeterD0::read(std::vector<Reading> &rds, size_t max_readings) {
 	if (_pull.size()) {
 		dump_file(CTRL, "TCIOFLUSH and cfsetiospeed");
 		tcflush(_fd, TCIOFLUSH);
+		_bufPos = _bufLen = 0; // rest of the last answer
 		cfsetispeed(&tio, baudrate_connect);
 		cfsetospeed(&tio, baudrate_connect);
+		D0Bus::framing(tio, _parity); // the port may be shared with meters of another parity
 		// apply new configuration
 		tcsetattr(_fd, TCSANOW, &tio);
 		if (_baudrate_change_delay_ms)
 			usleep(_baudrate_change_delay_ms *
 				   1000); // give some time for baudrate change to be applied
+		transaction.ready();
+		if (transaction.waited() > 0)
+			print(log_debug, "waited %.3fs for the bus", name().c_str(), transaction.waited());
 		int wlen = write(_fd, _pull.c_str(), _pull.size());
 		dump_file(DUMP_OUT, _pull.c_str(), wlen > 0 ? wlen : 0);
 		print(log_debug, "sending pullsequenz send (len:%d is:%d).", name().c_str(), _pull.size(),
 			  wlen);
 	}
 
-	time(&start_time);
+	start_time = progress_time = vz::metrics::monotonic();
+	_readCalls = _bytesRead = 0;
+	_waitTime = 0;
 
-	byte_iterator = number_of_tuples = baudrate = 0;
-	byte = lastbyte = 0;
-	context = START; // start with context START
+	number_of_tuples = 0;
+	_parser.reset();
 
 	if (_wait_sync_end) {
 		/* wait once for the sync pattern ("!") at the end of a regular D0 message.
 		   This is intended for D0 meters that start sending data automatically
 		   (e.g. Hager EHZ361).
 		*/
-		int skipped = 0;
-		while (_wait_sync_end && ::read(_fd, &byte, 1)) {
-			dump_file(byte);
-			if (byte == '!') {
+		size_t skipped = 0;
+		while (_wait_sync_end && (_bufPos < _bufLen || _fill(timeout_ms) > 0)) {
+			const char *sync = (const char *)memchr(_buf + _bufPos, '!', _bufLen - _bufPos);
+			if (sync) {
+				skipped += sync - (_buf + _bufPos);
+				_bufPos = sync + 1 - _buf;
 				_wait_sync_end = false;
-				print(log_debug, "found wait_sync_end. skipped %d bytes.", name().c_str(), skipped);
+				print(log_debug, "found wait_sync_end. skipped %zu bytes.", name().c_str(), skipped);
 			} else {
-				skipped++;
+				skipped += _bufLen - _bufPos;
+				_bufPos = _bufLen;
 				if (skipped > D0_BUFFER_LENGTH) {
 					_wait_sync_end = false;
 					print(log_error,
-						  "stopped searching for wait_sync_end after %d bytes without success!",
+						  "stopped searching for wait_sync_end after %zu bytes without success!",
 						  name().c_str(), skipped);
 				}
 			}
@@ -470,106 +440,47 @@ ssize_t MeterD0::read(std::vector<Reading> &rds, size_t max_readings) {
 	}
 
 	while (1) {
-		// check for timeout
-		time(&end_time);
-		if (difftime(end_time, start_time) > _read_timeout_s) {
-			print(log_error, "nothing received for more than %d seconds", name().c_str(),
-				  _read_timeout_s);
-			dump_file(CTRL, "timeout!");
-			break;
-		}
-
-		// now read a single byte
-		bytes_read = ::read(_fd, &byte, 1);
-		if (bytes_read == 0 || (bytes_read == -1 && errno == EAGAIN)) {
-			// wait 5ms and read again
-			usleep(5000);
-			continue;
-		} else if (bytes_read == -1) {
-			print(log_error, "error reading a byte (%d)", name().c_str(), errno);
-			break;
-		}
-		dump_file(byte);
-
-		// reset timeout if we are making progress
-		if (context != START) {
-			time(&start_time);
-		}
-
-		lastbyte = byte;
-		if ((byte == '/') && (byte_iterator == 0)) {
-			context = VENDOR; // Slash can also be in OBIS String of TD-3511 meter
-		} else if ((byte == '?') || (byte == '!')) {
-			if (context != END) {
-				context = END; // "!" is the identifier for the END
-				byte_iterator = 0;
-			}
-		}
-
-		switch (context) {
-		case START:            // strip the initial "/"
-			if (byte == '/') { // if ((byte != '\r') &&  (byte != '\n')) { 	// allow extra new line
-							   // at the start
-				byte_iterator = number_of_tuples = 0; // start
-				context = VENDOR;                     // set new context: START -> VENDOR
-			} // else ignore the other chars. -> Wait for / (!? is checked above already)
-			break;
-
-		case VENDOR: // VENDOR has 3 Bytes
-			if ((byte == '\r') || (byte == '\n') || (byte == '/')) {
-				byte_iterator = number_of_tuples = 0;
+		if (_bufPos == _bufLen) {
+			// the buffer is parsed without syscalls, the timeout only matters when it is empty
+			int remaining = timeout_ms - (int)((vz::metrics::monotonic() - progress_time) * 1000);
+			int res = remaining > 0 ? _fill(remaining) : 0;
+			if (res == 0) {
+				print(log_error, "nothing received for more than %d seconds", name().c_str(),
+					  _read_timeout_s);
+				dump_file(CTRL, "timeout!");
+				break;
+			} else if (res < 0) {
 				break;
 			}
+		}
 
-			if (!isalpha(byte))
-				goto error;                    // Vendor ID needs to be alpha
-			vendor[byte_iterator++] = byte;    // read next byte
-			if (byte_iterator >= VENDOR_LEN) { // after 3rd byte
-				// check for reaction time indicator: (3rd letter lower case)
-				if (islower(vendor[2]))
-					_reaction_time_ms = 20; // lower case indicates 20ms
-				else
-					_reaction_time_ms = 200; // upper case indicates 200ms
-
-				vendor[byte_iterator] = '\0'; // termination
-				byte_iterator = 0;            // reset byte counter
-				context = BAUDRATE;           // set new context: VENDOR -> BAUDRATE
-			}
-			break;
-
-		case BAUDRATE:       // BAUDRATE consists of 1 char only
-			baudrate = byte; // with _auto_ack we could check here whether the baudrate changed and
-							 // set _ack to ""
-			byte_iterator = 0;
-			context = IDENTIFICATION; // set new context: BAUDRATE -> IDENTIFICATION
-			break;
-
-		case IDENTIFICATION:                          // IDENTIFICATION has 16 bytes
-			if ((byte == '\r') || (byte == '\n')) {   // line end
-				identification[byte_iterator] = '\0'; // termination
-				print(log_debug, "Pull answer (vendor=%s, baudrate=%c, identification=%s)",
-					  name().c_str(), vendor, baudrate, identification);
-				byte_iterator = 0;
-				context = ACK; // set new context: IDENTIFICATION -> ACK (old: OBIS_CODE)
-				// warning we send the ACK only after receiving of next char. This works only as the
-				// ID is ended by \r \n
-			} else {
-				if (!isprint(byte)) {
-					print(log_error, "====> binary character '%x'", name().c_str(), byte);
-					// error_flag=true;
-				} else {
-					if (byte_iterator < IDENTIFICATION_LEN)
-						identification[byte_iterator++] = byte;
-					else
-						print(log_error, "Too much data for identification (byte=0x%X)",
-							  name().c_str(), byte);
-				}
-				// break;
-			}
-			break;
+		const char *pos = _buf + _bufPos;
+		D0Parser::Event event = _parser.parse(pos, _buf + _bufLen);
+		_bufPos = pos - _buf;
+
+		switch (event) {
+		case D0Parser::NEED_DATA:
+			// reset timeout if we are making progress
+			if (_parser.started())
+				progress_time = _lastFill;
+			break;
+
+		case D0Parser::HEADER: {
+			const char *vendor = _parser.vendor();
+			char baudrate = _parser.baudrate();
+			print(log_debug, "Pull answer (vendor=%s, baudrate=%c, identification=%s)",
+				  name().c_str(), vendor, baudrate, _parser.identification());
+			number_of_tuples = 0; // a new telegram
+			// check for reaction time indicator: (3rd letter lower case)
+			if (islower(vendor[2]))
+				_reaction_time_ms = 20; // lower case indicates 20ms
+			else
+				_reaction_time_ms = 200; // upper case indicates 200ms
+			if (_pull.size())
+				transaction.guard(_reaction_time_ms);
 
-		case ACK:
 			if (_auto_ack || _ack.size()) {
+				double ack_time = vz::metrics::monotonic();
 				// first delay according to min reaction time:
 				usleep(_reaction_time_ms * 1000);
 
@@ -638,303 +549,99 @@ ssize_t MeterD0::read(std::vector<Reading> &rds, size_t max_readings) {
 					else
 						dump_file(CTRL, "tcdrain cfsetispeed");
 				}
+				_waitTime += vz::metrics::monotonic() - ack_time;
 			}
-			context = OBIS_CODE;
-			break;
-
-		case START_LINE:
-			break;
-
-		case OBIS_CODE:
-			print((log_level_t)(log_debug + 5), "DEBUG OBIS_CODE byte %c hex= %X ", name().c_str(),
-				  byte, byte);
-			if ((byte != '\n') && (byte != '\r') && (byte != 0x02)) { // exclude STX
-				if (byte == '(') {
-					obis_code[byte_iterator] = '\0';
-					byte_iterator = 0;
-					context = VALUE;
-				} else {
-					if (byte_iterator < OBIS_LEN)
-						obis_code[byte_iterator++] = byte;
-					else
-						print(log_error, "Too much data for obis_code (byte=0x%X)", name().c_str(),
-							  byte);
-				}
-			}
-			break;
-
-		case VALUE:
-			print(((log_level_t)(log_debug + 5)), "DEBUG VALUE byte= %c hex= %x ", name().c_str(),
-				  byte, byte);
-			if ((byte == '*') || (byte == ')')) {
-				value[byte_iterator] = '\0';
-				byte_iterator = 0;
-
-				if (byte == ')') {
-					unit[0] = '\0';
-					context = END_LINE;
-				} else {
-					context = UNIT;
-				}
-			} else {
-				if (byte_iterator < VALUE_LEN)
-					value[byte_iterator++] = byte;
-				else
-					print(log_error, "Too much data for value (byte=0x%X)", name().c_str(), byte);
-			}
-			break;
-
-		case UNIT:
-			if (byte == ')') {
-				unit[byte_iterator] = '\0';
-				byte_iterator = 0;
-				context = END_LINE;
-			} else {
-				if (byte_iterator < UNIT_LEN)
-					unit[byte_iterator++] = byte;
-				else
-					print(log_error, "Too much data for unit (byte=0x%X)", name().c_str(), byte);
+		} break;
+
+		case D0Parser::RECORD: {
+			D0Parser::Slice obis = _parser.obisText(), value = _parser.value(),
+							unit = _parser.unit();
+			print(log_debug, "Parsed reading (OBIS code=%.*s, value=%.*s, unit=%.*s)",
+				  name().c_str(), (int)obis.len, obis.data, (int)value.len, value.data,
+				  (int)unit.len, unit.data);
+			if (number_of_tuples < max_readings) { // free slots available?
+				rds[number_of_tuples].value(_parser.number());
+				rds[number_of_tuples].identifier(_identifiers.get(_parser.obis()));
+				rds[number_of_tuples].time();
+				number_of_tuples++;
 			}
-			break;
+		} break;
 
-		case END_LINE:
-			print(log_alert, "logical error in state machine. reached END_LINE", name().c_str());
-			goto error; // this should never happen
+		case D0Parser::INVALID:
+			print(log_alert, "Failed to parse obis code (%s)", name().c_str(),
+				  _parser.obisText().str().c_str());
 			break;
 
-		case END:
-			// here we stay until we receive either:
-			// a) ! as end indicator
-			// b) ?! as pull seq indicator -> wait for VENDOR
-			// c) how to handle ? with something else? -> ignore (so ??! will be accepted as b)
-			// d) 0x0d 0x0a ? -> ignore, so stay in END state.
-			// above is new! Previous versions ended on all but ? ("assuming !")
-
-			if (byte == '!') {
-				if (byte_iterator == 0) {
-					// case a) ! as end ind.
-					// fallthrough to return number of tuples below.
-				} else {
-					// can only be case b) ?!.
-					if (endseq[0] == '?') {
-						context = VENDOR;
-						byte_iterator = 0;
-						break;
-					} else {
-						error_flag = true; // state machine logic error!
-						print(log_debug, "DEBUG END b2 byte: %x byte_it: %d ", name().c_str(), byte,
-							  byte_iterator);
-					}
-				}
-			} else if (byte == '?') {
-				if (byte_iterator == 0) {
-					// can be start of case b, store it
-					endseq[byte_iterator++] = byte;
-					break;
-				} else {
-					// we simply keep the state. so we accept ??! as well
-					break;
-				}
-			} else if (byte == STX) {
-				// some meter seem to send ? STX ... as start package. (e.g. AS1440)
-				context = OBIS_CODE;
-				byte_iterator = 0;
-				break;
-			} else if (byte == '/') { // go to vendor
-				context = VENDOR;
-				byte_iterator = 0;
-				break;
-			} else { // any other char than ! or ?:
-				if (byte_iterator > 0)
-					byte_iterator = 0; // reset ? reminder
-				break; // but stay in this state and accept that char! (here we ended before!)
-					   // TODO Think about a timeout here?
-			}
-
-			if (error_flag) {
-				print(log_error, "reading binary values.", name().c_str());
-				goto error;
-			}
-
+		case D0Parser::END:
 			print(log_debug,
 				  "Read package with %i tuples (vendor=%s, baudrate=%c, identification=%s)",
-				  name().c_str(), number_of_tuples, vendor, baudrate, identification);
+				  name().c_str(), number_of_tuples, _parser.vendor(), _parser.baudrate(),
+				  _parser.identification());
+			if (_parser.skipped())
+				print(log_debug, "Skipped %zu lines", name().c_str(), _parser.skipped());
+			if (_parser.dropped())
+				print(log_error, "Dropped %zu bytes of binary or too long data", name().c_str(),
+					  _parser.dropped());
+			print(log_debug, "%zu bytes in %zu reads (%.1f per read), parsing took %.3f ms",
+				  name().c_str(), _bytesRead, _readCalls,
+				  _readCalls ? (double)_bytesRead / _readCalls : 0.0,
+				  (vz::metrics::monotonic() - start_time - _waitTime) * 1000);
 			return number_of_tuples;
-		} // end switch
-
-		if (END_LINE == context) { // add the data already here (so after the closing bracket) but
-								   // before any \r\n
-			// free slots available and sane content?
-			if ((number_of_tuples < max_readings) && (strlen(obis_code) > 0) &&
-				(strlen(value) > 0)) {
-				switch (obis_code[0]) { // let's check sanity of first char. we can't use isValid()
-										// as here we get incomplete obis_codes as well (e.g. 1.8.0
-										// -> 255-255:1.8.0)
-				case '0':               // nobreak;
-				case '1':               // nobreak;
-				case '2':               // nobreak;
-				case '3':               // nobreak;
-				case '4':               // nobreak;
-				case '5':               // nobreak;
-				case '6':               // nobreak;
-				case '7':               // nobreak;
-				case '8':               // nobreak;
-				case '9':               // nobreak;
-				case 'C':               // nobreak;
-				case 'F':
-					print(log_debug, "Parsed reading (OBIS code=%s, value=%s, unit=%s)",
-						  name().c_str(), obis_code, value, unit);
-					rds[number_of_tuples].value(strtod(value, NULL));
 
-					try {
-						Obis obis(obis_code);
-						ReadingIdentifier *rid(new ObisIdentifier(obis));
-						rds[number_of_tuples].identifier(rid);
-						rds[number_of_tuples].time();
-						number_of_tuples++;
-					} catch (vz::VZException &e) {
-						print(log_alert, "Failed to parse obis code (%s)", name().c_str(),
-							  obis_code);
-					}
-					break;
-				case 'L': // nobreak; // L, P not supported yet
-				case 'P': // nobreak;
-				default:
-					print(log_debug, "Ignored reading (OBIS code=%s, value=%s, unit=%s)",
-						  name().c_str(), obis_code, value, unit);
-					break;
-				}
-			}
-			byte_iterator = 0;
-			context = OBIS_CODE;
+		case D0Parser::ERROR:
+			print(log_alert, "Invalid vendor id (%s)", name().c_str(), _parser.vendor());
+			return number_of_tuples; // return number of good readings so far.
 		}
-
 	} // end while
 
 	// Read terminated
-	print(log_alert, "read timed out!, context: %i, bytes read: %i, last byte 0x%x", name().c_str(),
-		  context, byte_iterator, lastbyte);
+	print(log_alert, "read timed out!, %zu bytes read", name().c_str(), _bytesRead);
 	return number_of_tuples; // in any case return the number of readings. there might be some valid
 							 // ones.
-
-error:
-	print(log_alert, "Something unexpected happened: %s:%i!", name().c_str(), __FUNCTION__,
-		  __LINE__);
-	return number_of_tuples; // return number of good readings so far.
 }
 
-int MeterD0::_openSocket(const char *node, const char *service) {
-	struct sockaddr_in sin;
-	struct addrinfo *ais;
-	int fd; // file descriptor
-	int res;
-
-	fd = socket(PF_INET, SOCK_STREAM, 0);
-	if (fd < 0) {
-		print(log_alert, "socket(): %s", name().c_str(), strerror(errno));
-		return ERR;
-	}
-
-	getaddrinfo(node, service, NULL, &ais);
-	memcpy(&sin, ais->ai_addr, ais->ai_addrlen);
-	freeaddrinfo(ais);
-
-	res = connect(fd, (struct sockaddr *)&sin, sizeof(sin));
-	if (res < 0) {
-		print(log_alert, "connect(%s, %s): %s", name().c_str(), node, service, strerror(errno));
-		return ERR;
-	}
-
-	return fd;
-}
-
-int MeterD0::_openDevice(struct termios *old_tio, speed_t baudrate) {
-	struct termios tio;
-	memset(&tio, 0, sizeof(struct termios));
-
-	int fd = ::open(device(), O_RDWR);
-	if (fd < 0) {
-		print(log_alert, "open(%s): %s", name().c_str(), device(), strerror(errno));
-		return ERR;
-	}
-
-	// get old configuration
-	tcgetattr(fd, &tio);
-
-	// backup old configuration to restore it when closing the meter connection
-	memcpy(old_tio, &tio, sizeof(struct termios));
-	/*
-	initialize all control characters
-	default values can be found in /usr/include/termios.h, and are given
-	in the comments, but we don't need them here
-	*/
-	tio.c_cc[VINTR] = 0;    // Ctrl-c
-	tio.c_cc[VQUIT] = 0;    // Ctrl-<backslash>
-	tio.c_cc[VERASE] = 0;   // del
-	tio.c_cc[VKILL] = 0;    // @
-	tio.c_cc[VEOF] = 4;     // Ctrl-d
-	tio.c_cc[VTIME] = 0;    // inter-character timer unused
-	tio.c_cc[VMIN] = 1;     // blocking read until 1 character arrives
-	tio.c_cc[VSWTC] = 0;    // '\0'
-	tio.c_cc[VSTART] = 0;   // Ctrl-q
-	tio.c_cc[VSTOP] = 0;    // Ctrl-s
-	tio.c_cc[VSUSP] = 0;    // Ctrl-z
-	tio.c_cc[VEOL] = 0;     // '\0'
-	tio.c_cc[VREPRINT] = 0; // Ctrl-r
-	tio.c_cc[VDISCARD] = 0; // Ctrl-u
-	tio.c_cc[VWERASE] = 0;  // Ctrl-w
-	tio.c_cc[VLNEXT] = 0;   // Ctrl-v
-	tio.c_cc[VEOL2] = 0;    // '\0'
-
-	tio.c_iflag &= ~(BRKINT | INLCR | IMAXBEL | IXOFF | IXON);
-	tio.c_oflag &= ~(OPOST | ONLCR);
-	tio.c_lflag &= ~(ISIG | ICANON | IEXTEN | ECHO);
+int MeterD0::_fill(int timeout_ms) {
+	double wait_start = vz::metrics::monotonic();
+	double deadline = wait_start + timeout_ms / 1000.0;
+	ssize_t len;
+	for (;;) {
+		// signals and spurious wakeups retry with the remaining time
+		int remaining = (int)((deadline - vz::metrics::monotonic()) * 1000);
+		if (remaining < 0)
+			remaining = 0;
+		struct pollfd pfd;
+		pfd.fd = _fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int res = poll(&pfd, 1, remaining);
+		if (res == 0 && remaining == 0) {
+			_waitTime += vz::metrics::monotonic() - wait_start;
+			return 0;
+		}
+		if (res < 0 && errno != EINTR) {
+			print(log_error, "error waiting for data (%s)", name().c_str(), strerror(errno));
+			return -1;
+		}
+		if (res <= 0)
+			continue;
 
-	switch (_parity) {
-	case parity_8n1:
-		tio.c_cflag &= ~PARENB;
-		tio.c_cflag &= ~PARODD;
-		tio.c_cflag &= ~CSTOPB;
-		tio.c_cflag &= ~CSIZE;
-		tio.c_cflag |= CS8;
-		break;
-	case parity_7n1:
-		tio.c_cflag &= ~PARENB;
-		tio.c_cflag &= ~PARODD;
-		tio.c_cflag &= ~CSTOPB;
-		tio.c_cflag &= ~CSIZE;
-		tio.c_cflag |= CS7;
-		break;
-	case parity_7e1:
-		tio.c_cflag &= ~CRTSCTS;
-		tio.c_cflag |= PARENB;
-		tio.c_cflag &= ~PARODD;
-		tio.c_cflag &= ~CSTOPB;
-		tio.c_cflag &= ~CSIZE;
-		tio.c_cflag |= CS7;
-		break;
-	case parity_7o1:
-		tio.c_cflag &= ~PARENB;
-		tio.c_cflag |= PARODD;
-		tio.c_cflag &= ~CSTOPB;
-		tio.c_cflag &= ~CSIZE;
-		tio.c_cflag |= CS7;
-		break;
+		len = ::read(_fd, _buf, sizeof(_buf));
+		if (len > 0)
+			break;
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			continue;
+		print(log_error, "error reading data (%s)", name().c_str(),
+			  len ? strerror(errno) : "end of file");
+		return -1;
 	}
-	// Set return rules for read to prevent endless waiting
-	tio.c_cc[VTIME] = 50; // inter-character timer  50*0.1
-	tio.c_cc[VMIN] = 0;   // VTIME is timeout counter
-	// now clean the modem line and activate the settings for the port
-
-	tcflush(fd, TCIOFLUSH);
-	// set baudrate
-	cfsetispeed(&tio, baudrate);
-	cfsetospeed(&tio, baudrate);
-
-	// apply new configuration
-	tcsetattr(fd, TCSANOW, &tio);
-
-	return fd;
+	_lastFill = vz::metrics::monotonic();
+	_waitTime += _lastFill - wait_start;
+	_bufPos = 0;
+	_bufLen = len;
+	_readCalls++;
+	_bytesRead += len;
+	dump_file(DUMP_IN, _buf, len);
+	return 1;
 }
 
 void MeterD0::dump_file(DUMP_MODE ctrl, const char *str) {
@@ -23,23 +23,28 @@
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "MqttTopicTrie.hpp"
 #include "mqtt.hpp"
 #include "Options.hpp"
 #include "protocols/MeterMQTT.hpp"
 #include <VZException.hpp>
 #include "Json.hpp"
 
+#define MQTT_MAX_PENDING 10000 // readings kept if read() doesn't keep up
+
 MeterMQTT::MeterMQTT(const std::list<Option> &options)
-	: Protocol("mqtt") {
+	: Protocol("mqtt"), _time_value(0), _tok(NULL) {
 	_open = false;
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_cond, NULL);
 	OptionList optlist;
 
 	try {
 		_subscription = optlist.lookup_string(options, "subscription");
 		if (_subscription.length() == 0)
 			throw vz::OptionNotFoundException("subscription empty"); 
-		if (_subscription.find('#') != std::string::npos || _subscription.find('+') != std::string::npos)
-			throw vz::VZException("subscription wildcards '#' or '+' not supported"); 
+		if (!MqttTopicTrie<MqttSubscriber *>::valid(_subscription))
+			throw vz::VZException("wildcards '+' and '#' have to be a whole topic level, '#' the last one"); 
 	} catch (vz::OptionNotFoundException &e) {
 		print(log_alert, "Missing subscription", name().c_str());
 		throw;		
@@ -50,6 +55,13 @@ MeterMQTT::MeterMQTT(const std::list<Option> &options)
 		throw;
 	}
 
+	try {
+		_topic_identifier = optlist.lookup_bool(options, "topic_identifier");
+	} catch (vz::OptionNotFoundException &e) {
+		/* wildcard subscriptions need the topic to tell the readings apart */
+		_topic_identifier = _subscription.find_first_of("+#") != std::string::npos;
+	}
+
 	try {
 		_use_local_time = optlist.lookup_bool(options, "use_local_time");
 	} catch (vz::OptionNotFoundException &e) {
@@ -132,7 +144,33 @@ MeterMQTT::MeterMQTT(const std::list<Option> &options)
 		throw;
 	}
 	
-	print(log_info, "Initialized: subscription: %s", name().c_str(), _subscription.c_str());
+	try {
+		_stream_parser = optlist.lookup_bool(options, "stream_parser");
+	} catch (vz::OptionNotFoundException &e) {
+		/* using default value if not specified */
+		_stream_parser = false;
+	}
+
+	// compile the paths once, all values are extracted with one walk per message
+	try {
+		for (size_t idx = 0; idx < _data_query_values.size(); idx++) {
+			JsonPath path(_data_query_values[idx]);
+			_extractor.add(path);
+			_value_names.push_back(path.name());
+		}
+		if (!_use_local_time)
+			_time_value = _extractor.add(JsonPath(_data_query_time));
+	} catch (vz::VZException &e) {
+		print(log_alert, "Invalid data_query: %s", name().c_str(), e.what());
+		throw;
+	}
+	if (_stream_parser && !_extractor.streamable()) {
+		print(log_warning, "stream_parser doesn't support negative indices, using json-c", name().c_str());
+		_stream_parser = false;
+	}
+
+	print(log_info, "Initialized: subscription: %s, topic_identifier: %d, stream_parser: %d",
+		  name().c_str(), _subscription.c_str(), _topic_identifier, _stream_parser);
 	for (size_t idx = 0; idx < _data_query_values.size(); idx++)
 		print(log_info, "data_query_value[%u]: %s", name().c_str(), idx, _data_query_values[idx].c_str());
 	print(log_info, "data_query_time: %s, unit: %d", name().c_str(), _data_query_time.c_str(), _time_unit);
@@ -141,6 +179,11 @@ MeterMQTT::MeterMQTT(const std::list<Option> &options)
 }
 
 MeterMQTT::~MeterMQTT() {
+	close();
+	if (_tok)
+		json_tokener_free(_tok);
+	pthread_cond_destroy(&_cond);
+	pthread_mutex_destroy(&_mutex);
 }
 
 int MeterMQTT::open() {
@@ -149,123 +192,157 @@ int MeterMQTT::open() {
 		return ERR;
 	}
 	
-	if (!mqttClient->subscribe(_subscription)) {
+	_open = true;
+	if (!mqttClient->subscribe(_subscription, this)) {
 		print(log_alert, "mqttClient.subscribe failed", name().c_str());
+		_open = false;
 		return ERR;
 	}
 	
-	_open = true;
 	return SUCCESS;
 }
 
 int MeterMQTT::close() {
 	if (_open && mqttClient)	{
-		mqttClient->unsubscribe(_subscription);
+		mqttClient->unsubscribe(_subscription, this);
 	}
+	pthread_mutex_lock(&_mutex);
 	_open = false;
+	_pending.clear();
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_mutex);
 	return SUCCESS;
 }
 
+static void unlock_mutex(void *mutex) { pthread_mutex_unlock(static_cast<pthread_mutex_t *>(mutex)); }
+
 ssize_t MeterMQTT::read(std::vector<Reading> &rds, size_t rds_max) {
-	if (_open && mqttClient) {
-		std::vector<std::string> data;
-		
-		if (_read_pending.size() == 0) {
-			mqttClient->receive(_subscription, data);
-		} else {
-			_read_pending.swap(data);
-			std::vector<std::string> data_add;
-			mqttClient->receive(_subscription, data_add);
-			data.insert(data.end(), data_add.begin(), data_add.end());
+	if (rds.size() < rds_max)
+		rds_max = rds.size();
+	size_t n = 0;
+
+	pthread_mutex_lock(&_mutex);
+	pthread_cleanup_push(&unlock_mutex, &_mutex); // the reading thread is cancelled while waiting
+
+	// wake up as soon as a message arrives, but return at least once a second
+	// so that the aggregation of the reading thread keeps its timing
+	if (_pending.empty() && _open) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += 1;
+		while (_pending.empty() && _open) {
+			if (pthread_cond_timedwait(&_cond, &_mutex, &deadline) == ETIMEDOUT)
+				break;
 		}
-			
-		if (data.size() > 0) {
-			size_t rds_pos = 0;
-			size_t parsed = 0;
-			if (rds.size() < rds_max)
-				rds_max = rds.size();
-			std::vector<std::string>::iterator it = data.begin();			
-			for (; it != data.end() && rds_pos < rds_max; ++it) {				
-				ssize_t res = parse(*it, rds, rds_pos, rds_max);
-				if (res < 0) {
-					print(log_warning, "Parsing aborted, %d data-messages queued again", name().c_str(), data.size() - parsed);
-					break;
-				}
-				parsed++;
-				rds_pos += res;				
-			}
-			
-			if (it != data.end()) {
-				data.erase(data.begin(), ++it);
-				data.swap(_read_pending);
-			} 
-			
-			return rds_pos;
+	}
+
+	for (; n < rds_max && !_pending.empty(); n++) {
+		rds[n] = _pending.front();
+		_pending.pop_front();
+	}
+	if (!_pending.empty())
+		print(log_debug, "%u readings still pending", name().c_str(), _pending.size());
+
+	pthread_cleanup_pop(1);
+	return n;
+}
+
+void MeterMQTT::message(const char *topic, const char *payload, size_t len) {
+	size_t n = parse(topic, payload, len, _parsed);
+	if (n == 0)
+		return;
+
+	size_t dropped = 0;
+	pthread_mutex_lock(&_mutex);
+	for (size_t i = 0; i < n; i++) {
+		if (_pending.size() >= MQTT_MAX_PENDING) {
+			_pending.pop_front();
+			dropped++;
 		}
-	}	
-	return 0;
+		_pending.push_back(_parsed[i]);
+	}
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock(&_mutex);
+
+	if (dropped)
+		print(log_warning, "Too many pending readings, dropped %u", name().c_str(), dropped);
 }
 
-ssize_t MeterMQTT::parse(const std::string& msg, std::vector<Reading> &rds, size_t rds_pos, size_t rds_max) {
-	if (rds_pos >= rds_max)
-		return -1;
-		
-	ssize_t res = 0;
-	struct json_object *json_data = NULL;
-	struct json_tokener *json_tok = json_tokener_new();
-	
-	json_data = json_tokener_parse_ex(json_tok, msg.c_str(), msg.length());
-	if (json_tok->err == json_tokener_success) {
-		struct timeval tv;
-		bool tv_valid = false;
-		
-		for (size_t idx = 0; idx < _data_query_values.size() && rds_pos < rds_max; idx++) {
-			std::string query_value = _data_query_values[idx];
-			std::string id;
-			struct json_object *jvalue = json_path_single(json_data, query_value.c_str(), &id, 2, json_type_double, json_type_int);
-			if (jvalue) {
-				rds[rds_pos].value( json_object_get_double(jvalue) );				
-			
-				ReadingIdentifier *rid(new StringIdentifier(id));
-				rds[rds_pos].identifier(rid);
-				
-				if (!tv_valid) {				
-					if (!_use_local_time) {
-						struct json_object *jtime = json_path_single(json_data, _data_query_time.c_str(), 2, json_type_int, json_type_double);
-						if (jtime) {
-							int64_t t = json_object_get_int64(jtime);
-							if (_time_unit == 0) {
-								tv.tv_sec = (long)(t / 1000);
-								tv.tv_usec = (long)(t % 1000) * 1000;	
-								tv_valid = true;					
-							} else if (_time_unit == 1) {					
-								tv.tv_sec = (long)t;
-								tv.tv_usec = 0;
-								tv_valid = true;
-							} 
-						}															
-					} else {
-						gettimeofday(&tv, NULL); /* use local time */
-						tv_valid = true;
-					}
-				}
-				
-				if (!tv_valid) {
-					print(log_finest, "Time '%s' not found in object: %s", name().c_str(), _data_query_time.c_str(), json_object_to_json_string(json_data)); 	
-					break;
-				}
-				
-				rds[rds_pos].time(tv);
-				res++;
-				rds_pos++;
-			} else {
-				print(log_finest, "Value '%s' not found in object: %s", name().c_str(), query_value.c_str(), json_object_to_json_string(json_data)); 	
-			}
+size_t MeterMQTT::parse(const char *topic, const char *msg, size_t len, std::vector<Reading> &rds) {
+	size_t res = 0;
+
+	if (_stream_parser) {
+		// the mosquitto buffer is scanned directly, no json-c objects are created
+		if (!_extractor.extract(msg, len, _values)) {
+			print(log_finest, "Invalid json on %s", name().c_str(), topic);
+			return 0;
+		}
+	} else {
+		if (_tok == NULL)
+			_tok = json_tokener_new();
+		else
+			json_tokener_reset(_tok);
+
+		// parse directly from the mosquitto buffer, it is not necessarily null terminated
+		struct json_object *json_data = json_tokener_parse_ex(_tok, msg, len);
+		if (_tok->err != json_tokener_success) {
+			print(log_finest, "Invalid json on %s: %s", name().c_str(), topic,
+				  json_tokener_error_desc(_tok->err));
+			return 0;
 		}
-		json_object_put(json_data);	
+		_extractor.extract(json_data, _values);
+		json_object_put(json_data);
+	}
+
+	struct timeval tv;
+	if (!_use_local_time) {
+		const JsonExtractor::Value &t = _values[_time_value];
+		if (!t._found) {
+			print(log_finest, "Time '%s' not found in message on %s", name().c_str(),
+				  _data_query_time.c_str(), topic);
+			return 0;
+		}
+		int64_t time = t.toInt64();
+		if (_time_unit == 0) {
+			tv.tv_sec = (long)(time / 1000);
+			tv.tv_usec = (long)(time % 1000) * 1000;
+		} else {
+			tv.tv_sec = (long)time;
+			tv.tv_usec = 0;
+		}
+	} else {
+		gettimeofday(&tv, NULL); /* use local time */
+	}
+
+	auto it = _identifiers.find(topic);
+	if (it == _identifiers.end()) {
+		if (_identifiers.size() >= 256)
+			_identifiers.clear(); // e.g. a wildcard subscription with changing topics
+		it = _identifiers
+				 .emplace(topic, std::vector<ReadingIdentifier::Ptr>(_data_query_values.size()))
+				 .first;
+	}
+	std::vector<ReadingIdentifier::Ptr> &ids = it->second;
+	if (rds.size() < _data_query_values.size())
+		rds.resize(_data_query_values.size());
+
+	for (size_t idx = 0; idx < _data_query_values.size(); idx++) {
+		const JsonExtractor::Value &v = _values[idx];
+		if (!v._found) {
+			print(log_finest, "Value '%s' not found in message on %s", name().c_str(),
+				  _data_query_values[idx].c_str(), topic);
+			continue;
+		}
+
+		if (!ids[idx]) {
+			ids[idx] = ReadingIdentifier::Ptr(new StringIdentifier(
+				_topic_identifier ? std::string(topic) + "/" + _value_names[idx] : _value_names[idx]));
+		}
+		rds[res].identifier(ids[idx]);
+		rds[res].value(v.toDouble());
+		rds[res].time(tv);
+		res++;
 	}
-	
-	json_tokener_free(json_tok);
 		
 	return res;	
 }
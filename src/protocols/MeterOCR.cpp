@@ -57,6 +57,7 @@ affected.
 // #include <stdio.h>
 // #include <stdlib.h>
 // #include <sys/time.h>
+#include <algorithm>
 #include <climits>
 #include <cmath>
 #include <errno.h>
@@ -247,22 +248,13 @@ MeterOCR::RecognizerNeedle::RecognizerNeedle(struct json_object *jr)
 	}
 }
 
-bool MeterOCR::RecognizerNeedle::recognize(PIX *imageO, int dX, int dY, ReadsMap &readings,
+bool MeterOCR::RecognizerNeedle::recognize(Frame &frame, int dX, int dY, ReadsMap &readings,
 										   const ReadsMap *old_readings, PIXA *debugPixa) {
-	if (!imageO)
-		return false;
 	// 1st step: crop the image:
-	PIX *image = pixClone(imageO);
-
-	// now crop the image if possible:
 	print(log_debug, "Cropping image to (%d,%d)-(%d,%d)", "ocr", _min_x, _min_y, _max_x, _max_y);
-	PIX *image2 = pixCreate(_max_x - _min_x, _max_y - _min_y, pixGetDepth(image));
-	pixCopyResolution(image2, image);
-	pixCopyColormap(image2, image);
-	pixRasterop(image2, 0, 0, _max_x - _min_x, _max_y - _min_y, PIX_SRC, image, _min_x + dX,
-				_min_y + dY);
-	pixDestroy(&image);
-	image = image2;
+	PIX *image = frame.crop(false, _min_x + dX, _min_y + dY, _max_x - _min_x, _max_y - _min_y);
+	if (!image)
+		return false;
 	saveDebugImage(debugPixa, image, "cropped");
 
 	// now filter on red color either using provided matrix or std. internally the needles have to
@@ -277,7 +269,7 @@ bool MeterOCR::RecognizerNeedle::recognize(PIX *imageO, int dX, int dY, ReadsMap
 		kernelSetElement(kel, 0, 2, -1.0);
 	}
 
-	image2 = pixMultMatrixColor(image, kel);
+	PIX *image2 = pixMultMatrixColor(image, kel);
 	pixDestroy(&image);
 	image = image2;
 	saveDebugImage(debugPixa, image, "multcolor");
@@ -539,22 +531,13 @@ MeterOCR::RecognizerBinary::RecognizerBinary(struct json_object *jr)
 
 MeterOCR::RecognizerBinary::~RecognizerBinary() {}
 
-bool MeterOCR::RecognizerBinary::recognize(PIX *imageO, int dX, int dY, ReadsMap &readings,
+bool MeterOCR::RecognizerBinary::recognize(Frame &frame, int dX, int dY, ReadsMap &readings,
 										   const ReadsMap *old_readings, PIXA *debugPixa) {
-	if (!imageO)
-		return false;
 	// 1st step: crop the image:
-	PIX *image = pixClone(imageO);
-
-	// now crop the image if possible:
 	print(log_debug, "Cropping image to (%d,%d)-(%d,%d)", "ocr", _min_x, _min_y, _max_x, _max_y);
-	PIX *image2 = pixCreate(_max_x - _min_x, _max_y - _min_y, pixGetDepth(image));
-	pixCopyResolution(image2, image);
-	pixCopyColormap(image2, image);
-	pixRasterop(image2, 0, 0, _max_x - _min_x, _max_y - _min_y, PIX_SRC, image, _min_x + dX,
-				_min_y + dY);
-	pixDestroy(&image);
-	image = image2;
+	PIX *image = frame.crop(false, _min_x + dX, _min_y + dY, _max_x - _min_x, _max_y - _min_y);
+	if (!image)
+		return false;
 	saveDebugImage(debugPixa, image, "cropped");
 
 	// now filter on red color either using provided matrix or std. internally the needles have to
@@ -569,7 +552,7 @@ bool MeterOCR::RecognizerBinary::recognize(PIX *imageO, int dX, int dY, ReadsMap
 		kernelSetElement(kel, 0, 2, -1.0);
 	}
 
-	image2 = pixMultMatrixColor(image, kel);
+	PIX *image2 = pixMultMatrixColor(image, kel);
 	pixDestroy(&image);
 	image = image2;
 	saveDebugImage(debugPixa, image, "multcolor");
@@ -788,6 +771,10 @@ MeterOCR::MeterOCR(const std::list<Option> &options)
 				_recognizer.push_back(r);
 				int minX, minY, maxX, maxY;
 				r->getCaptureCoords(minX, minY, maxX, maxY);
+				if (maxX <= 0) // boxes without end, up to the border of the image
+					maxX = INT_MAX;
+				if (maxY <= 0)
+					maxY = INT_MAX;
 				if (minX < _min_x)
 					_min_x = minX;
 				if (minY < _min_y)
@@ -816,6 +803,33 @@ void MeterOCR::Recognizer::saveDebugImage(PIXA *debugPixa, PIX *image, const cha
 	(void)title; // TODO p3 use pixSaveTiledWithText
 }
 
+MeterOCR::Frame::~Frame() {
+	pixDestroy(&_color);
+	if (_gray)
+		pixDestroy(&_gray);
+}
+
+PIX *MeterOCR::Frame::gray() {
+	if (!_gray)
+		_gray = pixGetDepth(_color) == 32 ? pixConvertRGBToLuminance(_color) : pixClone(_color);
+	return _gray;
+}
+
+PIX *MeterOCR::Frame::crop(bool gray, int cx, int cy, int w, int h) {
+	PIX *src = gray ? this->gray() : _color;
+	if (!src || w <= 0 || h <= 0)
+		return 0;
+	PIX *image = pixCreate(w, h, pixGetDepth(src));
+	pixCopyResolution(image, src);
+	pixCopyColormap(image, src);
+	pixRasterop(image, 0, 0, w, h, PIX_SRC, src, cx - x, cy - y);
+	return image;
+}
+
+int MeterOCR::Frame::right() const { return x + pixGetWidth(_color); }
+
+int MeterOCR::Frame::bottom() const { return y + pixGetHeight(_color); }
+
 MeterOCR::~MeterOCR() {
 	if (_last_reads)
 		delete _last_reads;
@@ -1200,6 +1214,19 @@ static void YUV422toRGBA888(int stride_s_w, int stride_s_h, int stride_d_w, int
 	}
 }
 
+// copies the luma of a YUYV window into the same window of an 8 bpp image
+static void YUV422toY8(int stride_s_w, int s_x, int s_y, int width, int height,
+					   const unsigned char *src, Pix *dst) {
+	l_uint32 *data = pixGetData(dst);
+	int wpl = pixGetWpl(dst);
+	for (int line = s_y; line < s_y + height; ++line) {
+		const unsigned char *py = src + 2 * ((stride_s_w * line) + s_x);
+		l_uint32 *lined = data + line * wpl;
+		for (int column = s_x; column < s_x + width; ++column, py += 2)
+			SET_DATA_BYTE(lined, column, *py);
+	}
+}
+
 bool MeterOCR::readV4l2Frame(Pix *&image, bool first_time) {
 	bool toRet = false;
 	struct v4l2_buffer buf;
@@ -1233,38 +1260,43 @@ bool MeterOCR::readV4l2Frame(Pix *&image, bool first_time) {
 	print(log_finest, "buf.index=%d buf.bytesused=%d", name().c_str(), buf.index, buf.bytesused);
 
 	if (!image) {
-		// return buffer:
+		// skipped frame, return the buffer without converting it:
 		if (-1 == xioctl(_v4l2_fd, VIDIOC_QBUF, &buf)) {
 			print(log_alert, "VIDIOC_QBUF failed", name().c_str());
 		}
 		return false;
 	}
-	// copy into a Pix image (!would be better if we don't need to copy!)
-	// check that the data is big enough:
+	// the frame is converted into the persistent image in place, only the part used for the
+	// region of interest. 8 bpp images get the luma only.
 	int32_t w, h, d;
 	pixGetDimensions(image, &w, &h, &d);
-	// image can be smaller than cap_size_x/y in this case render to
-	// _min_x, _min_y,...
-
-	if (buf.bytesused >= ((unsigned int)w * (unsigned int)h *
-						  (unsigned int)(d / 16))) { // we expect half of the data we need
-		// convert from yuyv(yuv2) to RGBA:
+	const unsigned char *src = (const unsigned char *)(_v4l2_buffers[buf.index].start);
+
+	if (buf.bytesused >= ((unsigned int)w * (unsigned int)h * 2)) { // YUYV: 2 bytes per pixel
+		int x1, y1, x2, y2;
+		roiSource(w, h, x1, y1, x2, y2);
+		x1 = std::max(x1, 0) & ~1; // YUYV macropixels (two pixels) are converted as a whole
+		y1 = std::max(y1, 0);
+		x2 = std::min((x2 + 1) & ~1, w);
+		y2 = std::min(y2, h);
 		if (first_time) {
 			// if for the first time we convert the full picture and draw a rectangle around the
 			// area to be searched:
-			YUV422toRGBA888(_v4l2_cap_size_x, _v4l2_cap_size_y, w, h, 0, 0, w, h,
-							(uint8_t *)(_v4l2_buffers[buf.index].start),
-							(uint8_t *)pixGetData(image));
-			// draw rectangle in green:
-			BOX *box = boxCreate(_min_x - 1, _min_y - 1, _max_x - _min_x + 2, _max_y - _min_y + 2);
+			if (d == 8)
+				YUV422toY8(_v4l2_cap_size_x, 0, 0, w, h, src, image);
+			else
+				YUV422toRGBA888(_v4l2_cap_size_x, _v4l2_cap_size_y, w, h, 0, 0, w, h,
+								(uint8_t *)src, (uint8_t *)pixGetData(image));
+			// draw rectangle in green (outside of the area, it's not overwritten later on):
+			BOX *box = boxCreate(x1 - 1, y1 - 1, x2 - x1 + 2, y2 - y1 + 2);
 			pixRenderBoxArb(image, box, 1, 0, 0xff, 0);
 			boxDestroy(&box);
-		} else {
+		} else if (d == 8) {
 			// we only update the interesting rectangle
-			YUV422toRGBA888(_v4l2_cap_size_x, _v4l2_cap_size_y, w, h, _min_x, _min_y,
-							_max_x - _min_x, _max_y - _min_y,
-							(uint8_t *)(_v4l2_buffers[buf.index].start),
-							(uint8_t *)pixGetData(image));
+			YUV422toY8(_v4l2_cap_size_x, x1, y1, x2 - x1, y2 - y1, src, image);
+		} else {
+			YUV422toRGBA888(_v4l2_cap_size_x, _v4l2_cap_size_y, w, h, x1, y1, x2 - x1, y2 - y1,
+							(uint8_t *)src, (uint8_t *)pixGetData(image));
 		}
 		toRet = true;
 	}
@@ -1335,6 +1367,124 @@ int MeterOCR::close() {
 
 double radians(double d) { return d * M_PI / 180; }
 
+void MeterOCR::roiRect(int w, int h, int &x1, int &y1, int &x2, int &y2) const {
+	x1 = _min_x;
+	y1 = _min_y;
+	x2 = std::min(_max_x, w); // INT_MAX for boxes without end, clamped before adding the range
+	y2 = std::min(_max_y, h);
+	if (_autofix_range > 0) { // the recognizers are moved by up to the range
+		x1 = std::min(x1 - _autofix_range, _autofix_x - _autofix_range);
+		y1 = std::min(y1 - _autofix_range, _autofix_y - _autofix_range);
+		x2 = std::max(x2 + _autofix_range, _autofix_x + _autofix_range + 1);
+		y2 = std::max(y2 + _autofix_range, _autofix_y + _autofix_range + 1);
+	}
+	x1 = std::max(x1, 0);
+	y1 = std::max(y1, 0);
+	x2 = std::min(x2, w);
+	y2 = std::min(y2, h);
+	if (x1 >= x2 || y1 >= y2) { // no capture coords, keep the full image
+		x1 = 0;
+		y1 = 0;
+		x2 = w;
+		y2 = h;
+	}
+}
+
+void MeterOCR::roiSource(int w, int h, int &x1, int &y1, int &x2, int &y2) const {
+	roiRect(w, h, x1, y1, x2, y2);
+	if (fabs(_rotate) < 0.1)
+		return;
+
+	// bounding box of the source of the rotated corners (+ margin for the interpolation):
+	double angle = radians(_rotate);
+	double cosa = cos(angle), sina = sin(angle);
+	int cx = w / 2, cy = h / 2;
+	double sx1 = INFINITY, sy1 = INFINITY, sx2 = -INFINITY, sy2 = -INFINITY;
+	for (int i = 0; i < 4; ++i) {
+		double px = (i & 1 ? x2 : x1) - cx;
+		double py = (i & 2 ? y2 : y1) - cy;
+		double sx = cx + cosa * px + sina * py;
+		double sy = cy - sina * px + cosa * py;
+		sx1 = std::min(sx1, sx);
+		sy1 = std::min(sy1, sy);
+		sx2 = std::max(sx2, sx);
+		sy2 = std::max(sy2, sy);
+	}
+	const int margin = 2;
+	x1 = (int)floor(sx1) - margin;
+	y1 = (int)floor(sy1) - margin;
+	x2 = (int)ceil(sx2) + margin;
+	y2 = (int)ceil(sy2) + margin;
+}
+
+PIX *MeterOCR::cropRoi(PIX *image, int &x, int &y) {
+	int w = pixGetWidth(image);
+	int h = pixGetHeight(image);
+
+	// the region of interest in the rotated image:
+	int x1, y1, x2, y2;
+	roiRect(w, h, x1, y1, x2, y2);
+	x = x1;
+	y = y1;
+
+	if (fabs(_rotate) < 0.1) {
+		BOX *box = boxCreate(x1, y1, x2 - x1, y2 - y1);
+		PIX *roi = pixClipRectangle(image, box, NULL);
+		boxDestroy(&box);
+		return roi;
+	}
+
+	// pixRotate() maps the rotated pixel p to the source c + M(p - c), with c the center and
+	// M = [cos sin; -sin cos]. Rotating a part S of the source with the center c + a instead
+	// gives the same pixels shifted by o = s0 + (M^T - I)a, s0 the origin of S. So a is chosen
+	// that the shift is (almost, the error is about 0.7 * angle pixels) integer.
+	double angle = radians(_rotate);
+	double cosa = cos(angle), sina = sin(angle);
+	int cx = w / 2, cy = h / 2;
+	int bx1, by1, bx2, by2;
+	roiSource(w, h, bx1, by1, bx2, by2);
+
+	// integer shift n = (M^T - I)a near the one of the center of the bounding box:
+	double ax = (bx1 + bx2) / 2.0 - cx, ay = (by1 + by2) / 2.0 - cy;
+	double nx = round((cosa - 1) * ax - sina * ay);
+	double ny = round(sina * ax + (cosa - 1) * ay);
+	double det = 2 * (1 - cosa); // (M^T - I)^-1 = [cos-1 sin; -sin cos-1] / det
+	int acx = (int)lround(((cosa - 1) * nx + sina * ny) / det);
+	int acy = (int)lround((-sina * nx + (cosa - 1) * ny) / det);
+	int scx = cx + acx, scy = cy + acy; // center of S
+	int hw = std::max(scx - bx1, bx2 - scx);
+	int hh = std::max(scy - by1, by2 - scy);
+
+	if ((double)(2 * hw) * (2 * hh) >= (double)w * h) {
+		// small angle: the center can't be moved far, rotate the full image
+		PIX *image_rot = pixRotate(image, angle, L_ROTATE_AREA_MAP, L_BRING_IN_WHITE, 0, 0);
+		if (!image_rot)
+			return 0;
+		BOX *box = boxCreate(x1, y1, x2 - x1, y2 - y1);
+		PIX *roi = pixClipRectangle(image_rot, box, NULL);
+		boxDestroy(&box);
+		pixDestroy(&image_rot);
+		return roi;
+	}
+
+	int s0x = scx - hw, s0y = scy - hh;
+	PIX *part = pixCreate(2 * hw, 2 * hh, pixGetDepth(image));
+	pixCopyResolution(part, image);
+	pixCopyColormap(part, image);
+	pixSetBlackOrWhite(part, L_SET_WHITE); // like the pixels brought in by pixRotate()
+	pixRasterop(part, 0, 0, 2 * hw, 2 * hh, PIX_SRC, image, s0x, s0y);
+	PIX *part_rot = pixRotate(part, angle, L_ROTATE_AREA_MAP, L_BRING_IN_WHITE, 0, 0);
+	pixDestroy(&part);
+	if (!part_rot)
+		return 0;
+
+	BOX *box = boxCreate(x1 - (s0x + (int)nx), y1 - (s0y + (int)ny), x2 - x1, y2 - y1);
+	PIX *roi = pixClipRectangle(part_rot, box, NULL);
+	boxDestroy(&box);
+	pixDestroy(&part_rot);
+	return roi;
+}
+
 ssize_t MeterOCR::read(std::vector<Reading> &rds, size_t max_reads) {
 
 	unsigned int i = 0;
@@ -1387,8 +1537,15 @@ ssize_t MeterOCR::read(std::vector<Reading> &rds, size_t max_reads) {
 			if (_min_y > _max_y)
 				_min_y = _max_y;
 
+			// the luminance is enough if no recognizer needs colors:
+			int depth = 8;
+			for (std::list<Recognizer *>::iterator it = _recognizer.begin();
+				 it != _recognizer.end(); ++it)
+				if (*it && (*it)->needsColor())
+					depth = 32;
+
 			first_time = true;
-			_last_image = pixCreateNoInit(_v4l2_cap_size_x, _v4l2_cap_size_y, 32);
+			_last_image = pixCreateNoInit(_v4l2_cap_size_x, _v4l2_cap_size_y, depth);
 		}
 
 		int skip = _v4l2_skip_frames + 1;
@@ -1424,25 +1581,21 @@ ssize_t MeterOCR::read(std::vector<Reading> &rds, size_t max_reads) {
 
 	PIXA *debugPixa = _generate_debug_image ? pixaCreate(0) : 0;
 
-	// rotate image if parameter set:
-	if (fabs(_rotate) >= 0.1) {
-		Pix *image_rot =
-			pixRotate(image, radians(_rotate), L_ROTATE_AREA_MAP, L_BRING_IN_WHITE, 0, 0);
-
-		if (image_rot) {
-			pixDestroy(&image);
-			image = image_rot;
-			image_rot = 0;
-		}
-		// for debugging to see the rotated picture:
-		if (debugPixa)
-			pixSaveTiled(image, debugPixa, 1, 0, 1, 32);
-		// TODO p3 double check with pixFindSkew? (auto-rotate?)
-	} else {
-		// add a small version of the input image:
+	// rotate (if parameter set) and crop the region used by the recognizers only:
+	int roi_x, roi_y;
+	PIX *roi = cropRoi(image, roi_x, roi_y);
+	pixDestroy(&image);
+	if (!roi) {
+		print(log_error, "couldn't crop the image", name().c_str());
 		if (debugPixa)
-			pixSaveTiled(image, debugPixa, 1, 0, 1, 32);
+			pixaDestroy(&debugPixa);
+		return 0;
 	}
+	Frame frame(roi, roi_x, roi_y);
+	// add a small version of the input image:
+	if (debugPixa)
+		pixSaveTiled(frame.color(), debugPixa, 1, 0, 1, 32);
+	// TODO p3 double check with pixFindSkew? (auto-rotate?)
 
 	// now do autofix detection:
 	// this works by scanning for two edges and moving the image relatively so that the two edges
@@ -1452,7 +1605,7 @@ ssize_t MeterOCR::read(std::vector<Reading> &rds, size_t max_reads) {
 	if (_autofix_range > 0) {
 		// TODO p2 add search direction. now we do from left to right and from bottom to top
 		// TODO p2 add parameter for edge intensity/threshold
-		autofixDetection(image, autofix_dX, autofix_dY, debugPixa);
+		autofixDetection(frame, autofix_dX, autofix_dY, debugPixa);
 	}
 
 	ReadsMap *new_reads = new ReadsMap;
@@ -1463,7 +1616,7 @@ ssize_t MeterOCR::read(std::vector<Reading> &rds, size_t max_reads) {
 	for (std::list<Recognizer *>::iterator it = _recognizer.begin(); it != _recognizer.end();
 		 ++it) { // let's stick to begin not cbegin (c++11)
 		if (*it)
-			(*it)->recognize(image, autofix_dX, autofix_dY, readings, _last_reads, debugPixa);
+			(*it)->recognize(frame, autofix_dX, autofix_dY, readings, _last_reads, debugPixa);
 	}
 
 	if (debugPixa && pixaGetCount(debugPixa) > 0) {
@@ -1526,7 +1679,7 @@ ssize_t MeterOCR::read(std::vector<Reading> &rds, size_t max_reads) {
 						{
 							FILE *fp = fopenWriteStream(outfilename.c_str(), "wb+");
 							if (fp) {
-								pixWriteStreamJpeg(fp, image, 100, 0); // 100, 0: 390ms (680kb)
+								pixWriteStreamJpeg(fp, frame.color(), 100, 0);
 								fclose(fp);
 							} else
 								print(log_alert, "couldn't open debug file", "ocr");
@@ -1551,7 +1704,6 @@ ssize_t MeterOCR::read(std::vector<Reading> &rds, size_t max_reads) {
 					break;
 			}
 		}
-	pixDestroy(&image);
 
 	// we provide those values to the recognizers even if not impulses wanted
 	if (_last_reads) {
@@ -1582,7 +1734,7 @@ int MeterOCR::calcImpulses(const double &value, const double &oldValue) const {
 	return imp;
 }
 
-bool MeterOCR::autofixDetection(Pix *image_org, int &dX, int &dY, PIXA *debugPixa) {
+bool MeterOCR::autofixDetection(Frame &frame, int &dX, int &dY, PIXA *debugPixa) {
 	std::string outfilename;
 
 	// now do autofix detection:
@@ -1591,22 +1743,14 @@ bool MeterOCR::autofixDetection(Pix *image_org, int &dX, int &dY, PIXA *debugPix
 	// detected center
 	if (_autofix_range > 0) {
 		int w = 2 * _autofix_range + 1;
-		// 1.step: crop the small detection area
-		PIX *img = pixCreate(w, w, pixGetDepth(image_org));
-		pixCopyResolution(img, image_org);
-		pixCopyColormap(img, image_org);
-		pixRasterop(img, 0, 0, w, w, PIX_SRC, image_org, _autofix_x - _autofix_range,
-					_autofix_y - _autofix_range);
-		// don't destroy image, we don't take the ownership
-
-		// 2nd step: change to grayscale
-		Pix *image_gs = pixConvertRGBToLuminance(img);
-		if (image_gs) {
-			pixDestroy(&img);
-			if (debugPixa)
-				pixSaveTiledWithText(image_gs, debugPixa, w, 1, 10, 1, 0, "autofix", 0xff000000,
-									 L_ADD_BELOW);
-		}
+		// 1.step: crop the small detection area from the grayscale frame
+		Pix *image_gs =
+			frame.crop(true, _autofix_x - _autofix_range, _autofix_y - _autofix_range, w, w);
+		if (!image_gs)
+			return false;
+		if (debugPixa)
+			pixSaveTiledWithText(image_gs, debugPixa, w, 1, 10, 1, 0, "autofix", 0xff000000,
+								 L_ADD_BELOW);
 
 		// 3rd step pixTwoSidedEdgeFilter
 		Pix *imgEdgeV = pixTwoSidedEdgeFilter(image_gs, L_VERTICAL_EDGES);
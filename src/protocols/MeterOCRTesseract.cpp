@@ -137,41 +137,33 @@ MeterOCR::RecognizerTesseract::RecognizerTesseract(struct json_object *jr)
 		_min_y1 = 0;
 }
 
-bool MeterOCR::RecognizerTesseract::recognize(PIX *imageO, int dX, int dY, ReadsMap &readings,
+bool MeterOCR::RecognizerTesseract::recognize(Frame &frame, int dX, int dY, ReadsMap &readings,
 											  const ReadsMap *old_readings, PIXA *debugPixa) {
 
-	// init tesseract (TODO if we do this in the constructor we get corrupted readings after 3-4
-	// read calls....) this is just a workaround
-	if (!initTesseract())
-		return 0;
-
-	PIX *image = pixClone(imageO);
+	// the engine is loaded once with the first image and kept. It used to be loaded for every
+	// image as readings got corrupted after 3-4 calls: the adaptive classifier learned from the
+	// previous images. Now learning is disabled and each box starts from the static classifier.
+	if (!api && !initTesseract())
+		return false;
 
-	// now crop the image if possible:
+	// crop the grayscale frame if possible. It's converted once and shared by the recognizers.
+	PIX *image;
 	if (_min_x1 > 0 || _max_x2 > 0 || _min_y1 > 0 || _max_y2 > 0) {
-		int w = _max_x2 > 0 ? _max_x2 : pixGetWidth(image);
+		int w = _max_x2 > 0 ? _max_x2 : frame.right();
 		w -= _min_x1;
-		int h = _max_y2 > 0 ? _max_y2 : pixGetHeight(image);
+		int h = _max_y2 > 0 ? _max_y2 : frame.bottom();
 		h -= _min_y1;
 		print(log_error, "Cropping image to (%d,%d)x(%d,%d)", "RecognizerTesseract", _min_x1,
 			  _min_y1, w, h);
-		PIX *image2 = pixCreate(w, h, pixGetDepth(image));
-		pixCopyResolution(image2, image);
-		pixCopyColormap(image2, image);
-		pixRasterop(image2, 0, 0, w, h, PIX_SRC, image, _min_x1 + dX, _min_y1 + dY);
-		pixDestroy(&image);
-		image = image2;
+		image = frame.crop(true, _min_x1 + dX, _min_y1 + dY, w, h);
 		saveDebugImage(debugPixa, image, "cropped");
-	}
-
-	// Convert the RGB image to grayscale
-	Pix *image_gs = pixConvertRGBToLuminance(image);
-	if (image_gs) {
-		pixDestroy(&image);
-		image = image_gs;
-		image_gs = 0;
+	} else {
+		image = pixCopy(NULL, frame.gray()); // the gamma correction works in place
 		saveDebugImage(debugPixa, image, "grayscale");
 	}
+	if (!image)
+		return false;
+	Pix *image_gs;
 
 	// Increase the dynamic range
 	// make dark gray *black* and light gray *white*
@@ -222,7 +214,7 @@ bool MeterOCR::RecognizerTesseract::recognize(PIX *imageO, int dX, int dY, Reads
 
 	api->SetImage(image);
 
-	Pix *dump = api->GetThresholdedImage();
+	Pix *dump = debugPixa ? api->GetThresholdedImage() : 0; // only for the debug image
 	//	outfilename=_file;
 	//	outfilename.append("thresh.tif");
 	//    pixWrite(outfilename.c_str(), dump, IFF_TIFF_G4);
@@ -263,6 +255,7 @@ bool MeterOCR::RecognizerTesseract::recognize(PIX *imageO, int dX, int dY, Reads
 		BOX *box = boxCreate(left, top, w, h);
 		boxaAddBox(boxb, box, L_INSERT);
 
+		api->ClearAdaptiveClassifier(); // nothing learned from the other boxes or images
 		if (api->Recognize(0) == 0) {
 			std::string outtext;
 			tesseract::ResultIterator *ri = api->GetIterator();
@@ -309,22 +302,26 @@ bool MeterOCR::RecognizerTesseract::recognize(PIX *imageO, int dX, int dY, Reads
 		}
 	}
 
-	Pix *bbpix2 = pixDrawBoxa(dump, boxa, 1, 0x00ff0000);  // rgba color -> green, detected
-	Pix *bbpix = pixDrawBoxa(bbpix2, boxb, 1, 0x0000ff00); // blue = bounding box for search
-	pixDestroy(&bbpix2);
+	if (dump) {
+		Pix *bbpix2 = pixDrawBoxa(dump, boxa, 1, 0x00ff0000);  // rgba color -> green, detected
+		Pix *bbpix = pixDrawBoxa(bbpix2, boxb, 1, 0x0000ff00); // blue = bounding box for search
+		pixDestroy(&bbpix2);
+		saveDebugImage(debugPixa, bbpix, "bb");
+		pixDestroy(&bbpix);
+		pixDestroy(&dump);
+	}
 	boxaDestroy(&boxa);
 	boxaDestroy(&boxb);
-	saveDebugImage(debugPixa, bbpix, "bb");
-	pixDestroy(&bbpix);
 
-	pixDestroy(&dump);
+	// release the image and the results but keep the engine for the next image:
+	api->Clear();
 	pixDestroy(&image);
 	return true;
 }
 
 bool MeterOCR::RecognizerTesseract::initTesseract() {
 	if (api)
-		deinitTesseract(); // we want to deinit/init in this case on purpose! (see TODO in read)
+		deinitTesseract();
 
 	// init tesseract-ocr without specifiying tessdata path
 	api = new tesseract::TessBaseAPI();
@@ -333,8 +330,8 @@ bool MeterOCR::RecognizerTesseract::initTesseract() {
 	api->SetVariable("load_system_dawg", "F");
 	api->SetVariable("load_freq_dawg", "F");
 
-	// only for debugging:
-	api->SetVariable("tessedit_write_images", "T");
+	// the same engine recognizes all images, they must not influence each other:
+	api->SetVariable("classify_enable_learning", "F");
 
 	if (api->Init(NULL, "deu")) {
 		delete api;
@@ -9,6 +9,8 @@
 
 #include "protocols/MeterOMS.hpp"
 #include <assert.h>
+#include <ctype.h>
+#include <json-c/json.h>
 #include <mbus/mbus.h>
 #include <openssl/conf.h>
 #include <openssl/err.h>
@@ -126,9 +128,44 @@ int MeterOMS::OMSSerialHWif::receive_frame(mbus_frame *frame) {
 	return mbus_serial_recv_frame(_handle, frame);
 }
 
+// convert the key in hex into binary and expand it
+static MeterOMS::AesContext parse_key(const std::string &hex) {
+	if (hex.length() != 32) {
+		print(log_alert, "Key length needs to be 32!", "OMS");
+		throw vz::VZException("OMS key length error");
+	}
+
+	unsigned char key[16];
+	memset(key, 0, 16);
+	int j = 0;
+	for (int i = 0; i < 32; ++i) {
+		const char c = hex[i];
+		int v = 0;
+		if (c >= '0' && c <= '9')
+			v = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			v = 10 + c - 'a';
+		else if (c >= 'A' && c <= 'F')
+			v = 10 + c - 'A';
+
+		if (i % 2 == 0) {
+			v <<= 4;
+			key[j] = v;
+		} else {
+			key[j] |= v;
+			++j;
+		}
+	}
+
+	MeterOMS::AesContext ctx = MeterOMS::aes_context(key);
+	OPENSSL_cleanse(key, sizeof(key));
+	if (!ctx)
+		throw vz::VZException("OMS AES init failed");
+	return ctx;
+}
+
 MeterOMS::MeterOMS(const std::list<Option> &options, OMSHWif *hwif)
-	: Protocol("oms"), _hwif(hwif), _aes_key(0), _mbus_debug(false), _use_local_time(false),
-	  _last_timestamp(0.0) {
+	: Protocol("oms"), _hwif(hwif), _mbus_debug(false), _use_local_time(false), _receiver(false) {
 	OptionList optlist;
 	// todo parse from options for tcp or uart... if (!_hwif) ->
 	print(log_debug, "Using libmbus version %s", name().c_str(), mbus_get_current_version());
@@ -180,39 +217,73 @@ MeterOMS::MeterOMS(const std::list<Option> &options, OMSHWif *hwif)
 		// keep default
 	}
 
-	std::string _key;
+	// either one device with "key" or a receiver for the "devices" with their keys:
+	struct json_object *jso = 0;
 	try {
-		_key = optlist.lookup_string(options, "key");
+		jso = optlist.lookup_json_array(options, "devices");
+	} catch (vz::OptionNotFoundException &e) {
+		// single device
 	} catch (vz::VZException &e) {
-		print(log_alert, "Missing path or invalid type", name().c_str());
+		print(log_alert, "devices has to be an array", name().c_str());
 		throw;
 	}
-	if (_key.length() != 32) {
-		print(log_alert, "Key length needs to be 32!", name().c_str());
-		throw vz::VZException("OMS key length error");
-	}
-
-	// convert _key into binary _aes_key
-	_aes_key = (unsigned char *)malloc(16);
-	memset(_aes_key, 0, 16);
-	int j = 0;
-	for (int i = 0; i < 32; ++i) {
-		const char c = _key[i];
-		int v = 0;
-		if (c >= '0' && c <= '9')
-			v = c - '0';
-		else if (c >= 'a' && c <= 'f')
-			v = 10 + c - 'a';
-		else if (c >= 'A' && c <= 'F')
-			v = 10 + c - 'A';
-
-		if (i % 2 == 0) {
-			v <<= 4;
-			_aes_key[j] = v;
-		} else {
-			_aes_key[j] |= v;
-			++j;
+	_receiver = jso != 0;
+
+	if (!_receiver) {
+		Device &dev = _devices[0];
+		dev.last_timestamp = 0.0;
+		try {
+			dev.aes = parse_key(optlist.lookup_string(options, "key"));
+		} catch (vz::VZException &e) {
+			print(log_alert, "Missing key or devices or invalid key", name().c_str());
+			throw;
+		}
+	} else {
+		if (optlist.contains(options, "key")) {
+			print(log_alert, "Use either key or devices", name().c_str());
+			throw vz::VZException("OMS key and devices");
+		}
+		int count = json_object_array_length(jso);
+		for (int i = 0; i < count; i++) {
+			struct json_object *jd = json_object_array_get_idx(jso, i);
+			struct json_object *jid = 0, *jman = 0, *jkey = 0;
+			if (!jd || !json_object_object_get_ex(jd, "id", &jid) ||
+				!json_object_object_get_ex(jd, "key", &jkey)) {
+				print(log_alert, "devices[%d] needs id and key", name().c_str(), i);
+				throw vz::VZException("OMS device without id or key");
+			}
+			// the id is BCD, so its digits as printed read as hex give the frame's little endian
+			// bytes
+			const char *id = json_object_get_string(jid);
+			if (strlen(id) != 8 || strspn(id, "0123456789abcdefABCDEF") != 8) { // no "0x", sign
+				print(log_alert, "devices[%d]: id needs 8 digits", name().c_str(), i);
+				throw vz::VZException("OMS device id invalid");
+			}
+			unsigned long addr = strtoul(id, NULL, 16);
+			uint64_t man = 0; // any
+			if (json_object_object_get_ex(jd, "manufacturer", &jman)) {
+				// three letters, 5 bits each
+				const char *code = json_object_get_string(jman);
+				for (int c = 0; c < 3 && isalpha((unsigned char)code[c]); ++c)
+					man = (man << 5) | (toupper(code[c]) - 'A' + 1);
+				if (strlen(code) != 3 || man < 1 << 10) {
+					print(log_alert, "devices[%d]: manufacturer needs 3 letters", name().c_str(),
+						  i);
+					throw vz::VZException("OMS device manufacturer invalid");
+				}
+			}
+			Device &dev = _devices[man << 32 | addr];
+			char buf[9];
+			snprintf(buf, sizeof(buf), "%08lX", addr);
+			dev.id = buf;
+			dev.last_timestamp = 0.0;
+			dev.aes = parse_key(json_object_get_string(jkey));
 		}
+		if (_devices.empty()) {
+			print(log_alert, "devices is empty", name().c_str());
+			throw vz::VZException("OMS devices empty");
+		}
+		print(log_info, "Receiving %d devices", name().c_str(), (int)_devices.size());
 	}
 }
 
@@ -221,11 +292,9 @@ MeterOMS::~MeterOMS() {
 		delete _hwif;
 
 	// openssl cleanup:
+	_devices.clear(); // frees the cipher contexts
 	EVP_cleanup();
 	ERR_free_strings();
-
-	if (_aes_key)
-		free(_aes_key);
 }
 
 int MeterOMS::open() {
@@ -286,6 +355,14 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 				case 0x5b: // 12 byte CMD to device M-bus 4 Ident 2 Manuf Ver Med Acc Status 2
 						   // ConfWord
 				{
+					// drop frames of other devices before decrypting them:
+					Device *dev = lookup_device(frame.data);
+					if (!dev) {
+						print(log_finest, "ignoring frame of unknown device %.2x%.2x%.2x%.2x",
+							  name().c_str(), frame.data[3], frame.data[2], frame.data[1],
+							  frame.data[0]);
+						break;
+					}
 					// check control word (bytes 10 and 11 (0-based)):
 					u_int8_t controlword_low = frame.data[10];
 					u_int8_t controlword_high = frame.data[11];
@@ -312,7 +389,7 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 						iv[7] = frame.data[7];
 
 						memset(iv + 8, frame.data[8], 8);
-						aes_decrypt(frame.data + 12, 16 * nr_enc_16byte_blocks, _aes_key, iv);
+						aes_decrypt(frame.data + 12, 16 * nr_enc_16byte_blocks, dev->aes, iv);
 						if (_mbus_debug)
 							mbus_frame_print(&frame);
 						if (frame.length1 <= 14 || frame.data[12] != 0x2f ||
@@ -349,7 +426,7 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 								switch (record->drh.vib.vif) {
 								case 0x6d: // time
 									timeFromMeter = get_record_value(record);
-									if (timeFromMeter > 1.0 && (timeFromMeter == _last_timestamp)) {
+									if (timeFromMeter > 1.0 && (timeFromMeter == dev->last_timestamp)) {
 										// duplicated timestamp received. ignore the remaining
 										// telegram as by spec
 										ignore_telegram = true;
@@ -358,7 +435,7 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 											  name().c_str(), timeFromMeter);
 									} else {
 										if (timeFromMeter > 1.0)
-											_last_timestamp = timeFromMeter;
+											dev->last_timestamp = timeFromMeter;
 									}
 									break;
 								case 0x03:
@@ -367,7 +444,7 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 											  get_record_value(record),
 											  mbus_vib_unit_lookup(&(record->drh.vib)));
 										if (ret < n) {
-											rds[ret].identifier(new ObisIdentifier("1.8.0"));
+											rds[ret].identifier(identifier(*dev, "1.8.0"));
 											rds[ret].value(get_record_value(record));
 											if (timeFromMeter > 1.0 && !_use_local_time)
 												rds[ret].time_from_double(timeFromMeter);
@@ -383,7 +460,7 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 											  get_record_value(record),
 											  mbus_vib_unit_lookup(&(record->drh.vib)));
 										if (ret < n) {
-											rds[ret].identifier(new ObisIdentifier("2.8.0"));
+											rds[ret].identifier(identifier(*dev, "2.8.0"));
 											rds[ret].value(get_record_value(record));
 											if (timeFromMeter > 1.0 && !_use_local_time)
 												rds[ret].time_from_double(timeFromMeter);
@@ -399,7 +476,7 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 											  get_record_value(record),
 											  mbus_vib_unit_lookup(&(record->drh.vib)));
 										if (ret < n) {
-											rds[ret].identifier(new ObisIdentifier("1.7.0"));
+											rds[ret].identifier(identifier(*dev, "1.7.0"));
 											rds[ret].value(get_record_value(record));
 											if (timeFromMeter > 1.0 && !_use_local_time)
 												rds[ret].time_from_double(timeFromMeter);
@@ -415,7 +492,7 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 											  get_record_value(record),
 											  mbus_vib_unit_lookup(&(record->drh.vib)));
 										if (ret < n) {
-											rds[ret].identifier(new ObisIdentifier("2.7.0"));
+											rds[ret].identifier(identifier(*dev, "2.7.0"));
 											rds[ret].value(get_record_value(record));
 											if (timeFromMeter > 1.0 && !_use_local_time)
 												rds[ret].time_from_double(timeFromMeter);
@@ -442,7 +519,9 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 				}
 
 				// reply with E5h: MBUS_FRAME_ACK_START
-				if (0 != _hwif->send_frame(frame_ack)) {
+				if (_receiver) {
+					expect_frame = 1; // we only listen
+				} else if (0 != _hwif->send_frame(frame_ack)) {
 					print(log_alert, "send_frame failed!", name().c_str());
 					expect_frame = 0;
 				} else {
@@ -454,7 +533,9 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 			} else if ((frame.control & MBUS_CONTROL_MASK_SND_NKE) == MBUS_CONTROL_MASK_SND_NKE) {
 				got_SND_NKE = true;
 				// reply with E5h: MBUS_FRAME_ACK_START
-				if (0 != _hwif->send_frame(frame_ack)) {
+				if (_receiver) {
+					expect_frame = 1;
+				} else if (0 != _hwif->send_frame(frame_ack)) {
 					print(log_alert, "send_frame failed!", name().c_str());
 					expect_frame = 0; // we need to wait for next one
 				} else {
@@ -476,57 +557,74 @@ ssize_t MeterOMS::read(std::vector<Reading> &rds, size_t n) {
 	return ret;
 }
 
-bool MeterOMS::aes_decrypt(unsigned char *ciphertext, int ciphertext_len, unsigned char *key,
-						   unsigned char *iv) {
+MeterOMS::Device *MeterOMS::lookup_device(const unsigned char *header) {
+	if (!_receiver)
+		return &_devices.begin()->second;
+
+	uint64_t addr = (uint64_t)header[3] << 24 | header[2] << 16 | header[1] << 8 | header[0];
+	uint64_t man = (uint64_t)(header[5] << 8 | header[4]) << 32;
+	std::unordered_map<uint64_t, Device>::iterator it = _devices.find(man | addr);
+	if (it == _devices.end())
+		it = _devices.find(addr); // any manufacturer
+	return it == _devices.end() ? NULL : &it->second;
+}
+
+ReadingIdentifier *MeterOMS::identifier(const Device &dev, const char *obis) const {
+	if (!_receiver)
+		return new ObisIdentifier(obis);
+	return new StringIdentifier(dev.id + "/" + obis);
+}
+
+MeterOMS::AesContext MeterOMS::aes_context(const unsigned char *key) {
 	/* no keys in logs!
-	printf("iv =");
-	for (int i=0; i<16; ++i)
-			printf("%.2x", iv[i]);
-	printf("\nkey=");
+	printf("key=");
 	for (int i=0; i<16; ++i)
 			printf("%.2x", key[i]);
 	*/
 
-	unsigned char *plaintext = ciphertext; // we decrypt directly into the ciphertext
+	AesContext ctx(EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free);
+	if (!ctx) {
+		print(log_alert, "EVP_CIPHER_CTX_new failed", "OMS");
+		return AesContext();
+	}
 
-	EVP_CIPHER_CTX *ctx;
+	// expands the key, the iv follows per frame:
+	if (!EVP_DecryptInit_ex(ctx.get(), EVP_aes_128_cbc(), NULL, key, NULL)) {
+		print(log_alert, "EVP_DecryptInit_ex failed", "OMS");
+		return AesContext();
+	}
+	EVP_CIPHER_CTX_set_padding(ctx.get(), 0);
+
+	assert(EVP_CIPHER_CTX_iv_length(ctx.get()) == 16);
+	assert(EVP_CIPHER_CTX_key_length(ctx.get()) == 16);
+	return ctx;
+}
+
+bool MeterOMS::aes_decrypt(unsigned char *ciphertext, int ciphertext_len, const AesContext &ctx,
+						   const unsigned char *iv) {
+	unsigned char *plaintext = ciphertext; // we decrypt directly into the ciphertext
 
 	int len = 0;
 	int plaintext_len;
 
-	/* Create and initialise the context */
-	if (!(ctx = EVP_CIPHER_CTX_new())) {
-		print(log_alert, "EVP_CIPHER_CTX_new failed", name().c_str());
-		return false;
-	}
-
-	if (!EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, iv)) {
+	// keeps the cipher and the expanded key, resets the state to the new iv:
+	if (!EVP_DecryptInit_ex(ctx.get(), NULL, NULL, NULL, iv)) {
 		print(log_alert, "EVP_DecryptInit_ex failed", name().c_str());
-		EVP_CIPHER_CTX_free(ctx);
 		return false;
 	}
-	EVP_CIPHER_CTX_set_padding(ctx, 0);
 
-	assert(EVP_CIPHER_CTX_iv_length(ctx) == 16);
-	assert(EVP_CIPHER_CTX_key_length(ctx) == 16);
-
-	if (!EVP_DecryptUpdate(ctx, plaintext, &len, ciphertext, ciphertext_len)) {
+	if (!EVP_DecryptUpdate(ctx.get(), plaintext, &len, ciphertext, ciphertext_len)) {
 		print(log_alert, "EVP_DecryptUpdate failed (len=%d)", name().c_str(), len);
-		EVP_CIPHER_CTX_free(ctx);
 		return false;
 	}
 	plaintext_len = len;
 
-	if (!EVP_DecryptFinal_ex(ctx, plaintext + len, &len)) {
+	if (!EVP_DecryptFinal_ex(ctx.get(), plaintext + len, &len)) {
 		print(log_alert, "EVP_DecryptFinale_ex failed (len=%d)", name().c_str(), len);
-		EVP_CIPHER_CTX_free(ctx);
 		return false;
 	}
 	plaintext_len += len;
 
-	/* Clean up */
-	EVP_CIPHER_CTX_free(ctx);
-
 	return plaintext_len == ciphertext_len;
 }
 
@@ -25,9 +25,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/gpio.h>
 #include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/time.h>
 #include <time.h>
@@ -39,18 +41,64 @@
 
 MeterS0::MeterS0(const std::list<Option> &options, HWIF *hwif, HWIF *hwif_dir)
 	: Protocol("s0"), _hwif(hwif), _hwif_dir(hwif_dir), _counter_thread_stop(false),
-	  _send_zero(false), _debounce_delay_ms(0), _nonblocking_delay_ns(1e5), _first_impulse(true) {
+	  _send_zero(false), _read_period_ms(1000), _power(POWER_INTERVALS), _ema_alpha(0),
+	  _debounce_delay_ms(0), _nonblocking_delay_ns(1e5), _first_impulse(true) {
 	OptionList optlist;
 
+	try {
+		_debounce_delay_ms = optlist.lookup_int(options, "debounce_delay");
+	} catch (vz::OptionNotFoundException &e) {
+		_debounce_delay_ms = 30;
+	} catch (vz::VZException &e) {
+		print(log_alert, "Failed to parse debounce_delay", "");
+		throw;
+	}
+	if (_debounce_delay_ms < 0)
+		throw vz::VZException("debounce_delay must not be negative.");
+
 	// check which HWIF to use:
+	// if "gpio" and "gpiochip" are given -> GPIO character device (gpio can be a list of lines)
 	// if "gpio" is given -> GPIO
 	// else (assuming "device") -> UART
 	bool use_gpio = false;
 	bool use_mmap = false;
 	std::string mmap;
+	std::string gpiochip;
 	int gpiopin = -1;
 
-	if (!_hwif) {
+	try {
+		gpiochip = optlist.lookup_string(options, "gpiochip");
+	} catch (vz::OptionNotFoundException &e) {
+		// use sysfs
+	} catch (vz::VZException &e) {
+		print(log_alert, "Failed to parse gpiochip", "");
+		throw;
+	}
+
+	std::vector<int> gpios; // a list of lines, each with its own counter
+	try {
+		const Option &gpio = optlist.lookup(options, "gpio");
+		if (gpio.type() == Option::type_array) {
+			struct json_object *jso = gpio;
+			int len = json_object_array_length(jso);
+			for (int i = 0; i < len; i++) {
+				struct json_object *jl = json_object_array_get_idx(jso, i);
+				if (!json_object_is_type(jl, json_type_int) || json_object_get_int(jl) < 0)
+					throw vz::VZException("gpio must be a list of line numbers");
+				gpios.push_back(json_object_get_int(jl));
+			}
+			if (gpios.empty())
+				throw vz::VZException("gpio must not be an empty list");
+			if (!_hwif && gpiochip.empty())
+				throw vz::VZException("a list of gpio lines needs gpiochip");
+		}
+	} catch (vz::OptionNotFoundException &e) {
+		// UART
+	}
+
+	if (!_hwif && !gpios.empty()) {
+		_hwif = new HWIF_GPIOCDEV(gpiochip, gpios, true, _debounce_delay_ms * 1000);
+	} else if (!_hwif) {
 		try {
 			gpiopin = optlist.lookup_int(options, "gpio");
 			if (gpiopin >= 0)
@@ -59,7 +107,10 @@ MeterS0::MeterS0(const std::list<Option> &options, HWIF *hwif, HWIF *hwif_dir)
 			// ignore
 		}
 
-		if (use_gpio) {
+		if (use_gpio && !gpiochip.empty()) {
+			_hwif = new HWIF_GPIOCDEV(gpiochip, std::vector<int>(1, gpiopin), true,
+									  _debounce_delay_ms * 1000);
+		} else if (use_gpio) {
 			try {
 				mmap = optlist.lookup_string(options, "mmap");
 				if (mmap == "rpi2" || mmap == "rpi" || mmap == "rpi1") {
@@ -88,16 +139,33 @@ MeterS0::MeterS0(const std::list<Option> &options, HWIF *hwif, HWIF *hwif_dir)
 			// ignore
 		}
 		if (gpiodirpin >= 0) {
+			if (!gpios.empty())
+				throw vz::VZException("gpio_dir is not supported with a list of gpio lines");
 			if (gpiodirpin == gpiopin) {
 				throw vz::VZException("gpio_dir must not be equal to gpio");
 			}
-			if (use_mmap) {
+			if (!gpiochip.empty()) {
+				_hwif_dir = new HWIF_GPIOCDEV(gpiochip, std::vector<int>(1, gpiodirpin), false, 0);
+			} else if (use_mmap) {
 				_hwif_dir = new HWIF_MMAP(gpiodirpin, mmap);
 			} else
 				_hwif_dir = new HWIF_GPIO(gpiodirpin, options);
 		}
 	}
 
+	std::vector<Counter> counters(gpios.empty() ? 2 : gpios.size());
+	_counters.swap(counters);
+	if (gpios.empty()) {
+		_counters[0].impulse = "Impulse";
+		_counters[0].power = "Power";
+		_counters[1].impulse = "Impulse_neg";
+		_counters[1].power = "Power_neg";
+	}
+	for (size_t i = 0; i < gpios.size(); i++) {
+		_counters[i].impulse = "Impulse_" + std::to_string(gpios[i]);
+		_counters[i].power = "Power_" + std::to_string(gpios[i]);
+	}
+
 	try {
 		_resolution = optlist.lookup_int(options, "resolution");
 	} catch (vz::OptionNotFoundException &e) {
@@ -109,17 +177,6 @@ MeterS0::MeterS0(const std::list<Option> &options, HWIF *hwif, HWIF *hwif_dir)
 	if (_resolution < 1)
 		throw vz::VZException("Resolution must be greater than 0.");
 
-	try {
-		_debounce_delay_ms = optlist.lookup_int(options, "debounce_delay");
-	} catch (vz::OptionNotFoundException &e) {
-		_debounce_delay_ms = 30;
-	} catch (vz::VZException &e) {
-		print(log_alert, "Failed to parse debounce_delay", "");
-		throw;
-	}
-	if (_debounce_delay_ms < 0)
-		throw vz::VZException("debounce_delay must not be negative.");
-
 	try {
 		_nonblocking_delay_ns = optlist.lookup_int(options, "nonblocking_delay");
 	} catch (vz::OptionNotFoundException &e) {
@@ -139,6 +196,50 @@ MeterS0::MeterS0(const std::list<Option> &options, HWIF *hwif, HWIF *hwif_dir)
 		print(log_alert, "Failed to parse send_zero", "");
 		throw;
 	}
+
+	try {
+		_read_period_ms = optlist.lookup_int(options, "read_period");
+	} catch (vz::OptionNotFoundException &e) {
+		// keep default 1000ms
+	} catch (vz::VZException &e) {
+		print(log_alert, "Failed to parse read_period", "");
+		throw;
+	}
+	if (_read_period_ms < 10)
+		throw vz::VZException("read_period must not be <10ms.");
+	_log.resize(_read_period_ms);
+
+	try {
+		std::string power = optlist.lookup_string(options, "power");
+		if (power == "intervals")
+			_power = POWER_INTERVALS;
+		else if (power == "window")
+			_power = POWER_WINDOW;
+		else if (power == "last")
+			_power = POWER_LAST;
+		else if (power == "ema")
+			_power = POWER_EMA;
+		else
+			throw vz::VZException("power must be intervals, window, last or ema.");
+	} catch (vz::OptionNotFoundException &e) {
+		// keep default intervals
+	} catch (vz::VZException &e) {
+		print(log_alert, "Failed to parse power", "");
+		throw;
+	}
+
+	int ema_intervals = 8;
+	try {
+		ema_intervals = optlist.lookup_int(options, "ema_intervals");
+	} catch (vz::OptionNotFoundException &e) {
+		// keep default
+	} catch (vz::VZException &e) {
+		print(log_alert, "Failed to parse ema_intervals", "");
+		throw;
+	}
+	if (ema_intervals < 1)
+		throw vz::VZException("ema_intervals must be greater than 0.");
+	_ema_alpha = 2.0 / (ema_intervals + 1);
 }
 
 MeterS0::~MeterS0() {
@@ -191,6 +292,36 @@ void timespec_add_ms(struct timespec &a, unsigned long ms) {
 	}
 }
 
+void MeterS0::ImpulseLog::resize(int read_period_ms) {
+	unsigned int size = MIN_SIZE;
+	while (size < MAX_SIZE && size < 2u * read_period_ms)
+		size *= 2;
+	_entries.resize(size);
+	_mask = size - 1;
+}
+
+bool MeterS0::ImpulseLog::push(const struct timespec &ts, unsigned int counter) {
+	unsigned int head = _head.load(std::memory_order_relaxed);
+	if (head - _tail.load(std::memory_order_acquire) >= _entries.size()) {
+		_dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	_entries[head & _mask].ts = ts;
+	_entries[head & _mask].counter = counter;
+	_head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+bool MeterS0::ImpulseLog::pop(struct timespec &ts, unsigned int &counter) {
+	unsigned int tail = _tail.load(std::memory_order_relaxed);
+	if (tail == _head.load(std::memory_order_acquire))
+		return false;
+	ts = _entries[tail & _mask].ts;
+	counter = _entries[tail & _mask].counter;
+	_tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
 void MeterS0::check_ref_for_overflow() {
 	// protect against _ms_last_impulse overflwing,
 	// it would overflow roughly once a month with 32bit unsigned long
@@ -202,14 +333,22 @@ void MeterS0::check_ref_for_overflow() {
 	}
 }
 
+void MeterS0::count_impulse(const struct timespec &ts, unsigned int counter) {
+	// log the time before counting, so read() finds the impulses it counted in the log.
+	// If the log is full the impulse is counted without its time, read() warns.
+	_log.push(ts, counter);
+	++_counters[counter].impulses;
+}
+
 void MeterS0::counter_thread() {
 	// _hwif exists and open() succeeded
 	print(log_finest, "Counter thread started with %s hwif", name().c_str(),
 		  _hwif->is_blocking() ? "blocking" : "non blocking");
 
 	bool is_blocking = _hwif->is_blocking();
+	bool has_timestamps = _hwif->has_timestamps();
 
-	{ // set thread priority to highest and SCHED_FIFO scheduling class
+	if (!has_timestamps) { // set thread priority to highest and SCHED_FIFO scheduling class
 		// ignore any errors
 		int policy;
 		struct sched_param param;
@@ -231,7 +370,24 @@ void MeterS0::counter_thread() {
 		(cur_state >= 0) ? cur_state : 0; // use current state if it is valid else assume low edge
 	const int nonblocking_delay_ns = _nonblocking_delay_ns;
 	while (!_counter_thread_stop) {
-		if (is_blocking) {
+		if (has_timestamps) {
+			// the kernel debounced the line already and timestamped the edges
+			struct timespec ts[16];
+			unsigned int lines[16];
+			int n = _hwif->waitForImpulses(ts, lines, 16);
+			if (n < 0) {
+				struct timespec delay = {0, 100000000}; // don't spin on errors
+				nanosleep(&delay, NULL);
+				continue;
+			}
+			for (int i = 0; i < n; i++) {
+				unsigned int c = lines[i];
+				if (_hwif_dir && (_hwif_dir->status() > 0))
+					c = 1; // Impulse_neg
+				if (c < _counters.size())
+					count_impulse(ts[i], c);
+			}
+		} else if (is_blocking) {
 			bool timeout = false;
 			if (_hwif->waitForImpulse(timeout)) {
 				// something has happened on the hardwareinterface (hwif)
@@ -258,9 +414,9 @@ void MeterS0::counter_thread() {
 						 // HWIF -> rising edge event (or error in case we accept the trigger)
 					if (_hwif_dir && (_hwif_dir->status() >
 									  0)) // check if second hardware interface has caused the event
-						++_impulses_neg;
+						count_impulse(temp_ts, 1);
 					else // main hardware interface caused the event
-						++_impulses;
+						count_impulse(temp_ts, 0);
 				}
 			}
 		} else { // non-blocking case:
@@ -269,10 +425,12 @@ void MeterS0::counter_thread() {
 				if (last_state == 0) { // low->high edge found
 					//  auch hier muss wahrscheinlich erst das debouncing erfolgen, bevor es zur
 					//  Auswertung kommt !!
+					struct timespec temp_ts;
+					clock_gettime(CLOCK_REALTIME, &temp_ts);
 					if (_hwif_dir && (_hwif_dir->status() > 0))
-						++_impulses_neg;
+						count_impulse(temp_ts, 1);
 					else
-						++_impulses;
+						count_impulse(temp_ts, 0);
 					if (_debounce_delay_ms > 0) {
 						// nanosleep _debounce_delay_ms
 						struct timespec ts;
@@ -294,7 +452,8 @@ void MeterS0::counter_thread() {
 			}
 		} // non blocking case
 	}     // while
-	print(log_finest, "Counter thread stopped with %d imp", name().c_str(), _impulses.load());
+	print(log_finest, "Counter thread stopped with %d imp", name().c_str(),
+		  _counters[0].impulses.load());
 }
 
 int MeterS0::open() {
@@ -306,15 +465,24 @@ int MeterS0::open() {
 	if (_hwif_dir && (!_hwif_dir->_open()))
 		return ERR;
 
-	_impulses = 0;
-	_impulses_neg = 0;
+	for (size_t i = 0; i < _counters.size(); i++) {
+		_counters[i].impulses = 0;
+		_counters[i].have_last_logged = false;
+		_counters[i].interval = 0;
+		_counters[i].ema = 0;
+	}
 
 	clock_gettime(CLOCK_REALTIME, &_time_last_read); // we use realtime as this is returned as well
 													 // (clock_monotonic would be better but...)
-	// store current time as last_time. Next read will return after 1s.
+	// store current time as last_time. Next read will return after the read period.
 	_time_last_ref = _time_last_read;
 	_ms_last_impulse = 0;
 	_time_last_impulse_returned = _time_last_read;
+	struct timespec ts;
+	unsigned int c;
+	while (_log.pop(ts, c))
+		; // drop impulses from before a reopen
+	_log.dropped();
 
 	// create counter_thread and pass this as param
 	_counter_thread_stop = false;
@@ -345,102 +513,194 @@ ssize_t MeterS0::read(std::vector<Reading> &rds, size_t n) {
 
 	if (!_hwif)
 		return 0;
-	if (n < 4)
+	if (n < 2 * _counters.size())
 		return 0; // would be worth a debug msg!
 
-	// wait till last+1s (even if we are already later)
+	// wait till last+read period (even if we are already later)
 	struct timespec req = _time_last_read;
 	// (or even more seconds if !send_zero
 
-	unsigned int t_imp;
-	unsigned int t_imp_neg;
+	// of each counter within this read
+	struct Window {
+		unsigned int impulses;
+		unsigned int intervals; // between logged impulses
+		bool logged;
+		struct timespec first; // start of the first interval
+		double power;
+		bool with_power;
+		struct timespec time;
+	};
+	std::vector<Window> win(_counters.size());
 	bool is_zero = true;
 	do {
-		req.tv_sec += 1;
+		timespec_add_ms(req, _read_period_ms);
 		while (EINTR == clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &req, NULL))
 			;
 		// check from counter_thread the current impulses:
-		t_imp = _impulses;
-		t_imp_neg = _impulses_neg;
-		if (t_imp > 0 || t_imp_neg > 0) {
-			is_zero = false;
-			// reduce _impulses to avoid wraps. there is no race cond here as it's ok if _impulses
-			// is >0 afterwards if new impulses arrived in the meantime. That's why we don't set to
-			// 0!
-			_impulses -= t_imp;
-			_impulses_neg -= t_imp_neg;
+		for (size_t i = 0; i < _counters.size(); i++) {
+			win[i].impulses = _counters[i].impulses;
+			if (win[i].impulses > 0) {
+				is_zero = false;
+				// reduce impulses to avoid wraps. there is no race cond here as it's ok if
+				// impulses is >0 afterwards if new impulses arrived in the meantime. That's why
+				// we don't set to 0!
+				_counters[i].impulses -= win[i].impulses;
+			}
 		}
 	} while (!_send_zero &&
 			 (is_zero)); // so we are blocking is send_zero is false and no impulse coming!
 	// todo check thread cancellation on program termination
 
-	// we got t_imp and/or t_imp_neq between _time_last_read and req
+	// we got the impulses between _time_last_read and req
 
 	clock_gettime(CLOCK_REALTIME, &req);
-	double t1;
-	double t2;
-	if (_hwif->is_blocking()) {
-		// if is_zero we need to correct the time here as no impulse occured!
-		if (is_zero) {
-			// we simply add the time from req-_time_last_read to _time_last_ref:
-			struct timespec d1s;
-			timespec_sub(req, _time_last_read, d1s);
-			timespec_add(_time_last_ref, d1s);
-			// this has a little racecond as well (if after existing while loop a impulse returned
-			// the ms_last_impulse might have been increased already based on old time_last_ref
-		}
+	for (size_t i = 0; i < win.size(); i++) {
+		win[i].with_power = !_first_impulse;
+		win[i].time = req;
+	}
 
-		// we use the time from last impulse
-		t1 = _time_last_impulse_returned.tv_sec + _time_last_impulse_returned.tv_nsec / 1e9;
-		struct timespec temp_ts = _time_last_ref;
-		timespec_add_ms(temp_ts, _ms_last_impulse);
-		check_ref_for_overflow();
-		t2 = temp_ts.tv_sec + temp_ts.tv_nsec / 1e9;
-		_time_last_impulse_returned = temp_ts;
+	// the impulses logged by the counter thread since the last read
+	for (size_t i = 0; i < win.size(); i++) {
+		win[i].intervals = 0;
+		win[i].logged = false;
+		win[i].first = _counters[i].time_last_logged;
+	}
+	struct timespec ts;
+	unsigned int c;
+	while (_log.pop(ts, c)) {
+		Counter &counter = _counters[c];
+		if (counter.have_last_logged) {
+			++win[c].intervals;
+			struct timespec d;
+			timespec_sub(ts, counter.time_last_logged, d);
+			double dt = d.tv_sec + d.tv_nsec / 1e9;
+			if (dt <= 0)
+				dt = 0.000001;
+			double power = 3600000 / (dt * _resolution);
+			counter.ema = counter.interval > 0 ? counter.ema + _ema_alpha * (power - counter.ema)
+											   : power;
+			counter.interval = dt;
+		} else {
+			win[c].first = ts; // the very first impulse only starts an interval
+		}
+		counter.have_last_logged = true;
+		counter.time_last_logged = ts;
+		win[c].logged = true;
+	}
+	unsigned int dropped = _log.dropped();
+	if (dropped)
+		print(log_warning, "%u impulses counted without their time, more than %u per read_period",
+			  name().c_str(), dropped, _log.size());
+
+	if (_hwif->has_timestamps() || _power != POWER_INTERVALS) {
+		double now = req.tv_sec + req.tv_nsec / 1e9;
+		double window = now - (_time_last_read.tv_sec + _time_last_read.tv_nsec / 1e9);
+		if (window <= 0)
+			window = 0.000001;
+		for (size_t i = 0; i < win.size(); i++) {
+			Counter &counter = _counters[i];
+			win[i].power = 0;
+			switch (_power) {
+			case POWER_INTERVALS:
+				// exact intervals between the impulses (with kernel timestamps)
+				if (win[i].logged)
+					win[i].time = counter.time_last_logged;
+				if (win[i].intervals > 0) {
+					struct timespec d;
+					timespec_sub(counter.time_last_logged, win[i].first, d);
+					double dt = d.tv_sec + d.tv_nsec / 1e9;
+					if (dt <= 0)
+						dt = 0.000001;
+					win[i].power = (3600000 / (dt * _resolution)) * win[i].intervals;
+					win[i].with_power = true;
+				} else if (win[i].impulses > 0) {
+					win[i].with_power = false; // no complete interval yet
+				}
+				break;
+			case POWER_WINDOW:
+				win[i].power = (3600000 / (window * _resolution)) * win[i].impulses;
+				win[i].with_power = true;
+				break;
+			case POWER_LAST:
+			case POWER_EMA:
+				if (counter.interval > 0) {
+					double power =
+						_power == POWER_LAST ? 3600000 / (counter.interval * _resolution) : counter.ema;
+					// the next impulse is overdue: the power is lower than 1 impulse since the
+					// last one, so it decays instead of holding a stale value
+					double since = now - (counter.time_last_logged.tv_sec +
+										  counter.time_last_logged.tv_nsec / 1e9);
+					if (since > 0 && 3600000 / (since * _resolution) < power)
+						power = 3600000 / (since * _resolution);
+					win[i].power = power;
+					win[i].with_power = true;
+				} else {
+					win[i].with_power = false; // no complete interval yet
+				}
+				break;
+			}
+		}
 		_time_last_read = req;
-		req = _time_last_impulse_returned;
 	} else {
-		// we use the time from last read call
-		t1 = _time_last_read.tv_sec + _time_last_read.tv_nsec / 1e9;
-		t2 = req.tv_sec + req.tv_nsec / 1e9;
-		_time_last_read = req;
-	}
+		double t1;
+		double t2;
+		if (_hwif->is_blocking()) {
+			// if is_zero we need to correct the time here as no impulse occured!
+			if (is_zero) {
+				// we simply add the time from req-_time_last_read to _time_last_ref:
+				struct timespec d1s;
+				timespec_sub(req, _time_last_read, d1s);
+				timespec_add(_time_last_ref, d1s);
+				// this has a little racecond as well (if after existing while loop a impulse
+				// returned the ms_last_impulse might have been increased already based on old
+				// time_last_ref
+			}
 
-	if (t2 == t1)
-		t2 += 0.000001;
+			// we use the time from last impulse
+			t1 = _time_last_impulse_returned.tv_sec + _time_last_impulse_returned.tv_nsec / 1e9;
+			struct timespec temp_ts = _time_last_ref;
+			timespec_add_ms(temp_ts, _ms_last_impulse);
+			check_ref_for_overflow();
+			t2 = temp_ts.tv_sec + temp_ts.tv_nsec / 1e9;
+			_time_last_impulse_returned = temp_ts;
+			_time_last_read = req;
+			req = _time_last_impulse_returned;
+		} else {
+			// we use the time from last read call
+			t1 = _time_last_read.tv_sec + _time_last_read.tv_nsec / 1e9;
+			t2 = req.tv_sec + req.tv_nsec / 1e9;
+			_time_last_read = req;
+		}
 
-	if (_send_zero || t_imp > 0) {
-		if (!_first_impulse) {
-			double value = (3600000 / ((t2 - t1) * _resolution)) * t_imp;
-			rds[ret].identifier(new StringIdentifier("Power"));
-			rds[ret].time(req);
-			rds[ret].value(value);
-			++ret;
+		if (t2 == t1)
+			t2 += 0.000001;
+
+		for (size_t i = 0; i < win.size(); i++) {
+			win[i].power = (3600000 / ((t2 - t1) * _resolution)) * win[i].impulses;
+			win[i].time = req;
 		}
-		rds[ret].identifier(new StringIdentifier("Impulse"));
-		rds[ret].time(req);
-		rds[ret].value(t_imp);
-		++ret;
-	}
-
-	if (_send_zero || t_imp_neg > 0) {
-		if (!_first_impulse) {
-			double value = (3600000 / ((t2 - t1) * _resolution)) * t_imp_neg;
-			rds[ret].identifier(new StringIdentifier("Power_neg"));
-			rds[ret].time(req);
-			rds[ret].value(value);
+	}
+
+	unsigned int impulses = 0;
+	for (size_t i = 0; i < win.size(); i++) {
+		impulses += win[i].impulses;
+		if (_send_zero || win[i].impulses > 0) {
+			if (win[i].with_power) {
+				rds[ret].identifier(new StringIdentifier(_counters[i].power));
+				rds[ret].time(win[i].time);
+				rds[ret].value(win[i].power);
+				++ret;
+			}
+			rds[ret].identifier(new StringIdentifier(_counters[i].impulse));
+			rds[ret].time(win[i].time);
+			rds[ret].value(win[i].impulses);
 			++ret;
 		}
-		rds[ret].identifier(new StringIdentifier("Impulse_neg"));
-		rds[ret].time(req);
-		rds[ret].value(t_imp_neg);
-		++ret;
 	}
 	if (_first_impulse && ret > 0)
 		_first_impulse = false;
 
-	print(log_finest, "Reading S0 - returning %d readings (n=%d n_neg = %d)", name().c_str(), ret,
-		  t_imp, t_imp_neg);
+	print(log_finest, "Reading S0 - returning %d readings (n=%d)", name().c_str(), ret, impulses);
 
 	return ret;
 }
@@ -746,3 +1006,176 @@ bool MeterS0::HWIF_GPIO::waitForImpulse(bool &timeout) {
 	timeout = false;
 	return false;
 }
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+// GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME, missing in the headers of kernels < 5.11
+static const __u64 EVENT_CLOCK_REALTIME = 1ull << 11;
+#endif
+
+MeterS0::HWIF_GPIOCDEV::HWIF_GPIOCDEV(const std::string &chip, const std::vector<int> &lines,
+									   bool edges, int debounce_us)
+	: _chip(chip), _lines(lines), _edges(edges), _debounce_us(debounce_us), _fd(-1),
+	  _monotonic(false), _seqno(lines.size(), 0) {
+	if (_lines.empty() || _lines.size() > 64)
+		throw vz::VZException("1 to 64 gpio lines can be requested from a gpiochip");
+	for (size_t i = 0; i < _lines.size(); i++) {
+		if (_lines[i] < 0)
+			throw vz::VZException("invalid (<0) gpio(pin) set");
+		for (size_t j = 0; j < i; j++)
+			if (_lines[j] == _lines[i])
+				throw vz::VZException("gpio lines must be unique");
+	}
+	if (_chip.find('/') == std::string::npos)
+		_chip.insert(0, "/dev/"); // e.g. "gpiochip0"
+}
+
+MeterS0::HWIF_GPIOCDEV::~HWIF_GPIOCDEV() {
+	if (_fd >= 0)
+		_close();
+}
+
+bool MeterS0::HWIF_GPIOCDEV::_open() {
+#ifdef GPIO_V2_GET_LINE_IOCTL
+	int chip = ::open(_chip.c_str(), O_RDONLY | O_CLOEXEC);
+	if (chip < 0) {
+		print(log_alert, "open(%s): %s", "S0", _chip.c_str(), strerror(errno));
+		return false;
+	}
+
+	struct gpio_v2_line_request req;
+	memset(&req, 0, sizeof(req));
+	for (size_t i = 0; i < _lines.size(); i++)
+		req.offsets[i] = _lines[i];
+	req.num_lines = _lines.size();
+	strncpy(req.consumer, "vzlogger", sizeof(req.consumer) - 1);
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	if (_edges) {
+		req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING | EVENT_CLOCK_REALTIME;
+		req.event_buffer_size = 64 * _lines.size(); // capped by the kernel
+		if (_debounce_us > 0) { // in hardware if supported by the chip, else by the kernel
+			req.config.num_attrs = 1;
+			req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+			req.config.attrs[0].attr.debounce_period_us = _debounce_us;
+			req.config.attrs[0].mask =
+				_lines.size() == 64 ? ~0ull : (1ull << _lines.size()) - 1; // all lines
+		}
+	}
+
+	int rv = ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req);
+	_monotonic = false;
+	if (rv < 0 && errno == EINVAL && _edges) {
+		// older kernel, timestamps are CLOCK_MONOTONIC
+		req.config.flags &= ~EVENT_CLOCK_REALTIME;
+		rv = ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req);
+		_monotonic = true;
+	}
+	int err = errno;
+	::close(chip);
+	if (rv < 0) {
+		print(log_alert, "request line %d (of %d) of %s: %s", "S0", _lines[0], (int)_lines.size(),
+			  _chip.c_str(), strerror(err));
+		return false;
+	}
+
+	_fd = req.fd;
+	_seqno.assign(_lines.size(), 0);
+	return true;
+#else
+	print(log_alert, "GPIO character device not supported by this build", "S0");
+	return false;
+#endif
+}
+
+bool MeterS0::HWIF_GPIOCDEV::_close() {
+	if (_fd < 0)
+		return false;
+
+	::close(_fd);
+	_fd = -1;
+
+	return true;
+}
+
+int MeterS0::HWIF_GPIOCDEV::status() {
+#ifdef GPIO_V2_GET_LINE_IOCTL
+	if (_fd < 0)
+		return -1;
+	struct gpio_v2_line_values values;
+	values.bits = 0;
+	values.mask = 1;
+	if (ioctl(_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+		return -2;
+	return (values.bits & 1) ? 1 : 0;
+#else
+	return -1;
+#endif
+}
+
+bool MeterS0::HWIF_GPIOCDEV::waitForImpulse(bool &timeout) {
+	struct timespec ts;
+	unsigned int line;
+	int rv = waitForImpulses(&ts, &line, 1);
+	timeout = rv == 0;
+	return rv > 0;
+}
+
+int MeterS0::HWIF_GPIOCDEV::waitForImpulses(struct timespec *ts, unsigned int *lines, int n) {
+#ifdef GPIO_V2_GET_LINE_IOCTL
+	if (_fd < 0 || !_edges)
+		return -1;
+
+	struct pollfd poll_fd;
+	poll_fd.fd = _fd;
+	poll_fd.events = POLLIN;
+	poll_fd.revents = 0;
+
+	int rv = poll(&poll_fd, 1, 1000); // timeout set to 1s
+	if (rv == 0 || (rv < 0 && errno == EINTR))
+		return 0;
+	if (rv < 0 || !(poll_fd.revents & POLLIN))
+		return -1;
+
+	struct gpio_v2_line_event events[16];
+	if (n > 16)
+		n = 16;
+	ssize_t bytes = ::read(_fd, events, n * sizeof(events[0]));
+	if (bytes < 0) {
+		print(log_error, "read(%s): %s", "S0", _chip.c_str(), strerror(errno));
+		return -1;
+	}
+
+	long long offset_ns = 0; // to CLOCK_REALTIME
+	if (_monotonic) {
+		struct timespec real, mono;
+		clock_gettime(CLOCK_REALTIME, &real);
+		clock_gettime(CLOCK_MONOTONIC, &mono);
+		offset_ns = (real.tv_sec - mono.tv_sec) * 1000000000ll + (real.tv_nsec - mono.tv_nsec);
+	}
+
+	int count = 0;
+	for (size_t i = 0; i < bytes / sizeof(events[0]); i++) {
+		unsigned int line = 0;
+		while (line < _lines.size() && (unsigned int)_lines[line] != events[i].offset)
+			line++;
+		if (line == _lines.size())
+			continue;
+		if (_seqno[line] && events[i].line_seqno != _seqno[line] + 1)
+			print(log_warning, "%u edges lost on line %d", "S0",
+				  events[i].line_seqno - _seqno[line] - 1, _lines[line]);
+		_seqno[line] = events[i].line_seqno;
+		if (events[i].id != GPIO_V2_LINE_EVENT_RISING_EDGE)
+			continue;
+		long long ns = events[i].timestamp_ns + offset_ns;
+		ts[count].tv_sec = ns / 1000000000ll;
+		ts[count].tv_nsec = ns % 1000000000ll;
+		lines[count] = line;
+		++count;
+	}
+	return count;
+#else
+	(void)ts;
+	(void)lines;
+	(void)n;
+	return -1;
+#endif
+}
@@ -29,6 +29,7 @@
 
 #include <errno.h>
 #include <math.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,7 +46,6 @@
 
 /* sml stuff */
 #include <sml/sml_file.h>
-#include <sml/sml_transport.h>
 
 #include "Obis.hpp"
 #include "Options.hpp"
@@ -55,7 +55,8 @@
 #define SML_BUFFER_LEN 8096
 
 MeterSML::MeterSML(const std::list<Option> &options)
-	: Protocol("sml"), _host(""), _device(""), BUFFER_LEN(SML_BUFFER_LEN) {
+	: Protocol("sml"), _host(""), _device(""), BUFFER_LEN(SML_BUFFER_LEN), _framer(SML_BUFFER_LEN),
+	  _frameErrors(0) {
 	OptionList optlist;
 
 	/* connection */
@@ -97,6 +98,21 @@ MeterSML::MeterSML(const std::list<Option> &options)
 		/* using default value if not specified */
 		_use_local_time = false;
 	}
+	try {
+		_tcpPool = optlist.lookup_bool(options, "tcp_pool");
+	} catch (vz::OptionNotFoundException &e) {
+		/* a socket and blocking read of its own */
+		_tcpPool = false;
+	}
+	if (_tcpPool && (_host.empty() || _pull.size())) {
+		print(log_alert, "tcp_pool needs a host and can't send a pullseq", name().c_str());
+		throw vz::VZException("tcp_pool without host or with pullseq");
+	}
+	try {
+		_framer.verifyCrc(optlist.lookup_bool(options, "verify_crc"));
+	} catch (vz::OptionNotFoundException &e) {
+		/* check the CRC by default */
+	}
 
 	/* baudrate */
 	int baudrate = 9600; /* default to avoid compiler warning */
@@ -194,7 +210,9 @@ MeterSML::MeterSML(const std::list<Option> &options)
 	}
 }
 
-MeterSML::MeterSML(const MeterSML &proto) : Protocol(proto), _fd(ERR), BUFFER_LEN(SML_BUFFER_LEN) {}
+MeterSML::MeterSML(const MeterSML &proto)
+	: Protocol(proto), _tcpPool(false), _fd(ERR), BUFFER_LEN(SML_BUFFER_LEN),
+	  _framer(SML_BUFFER_LEN), _frameErrors(0) {}
 
 MeterSML::~MeterSML() {}
 
@@ -204,19 +222,31 @@ int MeterSML::open() {
 		_fd = _openDevice(&_old_tio, _baudrate);
 	} else if (_host != "") {
 		char *addr = strdup(host());
+		char *tofree = addr;
 		const char *node = strsep(&addr, ":");
 		const char *service = strsep(&addr, ":");
 		if (node == NULL && service == NULL) {
-			free(addr);
+			free(tofree);
 			return -1;
 		}
+		if (_tcpPool) {
+			_source = SmlTcpPool::instance().add(node, service, name());
+			free(tofree);
+			return _source ? SUCCESS : ERR;
+		}
 		_fd = _openSocket(node, service);
-		free(addr);
+		free(tofree);
 	}
+	_framer.reset();
 	return _fd;
 }
 
 int MeterSML::close() {
+	if (_tcpPool) {
+		if (_source)
+			SmlTcpPool::instance().remove(_source); // the stats stay with the meter
+		return SUCCESS;
+	}
 
 	if (_device != "") {
 		/* reset serial port */
@@ -238,12 +268,16 @@ bool MeterSML::reopen() {
 
 ssize_t MeterSML::read(std::vector<Reading> &rds, size_t n) {
 
-	unsigned char buffer[SML_BUFFER_LEN];
-	size_t bytes, m = 0;
-
-	sml_file *file;
-	sml_get_list_response *body;
-	sml_list *entry;
+	if (_tcpPool) {
+		/* the pool reconnects on its own */
+		if (!_source) {
+			sleep(1);
+			return 0;
+		}
+		_source->next(_poolFrame);
+		_logFrameErrors();
+		return _parseFile(_poolFrame.data(), _poolFrame.size(), rds, n);
+	}
 
 	if (_fd < 0) {
 		if (!reopen()) {
@@ -259,25 +293,46 @@ ssize_t MeterSML::read(std::vector<Reading> &rds, size_t n) {
 			  wlen);
 	}
 
-	/* wait until we receive a new datagram from the meter (blocking read) */
-	bytes = sml_transport_read(_fd, buffer, SML_BUFFER_LEN);
-
-	if (0 == bytes) {
-		// try to reopen. see issue #362
-		if (reopen()) {
-			bytes = sml_transport_read(_fd, buffer, SML_BUFFER_LEN);
-			print(log_info, "sml_transport_read returned len=%d after reopen", name().c_str(),
-				  bytes);
+	/* wait until we receive a new datagram from the meter,
+	   corrupt ones are dropped by the framer without reopening */
+	while (!_framer.next()) {
+		if (_fill() < 0) {
+			// the device is gone, try to reopen. see issue #362
+			reopen();
+			return 0;
 		}
 	}
 
-	if (bytes < 16) {
-		print(log_error, "short message from sml_transport_read len=%d", name().c_str(), bytes);
-		return (0);
+	_logFrameErrors();
+	return _parseFile(_framer.frame(), _framer.frameLen(), rds, n);
+}
+
+void MeterSML::_logFrameErrors() {
+	const vz::metrics::FrameStats &stats = *frameStats();
+	uint64_t errors = stats.corrupt + stats.crc_errors;
+	if (errors != _frameErrors) {
+		print(log_warning,
+			  "dropped %llu corrupt frames and %llu with CRC errors so far (%llu resyncs)",
+			  name().c_str(), (unsigned long long)stats.corrupt.load(),
+			  (unsigned long long)stats.crc_errors.load(), (unsigned long long)stats.resyncs.load());
+		_frameErrors = errors;
 	}
+}
+
+ssize_t MeterSML::_parseFile(const unsigned char *buf, size_t len, std::vector<Reading> &rds,
+							 size_t n) {
+	size_t m = 0;
+
+	sml_file *file;
+	sml_get_list_response *body;
+	sml_list *entry;
 
-	/* parse SML file & stripping escape sequences */
-	file = sml_file_parse(buffer + 8, bytes - 16);
+	/* parse SML file, the escape sequences are already stripped */
+	file = sml_file_parse((unsigned char *)buf, len);
+
+	/* all readings of the file get the same local time */
+	struct timeval now;
+	gettimeofday(&now, NULL);
 
 	/* obtain SML messagebody of type getResponseList */
 	for (short i = 0; i < file->messages_len; i++) {
@@ -289,7 +344,7 @@ ssize_t MeterSML::read(std::vector<Reading> &rds, size_t n) {
 
 			/* iterating through linked list */
 			for (; m < n && entry != NULL;) {
-				if (_parse(entry, &rds[m]))
+				if (_parse(entry, &rds[m], now))
 					m++;
 				entry = entry->next;
 			}
@@ -302,40 +357,89 @@ ssize_t MeterSML::read(std::vector<Reading> &rds, size_t n) {
 	return m; // return number of successful readings
 }
 
-bool MeterSML::_parse(sml_list *entry, Reading *rd) {
-	// int unit = (entry->unit) ? *entry->unit : 0;
-	int scaler = (entry->scaler) ? *entry->scaler : 1;
+int MeterSML::_fill() {
+	size_t len;
+	unsigned char *space = _framer.space(len);
 
-	Obis obis((unsigned char)entry->obj_name->str[0], (unsigned char)entry->obj_name->str[1],
-			  (unsigned char)entry->obj_name->str[2], (unsigned char)entry->obj_name->str[3],
-			  (unsigned char)entry->obj_name->str[4], (unsigned char)entry->obj_name->str[5]);
-	if (obis.isValid() && entry->value != NULL) {
-		// some entries might contain a string so check type and use proper rd->value(...) call
-		// if the entry does contain a string we can either throw it away or try to convert it to
-		// a value. We throw it away for now as its octet encoded and would need some conversion
-		if (entry->value->type == SML_TYPE_OCTET_STRING) {
-			// ignore value for now (entry->value->data.bytes points to something like
-			// "3032323830383136" we don't even create a reading for this:
-			return false;
-		} else {
-			rd->value(sml_value_to_double(entry->value) * pow(10, scaler));
+	struct pollfd pfd;
+	pfd.fd = _fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, -1) < 0) {
+		if (errno == EINTR)
+			return 0;
+		print(log_error, "error waiting for data (%s)", name().c_str(), strerror(errno));
+		return -1;
+	}
+
+	ssize_t bytes = ::read(_fd, space, len);
+	if (bytes > 0) {
+		_framer.commit(bytes);
+		return 1;
+	}
+	if (bytes < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	print(log_error, "error reading data (%s)", name().c_str(),
+		  bytes ? strerror(errno) : "end of file");
+	return -1;
+}
+
+// 10^scaler for all scalers (int8)
+static double scale_factor(int scaler) {
+	static const struct Table {
+		Table() {
+			for (int i = 0; i < 256; i++)
+				factor[i] = pow(10, i - 128);
 		}
+		double factor[256];
+	} table;
+	return table.factor[(scaler + 128) & 0xff];
+}
+
+bool MeterSML::_parse(sml_list *entry, Reading *rd, const struct timeval &now) {
+	if (entry->obj_name == NULL || entry->obj_name->len < 6 || entry->value == NULL)
+		return false;
+
+	// some entries might contain a string. We throw it away for now as its octet encoded
+	// and would need some conversion (entry->value->data.bytes points to something like
+	// "3032323830383136"), we don't even create a reading for this.
+	if (entry->value->type == SML_TYPE_OCTET_STRING)
+		return false;
+
+	const unsigned char *name = (const unsigned char *)entry->obj_name->str;
+	uint64_t key = 0;
+	for (int i = 0; i < 6; i++)
+		key = (key << 8) | name[i];
+	if (!_filter.empty() && !_filter.contains(key))
+		return false; // no channel uses it
+
+	ReadingIdentifier::Ptr rid = _identifiers.get(key);
+	if (!rid)
+		return false; // invalid OBIS code
 
-		ReadingIdentifier *rid(new ObisIdentifier(obis));
-		rd->identifier(rid);
+	// int unit = (entry->unit) ? *entry->unit : 0;
+	int scaler = (entry->scaler) ? *entry->scaler : 1;
+	rd->value(sml_value_to_double(entry->value) * scale_factor(scaler));
+	rd->identifier(rid);
 
-		// TODO handle SML_TIME_SEC_INDEX or time by SML File/Message
+	// TODO handle SML_TIME_SEC_INDEX or time by SML File/Message
+	if (!_use_local_time && entry->val_time) { /* use time from meter */
 		struct timeval tv;
-		if (!_use_local_time && entry->val_time) { /* use time from meter */
-			tv.tv_sec = *entry->val_time->data.timestamp;
-			tv.tv_usec = 0;
-		} else {
-			gettimeofday(&tv, NULL); /* use local time */
-		}
+		tv.tv_sec = *entry->val_time->data.timestamp;
+		tv.tv_usec = 0;
 		rd->time(tv);
-		return true;
+	} else {
+		rd->time(now); /* use local time */
 	}
-	return false;
+	return true;
+}
+
+void MeterSML::channelIdentifiers(const std::vector<ReadingIdentifier::Ptr> &ids) {
+	std::vector<Obis> codes = ObisIdentifiers::channelCodes(ids);
+	_filter.assign(codes);
+	if (codes.size())
+		print(log_debug, "Reading %zu OBIS codes, skipping other entries", name().c_str(),
+			  _filter.size());
 }
 
 int MeterSML::_openSocket(const char *node, const char *service) {
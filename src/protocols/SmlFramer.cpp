@@ -0,0 +1,179 @@
+/**
+ * Framer for the SML transport protocol version 1
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "protocols/SmlFramer.hpp"
+
+static const uint8_t start_seq[8] = {0x1b, 0x1b, 0x1b, 0x1b, 0x01, 0x01, 0x01, 0x01};
+
+SmlFramer::SmlFramer(size_t max_len) : _frame(max_len), _verifyCrc(true) { reset(); }
+
+void SmlFramer::reset() {
+	_rd = _fill = 0;
+	_state = HUNT;
+	_match = 0;
+	_wLen = 0;
+	_escape = false;
+	_resync = false;
+	_len = 0;
+}
+
+unsigned char *SmlFramer::space(size_t &len) {
+	if (_fill == 0)
+		_rd = 0; // the whole buffer is free
+	size_t wr = (_rd + _fill) % INPUT_LEN;
+	if (_fill == INPUT_LEN)
+		len = 0;
+	else if (wr >= _rd)
+		len = INPUT_LEN - wr;
+	else
+		len = _rd - wr;
+	return _in + wr;
+}
+
+void SmlFramer::commit(size_t len) { _fill += len; }
+
+bool SmlFramer::next() {
+	while (_fill) {
+		uint8_t byte = _in[_rd];
+		_rd = (_rd + 1) % INPUT_LEN;
+		_fill--;
+
+		if (_state == HUNT) {
+			if (_hunt(byte))
+				_begin();
+		} else {
+			_w[_wLen++] = byte;
+			if (_hunt(byte) && _wLen < 4) { // unaligned start sequence, bytes were lost
+				_stats.corrupt++;
+				_resync = true;
+				_begin();
+			} else if (_wLen == 4 && _word()) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool SmlFramer::_hunt(uint8_t byte) {
+	if (byte == start_seq[_match]) {
+		if (++_match < sizeof(start_seq))
+			return false;
+		_match = 0;
+		return true;
+	}
+	// a run of more than four 0x1b still ends with an escape sequence
+	_match = (byte == 0x1b) ? (_match == 4 ? 4 : 1) : 0;
+	return false;
+}
+
+void SmlFramer::_begin() {
+	_state = BODY;
+	_match = 0;
+	_wLen = 0;
+	_escape = false;
+	_len = 0;
+	_crcReg = 0xffff;
+	_crc(start_seq, sizeof(start_seq));
+	if (_resync) {
+		_stats.resyncs++;
+		_resync = false;
+	}
+}
+
+void SmlFramer::_lost(bool crc) {
+	if (crc)
+		_stats.crc_errors++;
+	else
+		_stats.corrupt++;
+	_state = HUNT;
+	_match = 0;
+	_resync = true;
+	// the word may already be part of the next start sequence
+	for (size_t i = 0; i < 4; i++)
+		_hunt(_w[i]);
+}
+
+bool SmlFramer::_word() {
+	static const uint8_t esc_seq[4] = {0x1b, 0x1b, 0x1b, 0x1b};
+	bool esc = memcmp(_w, esc_seq, 4) == 0;
+	_wLen = 0;
+
+	if (_escape) {
+		_escape = false;
+		if (esc) { // escaped data
+			_crc(_w, 4);
+		} else if (memcmp(_w, start_seq + 4, 4) == 0) { // the frame was cut off by the next one
+			_stats.corrupt++;
+			_resync = true;
+			_begin();
+			return false;
+		} else if (_w[0] == 0x1a) { // end sequence: 1a <padding> <crc16, lsb first>
+			_crc(_w, 2);
+			uint16_t crc = _crcReg ^ 0xffff;
+			size_t padding = _w[1];
+			if (padding > 3 || padding > _len) {
+				_lost();
+			} else if (_verifyCrc && (_w[2] != (crc & 0xff) || _w[3] != (crc >> 8))) {
+				_lost(true);
+			} else {
+				_len -= padding;
+				_state = HUNT;
+				_stats.frames++;
+				return true;
+			}
+			return false;
+		} else {
+			_lost();
+			return false;
+		}
+	} else {
+		_crc(_w, 4);
+		if (esc) {
+			_escape = true;
+			return false;
+		}
+	}
+
+	if (_len + 4 > _frame.size()) {
+		_lost();
+		return false;
+	}
+	memcpy(&_frame[_len], _w, 4);
+	_len += 4;
+	return false;
+}
+
+// CRC-16/X-25 (reflected 0x1021), as in sml_crc16_calculate()
+void SmlFramer::_crc(const uint8_t *p, size_t len) {
+	uint16_t crc = _crcReg;
+	for (size_t i = 0; i < len; i++) {
+		uint8_t x = p[i] ^ (crc & 0xff);
+		x ^= x << 4;
+		crc = (crc >> 8) ^ ((uint16_t)x << 8) ^ ((uint16_t)x << 3) ^ (x >> 4);
+	}
+	_crcReg = crc;
+}
@@ -0,0 +1,317 @@
+/**
+ * Event loop receiving SML over TCP from many remote sources
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2011, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "Metrics.hpp"
+#include "common.h"
+#include "protocols/SmlTcpPool.hpp"
+
+static const uint64_t WAKE_ID = 0;
+
+SmlTcpPool::Source::Source(const std::string &name, struct addrinfo *ais, int timeout)
+	: _name(name), _ais(ais), _timeout(timeout), _ai(ais), _fd(-1), _state(CLOSED), _reconnect(0),
+	  _deadline(0), _backoff(1) {
+	_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+SmlTcpPool::Source::~Source() {
+	if (_fd >= 0)
+		::close(_fd);
+	::close(_event);
+	freeaddrinfo(_ais);
+}
+
+void SmlTcpPool::Source::next(std::vector<unsigned char> &frame) {
+	SmlTcpPool &pool = SmlTcpPool::instance();
+	for (;;) {
+		{
+			std::lock_guard<std::mutex> lock(pool._mutex);
+			if (!_frames.empty()) {
+				frame.swap(_frames.front());
+				_frames.pop_front();
+				return;
+			}
+		}
+		struct pollfd pfd;
+		pfd.fd = _event;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		poll(&pfd, 1, -1);
+		uint64_t count;
+		if (::read(_event, &count, sizeof(count)) < 0 && errno != EAGAIN && errno != EINTR) {
+			print(log_error, "eventfd: %s", _name.c_str(), strerror(errno));
+			sleep(1);
+		}
+	}
+}
+
+bool SmlTcpPool::Source::connected() {
+	std::lock_guard<std::mutex> lock(SmlTcpPool::instance()._mutex);
+	return _state == CONNECTED;
+}
+
+SmlTcpPool &SmlTcpPool::instance() {
+	// never destroyed, the loop runs until the process exits
+	static SmlTcpPool *pool = new SmlTcpPool();
+	return *pool;
+}
+
+SmlTcpPool::SmlTcpPool() : _nextId(WAKE_ID + 1), _nextTimer(0), _running(false) {
+	_epoll = epoll_create1(EPOLL_CLOEXEC);
+	_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = WAKE_ID;
+	epoll_ctl(_epoll, EPOLL_CTL_ADD, _wake, &ev);
+}
+
+SmlTcpPool::Source::Ptr SmlTcpPool::add(const char *node, const char *service,
+										const std::string &name, int timeout) {
+	struct addrinfo hints, *ais;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int rc = getaddrinfo(node, service, &hints, &ais);
+	if (rc != 0) {
+		print(log_alert, "getaddrinfo(%s, %s): %s", name.c_str(), node, service, gai_strerror(rc));
+		return Source::Ptr();
+	}
+
+	Source::Ptr source(new Source(name, ais, timeout));
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_sources[_nextId++] = source;
+	_nextTimer = 0; // connect now
+	if (!_running) {
+		_running = pthread_create(&_thread, NULL, &_run, this) == 0;
+		if (_running)
+			pthread_detach(_thread);
+	}
+	uint64_t one = 1;
+	if (write(_wake, &one, sizeof(one)) < 0)
+		print(log_error, "eventfd: %s", name.c_str(), strerror(errno));
+	return source;
+}
+
+void SmlTcpPool::remove(const Source::Ptr &source) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (std::map<uint64_t, Source::Ptr>::iterator it = _sources.begin(); it != _sources.end();
+		 it++) {
+		if (it->second == source) {
+			if (source->_fd >= 0) {
+				::close(source->_fd); // removed from the epoll set as well
+				source->_fd = -1;
+			}
+			source->_state = Source::CLOSED;
+			_sources.erase(it);
+			return;
+		}
+	}
+}
+
+size_t SmlTcpPool::size() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _sources.size();
+}
+
+void *SmlTcpPool::_run(void *arg) {
+	static_cast<SmlTcpPool *>(arg)->_loop();
+	return NULL;
+}
+
+void SmlTcpPool::_loop() {
+	const int MAX_EVENTS = 64;
+	struct epoll_event events[MAX_EVENTS];
+	int timeout_ms = 0;
+
+	for (;;) {
+		int n = epoll_wait(_epoll, events, MAX_EVENTS, timeout_ms);
+		if (n < 0 && errno != EINTR) {
+			print(log_error, "epoll_wait: %s", "sml", strerror(errno));
+			sleep(1);
+		}
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		double now = vz::metrics::monotonic();
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.u64 == WAKE_ID) {
+				uint64_t count;
+				if (::read(_wake, &count, sizeof(count)) < 0 && errno != EAGAIN)
+					print(log_error, "eventfd: %s", "sml", strerror(errno));
+				continue;
+			}
+			std::map<uint64_t, Source::Ptr>::iterator it = _sources.find(events[i].data.u64);
+			if (it == _sources.end())
+				continue; // removed meanwhile
+			Source &source = *it->second;
+
+			if (source._state == Source::CONNECTING) {
+				int err = 0;
+				socklen_t len = sizeof(err);
+				getsockopt(source._fd, SOL_SOCKET, SO_ERROR, &err, &len);
+				if (err) {
+					_connectFailed(it->first, source, now, err);
+					continue;
+				}
+				print(log_info, "connected", source._name.c_str());
+				source._state = Source::CONNECTED;
+				source._deadline = now + source._timeout;
+				struct epoll_event ev;
+				ev.events = EPOLLIN;
+				ev.data.u64 = it->first;
+				epoll_ctl(_epoll, EPOLL_CTL_MOD, source._fd, &ev);
+			} else if (source._state == Source::CONNECTED) {
+				_receive(source, now);
+			}
+		}
+
+		// (re)connect the closed sources which are due, close the ones without data.
+		// SO_KEEPALIVE alone keeps half-open connections for hours.
+		if (now >= _nextTimer) {
+			_nextTimer = now + MAX_BACKOFF;
+			for (std::map<uint64_t, Source::Ptr>::iterator it = _sources.begin();
+				 it != _sources.end(); it++) {
+				Source &source = *it->second;
+				if (source._state == Source::CONNECTING && source._deadline <= now) {
+					_connectFailed(it->first, source, now, ETIMEDOUT);
+				} else if (source._state == Source::CONNECTED && source._deadline <= now) {
+					print(log_warning, "no data for %ds, reconnecting in %ds",
+						  source._name.c_str(), source._timeout, source._backoff);
+					_disconnect(source, now);
+				} else if (source._state == Source::CLOSED && source._reconnect <= now) {
+					_connect(it->first, source, now);
+				}
+				double timer = source._state == Source::CLOSED ? source._reconnect
+															   : source._deadline;
+				if (timer < _nextTimer)
+					_nextTimer = timer;
+			}
+		}
+		timeout_ms = (int)((_nextTimer - now) * 1000) + 1;
+	}
+}
+
+void SmlTcpPool::_connect(uint64_t id, Source &source, double now) {
+	source._fd = socket(source._ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (source._fd < 0) {
+		_connectFailed(id, source, now, errno); // e.g. no IPv6
+		return;
+	}
+	int on = 1;
+	setsockopt(source._fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+
+	source._framer.reset();
+	source._deadline = now + source._timeout;
+	if (source._deadline < _nextTimer)
+		_nextTimer = source._deadline;
+	struct epoll_event ev;
+	ev.data.u64 = id;
+	if (::connect(source._fd, source._ai->ai_addr, source._ai->ai_addrlen) == 0) {
+		source._state = Source::CONNECTED;
+		ev.events = EPOLLIN;
+	} else if (errno == EINPROGRESS) {
+		source._state = Source::CONNECTING;
+		ev.events = EPOLLOUT;
+	} else {
+		_connectFailed(id, source, now, errno);
+		return;
+	}
+	epoll_ctl(_epoll, EPOLL_CTL_ADD, source._fd, &ev);
+}
+
+void SmlTcpPool::_connectFailed(uint64_t id, Source &source, double now, int err) {
+	if (source._ai->ai_next) { // try the next address of the host right away
+		print(log_info, "connect: %s, trying the next address", source._name.c_str(),
+			  strerror(err));
+		if (source._fd >= 0)
+			::close(source._fd);
+		source._fd = -1;
+		source._ai = source._ai->ai_next;
+		_connect(id, source, now);
+		return;
+	}
+	print(log_warning, "connect: %s, retrying in %ds", source._name.c_str(), strerror(err),
+		  source._backoff);
+	source._ai = source._ais;
+	_disconnect(source, now);
+}
+
+void SmlTcpPool::_disconnect(Source &source, double now) {
+	if (source._fd >= 0) {
+		::close(source._fd);
+		source._fd = -1;
+	}
+	source._state = Source::CLOSED;
+	source._reconnect = now + source._backoff;
+	if (source._reconnect < _nextTimer)
+		_nextTimer = source._reconnect;
+	source._backoff *= 2;
+	if (source._backoff > MAX_BACKOFF)
+		source._backoff = MAX_BACKOFF;
+}
+
+void SmlTcpPool::_receive(Source &source, double now) {
+	bool queued = false;
+	for (;;) {
+		size_t len;
+		unsigned char *space = source._framer.space(len);
+		ssize_t bytes = ::read(source._fd, space, len);
+		if (bytes < 0 && errno == EINTR)
+			continue;
+		if (bytes < 0 && errno == EAGAIN)
+			break;
+		if (bytes <= 0) {
+			print(log_warning, "%s, reconnecting in %ds", source._name.c_str(),
+				  bytes ? strerror(errno) : "connection closed", source._backoff);
+			_disconnect(source, now);
+			break;
+		}
+
+		source._deadline = now + source._timeout;
+		source._framer.commit(bytes);
+		while (source._framer.next()) {
+			if (source._frames.size() >= MAX_QUEUED) {
+				print(log_warning, "meter too slow, frame dropped", source._name.c_str());
+				source._frames.pop_front();
+			}
+			source._frames.push_back(std::vector<unsigned char>(
+				source._framer.frame(), source._framer.frame() + source._framer.frameLen()));
+			source._backoff = 1; // the source works
+			queued = true;
+		}
+	}
+
+	if (queued) {
+		uint64_t one = 1;
+		if (write(source._event, &one, sizeof(one)) < 0)
+			print(log_error, "eventfd: %s", source._name.c_str(), strerror(errno));
+	}
+}
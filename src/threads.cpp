@@ -23,6 +23,7 @@
  * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <math.h>
 #include <unistd.h>
 
@@ -54,6 +55,7 @@ void *reading_thread(void *arg) {
 
 	details = meter_get_details(mtr->protocolId());
 	std::vector<Reading> rds(mtr->adapt_max_readings(details->max_readings, mapping->size()), Reading(mtr->identifier()));
+	std::vector<bool> dispatched(rds.size());
 
 	print(log_debug, "Number of readers: %d", mtr->name(), details->max_readings);
 	print(log_debug, "Config.local: %d", mtr->name(), options.local());
@@ -75,6 +77,7 @@ void *reading_thread(void *arg) {
 
 				/* fetch readings from meter and calculate delta */
 				n = mtr->read(rds, details->max_readings);
+				mtr->stats().readings.fetch_add(n, std::memory_order_relaxed);
 
 				/* dumping meter output */
 				if (options.verbosity() > log_debug) {
@@ -111,6 +114,7 @@ void *reading_thread(void *arg) {
 						}
 
 				/* insert readings into channel queues */
+				dispatched.assign(n, false);
 				if (n > 0)
 					for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
 
@@ -119,8 +123,11 @@ void *reading_thread(void *arg) {
 						for (size_t i = 0; i < n; i++) {
 							if (*rds[i].identifier().get() == *(*ch)->identifier().get()) {
 								// print(log_debug, "Found channel %s == %s", mtr->name(), rds[i].identifier().get()->toString().c_str(), (*ch)->identifier().get()->toString().c_str());
+								dispatched[i] = true;
 								if ((*ch)->time_ms() < rds[i].time_ms()) {
 									(*ch)->last(&rds[i]);
+									(*ch)->stats().last_value.store(rds[i].value());
+									(*ch)->stats().last_time_ms.store(rds[i].time_ms());
 								}
 
 								print(log_info, "Adding reading to queue (value=%.2f ts=%lld)",
@@ -145,41 +152,36 @@ void *reading_thread(void *arg) {
 						}
 
 					}                                                   // channel loop
+				mtr->stats().dispatch_misses.fetch_add(
+					std::count(dispatched.begin(), dispatched.end(), false),
+					std::memory_order_relaxed);
 			} while ((mtr->aggtime() > 0) && (time(NULL) < aggIntEnd)); /* default aggtime is -1 */
 
 			for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
 
 				/* aggregate buffer values if aggmode != NONE */
 				(*ch)->buffer()->aggregate(mtr->aggtime(), mtr->aggFixedInterval());
-				/* mark buffer "ready" */
-				(*ch)->buffer()->have_newValues();
 
 				/* shrink buffer */
 				(*ch)->buffer()->clean();
+				(*ch)->stats().buffer_depth.store((*ch)->size());
 #ifdef LOCAL_SUPPORT
 				if (options.local()) {
 					shrink_localbuffer();          // remove old/outdated data in the local buffer
 					add_ch_to_localbuffer(*(*ch)); // add this ch data to the local buffer
 				}
 #endif
+			}
 #ifdef ENABLE_MQTT
-				// update mqtt values as well:
-				if (mqttClient) {
-					Buffer::Ptr buf = (*ch)->buffer();
-					Buffer::iterator it;
-					buf->lock();
-					for (it = buf->begin(); it != buf->end(); ++it) {
-						if (&*it) { // this seems dirty. see issue #427
-									// the lock()/unlock() should avoid it.
-							Reading &r = *it;
-							if (!r.deleted()) {
-								mqttClient->publish((*ch), r, true);
-							}
-						}
-					}
-					buf->unlock();
-				}
+			// update mqtt values as well, all channels of the meter at once so that
+			// each mqtt group is published once per cycle:
+			if (mqttClient) {
+				mqttClient->publish(mapping->begin(), mapping->end());
+			}
 #endif
+			for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
+				/* mark buffer "ready" */
+				(*ch)->buffer()->have_newValues();
 
 				/* notify webserver and logging thread */
 				(*ch)->notify();
@@ -240,6 +242,7 @@ void *logging_thread(void *arg) { // is started by Channel::start and stopped vi
 		try {
 			ch->wait();
 			api->send();
+			ch->stats().buffer_depth.store(ch->size());
 		} catch (std::exception &e) {
 			print(log_alert, "Logging thread failed due to: %s", ch->name(), e.what());
 		}
@@ -571,9 +571,9 @@ int main(int argc, char *argv[]) {
 		// start webserver for local interface
 		if (options.local()) {
 			print(log_info, "Starting local interface HTTPd on port %i", "http", options.port());
-			httpd_handle =
-				MHD_start_daemon(MHD_USE_THREAD_PER_CONNECTION, options.port(), NULL, NULL,
-								 &handle_request, (void *)&mappings, MHD_OPTION_END);
+			httpd_handle = local_start_daemon(&mappings);
+			if (!httpd_handle)
+				print(log_alert, "Failed to start local interface HTTPd", "http");
 		}
 #endif /* LOCAL_SUPPORT */
 	} catch (std::exception &e) {
@@ -612,6 +612,11 @@ int main(int argc, char *argv[]) {
 					::sleep(1); // 1s should be ok. will introduce a shutdown latency >1s
 				}
 			}
+#ifdef LOCAL_SUPPORT
+			if (httpd_handle) {
+				local_expire_waiters(); // answer timed out comet requests
+			}
+#endif /* LOCAL_SUPPORT */
 			if (mainLoopReopenLogfile) {
 				mainLoopReopenLogfile = false;
 				print(log_info, "closing logfile for re-opening (requested with SIGUSR1)", "");
@@ -631,6 +636,7 @@ int main(int argc, char *argv[]) {
 	/* stop webserver */
 	if (httpd_handle) {
 		print(log_finest, "Waiting for httpd to stop...", "");
+		local_resume_all(); // suspended connections have to be resumed before stopping
 		MHD_stop_daemon(httpd_handle);
 		print(log_finest, "httpd stopped", "");
 	}
@@ -1,6 +1,13 @@
 #include "protocols/MeterD0.hpp"
 #include "Options.hpp"
 #include "gtest/gtest.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <test_helpers.hpp>
+#include <thread>
 
 // this is a dirty hack. we should think about better ways/rules to link against the
 // test objects.
@@ -11,6 +18,8 @@
 #include "../src/Obis.cpp"
 #include "../src/Options.cpp"
 #include "../src/Reading.cpp"
+#include "../src/protocols/D0Bus.cpp"
+#include "../src/protocols/D0Parser.cpp"
 #include "../src/protocols/MeterD0.cpp"
 
 void print(log_level_t l, char const *s1, char const *s2, ...) {
@@ -30,6 +39,39 @@ int writes(int fd, const char *str) {
 	return write(fd, str, len);
 }
 
+/*
+ * The meter reads chunks, so bytes following a telegram can't be left in a fifo.
+ * Tests checking what the meter sent use a pseudo terminal instead: the meter opens
+ * the slave, the test simulates the device on the master.
+ */
+int open_pty(std::string &slave) {
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0)
+		return -1;
+	slave = ptsname(fd);
+	return fd;
+}
+
+// simulated device: waits for the pull sequence, answers and collects what the meter sends
+std::thread answer_pull(int fd, std::string pull, std::string answer, std::string &received) {
+	return std::thread([fd, pull, answer, &received]() {
+		char buf[100];
+		bool answered = false;
+		struct pollfd pfd = {fd, POLLIN, 0};
+		// stop 500ms after the last byte
+		while (poll(&pfd, 1, answered ? 500 : 5000) > 0) {
+			ssize_t len = read(fd, buf, sizeof(buf));
+			if (len <= 0)
+				break;
+			received.append(buf, len);
+			if (!answered && received.find(pull) != std::string::npos) {
+				EXPECT_EQ((ssize_t)answer.size(), write(fd, answer.data(), answer.size()));
+				answered = true;
+			}
+		}
+	});
+}
+
 TEST(MeterD0, basic_dump_fd) {
 
 	std::string dumpName("/tmp/dumpD0UnitTestxyz1234");
@@ -66,36 +108,35 @@ TEST(MeterD0, basic_dump_fd) {
 TEST(MeterD0, basic_dump_fd_autoack) {
 
 	std::string dumpName("/tmp/dumpD0UnitTestxyz1234");
-	char tempfilename[L_tmpnam + 1];
-	ASSERT_NE(tmpnam_r(tempfilename), (char *)0);
+	std::string device;
+	int fd = open_pty(device);
+	ASSERT_NE(fd, -1);
 	std::list<Option> options;
-	options.push_back(Option("device", tempfilename));
+	options.push_back(Option("device", (char *)device.c_str()));
 	options.push_back(Option("dump_file", (char *)dumpName.c_str()));
 	options.push_back(Option("pullseq", (char *)"2F3F210D0A"));
 	options.push_back(Option("ackseq", (char *)"auto"));
 	options.push_back(Option("baudrate", 300));
 	MeterD0 m(options);
-	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
-	int fd = open(tempfilename, O_RDWR);
-	ASSERT_NE(fd, -1);
 	ASSERT_EQ(SUCCESS, m.open());
 	std::vector<Reading> rds;
 	rds.resize(1);
 	// can't test for timeout here as the fdset... don't work for pipes. EXPECT_EQ(0, m.read(rds,
 	// 10)); // check for timeout
-	writes(fd, "/HAg5eHZ010C_EHZ1vA02\r\n");      // small (HA)g to set reaction time to 20ms
-	writes(fd, "1-0:1.8.0*255(000001.2963)\r\n"); // works only with \r\n error (see ack handling)
-	writes(fd, "!");
+	std::string received;
+	std::thread device_thread = answer_pull(fd, "/?!\r\n",
+											"/HAg5eHZ010C_EHZ1vA02\r\n" // small (HA)g: 20ms
+											"1-0:1.8.0*255(000001.2963)\r\n"
+											"!",
+											received);
 	EXPECT_EQ(1, m.read(rds, 1));
+	device_thread.join();
 
-	// now read from fd and check for pullseq and proper ackseq:
-	char buf[100];
-	ssize_t len = read(fd, buf, sizeof(buf));
-	EXPECT_EQ((ssize_t)strlen("/?!\r\n\x06\x30\x35\x30\x0d\x0a"), len) << "buf=[" << buf << "]";
+	// check for pullseq and proper ackseq:
+	EXPECT_EQ(std::string("/?!\r\n\x06\x30\x35\x30\x0d\x0a"), received);
 
 	ASSERT_EQ(0, m.close());
 	EXPECT_EQ(0, close(fd));
-	EXPECT_EQ(0, unlink(tempfilename));
 	//	EXPECT_EQ(0, unlink(dumpName.c_str()));
 }
 
@@ -196,17 +237,15 @@ TEST(MeterD0, HagerEHZ_waitsync) {
 }
 
 TEST(MeterD0, LandisGyr_basic) {
-	char tempfilename[L_tmpnam + 1];
+	std::string device;
+	int fd = open_pty(device);
+	ASSERT_NE(fd, -1);
 	char str_pullseq[12] = "2f3f210d0a";
-	ASSERT_NE(tmpnam_r(tempfilename), (char *)0);
 	std::list<Option> options;
-	options.push_back(Option("device", tempfilename));
+	options.push_back(Option("device", (char *)device.c_str()));
 	options.push_back(Option("pullseq", str_pullseq));
 	MeterD0 m(options);
-	ASSERT_STREQ(m.device(), tempfilename) << "devicename not eq " << tempfilename;
-	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
-	int fd = open(tempfilename, O_RDWR);
-	ASSERT_NE(fd, -1);
+	ASSERT_STREQ(m.device(), device.c_str()) << "devicename not eq " << device;
 	ASSERT_EQ(SUCCESS, m.open());
 
 	// now we can simulate some input by simply writing into fd
@@ -228,27 +267,25 @@ TEST(MeterD0, LandisGyr_basic) {
 	2.8.0(004329.6*kWh) <-- Summe Zählerstand Energieeinspeisung
 	!                   <-- Endesequenz
 	*/
-	// without splitting the MeterD0::read source/logic (or multithreading) we can't
-	// wait for the pullseq before we put the data. Thus we just put the data in the buffer
-	// and check afterwards whether a pullseq was send as well.
-
-	writes(fd, "/?!\r\n/LGZ52ZMD120APt.G03\r\n");
-	writes(fd, "F.F(00000000)\r\n"); // works only with \r\n error (see ack handling)
-	writes(fd, "0.0.0( 20000)\r\n");
-	writes(fd, "1.8.1(001846.0*kWh)\r\n");
-	writes(fd, "1.8.2(000000.0*kWh)\r\n");
-	writes(fd, "2.8.1(004329.6*kWh)\r\n");
-	writes(fd, "2.8.2(000000.0*kWh)\r\n");
-	writes(fd, "1.8.0(001846.0*kWh)\r\n");
-	writes(fd, "2.8.0(004329.6*kWh)\r\n");
-	writes(fd, "!");
+	std::string received;
+	std::thread device_thread = answer_pull(fd, "/?!\r\n",
+											"/?!\r\n/LGZ52ZMD120APt.G03\r\n"
+											"F.F(00000000)\r\n"
+											"0.0.0( 20000)\r\n"
+											"1.8.1(001846.0*kWh)\r\n"
+											"1.8.2(000000.0*kWh)\r\n"
+											"2.8.1(004329.6*kWh)\r\n"
+											"2.8.2(000000.0*kWh)\r\n"
+											"1.8.0(001846.0*kWh)\r\n"
+											"2.8.0(004329.6*kWh)\r\n"
+											"!",
+											received);
 
 	// now perform one read call
 	EXPECT_EQ(8, m.read(rds, 10));
-	// check whether pullseq is remaining in the fifo:
-	char buf[100];
-	ssize_t len = read(fd, buf, sizeof(buf));
-	ASSERT_EQ((ssize_t)strlen("/?!\r\n"), len) << "buf=[" << buf << "]";
+	device_thread.join();
+	// check whether pullseq was sent:
+	ASSERT_EQ(std::string("/?!\r\n"), received);
 
 	// check obis data:
 	ReadingIdentifier *p = rds[2].identifier().get();
@@ -273,7 +310,6 @@ TEST(MeterD0, LandisGyr_basic) {
 	EXPECT_EQ(0, m.close());
 
 	EXPECT_EQ(0, close(fd));
-	EXPECT_EQ(0, unlink(tempfilename));
 }
 
 int writes_hex(int fd, const char *str) {
@@ -293,17 +329,15 @@ int writes_hex(int fd, const char *str) {
 }
 
 TEST(MeterD0, ACE3000_basic) {
-	char tempfilename[L_tmpnam + 1];
+	std::string device;
+	int fd = open_pty(device);
+	ASSERT_NE(fd, -1);
 	char str_pullseq[12] = "2f3f210d0a";
-	ASSERT_NE(tmpnam_r(tempfilename), (char *)0);
 	std::list<Option> options;
-	options.push_back(Option("device", tempfilename));
+	options.push_back(Option("device", (char *)device.c_str()));
 	options.push_back(Option("pullseq", str_pullseq));
 	MeterD0 m(options);
-	ASSERT_STREQ(m.device(), tempfilename) << "devicename not eq " << tempfilename;
-	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
-	int fd = open(tempfilename, O_RDWR);
-	ASSERT_NE(fd, -1);
+	ASSERT_STREQ(m.device(), device.c_str()) << "devicename not eq " << device;
 	ASSERT_EQ(SUCCESS, m.open());
 
 	// now we can simulate some input by simply writing into fd
@@ -321,26 +355,24 @@ TEST(MeterD0, ACE3000_basic) {
 	1.8.0(013925.5*)    <-- Summe Zählerstand Energielieferung
 	Y<0x02><0x02><0x01><0x00>!<0x0d><0x0a><0x03>F<0x7f>    <-- Endesequenz and garbage?
 	*/
-	// without splitting the MeterD0::read source/logic (or multithreading) we can't
-	// wait for the pullseq before we put the data. Thus we just put the data in the buffer
-	// and check afterwards whether a pullseq was send as well.
-
-	writes_hex(fd, "7f7f7f7f7f2f3f210d0a2f414345305c336b3236305630312e31390d0a");
-	writes_hex(fd, "02462e46283030290d0a432e31283131323631");
-	writes_hex(fd, "3230303533333232333533290d0a");
-	writes_hex(fd, "432e352e30283030290d0a");                       // C.5.0(00)
-	writes_hex(fd, "312e382e30283031333932352e352a29590202010021"); // 1.8.0(01392.5*) ... !
-	writes_hex(fd, "0d0a03467f"); // (newline and <ETX> <BCC =0x46> garbage...) TODO add BCC check
-								  // (according to DIN 66219 / IEC 1155, if STX/ETX there should be
-								  // BCC as well. BCC = xor all from STX (not incl.) to ETX (incl.))
+	std::string received;
+	std::thread device_thread = answer_pull(
+		fd, "/?!\r\n",
+		from_hex("7f7f7f7f7f2f3f210d0a2f414345305c336b3236305630312e31390d0a"
+				 "02462e46283030290d0a432e31283131323631"
+				 "3230303533333232333533290d0a"
+				 "432e352e30283030290d0a"                       // C.5.0(00)
+				 "312e382e30283031333932352e352a29590202010021" // 1.8.0(01392.5*) ... !
+				 "0d0a03467f"), // (newline and <ETX> <BCC =0x46> garbage...) TODO add BCC check
+		// (according to DIN 66219 / IEC 1155, if STX/ETX there should be
+		// BCC as well. BCC = xor all from STX (not incl.) to ETX (incl.))
+		received);
 
 	// now perform one read call:
 	EXPECT_EQ(4, m.read(rds, 4));
-	// check whether garbage (after !) and pullseq is remaining in the fifo:
-	// will be ignored on next read call TODO add check
-	char buf[100];
-	ssize_t len = read(fd, buf, sizeof(buf));
-	ASSERT_EQ((ssize_t)strlen("\x0d\x0a\x03\x46\x7f/?!\r\n"), len) << "buf=[" << buf << "]";
+	device_thread.join();
+	// the garbage after ! stays in the receive buffer and is dropped by the next pull
+	ASSERT_EQ(std::string("/?!\r\n"), received);
 
 	// check obis data:
 	ReadingIdentifier *p = rds[3].identifier().get();
@@ -365,7 +397,6 @@ TEST(MeterD0, ACE3000_basic) {
 	EXPECT_EQ(0, m.close());
 
 	EXPECT_EQ(0, close(fd));
-	EXPECT_EQ(0, unlink(tempfilename));
 }
 
 TEST(MeterD0, SLB_DC3_basic) {
@@ -468,3 +499,195 @@ TEST(MeterD0, LuG_E350) {
 	EXPECT_EQ(0, close(fd));
 	EXPECT_EQ(0, unlink(tempfilename));
 }
+
+/*
+ * telegrams following each other in a fifo: the meter reads chunks and keeps the rest
+ * of the buffer for the next call
+ */
+TEST(MeterD0, consecutive_telegrams) {
+	char tempfilename[L_tmpnam + 1];
+	ASSERT_NE(tmpnam_r(tempfilename), (char *)0);
+	std::list<Option> options;
+	options.push_back(Option("device", tempfilename));
+	MeterD0 m(options);
+	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
+	int fd = open(tempfilename, O_RDWR);
+	ASSERT_NE(fd, -1);
+	ASSERT_EQ(SUCCESS, m.open());
+
+	std::string telegram("/LGZ4ZMF100AC.M27\r\n");
+	for (int i = 0; i < 20; i++) {
+		char line[40];
+		snprintf(line, sizeof(line), "1-0:%d.8.0*255(%06d.%03d*kWh)\r\n", i + 1, 1000 + i, i);
+		telegram += line;
+	}
+	telegram += "!\r\n";
+
+	std::vector<Reading> rds;
+	rds.resize(25);
+	const int batch = 60000 / telegram.size(); // stay below the pipe capacity
+	for (int i = 0; i < batch; i++)
+		ASSERT_EQ((ssize_t)telegram.size(), write(fd, telegram.data(), telegram.size()));
+	for (int i = 0; i < batch; i++) {
+		ASSERT_EQ(20, m.read(rds, 25)) << "telegram " << i;
+		EXPECT_EQ(1019.019, rds[19].value());
+	}
+
+	EXPECT_EQ(0, m.close());
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ(0, unlink(tempfilename));
+}
+
+/*
+ * two meters on one bus: the pull sequences are sent one after the other with the
+ * reaction time in between, each meter gets its own telegram
+ */
+TEST(MeterD0, shared_bus) {
+	std::string device;
+	int fd = open_pty(device);
+	ASSERT_NE(fd, -1);
+	char str_pull1[] = "2f3f31210d0a"; // "/?1!\r\n"
+	char str_pull2[] = "2f3f32210d0a";
+	std::list<Option> options1, options2, options3;
+	options1.push_back(Option("device", (char *)device.c_str()));
+	options1.push_back(Option("pullseq", str_pull1));
+	options2.push_back(Option("device", (char *)device.c_str()));
+	options2.push_back(Option("pullseq", str_pull2));
+	MeterD0 m1(options1);
+	MeterD0 m2(options2);
+	{
+		options3.push_back(Option("device", (char *)device.c_str()));
+		MeterD0 m3(options3);
+		EXPECT_EQ(ERR, m3.open()); // can't tell its telegrams from the others
+	}
+	ASSERT_EQ(SUCCESS, m1.open());
+	ASSERT_EQ(SUCCESS, m2.open());
+
+	std::vector<std::chrono::steady_clock::time_point> pulls;
+	std::string received;
+	std::thread device_thread([fd, &pulls, &received]() {
+		std::string pending;
+		char buf[100];
+		struct pollfd pfd = {fd, POLLIN, 0};
+		while (pulls.size() < 2 && poll(&pfd, 1, 5000) > 0) {
+			ssize_t len = read(fd, buf, sizeof(buf));
+			if (len <= 0)
+				break;
+			received.append(buf, len);
+			pending.append(buf, len);
+			size_t pos = pending.find("!\r\n");
+			if (pos == std::string::npos)
+				continue;
+			std::string answer = pending[pos - 1] == '1' ? "/LGZ5Meter1\r\n1.8.0(000111.0*kWh)\r\n!"
+														 : "/LGZ5Meter2\r\n1.8.0(000222.0*kWh)\r\n!";
+			pulls.push_back(std::chrono::steady_clock::now());
+			pending.erase(0, pos + 3);
+			EXPECT_EQ((ssize_t)answer.size(), write(fd, answer.data(), answer.size()));
+		}
+	});
+
+	std::vector<Reading> rds1(10), rds2(10);
+	ssize_t n1 = 0, n2 = 0;
+	std::thread reader1([&m1, &rds1, &n1]() { n1 = m1.read(rds1, 10); });
+	std::thread reader2([&m2, &rds2, &n2]() { n2 = m2.read(rds2, 10); });
+	reader1.join();
+	reader2.join();
+	device_thread.join();
+
+	// the second pull is sent after the first answer, not interleaved with it
+	ASSERT_EQ(2u, pulls.size());
+	EXPECT_TRUE(received == "/?1!\r\n/?2!\r\n" || received == "/?2!\r\n/?1!\r\n") << received;
+	double gap_ms = std::chrono::duration<double, std::milli>(pulls[1] - pulls[0]).count();
+	EXPECT_GE(gap_ms, 190.0); // reaction time of the first meter
+	ASSERT_EQ(1, n1);
+	ASSERT_EQ(1, n2);
+	EXPECT_EQ(111.0, rds1[0].value());
+	EXPECT_EQ(222.0, rds2[0].value());
+
+	EXPECT_EQ(0, m1.close());
+	EXPECT_EQ(0, m2.close());
+	EXPECT_EQ(0, close(fd));
+}
+
+/*
+ * signals interrupting the wait for data must not end the telegram
+ */
+TEST(MeterD0, signal_while_waiting) {
+	std::string device;
+	int fd = open_pty(device);
+	ASSERT_NE(fd, -1);
+	std::list<Option> options;
+	options.push_back(Option("device", (char *)device.c_str()));
+	options.push_back(Option("read_timeout", 2));
+	MeterD0 m(options);
+	ASSERT_EQ(SUCCESS, m.open());
+
+	struct sigaction sa, old_sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = [](int) {};
+	ASSERT_EQ(0, sigaction(SIGUSR1, &sa, &old_sa));
+
+	std::vector<Reading> rds(10);
+	ssize_t n = 0;
+	std::thread reader([&m, &rds, &n]() { n = m.read(rds, 10); });
+	writes(fd, "/LGZ5Meter1\r\n");
+	for (int i = 0; i < 3; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		pthread_kill(reader.native_handle(), SIGUSR1);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	writes(fd, "1.8.0(000111.0*kWh)\r\n!");
+	reader.join();
+	sigaction(SIGUSR1, &old_sa, NULL);
+
+	ASSERT_EQ(1, n);
+	EXPECT_EQ(111.0, rds[0].value());
+	EXPECT_EQ(0, m.close());
+	EXPECT_EQ(0, close(fd));
+}
+
+static int open_fds() {
+	int n = 0;
+	DIR *dir = opendir("/proc/self/fd");
+	while (dir && readdir(dir))
+		n++;
+	if (dir)
+		closedir(dir);
+	return n;
+}
+
+/*
+ * every address of the host is tried, failed attempts don't leak the socket
+ */
+TEST(MeterD0, host_connect) {
+	int srv = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_NE(srv, -1);
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(sin);
+	ASSERT_EQ(0, bind(srv, (struct sockaddr *)&sin, sizeof(sin)));
+	ASSERT_EQ(0, listen(srv, 1));
+	ASSERT_EQ(0, getsockname(srv, (struct sockaddr *)&sin, &len));
+	// localhost may resolve to ::1 first, nothing listens there
+	std::string host = "localhost:" + std::to_string(ntohs(sin.sin_port));
+	{
+		std::list<Option> options;
+		options.push_back(Option("host", (char *)host.c_str()));
+		MeterD0 m(options);
+		ASSERT_EQ(SUCCESS, m.open());
+		EXPECT_EQ(0, m.close());
+	}
+	EXPECT_EQ(0, close(srv));
+
+	int fds = open_fds();
+	const char *hosts[] = {host.c_str(), "vzlogger.invalid:1"}; // refused, unknown
+	for (const char *h : hosts) {
+		std::list<Option> options;
+		options.push_back(Option("host", (char *)h));
+		MeterD0 m(options);
+		EXPECT_EQ(ERR, m.open()) << h;
+	}
+	EXPECT_EQ(fds, open_fds());
+}
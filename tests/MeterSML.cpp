@@ -161,3 +161,93 @@ TEST(MeterSML, EMH_basic) {
 	EXPECT_EQ(0, close(fd));
 	EXPECT_EQ(0, unlink(tempfilename));
 }
+
+TEST(MeterSML, channel_filter) {
+	char tempfilename[L_tmpnam + 1];
+	ASSERT_NE(tmpnam_r(tempfilename), (char *)0);
+	std::list<Option> options;
+	options.push_back(Option("device", tempfilename));
+	MeterSML m(options);
+	std::vector<ReadingIdentifier::Ptr> ids;
+	ids.push_back(ReadingIdentifier::Ptr(new ObisIdentifier(Obis(1, 0, 1, 8, 2, 255))));
+	ids.push_back(ReadingIdentifier::Ptr(new ObisIdentifier(Obis(1, 0, 1, 7, 0, 255))));
+	m.channelIdentifiers(ids);
+	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
+	int fd = open(tempfilename, O_RDWR);
+	ASSERT_NE(-1, fd);
+	ASSERT_NE(-1, m.open());
+
+	std::vector<Reading> rds;
+	rds.resize(10);
+	writes_hex(
+		fd, "1B1B1B1B010101017607003600001AFA6200620072630101760101070036044808FE093032323830383136"
+			"01016331ED007607003600001AFB62006200726307017701093032323830383136017262016504487D8976"
+			"77078181C78203FF0101010104454D480177070100000000FF010101010930323238303831360177070100"
+			"010801FF63018001621E52FF560008D1CF1B0177070100010802FF63018001621E52FF560000004E9C0177"
+			"0700006001FFFF010101010B303030323238303831360177070100010700FF0101621B52FF550000007001"
+			"010163D201007607003600001AFC6200620072630201710163077A00001B1B1B1B1A019D37");
+
+	// 1-0:1.8.1 is skipped
+	EXPECT_EQ(2, m.read(rds, 10));
+	ObisIdentifier *o = dynamic_cast<ObisIdentifier *>(rds[0].identifier().get());
+	ASSERT_NE((ObisIdentifier *)0, o);
+	EXPECT_TRUE(Obis(1, 0, 1, 8, 2, 255) == (o->obis()));
+	EXPECT_EQ(2012.4, rds[0].value());
+	o = dynamic_cast<ObisIdentifier *>(rds[1].identifier().get());
+	ASSERT_NE((ObisIdentifier *)0, o);
+	EXPECT_TRUE(Obis(1, 0, 1, 7, 0, 255) == (o->obis()));
+	// one local time for the whole file
+	EXPECT_EQ(rds[0].time_ms(), rds[1].time_ms());
+
+	EXPECT_EQ(0, m.close());
+
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ(0, unlink(tempfilename));
+}
+
+TEST(MeterSML, resync) {
+	const char *emh =
+		"1B1B1B1B010101017607003600001AFA6200620072630101760101070036044808FE093032323830383136"
+		"01016331ED007607003600001AFB62006200726307017701093032323830383136017262016504487D8976"
+		"77078181C78203FF0101010104454D480177070100000000FF010101010930323238303831360177070100"
+		"010801FF63018001621E52FF560008D1CF1B0177070100010802FF63018001621E52FF560000004E9C0177"
+		"0700006001FFFF010101010B303030323238303831360177070100010700FF0101621B52FF550000007001"
+		"010163D201007607003600001AFC6200620072630201710163077A00001B1B1B1B1A019D37";
+	std::string corrupt(emh);
+	corrupt[200] = corrupt[200] == '0' ? '1' : '0'; // CRC error
+
+	char tempfilename[L_tmpnam + 1];
+	ASSERT_NE(tmpnam_r(tempfilename), (char *)0);
+	std::list<Option> options;
+	options.push_back(Option("device", tempfilename));
+	MeterSML m(options);
+	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
+	int fd = open(tempfilename, O_RDWR);
+	ASSERT_NE(-1, fd);
+	ASSERT_NE(-1, m.open());
+
+	std::vector<Reading> rds;
+	rds.resize(10);
+
+	// garbage, a frame cut off, a corrupt frame and a good one
+	writes_hex(fd, "0102031B1B");
+	writes_hex(fd, std::string(emh, 120).c_str());
+	writes_hex(fd, corrupt.c_str());
+	writes_hex(fd, emh);
+
+	EXPECT_EQ(3, m.read(rds, 3));
+	EXPECT_TRUE(Obis(1, 0, 1, 8, 1, 255) ==
+				dynamic_cast<ObisIdentifier *>(rds[0].identifier().get())->obis());
+
+	const vz::metrics::FrameStats *stats = m.frameStats();
+	ASSERT_NE((const vz::metrics::FrameStats *)0, stats);
+	EXPECT_EQ(1u, stats->frames.load());
+	EXPECT_EQ(1u, stats->corrupt.load());
+	EXPECT_EQ(1u, stats->crc_errors.load());
+	EXPECT_EQ(2u, stats->resyncs.load());
+
+	EXPECT_EQ(0, m.close());
+
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ(0, unlink(tempfilename));
+}
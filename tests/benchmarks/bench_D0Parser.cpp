@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <Obis.hpp>
+#include <protocols/D0Parser.hpp>
+#include <test_helpers.hpp>
+
+#include "benchmark.hpp"
+
+static const char *telegram = "/ESY5Q3DA1004 V3.04\r\n"
+							  "\r\n"
+							  "1-0:0.0.0*255(1ESY1161229886)\r\n"
+							  "1-0:1.8.0*255(00000285.7423*kWh)\r\n"
+							  "1-0:21.7.255*255(000000.00*W)\r\n"
+							  "1-0:41.7.255*255(000041.74*W)\r\n"
+							  "1-0:61.7.255*255(000012.09*W)\r\n"
+							  "1-0:1.7.255*255(000053.83*W)\r\n"
+							  "1-0:96.5.5*255(80)\r\n"
+							  "0-0:96.1.255*255(1ESY1161229886)\r\n"
+							  "!\r\n";
+
+/*
+ * parse a telegram with all records and with the records of one channel.
+ * D0_DUMP_FILE=<dump_file of a d0 meter> parses real data instead.
+ */
+BENCHMARK(d0_parse) {
+	std::string data = telegram;
+	const char *dumpFile = getenv("D0_DUMP_FILE");
+	if (dumpFile) {
+		data = read_dump(dumpFile);
+		if (data.empty()) {
+			fprintf(stderr, "no data in %s\n", dumpFile);
+			return false;
+		}
+	}
+
+	const int n = dumpFile ? 100 : 20000;
+	std::vector<Obis> codes(1, Obis(1, 0, 1, 8, 0, 255));
+	for (int filtered = 0; filtered < 2; filtered++) {
+		D0Parser parser;
+		if (filtered)
+			parser.filter(codes);
+		size_t records = 0;
+		benchmark::Timer timer;
+		for (int i = 0; i < n; i++) {
+			const char *pos = data.data(), *end = pos + data.size();
+			D0Parser::Event event;
+			while ((event = parser.parse(pos, end)) != D0Parser::NEED_DATA)
+				if (event == D0Parser::RECORD) {
+					records += parser.number() >= 0;
+					(void)parser.obis();
+				}
+		}
+		printf("parse %zu bytes%s: %6.2f ns/byte, %zu records\n", data.size(),
+			   filtered ? " (1 code)" : "", timer.ns() / ((double)n * data.size()), records / n);
+	}
+	return true;
+}
@@ -0,0 +1,45 @@
+#include <json-c/json.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <protocols/MeterOCR.hpp>
+
+#include "benchmark.hpp"
+
+/*
+ * frames read from a v4l2 device and recognized by tesseract, which needs the luminance
+ * only (frames are converted to 8 bpp). Needs a v4l2 dev, e.g. "modprobe vivid".
+ */
+BENCHMARK(ocr_v4l2_frame_rate) {
+	std::list<Option> options;
+	options.push_back(Option("v4l2_dev", (char *)"/dev/video0"));
+	struct json_object *jso = json_tokener_parse("[{\"boundingboxes\":[\
+	{\"identifier\": \"id1\", \"digit\":true, \"box\": {\"x1\": 100, \"x2\": 124, \"y1\": 80, \"y2\": 117}},\
+	{\"identifier\": \"id1\", \"digit\":true, \"scaler\":1, \"box\": {\"x1\": 130, \"x2\": 154, \"y1\": 80, \"y2\": 117}}\
+	]}]");
+	options.push_back(Option("recognizer", jso));
+	json_object_put(jso);
+
+	MeterOCR m(options);
+	if (SUCCESS != m.open()) {
+		printf("no v4l2 device /dev/video0\n");
+		return true;
+	}
+
+	const int frames = 50;
+	struct timespec cpu_start, cpu_end;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+	benchmark::Timer timer;
+	for (int i = 0; i < frames; ++i) {
+		std::vector<Reading> rds;
+		rds.resize(2);
+		m.read(rds, 2); // the value depends on the test pattern
+	}
+	double s = timer.ns() / 1e9;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+	double cpu_ms = (cpu_end.tv_sec - cpu_start.tv_sec) * 1e3 +
+					(cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e6;
+	printf("read %d frames: %5.1f frames/s, %6.2f ms cpu/frame\n", frames, frames / s,
+		   cpu_ms / frames);
+	return m.close() == 0;
+}
@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <Options.hpp>
+#include <protocols/MeterOMS.hpp>
+
+#include "benchmark.hpp"
+
+namespace {
+// the benchmark doesn't receive frames
+class NoHWif : public MeterOMS::OMSHWif {
+  public:
+	virtual ssize_t read(void *buf, size_t count) { return 0; }
+	virtual ssize_t write(const void *buf, size_t count) { return count; }
+};
+} // namespace
+
+/*
+ * decrypt a long frame (5 blocks) with a new context per frame and with the
+ * context of the device
+ */
+BENCHMARK(oms_decrypt) {
+	static const unsigned char key[16] = {0x00, 0x78, 0x58, 0x0E, 0x79, 0x54, 0x4B, 0x14,
+										  0x5D, 0x1A, 0x96, 0xD0, 0xF7, 0xE7, 0x77, 0xFA};
+	std::list<Option> opt;
+	opt.push_back(Option("key", "0078580E79544B145D1A96D0F7E777FA"));
+	MeterOMS m(opt, new NoHWif());
+	MeterOMS::AesContext ctx = MeterOMS::aes_context(key);
+	if (!ctx)
+		return false;
+
+	const int n = 50000;
+	unsigned char iv[16], frame[80], buf[80];
+	for (size_t i = 0; i < sizeof(frame); i++)
+		frame[i] = (unsigned char)(i * 7);
+	memset(iv, 0x33, sizeof(iv));
+	for (int reuse = 0; reuse < 2; reuse++) {
+		benchmark::Timer timer;
+		for (int i = 0; i < n; i++) {
+			memcpy(buf, frame, sizeof(buf));
+			if (!m.aes_decrypt(buf, sizeof(buf), reuse ? ctx : MeterOMS::aes_context(key), iv))
+				return false;
+		}
+		printf("decrypt 80 bytes %s: %8.1f ns/frame\n",
+			   reuse ? "with the device context" : "with a new context", timer.ns() / n);
+	}
+	return true;
+}
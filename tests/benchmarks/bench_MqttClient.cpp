@@ -0,0 +1,42 @@
+#include <json-c/json.h>
+#include <stdio.h>
+
+#include <Channel.hpp>
+#include <MqttPayload.hpp>
+#include <mqtt.hpp>
+
+#include "benchmark.hpp"
+
+/*
+ * publish() into a client without broker connection, per payload format:
+ * the channel lookup, the encoder and the libmosquitto call
+ */
+BENCHMARK(mqtt_publish) {
+	const int n = 100000;
+	std::list<Option> options;
+	ReadingIdentifier::Ptr pRid(new StringIdentifier("power"));
+	Channel::Ptr ch(new Channel(options, "null", "bench-uuid", pRid));
+	end_mqtt_client_thread(); // no client thread, the client asserts it has been stopped
+
+	for (int f = MqttPayload::TEXT; f <= MqttPayload::INFLUX; f++) {
+		const char *name = MqttPayload::formatName((MqttPayload::Format)f);
+		struct json_object *cfg = json_object_new_object();
+		json_object_object_add(cfg, "enabled", json_object_new_boolean(true));
+		json_object_object_add(cfg, "host", json_object_new_string("127.0.0.1"));
+		json_object_object_add(cfg, "port", json_object_new_int(1));
+		json_object_object_add(cfg, "queueSize", json_object_new_int(0));
+		json_object_object_add(cfg, "format", json_object_new_string(name));
+		MqttClient client(cfg);
+		json_object_put(cfg);
+
+		Reading rd(pRid);
+		benchmark::Timer timer;
+		for (int i = 0; i < n; i++) {
+			rd.value(1000.25 + i);
+			rd.time_from_ms(1700000000000LL + i);
+			client.publish(ch, rd, false);
+		}
+		printf("publish %-6s %8.1f ns/value\n", name, timer.ns() / n);
+	}
+	return true;
+}
@@ -0,0 +1,41 @@
+/*
+ * benchmarks, a separate program as they print timings instead of testing:
+ *   vzlogger_benchmarks          runs all of them
+ *   vzlogger_benchmarks name...  runs the given ones
+ */
+
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <chrono>
+
+namespace benchmark {
+
+// prints its timings, false on errors
+typedef bool (*Function)();
+
+// adds a benchmark to the ones main() knows
+struct Register {
+	Register(const char *name, Function function);
+};
+
+class Timer {
+  public:
+	Timer() : _start(std::chrono::steady_clock::now()) {}
+	double ns() const {
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - _start)
+			.count();
+	}
+
+  private:
+	std::chrono::steady_clock::time_point _start;
+};
+
+} // namespace benchmark
+
+#define BENCHMARK(name)                                                                            \
+	static bool benchmark_##name();                                                                \
+	static benchmark::Register register_##name(#name, benchmark_##name);                           \
+	static bool benchmark_##name()
+
+#endif // BENCHMARK_HPP
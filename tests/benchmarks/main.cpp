@@ -0,0 +1,54 @@
+#include <map>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+
+#include "benchmark.hpp"
+#include "common.h"
+
+static std::map<std::string, benchmark::Function> &benchmarks() {
+	static std::map<std::string, benchmark::Function> all;
+	return all;
+}
+
+benchmark::Register::Register(const char *name, Function function) {
+	benchmarks()[name] = function;
+}
+
+// the log of the code measured, only errors are of interest
+void print(log_level_t l, char const *s1, char const *s2, ...) {
+	if (l > log_error)
+		return;
+	fprintf(stderr, "%s: ", s2);
+	va_list argp;
+	va_start(argp, s2);
+	vfprintf(stderr, s1, argp);
+	va_end(argp);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+	std::map<std::string, benchmark::Function> run;
+	for (int i = 1; i < argc; i++) {
+		auto it = benchmarks().find(argv[i]);
+		if (it == benchmarks().end()) {
+			fprintf(stderr, "unknown benchmark %s, available:\n", argv[i]);
+			for (auto &b : benchmarks())
+				fprintf(stderr, "  %s\n", b.first.c_str());
+			return 1;
+		}
+		run.insert(*it);
+	}
+	if (run.empty())
+		run = benchmarks();
+
+	int failed = 0;
+	for (auto &b : run) {
+		printf("%s:\n", b.first.c_str());
+		if (!b.second()) {
+			fprintf(stderr, "%s failed\n", b.first.c_str());
+			failed++;
+		}
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef TEST_HELPERS_HPP
+#define TEST_HELPERS_HPP
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+// bytes of a hex string, e.g. "1b1b" for the SML escape sequence
+inline std::string from_hex(const char *str) {
+	std::string res;
+	for (size_t i = 0; str[i] && str[i + 1]; i += 2) {
+		unsigned char c;
+		sscanf(&str[i], "%2hhx", &c);
+		res += (char)c;
+	}
+	return res;
+}
+
+// the bytes received from the meter (">>>>>" sections) of a dump_file of MeterD0
+inline std::string read_dump(const char *filename) {
+	std::string data;
+	FILE *f = fopen(filename, "r");
+	if (!f)
+		return data;
+	char line[256];
+	bool in = false;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, ">>>>> ", 6)) {
+			in = true;
+		} else if (!strncmp(line, "<<<<< ", 6) || !strncmp(line, "##### ", 6)) {
+			in = false;
+		} else if (in) {
+			// up to 16 "xx " followed by the printable chars
+			for (int i = 0; i < 16; i++) {
+				unsigned int byte;
+				if (line[3 * i] == ' ' || sscanf(&line[3 * i], "%2x", &byte) != 1)
+					break;
+				data += (char)byte;
+			}
+		}
+	}
+	fclose(f);
+	return data;
+}
+
+#endif // TEST_HELPERS_HPP
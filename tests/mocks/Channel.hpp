@@ -4,6 +4,7 @@
 #include <gmock/gmock.h>
 
 #include "Buffer.hpp"
+#include "Metrics.hpp"
 #include "Options.hpp"
 #include "Reading.hpp"
 
@@ -36,6 +37,8 @@ class Channel {
 	ReadingIdentifier::Ptr mock_id;
 	Buffer::Ptr mock_buf;
 	Buffer::Ptr &real_buf() { return mock_buf; }
+	vz::metrics::ChannelStats mock_stats;
+	vz::metrics::ChannelStats &stats() { return mock_stats; }
 	Ptr _this_forthread;
 };
 
@@ -85,6 +85,22 @@ TEST(mock_MeterOMS, sync) {
 	m.close(); // this might be called and should not cause problems
 }
 
+static unsigned char first_frames[300] = {
+	0x10, 0x40, 0xF0, 0x30, 0x16, 0x68, 0x5F, 0x5F, 0x68, 0x73, 0xF0, 0x5B, 0x00, 0x00, 0x00,
+	0x00, 0x2D, 0x4C, 0x01, 0x0E, 0x00, 0x00, 0x50, 0x05, 0x81, 0xA0, 0x00, 0xA0, 0xD2, 0x41,
+	0xD0, 0xE1, 0xA8, 0xB6, 0xF4, 0xF8, 0xD0, 0x3C, 0x21, 0x2E, 0x60, 0x99, 0xFA, 0x3B, 0x4A,
+	0x36, 0xD8, 0x1B, 0x8D, 0x01, 0x86, 0x3F, 0x58, 0x38, 0x81, 0x09, 0x33, 0x54, 0xF7, 0xAD,
+	0xD2, 0xEC, 0x10, 0x12, 0x3C, 0xBB, 0xFE, 0x86, 0x8C, 0x14, 0xFF, 0xF0, 0x87, 0x59, 0x46,
+	0x91, 0xB4, 0xD7, 0x95, 0xC1, 0x2E, 0x85, 0x34, 0x01, 0xB2, 0xDC, 0x08, 0x5C, 0xFB, 0x1A,
+	0xEE, 0xD0, 0x00, 0xA1, 0x9E, 0x9D, 0xCE, 0xA6, 0x50, 0x15, 0x39, 0x2D, 0x15, 0x3B, 0x98,
+	0x16, 0x68, 0x5F, 0x5F, 0x68, 0x53, 0xF0, 0x5B, 0x00, 0x00, 0x00, 0x00, 0x2D, 0x4C, 0x01,
+	0x0E, 0x01, 0x00, 0x50, 0x05, 0xFB, 0xF5, 0x82, 0xB2, 0x97, 0x27, 0x5D, 0x1A, 0x6A, 0x20,
+	0x8B, 0xB1, 0x61, 0xFD, 0xB4, 0xF1, 0x7E, 0xEC, 0xCA, 0x54, 0xDD, 0x3A, 0x1D, 0x42, 0xFB,
+	0xFE, 0xF4, 0xB5, 0xF5, 0x0E, 0xF9, 0x0B, 0x96, 0xFD, 0xB5, 0xFC, 0xF0, 0x07, 0x84, 0xF8,
+	0xDC, 0xD1, 0xA6, 0xB7, 0x7D, 0x17, 0x42, 0x7A, 0xB2, 0xC9, 0x85, 0xE2, 0x73, 0x8B, 0x6B,
+	0x4E, 0x60, 0x3D, 0x57, 0x30, 0xF3, 0x4C, 0x5B, 0xC4, 0x02, 0x08, 0x97, 0x2B, 0x99, 0x4C,
+	0x9D, 0x29, 0xD8, 0x78, 0xA6, 0x2C, 0x18, 0x71, 0x7E, 0x18, 0x29, 0x16};
+
 TEST(mock_MeterOMS, first_packets) {
 	mock_OMShwif *hwif = new mock_OMShwif();
 	std::list<Option> opt;
@@ -102,22 +118,7 @@ TEST(mock_MeterOMS, first_packets) {
 	// 0x33, 0x28, 0xBE, 0x61, 0x77, 0xDC, 0xA5, 0x94, 0xC1, 0x28, 0x00, 0x24, 0xA8,
 	// 0x35, 0xF1, 0xD6, 0x55, 0xBA, 0x71, 0x82, 0xB2, 0x56, 0xE9, 0x4B, 0xD3, 0x3A,
 	// 0xC0, 0xA6, 0xB0, 0x8D, 0xA4, 0x67, 0x81, 0xEB, 0x4E, 0x91, 0xE0, 0x12, 0x16 };
-	unsigned char data[300] = {
-		0x10, 0x40, 0xF0, 0x30, 0x16, 0x68, 0x5F, 0x5F, 0x68, 0x73, 0xF0, 0x5B, 0x00, 0x00, 0x00,
-		0x00, 0x2D, 0x4C, 0x01, 0x0E, 0x00, 0x00, 0x50, 0x05, 0x81, 0xA0, 0x00, 0xA0, 0xD2, 0x41,
-		0xD0, 0xE1, 0xA8, 0xB6, 0xF4, 0xF8, 0xD0, 0x3C, 0x21, 0x2E, 0x60, 0x99, 0xFA, 0x3B, 0x4A,
-		0x36, 0xD8, 0x1B, 0x8D, 0x01, 0x86, 0x3F, 0x58, 0x38, 0x81, 0x09, 0x33, 0x54, 0xF7, 0xAD,
-		0xD2, 0xEC, 0x10, 0x12, 0x3C, 0xBB, 0xFE, 0x86, 0x8C, 0x14, 0xFF, 0xF0, 0x87, 0x59, 0x46,
-		0x91, 0xB4, 0xD7, 0x95, 0xC1, 0x2E, 0x85, 0x34, 0x01, 0xB2, 0xDC, 0x08, 0x5C, 0xFB, 0x1A,
-		0xEE, 0xD0, 0x00, 0xA1, 0x9E, 0x9D, 0xCE, 0xA6, 0x50, 0x15, 0x39, 0x2D, 0x15, 0x3B, 0x98,
-		0x16, 0x68, 0x5F, 0x5F, 0x68, 0x53, 0xF0, 0x5B, 0x00, 0x00, 0x00, 0x00, 0x2D, 0x4C, 0x01,
-		0x0E, 0x01, 0x00, 0x50, 0x05, 0xFB, 0xF5, 0x82, 0xB2, 0x97, 0x27, 0x5D, 0x1A, 0x6A, 0x20,
-		0x8B, 0xB1, 0x61, 0xFD, 0xB4, 0xF1, 0x7E, 0xEC, 0xCA, 0x54, 0xDD, 0x3A, 0x1D, 0x42, 0xFB,
-		0xFE, 0xF4, 0xB5, 0xF5, 0x0E, 0xF9, 0x0B, 0x96, 0xFD, 0xB5, 0xFC, 0xF0, 0x07, 0x84, 0xF8,
-		0xDC, 0xD1, 0xA6, 0xB7, 0x7D, 0x17, 0x42, 0x7A, 0xB2, 0xC9, 0x85, 0xE2, 0x73, 0x8B, 0x6B,
-		0x4E, 0x60, 0x3D, 0x57, 0x30, 0xF3, 0x4C, 0x5B, 0xC4, 0x02, 0x08, 0x97, 0x2B, 0x99, 0x4C,
-		0x9D, 0x29, 0xD8, 0x78, 0xA6, 0x2C, 0x18, 0x71, 0x7E, 0x18, 0x29, 0x16};
-	hwif->set_transmitdata(data, 300);
+	hwif->set_transmitdata(first_frames, sizeof(first_frames));
 
 	EXPECT_CALL(*hwif, read(_, _))
 		.Times(AtLeast(1))
@@ -140,6 +141,136 @@ TEST(mock_MeterOMS, first_packets) {
 	ASSERT_EQ(rds[7].time_s(), mktime(&t));
 }
 
+TEST(mock_MeterOMS, receiver) {
+	mock_OMShwif *hwif = new mock_OMShwif();
+	std::list<Option> opt;
+	struct json_object *devices = json_tokener_parse(
+		"[{\"id\": \"00000001\", \"key\": \"00000000000000000000000000000000\"},"
+		" {\"id\": \"00000000\", \"manufacturer\": \"SAM\","
+		" \"key\": \"0078580E79544B145D1A96D0F7E777FA\"}]");
+	opt.push_back(Option("devices", devices));
+	json_object_put(devices);
+	hwif->set_transmitdata(first_frames, sizeof(first_frames));
+
+	EXPECT_CALL(*hwif, read(_, _))
+		.Times(AtLeast(1))
+		.WillRepeatedly(Invoke(hwif, &mock_MeterOMS::mock_OMShwif::p_read));
+	EXPECT_CALL(*hwif, write(_, _)).Times(0); // a receiver doesn't acknowledge
+	MeterOMS m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	std::vector<Reading> rds(10);
+	ASSERT_EQ(m.read(rds, 10), 8);
+	m.close();
+	EXPECT_TRUE(*rds[0].identifier() == StringIdentifier("00000000/1.8.0"));
+	EXPECT_TRUE(*rds[3].identifier() == StringIdentifier("00000000/2.7.0"));
+	EXPECT_TRUE(*reading_id_parse(meter_protocol_oms, "00000000/1.8.0") == *rds[0].identifier());
+}
+
+TEST(mock_MeterOMS, receiver_unknown_device) {
+	mock_OMShwif *hwif = new mock_OMShwif();
+	std::list<Option> opt;
+	// same id but another manufacturer:
+	struct json_object *devices = json_tokener_parse(
+		"[{\"id\": \"00000000\", \"manufacturer\": \"ESY\","
+		" \"key\": \"0078580E79544B145D1A96D0F7E777FA\"}]");
+	opt.push_back(Option("devices", devices));
+	json_object_put(devices);
+	hwif->set_transmitdata(first_frames, sizeof(first_frames));
+
+	EXPECT_CALL(*hwif, read(_, _))
+		.Times(AtLeast(1))
+		.WillRepeatedly(Invoke(hwif, &mock_MeterOMS::mock_OMShwif::p_read));
+	EXPECT_CALL(*hwif, write(_, _)).Times(0);
+	MeterOMS m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	std::vector<Reading> rds(10);
+	ASSERT_EQ(m.read(rds, 10), 0);
+	m.close();
+}
+
+TEST(mock_MeterOMS, receiver_invalid) {
+	std::list<Option> opt;
+	opt.push_back(Option("key", "0078580E79544B145D1A96D0F7E777FA"));
+	struct json_object *devices = json_tokener_parse(
+		"[{\"id\": \"00000000\", \"key\": \"0078580E79544B145D1A96D0F7E777FA\"}]");
+	opt.push_back(Option("devices", devices));
+	json_object_put(devices);
+	ASSERT_THROW(MeterOMS m(opt, new mock_OMShwif()), vz::VZException); // key and devices
+
+	opt.clear();
+	devices = json_tokener_parse(
+		"[{\"id\": \"0000000\", \"key\": \"0078580E79544B145D1A96D0F7E777FA\"}]");
+	opt.push_back(Option("devices", devices));
+	json_object_put(devices);
+	ASSERT_THROW(MeterOMS m(opt, new mock_OMShwif()), vz::VZException); // 7 digits
+
+	const char *ids[] = {"0x123456", "+1234567", " 1234567", "1234567g"};
+	for (const char *id : ids) {
+		opt.clear();
+		devices = json_object_new_array();
+		struct json_object *device = json_object_new_object();
+		json_object_object_add(device, "id", json_object_new_string(id));
+		json_object_object_add(device, "key",
+							   json_object_new_string("0078580E79544B145D1A96D0F7E777FA"));
+		json_object_array_add(devices, device);
+		opt.push_back(Option("devices", devices));
+		json_object_put(devices);
+		ASSERT_THROW(MeterOMS m(opt, new mock_OMShwif()), vz::VZException) << id;
+	}
+}
+
+// the decryption before the context was reused: new context and key expansion per frame
+static bool decrypt_per_frame(unsigned char *data, int len, const unsigned char *key,
+							  const unsigned char *iv) {
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	int out = 0, fin = 0;
+	bool ok = ctx && EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, iv) &&
+			  EVP_CIPHER_CTX_set_padding(ctx, 0) && EVP_DecryptUpdate(ctx, data, &out, data, len) &&
+			  EVP_DecryptFinal_ex(ctx, data + out, &fin);
+	EVP_CIPHER_CTX_free(ctx);
+	return ok && out + fin == len;
+}
+
+static const unsigned char frames_key[16] = {0x00, 0x78, 0x58, 0x0E, 0x79, 0x54, 0x4B, 0x14,
+											 0x5D, 0x1A, 0x96, 0xD0, 0xF7, 0xE7, 0x77, 0xFA};
+
+// data and iv of the two long frames, 5 blocks each
+static void long_frames(const unsigned char *frames[2], unsigned char ivs[2][16]) {
+	frames[0] = first_frames + 5 + 7;
+	frames[1] = first_frames + 5 + 101 + 7;
+	for (int f = 0; f < 2; f++) {
+		const unsigned char *d = frames[f];
+		const unsigned char iv[8] = {d[4], d[5], d[0], d[1], d[2], d[3], d[6], d[7]};
+		memcpy(ivs[f], iv, 8);
+		memset(ivs[f] + 8, d[8], 8);
+	}
+}
+
+/*
+ * the context of the device is reused for all frames: same plaintext as with a new context
+ */
+TEST(mock_MeterOMS, decrypt_reused_context) {
+	std::list<Option> opt;
+	opt.push_back(Option("key", "0078580E79544B145D1A96D0F7E777FA"));
+	MeterOMS m(opt, new mock_OMShwif());
+	MeterOMS::AesContext ctx = MeterOMS::aes_context(frames_key);
+	ASSERT_TRUE(ctx.get() != NULL);
+	const unsigned char *frames[2];
+	unsigned char ivs[2][16];
+	long_frames(frames, ivs);
+
+	for (int i = 0; i < 4; i++) {
+		unsigned char buf[80], expected[80];
+		memcpy(buf, frames[i & 1] + 12, sizeof(buf));
+		memcpy(expected, buf, sizeof(expected));
+		ASSERT_TRUE(m.aes_decrypt(buf, sizeof(buf), ctx, ivs[i & 1]));
+		ASSERT_TRUE(decrypt_per_frame(expected, sizeof(expected), frames_key, ivs[i & 1]));
+		ASSERT_EQ(0, memcmp(expected, buf, sizeof(buf))) << "frame " << i;
+		ASSERT_EQ(0x2f, buf[0]);
+		ASSERT_EQ(0x2f, buf[1]);
+	}
+}
+
 } // namespace mock_MeterOMS
 
 void print(log_level_t l, char const *s1, char const *s2, ...) {
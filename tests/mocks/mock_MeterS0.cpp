@@ -28,6 +28,12 @@ class mock_S0hwif : public MeterS0::HWIF {
   protected:
 };
 
+class mock_S0hwif_ts : public mock_S0hwif {
+  public:
+	MOCK_CONST_METHOD0(has_timestamps, bool());
+	MOCK_METHOD3(waitForImpulses, int(struct timespec *, unsigned int *, int));
+};
+
 TEST(mock_MeterS0, timespec_add_ms) {
 	struct timespec a;
 	a.tv_sec = 1;
@@ -176,6 +182,232 @@ TEST(mock_MeterS0, basic_blocking_send_zero_2reads) {
 	m.close(); // this might be called and should not cause problems
 }
 
+TEST(mock_MeterS0, timestamped_impulses) {
+	mock_S0hwif_ts *hwif = new mock_S0hwif_ts();
+	std::list<Option> opt;
+
+	struct timespec t0;
+	clock_gettime(CLOCK_REALTIME, &t0);
+	int calls = 0;
+	EXPECT_CALL(*hwif, _open()).Times(1).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, _close()).Times(1).WillOnce(Return(true));
+	EXPECT_CALL(*hwif, is_blocking()).Times(AtLeast(1)).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, has_timestamps()).Times(AtLeast(1)).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, waitForImpulses(_, _, _))
+		.Times(AtLeast(1))
+		.WillRepeatedly(Invoke([&](struct timespec *ts, unsigned int *lines, int n) {
+			if (calls++ == 0 && n >= 3) { // 3 impulses, 0.4s apart
+				for (int i = 0; i < 3; i++) {
+					ts[i] = t0;
+					timespec_add_ms(ts[i], 400 * i);
+					lines[i] = 0;
+				}
+				return 3;
+			}
+			usleep(10000);
+			return 0;
+		}));
+	MeterS0 m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	std::vector<Reading> rds(4);
+	ASSERT_EQ(2, m.read(rds, 4));
+	EXPECT_TRUE(*rds[0].identifier() == StringIdentifier("Power"));
+	// 2 intervals of 0.4s, 1000 impulses/kWh
+	EXPECT_NEAR(9000.0, rds[0].value(), 0.001);
+	EXPECT_EQ(3, rds[1].value());
+	EXPECT_NEAR(t0.tv_sec * 1000 + t0.tv_nsec / 1000000 + 800, rds[1].time_ms(), 1);
+
+	m.close();
+}
+
+// more impulses than the log of the default read_period (2048): the power includes them all
+TEST(mock_MeterS0, impulse_log_size) {
+	mock_S0hwif_ts *hwif = new mock_S0hwif_ts();
+	std::list<Option> opt;
+
+	struct timespec t0;
+	clock_gettime(CLOCK_REALTIME, &t0);
+	int sent = 0;
+	EXPECT_CALL(*hwif, _open()).Times(1).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, _close()).Times(1).WillOnce(Return(true));
+	EXPECT_CALL(*hwif, is_blocking()).Times(AtLeast(1)).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, has_timestamps()).Times(AtLeast(1)).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, waitForImpulses(_, _, _))
+		.Times(AtLeast(1))
+		.WillRepeatedly(Invoke([&](struct timespec *ts, unsigned int *lines, int n) {
+			if (sent >= 2000) {
+				usleep(10000);
+				return 0;
+			}
+			// 1000 impulses 1ms apart, then 1000 impulses 0.1ms apart
+			for (int i = 0; i < n; i++, sent++) {
+				ts[i] = t0;
+				long us = sent < 1000 ? 1000l * sent : 999000l + 100l * (sent - 999);
+				ts[i].tv_sec += us / 1000000;
+				ts[i].tv_nsec += (us % 1000000) * 1000;
+				if (ts[i].tv_nsec >= 1000000000l) {
+					ts[i].tv_sec++;
+					ts[i].tv_nsec -= 1000000000l;
+				}
+				lines[i] = 0;
+			}
+			return n;
+		}));
+	MeterS0 m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	std::vector<Reading> rds(4);
+	ASSERT_EQ(2, m.read(rds, 4));
+	// 1999 intervals within 1.099s, 1000 impulses/kWh
+	EXPECT_NEAR(3600.0 / 1.099 * 1999, rds[0].value(), 1);
+	EXPECT_EQ(2000, rds[1].value());
+
+	m.close();
+}
+
+TEST(mock_MeterS0, multiple_lines) {
+	mock_S0hwif_ts *hwif = new mock_S0hwif_ts();
+	std::list<Option> opt;
+	struct json_object *gpios = json_tokener_parse("[17, 27, 22]");
+	opt.push_back(Option("gpio", gpios));
+	json_object_put(gpios);
+
+	struct timespec t0;
+	clock_gettime(CLOCK_REALTIME, &t0);
+	int calls = 0;
+	EXPECT_CALL(*hwif, _open()).Times(1).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, _close()).Times(1).WillOnce(Return(true));
+	EXPECT_CALL(*hwif, is_blocking()).Times(AtLeast(1)).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, has_timestamps()).Times(AtLeast(1)).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, waitForImpulses(_, _, _))
+		.Times(AtLeast(1))
+		.WillRepeatedly(Invoke([&](struct timespec *ts, unsigned int *lines, int n) {
+			if (calls++ == 0 && n >= 5) {
+				// line 0: 3 impulses 0.1s apart, line 2: 2 impulses 0.5s apart
+				static const unsigned int line[5] = {0, 2, 0, 0, 2};
+				static const unsigned long ms[5] = {0, 50, 100, 200, 550};
+				for (int i = 0; i < 5; i++) {
+					ts[i] = t0;
+					timespec_add_ms(ts[i], ms[i]);
+					lines[i] = line[i];
+				}
+				return 5;
+			}
+			usleep(10000);
+			return 0;
+		}));
+	MeterS0 m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	std::vector<Reading> rds(6);
+	ASSERT_EQ(0, m.read(rds, 5)); // too small for 3 lines
+	ASSERT_EQ(4, m.read(rds, 6));
+	EXPECT_TRUE(*rds[0].identifier() == StringIdentifier("Power_17"));
+	EXPECT_NEAR(36000.0, rds[0].value(), 0.001);
+	EXPECT_TRUE(*rds[1].identifier() == StringIdentifier("Impulse_17"));
+	EXPECT_EQ(3, rds[1].value());
+	EXPECT_TRUE(*rds[2].identifier() == StringIdentifier("Power_22"));
+	EXPECT_NEAR(7200.0, rds[2].value(), 0.001);
+	EXPECT_TRUE(*rds[3].identifier() == StringIdentifier("Impulse_22"));
+	EXPECT_EQ(2, rds[3].value());
+
+	m.close();
+}
+
+// impulses at 0, 50 and 150ms after start
+static int three_impulses(const struct timespec &t0, int &calls, struct timespec *ts,
+						  unsigned int *lines, int n) {
+	if (calls++ == 0 && n >= 3) {
+		static const unsigned long ms[3] = {0, 50, 150};
+		for (int i = 0; i < 3; i++) {
+			ts[i] = t0;
+			timespec_add_ms(ts[i], ms[i]);
+			lines[i] = 0;
+		}
+		return 3;
+	}
+	usleep(10000);
+	return 0;
+}
+
+TEST(mock_MeterS0, power_ema) {
+	mock_S0hwif_ts *hwif = new mock_S0hwif_ts();
+	std::list<Option> opt;
+	opt.push_back(Option("send_zero", true));
+	opt.push_back(Option("read_period", 200));
+	opt.push_back(Option("power", "ema"));
+	opt.push_back(Option("ema_intervals", 3));
+
+	struct timespec t0;
+	clock_gettime(CLOCK_REALTIME, &t0);
+	int calls = 0;
+	EXPECT_CALL(*hwif, _open()).Times(1).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, _close()).Times(1).WillOnce(Return(true));
+	EXPECT_CALL(*hwif, is_blocking()).Times(AtLeast(1)).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, has_timestamps()).Times(AtLeast(1)).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, waitForImpulses(_, _, _))
+		.Times(AtLeast(1))
+		.WillRepeatedly(Invoke([&](struct timespec *ts, unsigned int *lines, int n) {
+			return three_impulses(t0, calls, ts, lines, n);
+		}));
+	MeterS0 m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	std::vector<Reading> rds(4);
+	ASSERT_EQ(3, m.read(rds, 4)); // no Power_neg without an interval
+	EXPECT_TRUE(*rds[0].identifier() == StringIdentifier("Power"));
+	// 72kW, 36kW -> 72 + (36 - 72) / 2
+	EXPECT_NEAR(54000.0, rds[0].value(), 0.001);
+	EXPECT_EQ(3, rds[1].value());
+	int64_t tdist = rds[0].time_ms() - (t0.tv_sec * 1000 + t0.tv_nsec / 1000000);
+	EXPECT_TRUE(tdist >= 190 && tdist <= 300) << "tdist=" << tdist;
+
+	// no impulse for 250ms: less than 1 impulse within that time
+	ASSERT_EQ(3, m.read(rds, 4));
+	EXPECT_TRUE(*rds[0].identifier() == StringIdentifier("Power"));
+	EXPECT_NEAR(14400.0, rds[0].value(), 2500.0);
+	EXPECT_EQ(0, rds[1].value());
+
+	m.close();
+}
+
+TEST(mock_MeterS0, power_window) {
+	mock_S0hwif_ts *hwif = new mock_S0hwif_ts();
+	std::list<Option> opt;
+	opt.push_back(Option("read_period", 200));
+	opt.push_back(Option("power", "window"));
+
+	struct timespec t0;
+	clock_gettime(CLOCK_REALTIME, &t0);
+	int calls = 0;
+	EXPECT_CALL(*hwif, _open()).Times(1).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, _close()).Times(1).WillOnce(Return(true));
+	EXPECT_CALL(*hwif, is_blocking()).Times(AtLeast(1)).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, has_timestamps()).Times(AtLeast(1)).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, waitForImpulses(_, _, _))
+		.Times(AtLeast(1))
+		.WillRepeatedly(Invoke([&](struct timespec *ts, unsigned int *lines, int n) {
+			return three_impulses(t0, calls, ts, lines, n);
+		}));
+	MeterS0 m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	std::vector<Reading> rds(4);
+	ASSERT_EQ(2, m.read(rds, 4));
+	EXPECT_TRUE(*rds[0].identifier() == StringIdentifier("Power"));
+	// 3 impulses within 200ms
+	EXPECT_NEAR(54000.0, rds[0].value(), 5000.0);
+
+	m.close();
+}
+
+TEST(mock_MeterS0, invalid_power) {
+	mock_S0hwif hwif; // not deleted by a MeterS0 which failed to construct
+	std::list<Option> opt;
+	opt.push_back(Option("power", "median"));
+	ASSERT_THROW(MeterS0 m(opt, &hwif), vz::VZException);
+
+	opt.clear();
+	opt.push_back(Option("read_period", 5));
+	ASSERT_THROW(MeterS0 m(opt, &hwif), vz::VZException);
+}
+
 /* time out -> endless waiting for first impulse
 TEST(mock_MeterS0, basic_non_blocking_read_no_send_zero)
 {
@@ -0,0 +1,272 @@
+/*
+ * unit tests for D0Parser.cpp and a fuzz test
+ */
+
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Options.hpp>
+#include <protocols/D0Parser.hpp>
+#include <protocols/MeterD0.hpp>
+#include <test_helpers.hpp>
+
+// (D0Parser.cpp is already in MeterD0.cpp)
+
+static const char *telegram = "/ESY5Q3DA1004 V3.04\r\n"
+							  "\r\n"
+							  "1-0:0.0.0*255(1ESY1161229886)\r\n"
+							  "1-0:1.8.0*255(00000285.7423*kWh)\r\n"
+							  "1-0:21.7.255*255(000000.00*W)\r\n"
+							  "1-0:41.7.255*255(000041.74*W)\r\n"
+							  "1-0:61.7.255*255(000012.09*W)\r\n"
+							  "1-0:1.7.255*255(000053.83*W)\r\n"
+							  "1-0:96.5.5*255(80)\r\n"
+							  "0-0:96.1.255*255(1ESY1161229886)\r\n"
+							  "!\r\n";
+
+struct Record {
+	std::string obis;
+	std::string value;
+	std::string unit;
+	bool operator==(const Record &o) const {
+		return obis == o.obis && value == o.value && unit == o.unit;
+	}
+};
+
+// parse data in chunks of the given sizes (repeated), collect the records
+static std::vector<Record> parse_chunks(D0Parser &parser, const std::string &data,
+										const std::vector<size_t> &chunks, int *ends = NULL) {
+	std::vector<Record> records;
+	std::string chunk;
+	size_t off = 0;
+	for (size_t i = 0; off < data.size(); i++) {
+		// a fresh copy for each chunk, so slices into old chunks would be detected
+		chunk.assign(data, off, chunks[i % chunks.size()]);
+		off += chunk.size();
+		const char *pos = chunk.data(), *end = pos + chunk.size();
+		D0Parser::Event event;
+		while ((event = parser.parse(pos, end)) != D0Parser::NEED_DATA) {
+			if (event == D0Parser::RECORD) {
+				Record r = {parser.obisText().str(), parser.value().str(), parser.unit().str()};
+				records.push_back(r);
+			} else if (event == D0Parser::END && ends) {
+				(*ends)++;
+			}
+		}
+		EXPECT_EQ(pos, end);
+		memset(&chunk[0], 'x', chunk.size());
+	}
+	return records;
+}
+
+TEST(D0Parser, telegram) {
+	D0Parser parser;
+	const char *pos = telegram, *end = telegram + strlen(telegram);
+
+	ASSERT_EQ(D0Parser::HEADER, parser.parse(pos, end));
+	EXPECT_STREQ("ESY", parser.vendor());
+	EXPECT_EQ('5', parser.baudrate());
+	EXPECT_STREQ("Q3DA1004 V3.04", parser.identification());
+
+	ASSERT_EQ(D0Parser::RECORD, parser.parse(pos, end));
+	EXPECT_EQ("1-0:0.0.0*255", parser.obisText().str());
+	EXPECT_EQ("1ESY1161229886", parser.value().str());
+
+	ASSERT_EQ(D0Parser::RECORD, parser.parse(pos, end));
+	EXPECT_EQ(Obis(1, 0, 1, 8, 0, 255), parser.obis());
+	EXPECT_EQ("kWh", parser.unit().str());
+	EXPECT_DOUBLE_EQ(285.7423, parser.number());
+	// not copied
+	EXPECT_TRUE(parser.value().data > telegram && parser.value().data < end);
+
+	int records = 2;
+	D0Parser::Event event;
+	while ((event = parser.parse(pos, end)) == D0Parser::RECORD)
+		records++;
+	EXPECT_EQ(D0Parser::END, event);
+	EXPECT_EQ(8, records);
+	EXPECT_EQ(0u, parser.skipped());
+	EXPECT_EQ(D0Parser::NEED_DATA, parser.parse(pos, end));
+	EXPECT_EQ(pos, end);
+}
+
+TEST(D0Parser, split_anywhere) {
+	D0Parser parser;
+	std::vector<Record> whole = parse_chunks(parser, telegram, std::vector<size_t>(1, 1000));
+	ASSERT_EQ(8u, whole.size());
+
+	for (size_t size = 1; size < 40; size++) {
+		parser.reset();
+		int ends = 0;
+		std::vector<Record> split =
+			parse_chunks(parser, telegram, std::vector<size_t>(1, size), &ends);
+		EXPECT_TRUE(whole == split) << "chunk size " << size;
+		EXPECT_EQ(1, ends);
+	}
+}
+
+TEST(D0Parser, filter) {
+	D0Parser parser;
+	std::vector<Obis> codes;
+	codes.push_back(Obis("1-0:1.8.0*255"));
+	codes.push_back(Obis("1-0:1.7.255*255"));
+	codes.push_back(Obis("1-0:2.8.0*255")); // not in the telegram
+	parser.filter(codes);
+
+	std::vector<Record> records = parse_chunks(parser, telegram, std::vector<size_t>(1, 7));
+	ASSERT_EQ(2u, records.size());
+	EXPECT_EQ("1-0:1.8.0*255", records[0].obis);
+	EXPECT_EQ("1-0:1.7.255*255", records[1].obis);
+	EXPECT_EQ(6u, parser.skipped());
+}
+
+TEST(D0Parser, pull_echo_and_restart) {
+	// echo of the pull sequence, ACE3000 style STX/ETX, a second telegram
+	std::string data("/?!\r\n/ACE0\\3k260V01.19\r\n\x02"
+					 "F.F(00)\r\nC.5.0(00)\r\n1.8.0(01392.5*)\r\nL.1(garbage)\r\n!\r\n\x03\x46"
+					 "/ACE0\\3k260V01.19\r\n\x02"
+					 "1.8.0(01392.6*kWh)\r\n!\r\n");
+	D0Parser parser;
+	int ends = 0;
+	std::vector<Record> records = parse_chunks(parser, data, std::vector<size_t>(1, 5), &ends);
+	ASSERT_EQ(4u, records.size());
+	EXPECT_EQ("F.F", records[0].obis);
+	EXPECT_EQ("01392.5", records[2].value);
+	EXPECT_EQ("", records[2].unit);
+	EXPECT_EQ("kWh", records[3].unit);
+	EXPECT_EQ(2, ends);
+	EXPECT_EQ(1u, parser.skipped()); // L.1
+}
+
+TEST(D0Parser, too_long_fields) {
+	std::string data("/ABC5VeryLongIdentification1234\r\n\r\n1.8.0(");
+	data += std::string(50, '1');
+	data += "*kWh)\r\n!";
+	D0Parser parser;
+	std::vector<Record> records = parse_chunks(parser, data, std::vector<size_t>(1, 9));
+	ASSERT_EQ(1u, records.size());
+	EXPECT_EQ(std::string(32, '1'), records[0].value);
+	EXPECT_EQ(10u + 18u, parser.dropped());
+}
+
+TEST(D0Parser, obis_set) {
+	std::vector<Obis> codes;
+	for (int c = 1; c < 100; c += 3)
+		for (int d = 7; d <= 8; d++)
+			codes.push_back(Obis(1, 0, c, d, 0, 255));
+	codes.push_back(codes[0]); // duplicates are fine
+	ObisSet set;
+	EXPECT_FALSE(set.contains(codes[0]));
+	set.assign(codes);
+	EXPECT_EQ(codes.size() - 1, set.size());
+	for (int c = 0; c < 256; c++)
+		for (int d = 0; d < 256; d++) {
+			Obis o(1, 0, c, d, 0, 255);
+			bool expected = c < 100 && c % 3 == 1 && (d == 7 || d == 8);
+			ASSERT_EQ(expected, set.contains(o)) << c << "." << d;
+		}
+}
+
+// random chunks of random bytes and broken telegrams must neither crash nor stall
+TEST(D0Parser, fuzz) {
+	std::mt19937 rng(4711);
+	std::string base(telegram);
+	const char alphabet[] = "/?!()*.:-\r\n\x02\x03 01289CFLPkWhABCxyz";
+	for (int round = 0; round < 2000; round++) {
+		std::string data;
+		size_t len = rng() % 600;
+		for (size_t i = 0; i < len; i++) {
+			switch (rng() % 4) {
+			case 0:
+				data += (char)rng();
+				break;
+			case 1:
+				data += alphabet[rng() % (sizeof(alphabet) - 1)];
+				break;
+			default: // keep some structure
+				data += base[(i + round) % base.size()];
+				break;
+			}
+		}
+		D0Parser parser;
+		if (round % 2) {
+			std::vector<Obis> codes(1, Obis(1, 0, 1, 8, 0, 255));
+			parser.filter(codes);
+		}
+		std::vector<size_t> chunks;
+		for (int i = 0; i < 5; i++)
+			chunks.push_back(1 + rng() % 64);
+
+		std::string chunk;
+		size_t off = 0;
+		for (size_t i = 0; off < data.size(); i++) {
+			chunk.assign(data, off, chunks[i % chunks.size()]);
+			off += chunk.size();
+			const char *pos = chunk.data(), *end = pos + chunk.size();
+			int events = 0;
+			D0Parser::Event event;
+			while ((event = parser.parse(pos, end)) != D0Parser::NEED_DATA) {
+				if (event == D0Parser::RECORD) {
+					ASSERT_LE(parser.value().len, 32u);
+					(void)parser.number();
+				} else if (event == D0Parser::ERROR) {
+					parser.reset();
+				}
+				ASSERT_LE(++events, (int)chunk.size()) << "no progress";
+			}
+			ASSERT_EQ(pos, end);
+		}
+	}
+}
+
+// records of data with a fresh parser, optionally filtered
+static size_t count_records(const std::string &data, const std::vector<Obis> &codes) {
+	D0Parser parser;
+	if (codes.size())
+		parser.filter(codes);
+	size_t records = 0;
+	const char *pos = data.data(), *end = pos + data.size();
+	D0Parser::Event event;
+	while ((event = parser.parse(pos, end)) != D0Parser::NEED_DATA)
+		if (event == D0Parser::RECORD)
+			records += parser.number() >= 0;
+	return records;
+}
+
+// the dump_file written by MeterD0 holds the bytes received, they parse like the telegram
+TEST(D0Parser, dump_file) {
+	char fifo[] = "/tmp/d0parser_fifoXXXXXX";
+	char dump[] = "/tmp/d0parser_dumpXXXXXX";
+	ASSERT_NE(-1, close(mkstemp(fifo)));
+	ASSERT_NE(-1, close(mkstemp(dump)));
+	unlink(fifo);
+	ASSERT_EQ(0, mkfifo(fifo, S_IRUSR | S_IWUSR));
+	int fd = ::open(fifo, O_RDWR);
+	ASSERT_NE(-1, fd);
+	std::list<Option> options;
+	options.push_back(Option("device", fifo));
+	options.push_back(Option("dump_file", dump));
+	{
+		MeterD0 m(options);
+		ASSERT_EQ(SUCCESS, m.open());
+		ASSERT_EQ((ssize_t)strlen(telegram), write(fd, telegram, strlen(telegram)));
+		std::vector<Reading> rds(10);
+		EXPECT_EQ(8, m.read(rds, 10));
+		m.close();
+	}
+	close(fd);
+	unlink(fifo);
+	std::string data = read_dump(dump);
+	unlink(dump);
+	ASSERT_EQ(std::string(telegram), data);
+
+	EXPECT_EQ(8u, count_records(data, std::vector<Obis>()));
+	EXPECT_EQ(1u, count_records(data, std::vector<Obis>(1, Obis(1, 0, 1, 8, 0, 255))));
+}
@@ -0,0 +1,67 @@
+/*
+ * unit tests for Json.cpp (compiled paths and extractor)
+ */
+
+#include "gtest/gtest.h"
+
+#include <Json.hpp>
+#include <VZException.hpp>
+
+static const char *doc = "{ 'switch:0': { 'id': 0, 'apower': 8.9,"
+						 "  'aenergy': { 'total': 6.532, 'by_minute': [ 45.199, 47.141, 88.397 ],"
+						 "  'minute_ts': 1626935779 }, 'source': \"ti\\\"mer\" }, \"esc\\u0061ped\": 7,"
+						 " \"smile\\uD83D\\uDE00\": 8 }";
+
+TEST(Json, path_compile) {
+	JsonPath p("$.switch:0.aenergy.by_minute[-1]");
+	ASSERT_EQ(p.steps().size(), (size_t)4);
+	ASSERT_EQ(p.name(), "by_minute");
+	ASSERT_TRUE(p.steps()[3].isIndex());
+	ASSERT_EQ(p.steps()[3]._index, -1);
+
+	ASSERT_EQ(JsonPath("$").steps().size(), (size_t)0);
+	ASSERT_THROW(JsonPath("$..a"), vz::VZException);
+	ASSERT_THROW(JsonPath("$.a[1"), vz::VZException);
+	ASSERT_THROW(JsonPath("$.a[x]"), vz::VZException);
+	ASSERT_THROW(JsonPath("$.a[1]b"), vz::VZException);
+	ASSERT_THROW(JsonPath("a"), vz::VZException);
+}
+
+TEST(Json, extract_tree_and_stream) {
+	JsonExtractor ex;
+	ASSERT_EQ(ex.add(JsonPath("$.switch:0.apower")), (size_t)0);
+	ASSERT_EQ(ex.add(JsonPath("$.switch:0.aenergy.by_minute[1]")), (size_t)1);
+	ASSERT_EQ(ex.add(JsonPath("$.switch:0.aenergy.minute_ts")), (size_t)2);
+	ASSERT_EQ(ex.add(JsonPath("$.switch:0.source")), (size_t)3); // no number
+	ASSERT_EQ(ex.add(JsonPath("$.missing")), (size_t)4);
+	ASSERT_EQ(ex.add(JsonPath("$.escaped")), (size_t)5);
+	ASSERT_EQ(ex.add(JsonPath("$.smile\xf0\x9f\x98\x80")), (size_t)6); // surrogate pair
+	ASSERT_TRUE(ex.streamable());
+
+	std::vector<JsonExtractor::Value> tree, stream;
+	struct json_object *jso = json_tokener_parse(doc);
+	ASSERT_TRUE(jso != NULL);
+	ex.extract(jso, tree);
+	json_object_put(jso);
+	ASSERT_TRUE(ex.extract(doc, strlen(doc), stream));
+
+	for (size_t i = 0; i < ex.size(); i++) {
+		ASSERT_EQ(tree[i]._found, stream[i]._found) << i;
+		if (tree[i]._found) {
+			ASSERT_EQ(tree[i]._int, stream[i]._int) << i;
+			ASSERT_DOUBLE_EQ(tree[i].toDouble(), stream[i].toDouble()) << i;
+		}
+	}
+	ASSERT_DOUBLE_EQ(stream[0].toDouble(), 8.9);
+	ASSERT_DOUBLE_EQ(stream[1].toDouble(), 47.141);
+	ASSERT_EQ(stream[2].toInt64(), 1626935779);
+	ASSERT_FALSE(stream[3]._found);
+	ASSERT_FALSE(stream[4]._found);
+	ASSERT_EQ(stream[5].toInt64(), 7);
+	ASSERT_EQ(stream[6].toInt64(), 8);
+
+	ASSERT_FALSE(ex.extract("{ 'a': [1, 2 }", 13, stream));
+
+	ex.add(JsonPath("$.switch:0.aenergy.by_minute[-1]"));
+	ASSERT_FALSE(ex.streamable());
+}
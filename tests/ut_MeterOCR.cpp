@@ -3,6 +3,8 @@
  * Author: Matthias Behr, 2015
  */
 
+#include <allheaders.h> // from leptonica
+#include <cmath>
 #include <json-c/json.h>
 #include <protocols/MeterOCR.hpp>
 
@@ -14,6 +16,8 @@ class MeterOCR_Test {
   public:
 	static void test_calcImpulses();
 	static void test_roundBasedOnSmallerDigits();
+	static void test_cropRoi();
+	static void test_roiRectOpenBox();
 };
 
 TEST(MeterOCR, basic2_needle_autofix) {
@@ -233,6 +237,78 @@ void MeterOCR_Test::test_roundBasedOnSmallerDigits() {
 
 TEST(MeterOCR, roundBasedOnSmallerDigits) { MeterOCR_Test::test_roundBasedOnSmallerDigits(); }
 
+void MeterOCR_Test::test_cropRoi() {
+	std::list<Option> options;
+	options.emplace_back("file", ocrTestImage("img2.png"));
+	options.push_back(Option("rotate", -2.0));
+	struct json_object *jso = json_tokener_parse("[{\"type\": \"needle\", \"boundingboxes\":[\
+	{\"identifier\": \"water cons\", \"circle\": {\"cx\": 689, \"cy\": 449, \"cr\": 24}},\
+	{\"identifier\": \"water cons\", \"circle\": {\"cx\": 488, \"cy\": 542, \"cr\": 24}}\
+	]}]");
+	options.push_back(Option("recognizer", jso));
+	json_object_put(jso);
+	MeterOCR m(options);
+
+	PIX *image = pixRead(ocrTestImage("img2.png").c_str());
+	ASSERT_TRUE(image != 0);
+	int x, y;
+	PIX *roi = m.cropRoi(image, x, y);
+	ASSERT_TRUE(roi != 0);
+	EXPECT_EQ(m._min_x, x);
+	EXPECT_EQ(m._min_y, y);
+	int w = pixGetWidth(roi), h = pixGetHeight(roi);
+	EXPECT_EQ(m._max_x - m._min_x, w);
+	EXPECT_EQ(m._max_y - m._min_y, h);
+
+	// only the region is rotated, it has to match the rotated image up to the interpolation:
+	PIX *rotated = pixRotate(image, -2.0 * M_PI / 180, L_ROTATE_AREA_MAP, L_BRING_IN_WHITE, 0, 0);
+	int differ = 0;
+	for (int i = 0; i < h; ++i)
+		for (int j = 0; j < w; ++j) {
+			l_uint32 a, b;
+			pixGetPixel(roi, j, i, &a);
+			pixGetPixel(rotated, x + j, y + i, &b);
+			for (int shift = 8; shift < 32; shift += 8)
+				if (std::abs((int)((a >> shift) & 0xff) - (int)((b >> shift) & 0xff)) > 32) {
+					differ++;
+					break;
+				}
+		}
+	EXPECT_LT(differ, w * h / 100);
+
+	pixDestroy(&rotated);
+	pixDestroy(&roi);
+	pixDestroy(&image);
+}
+
+TEST(MeterOCR, cropRoi) { MeterOCR_Test::test_cropRoi(); }
+
+#if OCR_TESSERACT_SUPPORT
+// a box without end reaches up to the border of the image, autofix must not move that end
+void MeterOCR_Test::test_roiRectOpenBox() {
+	std::list<Option> options;
+	options.emplace_back("file", ocrTestImage("img2.png"));
+	struct json_object *jso = json_tokener_parse("[{\"boundingboxes\":[\
+	{\"identifier\": \"water cons\", \"digit\":true, \"box\": {\"x1\": 465, \"y1\": 358}}\
+	]}]");
+	options.push_back(Option("recognizer", jso));
+	json_object_put(jso);
+	jso = json_tokener_parse("{\"range\": 20, \"x\": 465, \"y\":395}");
+	options.push_back(Option("autofix", jso));
+	json_object_put(jso);
+	MeterOCR m(options);
+
+	int x1, y1, x2, y2;
+	m.roiRect(800, 600, x1, y1, x2, y2);
+	EXPECT_EQ(445, x1);
+	EXPECT_EQ(338, y1);
+	EXPECT_EQ(800, x2);
+	EXPECT_EQ(600, y2);
+}
+
+TEST(MeterOCR, roiRectOpenBox) { MeterOCR_Test::test_roiRectOpenBox(); }
+#endif
+
 TEST(MeterOCR, debouncing) {
 	ASSERT_EQ(8, debounce(9, 8.49));
 	ASSERT_EQ(9, debounce(9, 8.51));
@@ -278,3 +278,33 @@ TEST(MeterOCRTesseract, basic2_not_prepared_autofix) {
 	}
 	ASSERT_EQ(0, m.close());
 }
+
+// the engine is kept for all images: the readings must not change after some images (they did
+// with the first engine kept in the constructor)
+TEST(MeterOCRTesseract, stable_readings_many_frames) {
+	std::list<Option> options;
+	options.push_back(Option("file", (char *)"tests/meterOCR/img.png"));
+	options.push_back(Option("rotate", -2.0)); // rotate by -2deg (counterclockwise)
+	struct json_object *jso = json_tokener_parse("[{\"boundingboxes\":[\
+	{\"identifier\": \"water cons\", \"scaler\":4,\"digit\":true, \"box\": {\"x1\": 465, \"x2\": 487, \"y1\": 358, \"y2\": 395}},\
+	{\"identifier\": \"water cons\", \"scaler\":3,\"digit\":true, \"box\": {\"x1\": 502, \"x2\": 525, \"y1\": 358, \"y2\": 395}},\
+	{\"identifier\": \"water cons\", \"scaler\":2,\"digit\":true, \"box\": {\"x1\": 538, \"x2\": 562, \"y1\": 358, \"y2\": 395}},\
+	{\"identifier\": \"water cons\", \"scaler\":1,\"digit\":true, \"box\": {\"x1\": 575, \"x2\": 599, \"y1\": 358, \"y2\": 395}},\
+	{\"identifier\": \"water cons\", \"scaler\":0,\"digit\":true, \"box\": {\"x1\": 610, \"x2\": 637, \"y1\": 358, \"y2\": 395}}\
+	]}]");                                     // should detect 00434
+	options.push_back(Option("recognizer", jso));
+	json_object_put(jso);
+
+	MeterOCR m(options);
+	ASSERT_EQ(SUCCESS, m.open());
+
+	const int frames = 200;
+	for (int i = 0; i < frames; ++i) {
+		std::vector<Reading> rds;
+		rds.resize(1);
+		ASSERT_EQ(1, m.read(rds, 1)) << "frame " << i;
+		ASSERT_EQ(434, rds[0].value()) << "frame " << i;
+		m.set_forced_file_changed(); // otherwise next read call will assume image is unchanged
+	}
+	ASSERT_EQ(0, m.close());
+}
@@ -0,0 +1,38 @@
+/*
+ * unit tests for Metrics.hpp
+ */
+
+#include "gtest/gtest.h"
+
+#include <Metrics.hpp>
+
+TEST(metrics, histogram_buckets) {
+	vz::metrics::Histogram h;
+
+	h.observe(0.001); // first bucket
+	h.observe(0.005); // bounds are inclusive
+	h.observe(0.3);
+	h.observe(60); // +Inf
+
+	ASSERT_EQ(h.count(), (uint64_t)4);
+	ASSERT_EQ(h.bucket(0), (uint64_t)2);
+	ASSERT_EQ(h.bucket(6), (uint64_t)1); // le=0.5
+	ASSERT_EQ(h.bucket(vz::metrics::Histogram::nbounds), (uint64_t)1);
+	ASSERT_NEAR(h.sum(), 60.306, 1e-6);
+
+	uint64_t total = 0;
+	for (size_t i = 0; i <= vz::metrics::Histogram::nbounds; i++)
+		total += h.bucket(i);
+	ASSERT_EQ(total, h.count());
+}
+
+TEST(metrics, channel_stats_defaults) {
+	vz::metrics::ChannelStats s;
+
+	ASSERT_EQ(s.last_time_ms.load(), 0);
+	ASSERT_EQ(s.buffer_depth.load(), (size_t)0);
+	ASSERT_EQ(s.upload_latency.count(), (uint64_t)0);
+
+	s.curl_retries++;
+	ASSERT_EQ(s.curl_retries.load(), (uint64_t)1);
+}
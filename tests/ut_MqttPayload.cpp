@@ -0,0 +1,89 @@
+/*
+ * unit tests for MqttPayload.cpp
+ */
+
+#include "gtest/gtest.h"
+
+#include <json-c/json.h>
+#include <string.h>
+
+#include <MqttPayload.hpp>
+
+TEST(MqttPayload, format_names) {
+	MqttPayload::Format f = MqttPayload::TEXT;
+	ASSERT_TRUE(MqttPayload::parseFormat("cbor", f));
+	ASSERT_EQ(f, MqttPayload::CBOR);
+	ASSERT_STREQ(MqttPayload::formatName(f), "cbor");
+	ASSERT_TRUE(MqttPayload::parseFormat("influx", f));
+	ASSERT_EQ(f, MqttPayload::INFLUX);
+	ASSERT_FALSE(MqttPayload::parseFormat("xml", f));
+	ASSERT_EQ(f, MqttPayload::INFLUX);
+}
+
+TEST(MqttPayload, text_like_to_string) {
+	const double values[] = {0,   -0.0,   1,        -1,    42,     1e14,        -1e15,
+							 1e16, 0.5,   -123.456, 1e-7,  2.5e-6, 1234567.891, 1e300};
+	for (double v : values) {
+		std::string out;
+		MqttPayload::encode(out, MqttPayload::TEXT, 0, v, "");
+		ASSERT_EQ(out, std::to_string(v));
+	}
+}
+
+TEST(MqttPayload, json_like_json_c) {
+	const double values[] = {0, 1, -2.5, 0.1, 1e-7, 123456789012.0, 1e22};
+	for (double v : values) {
+		struct json_object *obj = json_object_new_object();
+		json_object_object_add(obj, "timestamp", json_object_new_int64(1700000000123LL));
+		json_object_object_add(obj, "value", json_object_new_double(v));
+
+		std::string out;
+		MqttPayload::encode(out, MqttPayload::JSON, 1700000000123LL, v, "");
+		ASSERT_EQ(out, json_object_to_json_string(obj));
+		json_object_put(obj);
+	}
+}
+
+TEST(MqttPayload, binary) {
+	std::string out;
+	MqttPayload::encode(out, MqttPayload::BINARY, 0x0102030405060708LL, 1.0, "");
+	const unsigned char expected[] = {0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01,
+									  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf0, 0x3f};
+	ASSERT_EQ(out.size(), sizeof(expected));
+	ASSERT_EQ(0, memcmp(out.data(), expected, sizeof(expected)));
+}
+
+TEST(MqttPayload, cbor) {
+	std::string out;
+	MqttPayload::encode(out, MqttPayload::CBOR, 1700000000123LL, 1.5, "");
+	// a2 69 "timestamp" 1b <8 bytes> 65 "value" fb 3ff8000000000000
+	const unsigned char expected[] = {
+		0xa2, 0x69, 't',  'i',  'm',  'e',  's',  't',  'a',  'm', 'p',  0x1b,
+		0x00, 0x00, 0x01, 0x8b, 0xcf, 0xe5, 0x68, 0x7b, 0x65, 'v', 'a',  'l',
+		'u',  'e',  0xfb, 0x3f, 0xf8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+	ASSERT_EQ(out.size(), sizeof(expected));
+	ASSERT_EQ(0, memcmp(out.data(), expected, sizeof(expected)));
+
+	// short forms of the timestamp
+	MqttPayload::encode(out, MqttPayload::CBOR, 23, 0, "");
+	ASSERT_EQ((unsigned char)out[11], 0x17);
+	MqttPayload::encode(out, MqttPayload::CBOR, 1000, 0, "");
+	ASSERT_EQ((unsigned char)out[11], 0x19);
+	MqttPayload::encode(out, MqttPayload::CBOR, -1, 0, "");
+	ASSERT_EQ((unsigned char)out[11], 0x20);
+}
+
+TEST(MqttPayload, influx) {
+	std::string prefix = "vzlogger,channel=";
+	MqttPayload::appendInfluxKey(prefix, "power meter,1");
+	std::string out;
+	MqttPayload::encode(out, MqttPayload::INFLUX, 1700000000123LL, 230.5, prefix);
+	ASSERT_EQ(out, "vzlogger,channel=power\\ meter\\,1 value=230.500000 1700000000123000000");
+}
+
+TEST(MqttPayload, thread_buffer) {
+	const std::string &a = MqttPayload::encode(MqttPayload::TEXT, 0, 1, "");
+	const std::string &b = MqttPayload::encode(MqttPayload::TEXT, 0, 2, "");
+	ASSERT_EQ(&a, &b);
+	ASSERT_EQ(b, "2.000000");
+}
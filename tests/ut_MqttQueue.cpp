@@ -0,0 +1,147 @@
+/*
+ * unit tests for the offline queue of MqttClient (mqtt.cpp)
+ */
+
+#include "gtest/gtest.h"
+
+#include <json-c/json.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <mqtt.hpp>
+
+namespace {
+
+// access to the offline queue of a client without broker connection
+class QueueClient : public MqttClient {
+  public:
+	struct Message {
+		std::string topic;
+		std::string payload;
+		bool retain;
+	};
+	std::vector<Message> published; // messages passed to the broker
+
+	QueueClient(struct json_object *cfg) : MqttClient(cfg) {}
+	void queue(int64_t time, bool retain = false) {
+		send("t", std::to_string(time), retain, time);
+	}
+	void connected(bool connected) { _isConnected = connected; }
+	void replay() { MqttClient::replay(); }
+	// reads the next messages of the queue file into memory
+	void load() {
+		std::unique_lock<std::mutex> lock(_queueMutex);
+		unspill();
+	}
+	// takes the messages in memory, loads the next ones from the file if there are none
+	std::vector<int64_t> take() {
+		std::unique_lock<std::mutex> lock(_queueMutex);
+		std::vector<int64_t> times;
+		if (_queue.empty())
+			unspill();
+		for (auto &msg : _queue)
+			times.push_back(msg._time);
+		_queue.clear();
+		return times;
+	}
+
+  protected:
+	virtual int publishMessage(const std::string &topic, const std::string &payload,
+							   bool retain) {
+		published.push_back(Message{topic, payload, retain});
+		return 0; // MOSQ_ERR_SUCCESS
+	}
+};
+
+struct json_object *queue_config(int queueSize) {
+	struct json_object *cfg = json_object_new_object();
+	json_object_object_add(cfg, "enabled", json_object_new_boolean(false));
+	json_object_object_add(cfg, "queueSize", json_object_new_int(queueSize));
+	return cfg;
+}
+
+} // namespace
+
+/*
+ * without queue file the oldest messages are dropped once the memory queue is full
+ */
+TEST(MqttQueue, memory_full_drops_oldest) {
+	struct json_object *cfg = queue_config(3);
+	QueueClient client(cfg);
+	json_object_put(cfg);
+
+	for (int t = 1; t <= 5; t++)
+		client.queue(t);
+	ASSERT_TRUE(client.queued());
+	ASSERT_TRUE(client.published.empty());
+	ASSERT_EQ(client.take(), std::vector<int64_t>({3, 4, 5}));
+}
+
+/*
+ * the replay is limited to replayRate, live values are published at once and the
+ * replayed values don't replace the retained live value
+ */
+TEST(MqttQueue, replay_rate) {
+	struct json_object *cfg = queue_config(100);
+	json_object_object_add(cfg, "replayRate", json_object_new_int(10));
+	QueueClient client(cfg);
+	json_object_put(cfg);
+
+	for (int t = 1; t <= 15; t++)
+		client.queue(t, true);
+	client.connected(true);
+	client.replay(); // one second worth of messages
+	ASSERT_EQ(10u, client.published.size());
+	ASSERT_EQ("1", client.published[0].payload);
+	ASSERT_TRUE(client.published[0].retain);
+
+	client.queue(100, true);
+	ASSERT_EQ(11u, client.published.size());
+	ASSERT_EQ("100", client.published[10].payload);
+	ASSERT_TRUE(client.published[10].retain);
+
+	client.replay(); // no more tokens (unless this took more than 100ms)
+	ASSERT_LT(client.published.size(), 16u);
+	ASSERT_TRUE(client.queued());
+	while (client.queued()) {
+		usleep(100000);
+		client.replay();
+	}
+	ASSERT_EQ(16u, client.published.size());
+	for (size_t i = 11; i < client.published.size(); i++) {
+		ASSERT_EQ(std::to_string(i), client.published[i].payload);
+		ASSERT_FALSE(client.published[i].retain);
+	}
+}
+
+/*
+ * destroy the client while the queue file is partly read: the next client
+ * gets each message once, in order
+ */
+TEST(MqttQueue, queue_file_restart) {
+	char file[] = "/tmp/vzlogger_mqtt_queueXXXXXX";
+	int fd = mkstemp(file);
+	ASSERT_NE(fd, -1);
+	close(fd);
+	struct json_object *cfg = queue_config(2);
+	json_object_object_add(cfg, "queueFile", json_object_new_string(file));
+
+	{
+		QueueClient client(cfg);
+		for (int t = 1; t <= 7; t++)
+			client.queue(t); // 1, 2 in memory, the rest in the file
+		ASSERT_EQ(client.take(), std::vector<int64_t>({1, 2}));
+		client.load(); // 3, 4 in memory, 5..7 unread
+	}
+	{
+		QueueClient client(cfg);
+		ASSERT_TRUE(client.queued());
+		ASSERT_EQ(client.take(), std::vector<int64_t>({3, 4}));
+		ASSERT_EQ(client.take(), std::vector<int64_t>({5, 6}));
+		client.queue(8);
+		ASSERT_EQ(client.take(), std::vector<int64_t>({7, 8}));
+		ASSERT_EQ(client.take(), std::vector<int64_t>());
+	}
+	json_object_put(cfg);
+	unlink(file);
+}
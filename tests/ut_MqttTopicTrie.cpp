@@ -0,0 +1,63 @@
+/*
+ * unit tests for MqttTopicTrie.hpp
+ */
+
+#include "gtest/gtest.h"
+
+#include <MqttTopicTrie.hpp>
+
+namespace {
+struct Collect {
+	std::vector<int> values;
+	void operator()(int v) { values.push_back(v); }
+};
+
+std::vector<int> match(const MqttTopicTrie<int> &trie, const char *topic) {
+	Collect c;
+	trie.match(topic, c);
+	std::sort(c.values.begin(), c.values.end());
+	return c.values;
+}
+} // namespace
+
+TEST(MqttTopicTrie, valid) {
+	ASSERT_TRUE(MqttTopicTrie<int>::valid("a/b/c"));
+	ASSERT_TRUE(MqttTopicTrie<int>::valid("a/+/c"));
+	ASSERT_TRUE(MqttTopicTrie<int>::valid("#"));
+	ASSERT_TRUE(MqttTopicTrie<int>::valid("a/#"));
+	ASSERT_FALSE(MqttTopicTrie<int>::valid(""));
+	ASSERT_FALSE(MqttTopicTrie<int>::valid("a/#/c"));
+	ASSERT_FALSE(MqttTopicTrie<int>::valid("a/b+/c"));
+	ASSERT_FALSE(MqttTopicTrie<int>::valid("a/b#"));
+}
+
+TEST(MqttTopicTrie, match) {
+	MqttTopicTrie<int> trie;
+	trie.insert("sensors/room1/temp", 1);
+	trie.insert("sensors/+/temp", 2);
+	trie.insert("sensors/#", 3);
+	trie.insert("#", 4);
+	trie.insert("+/room1/+", 5);
+
+	ASSERT_EQ(match(trie, "sensors/room1/temp"), std::vector<int>({1, 2, 3, 4, 5}));
+	ASSERT_EQ(match(trie, "sensors/room2/temp"), std::vector<int>({2, 3, 4}));
+	ASSERT_EQ(match(trie, "sensors"), std::vector<int>({3, 4})); // "a/#" matches "a"
+	ASSERT_EQ(match(trie, "sensors/room2/temp/x"), std::vector<int>({3, 4}));
+	ASSERT_EQ(match(trie, "other"), std::vector<int>({4}));
+	ASSERT_EQ(match(trie, "$SYS/room1/x"), std::vector<int>());
+}
+
+TEST(MqttTopicTrie, erase) {
+	MqttTopicTrie<int> trie;
+	trie.insert("a/+", 1);
+	trie.insert("a/b", 2);
+	trie.insert("a/#", 3);
+
+	ASSERT_TRUE(trie.erase("a/+", 1));
+	ASSERT_FALSE(trie.erase("a/+", 1));
+	ASSERT_FALSE(trie.erase("x/y", 1));
+	ASSERT_EQ(match(trie, "a/b"), std::vector<int>({2, 3}));
+	ASSERT_TRUE(trie.erase("a/#", 3));
+	ASSERT_EQ(match(trie, "a/b"), std::vector<int>({2}));
+	ASSERT_EQ(match(trie, "a/c"), std::vector<int>());
+}
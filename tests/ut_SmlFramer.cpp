@@ -0,0 +1,180 @@
+/*
+ * unit tests for SmlFramer.cpp
+ */
+
+#include "gtest/gtest.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <protocols/SmlFramer.hpp>
+#include <test_helpers.hpp>
+
+// the file of the MeterSML.EMH_basic test: 8 bytes start, 235 bytes body, 1 padding, 8 end
+static const char *emh =
+	"1B1B1B1B010101017607003600001AFA6200620072630101760101070036044808FE093032323830383136"
+	"01016331ED007607003600001AFB62006200726307017701093032323830383136017262016504487D8976"
+	"77078181C78203FF0101010104454D480177070100000000FF010101010930323238303831360177070100"
+	"010801FF63018001621E52FF560008D1CF1B0177070100010802FF63018001621E52FF560000004E9C0177"
+	"0700006001FFFF010101010B303030323238303831360177070100010700FF0101621B52FF550000007001"
+	"010163D201007607003600001AFC6200620072630201710163077A00001B1B1B1B1A019D37";
+
+static uint16_t crc_x25(const std::string &data) {
+	uint16_t crc = 0xffff;
+	for (size_t i = 0; i < data.size(); i++) {
+		crc ^= (uint8_t)data[i];
+		for (int b = 0; b < 8; b++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+	}
+	return crc ^ 0xffff;
+}
+
+// a complete file with the body escaped and padded
+static std::string make_file(const std::string &body) {
+	const std::string esc("\x1b\x1b\x1b\x1b", 4);
+	std::string file = esc + std::string("\x01\x01\x01\x01", 4);
+	std::string padded = body;
+	size_t padding = (4 - body.size() % 4) % 4;
+	padded.append(padding, '\0');
+	for (size_t i = 0; i < padded.size(); i += 4) {
+		file += padded.substr(i, 4);
+		if (padded.compare(i, 4, esc) == 0)
+			file += esc;
+	}
+	file += esc + '\x1a' + (char)padding;
+	uint16_t crc = crc_x25(file);
+	file += (char)(crc & 0xff);
+	file += (char)(crc >> 8);
+	return file;
+}
+
+// feed data in chunks of the given size, collect the frames
+static std::vector<std::string> feed(SmlFramer &framer, const std::string &data,
+									 size_t chunk = 1000) {
+	std::vector<std::string> frames;
+	size_t off = 0;
+	for (;;) {
+		while (framer.next())
+			frames.push_back(std::string((const char *)framer.frame(), framer.frameLen()));
+		if (off >= data.size())
+			break;
+		size_t len;
+		unsigned char *space = framer.space(len);
+		if (len > chunk)
+			len = chunk;
+		if (len > data.size() - off)
+			len = data.size() - off;
+		memcpy(space, data.data() + off, len);
+		framer.commit(len);
+		off += len;
+	}
+	return frames;
+}
+
+TEST(SmlFramer, emh) {
+	std::string file = from_hex(emh);
+	EXPECT_EQ(0x379d, crc_x25(file.substr(0, file.size() - 2)));
+	EXPECT_EQ(file, make_file(file.substr(8, 235)));
+
+	for (size_t chunk = 1; chunk <= 13; chunk++) {
+		SmlFramer framer;
+		std::vector<std::string> frames = feed(framer, file + file, chunk);
+		ASSERT_EQ(2u, frames.size()) << "chunk " << chunk;
+		EXPECT_EQ(file.substr(8, 235), frames[0]);
+		EXPECT_EQ(frames[0], frames[1]);
+		EXPECT_EQ(2u, framer.stats().frames.load());
+		EXPECT_EQ(0u, framer.stats().corrupt.load());
+		EXPECT_EQ(0u, framer.stats().resyncs.load());
+	}
+}
+
+TEST(SmlFramer, escaped_escape) {
+	std::string body("\x76\x05\x1b\x1b", 4);
+	body += std::string("\x1b\x1b\x1b\x1b", 4) + "abc";
+	std::string file = make_file(body);
+	EXPECT_EQ(8 + 16 + 8, file.size());
+
+	SmlFramer framer;
+	std::vector<std::string> frames = feed(framer, "garbage\x1b\x1b\x1b\x1b\x1b" + file, 3);
+	ASSERT_EQ(1u, frames.size());
+	EXPECT_EQ(body, frames[0]);
+	EXPECT_EQ(0u, framer.stats().resyncs.load()); // garbage before the first frame
+}
+
+TEST(SmlFramer, crc_error) {
+	std::string file = from_hex(emh);
+	std::string bad = file;
+	bad[100] ^= 0x10;
+
+	SmlFramer framer;
+	std::vector<std::string> frames = feed(framer, bad + file);
+	ASSERT_EQ(1u, frames.size());
+	EXPECT_EQ(file.substr(8, 235), frames[0]);
+	EXPECT_EQ(1u, framer.stats().crc_errors.load());
+	EXPECT_EQ(0u, framer.stats().corrupt.load());
+	EXPECT_EQ(1u, framer.stats().resyncs.load());
+
+	SmlFramer lax;
+	lax.verifyCrc(false);
+	frames = feed(lax, bad + file);
+	EXPECT_EQ(2u, frames.size());
+	EXPECT_EQ(0u, lax.stats().crc_errors.load());
+}
+
+TEST(SmlFramer, cut_off) {
+	std::string file = from_hex(emh);
+
+	// the next frame starts in the middle of the body
+	SmlFramer framer;
+	std::vector<std::string> frames = feed(framer, file.substr(0, 120) + file + file, 7);
+	ASSERT_EQ(2u, frames.size());
+	EXPECT_EQ(file.substr(8, 235), frames[0]);
+	EXPECT_EQ(1u, framer.stats().corrupt.load());
+	EXPECT_EQ(1u, framer.stats().resyncs.load());
+
+	// a byte was lost, the next start sequence isn't aligned to the body
+	SmlFramer unaligned;
+	frames = feed(unaligned, file.substr(0, 121) + file + file, 5);
+	ASSERT_EQ(2u, frames.size());
+	EXPECT_EQ(file.substr(8, 235), frames[1]);
+	EXPECT_EQ(1u, unaligned.stats().corrupt.load());
+	EXPECT_EQ(1u, unaligned.stats().resyncs.load());
+
+	// unknown escape sequence
+	SmlFramer escape;
+	std::string invalid = file.substr(0, 120) + "\x1b\x1b\x1b\x1b\x02\x02\x02\x02";
+	frames = feed(escape, invalid + file);
+	ASSERT_EQ(1u, frames.size());
+	EXPECT_EQ(1u, escape.stats().corrupt.load());
+	EXPECT_EQ(1u, escape.stats().resyncs.load());
+}
+
+TEST(SmlFramer, too_long) {
+	std::string small = make_file("0123456789");
+	std::string large = make_file(std::string(100, 'x'));
+
+	SmlFramer framer(64);
+	std::vector<std::string> frames = feed(framer, small + large + small);
+	ASSERT_EQ(2u, frames.size());
+	EXPECT_EQ("0123456789", frames[1]);
+	EXPECT_EQ(1u, framer.stats().corrupt.load());
+	EXPECT_EQ(1u, framer.stats().resyncs.load());
+}
+
+TEST(SmlFramer, reset) {
+	std::string file = from_hex(emh);
+
+	SmlFramer framer;
+	size_t len;
+	unsigned char *space = framer.space(len);
+	memcpy(space, file.data(), 100);
+	framer.commit(100);
+	EXPECT_FALSE(framer.next());
+	framer.reset();
+
+	std::vector<std::string> frames = feed(framer, file);
+	ASSERT_EQ(1u, frames.size());
+	EXPECT_EQ(0u, framer.stats().corrupt.load());
+}
@@ -0,0 +1,163 @@
+/*
+ * unit tests for SmlTcpPool.cpp, the sources are connected to a local listening socket
+ */
+
+#include "gtest/gtest.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include <protocols/SmlTcpPool.hpp>
+#include <test_helpers.hpp>
+
+static const char *file_hex =
+	"1B1B1B1B010101017607003600001AFA6200620072630101760101070036044808FE093032323830383136"
+	"01016331ED007607003600001AFB62006200726307017701093032323830383136017262016504487D8976"
+	"77078181C78203FF0101010104454D480177070100000000FF010101010930323238303831360177070100"
+	"010801FF63018001621E52FF560008D1CF1B0177070100010802FF63018001621E52FF560000004E9C0177"
+	"0700006001FFFF010101010B303030323238303831360177070100010700FF0101621B52FF550000007001"
+	"010163D201007607003600001AFC6200620072630201710163077A00001B1B1B1B1A019D37";
+
+// listening socket on an ephemeral port of the loopback interface
+static int listen_local(std::string &port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(sin);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, len) != 0 || listen(fd, 128) != 0 ||
+		getsockname(fd, (struct sockaddr *)&sin, &len) != 0)
+		return -1;
+	port = std::to_string(ntohs(sin.sin_port));
+	return fd;
+}
+
+static int accept_timeout(int fd, int timeout_ms) {
+	struct pollfd pfd = {fd, POLLIN, 0};
+	if (poll(&pfd, 1, timeout_ms) != 1)
+		return -1;
+	return accept(fd, NULL, NULL);
+}
+
+TEST(SmlTcpPool, reconnect) {
+	std::string port;
+	int server = listen_local(port);
+	ASSERT_NE(-1, server);
+	SmlTcpPool &pool = SmlTcpPool::instance();
+	size_t sources = pool.size();
+
+	SmlTcpPool::Source::Ptr source = pool.add("127.0.0.1", port.c_str(), "reconnect");
+	ASSERT_TRUE(source.get() != NULL);
+	EXPECT_EQ(sources + 1, pool.size());
+
+	std::string file = from_hex(file_hex);
+	std::vector<unsigned char> frame;
+	int conn = accept_timeout(server, 5000);
+	ASSERT_NE(-1, conn);
+	ASSERT_EQ((ssize_t)file.size(), write(conn, file.data(), file.size()));
+	source->next(frame);
+	EXPECT_EQ(file.substr(8, 235), std::string(frame.begin(), frame.end()));
+	EXPECT_TRUE(source->connected());
+
+	// the connection is lost, the pool reconnects after a second
+	close(conn);
+	conn = accept_timeout(server, 5000);
+	ASSERT_NE(-1, conn);
+	std::string data = "garbage" + file.substr(0, 100);
+	ASSERT_EQ((ssize_t)data.size(), write(conn, data.data(), data.size()));
+	data = file.substr(100) + file.substr(0, 20);
+	ASSERT_EQ((ssize_t)data.size(), write(conn, data.data(), data.size()));
+	frame.clear();
+	source->next(frame);
+	EXPECT_EQ(file.substr(8, 235), std::string(frame.begin(), frame.end()));
+	EXPECT_EQ(2u, source->stats().frames.load());
+
+	pool.remove(source);
+	EXPECT_EQ(sources, pool.size());
+	EXPECT_FALSE(source->connected());
+	close(conn);
+	close(server);
+}
+
+TEST(SmlTcpPool, many_sources) {
+	const int n = 50;
+	std::string port;
+	int server = listen_local(port);
+	ASSERT_NE(-1, server);
+	SmlTcpPool &pool = SmlTcpPool::instance();
+
+	std::vector<SmlTcpPool::Source::Ptr> sources;
+	for (int i = 0; i < n; i++)
+		sources.push_back(pool.add("127.0.0.1", port.c_str(), "source" + std::to_string(i)));
+
+	std::string file = from_hex(file_hex);
+	std::vector<int> conns;
+	for (int i = 0; i < n; i++) {
+		int conn = accept_timeout(server, 5000);
+		ASSERT_NE(-1, conn);
+		conns.push_back(conn);
+		ASSERT_EQ((ssize_t)file.size(), write(conn, file.data(), file.size()));
+	}
+
+	std::vector<unsigned char> frame;
+	for (int i = 0; i < n; i++) {
+		sources[i]->next(frame);
+		EXPECT_EQ(235u, frame.size());
+		pool.remove(sources[i]);
+	}
+	for (int i = 0; i < n; i++)
+		close(conns[i]);
+	close(server);
+}
+
+// localhost resolves to ::1 as well on most hosts, which refuses the connection
+TEST(SmlTcpPool, next_address) {
+	std::string port;
+	int server = listen_local(port);
+	ASSERT_NE(-1, server);
+	SmlTcpPool &pool = SmlTcpPool::instance();
+
+	SmlTcpPool::Source::Ptr source = pool.add("localhost", port.c_str(), "next_address");
+	ASSERT_TRUE(source.get() != NULL);
+	int conn = accept_timeout(server, 5000);
+	ASSERT_NE(-1, conn);
+
+	pool.remove(source);
+	close(conn);
+	close(server);
+}
+
+// a connection without data is reopened
+TEST(SmlTcpPool, idle_timeout) {
+	std::string port;
+	int server = listen_local(port);
+	ASSERT_NE(-1, server);
+	SmlTcpPool &pool = SmlTcpPool::instance();
+
+	SmlTcpPool::Source::Ptr source = pool.add("127.0.0.1", port.c_str(), "idle_timeout", 1);
+	ASSERT_TRUE(source.get() != NULL);
+	int conn = accept_timeout(server, 5000);
+	ASSERT_NE(-1, conn);
+	char c;
+	struct pollfd pfd = {conn, POLLIN, 0};
+	ASSERT_EQ(1, poll(&pfd, 1, 5000)); // closed by the pool
+	EXPECT_EQ(0, read(conn, &c, 1));
+	close(conn);
+	conn = accept_timeout(server, 5000);
+	EXPECT_NE(-1, conn);
+
+	pool.remove(source);
+	close(conn);
+	close(server);
+}
+
+TEST(SmlTcpPool, unresolvable) {
+	EXPECT_TRUE(SmlTcpPool::instance().add("localhost", "no-such-service", "bad").get() == NULL);
+}
@@ -1,4 +1,5 @@
 #include "Obis.hpp"
+#include "Reading.hpp"
 #include "VZException.hpp"
 #include "gtest/gtest.h"
 
@@ -122,3 +123,22 @@ TEST(Obis, Obis_parse_LuG_E350) // all known codes from Landis+Gyr E350
 	//	0.2.0     M23
 	//	C.5.0     0433
 }
+
+TEST(Obis, ObisIdentifiers) {
+	std::vector<ReadingIdentifier::Ptr> ids;
+	ids.push_back(ReadingIdentifier::Ptr(new ObisIdentifier(Obis("1-0:1.8.0"))));
+	ids.push_back(ReadingIdentifier::Ptr(new ObisIdentifier(Obis("1-0:2.8.0"))));
+	std::vector<Obis> codes = ObisIdentifiers::channelCodes(ids);
+	ASSERT_EQ(2u, codes.size());
+	EXPECT_EQ(Obis("1-0:2.8.0"), codes[1]);
+	ids.push_back(ReadingIdentifier::Ptr(new StringIdentifier("power")));
+	EXPECT_TRUE(ObisIdentifiers::channelCodes(ids).empty()); // all codes needed
+
+	ObisIdentifiers identifiers;
+	Obis obis("1-0:1.8.0*255");
+	ReadingIdentifier::Ptr rid = identifiers.get(obis.key());
+	ASSERT_TRUE(rid.get() != NULL);
+	EXPECT_EQ(obis, dynamic_cast<ObisIdentifier *>(rid.get())->obis());
+	EXPECT_EQ(rid, identifiers.get(obis)); // shared by the readings
+	EXPECT_TRUE(identifiers.get(Obis(0xaa, 0, 1, 8, 0, 0xff).key()).get() == NULL); // invalid
+}